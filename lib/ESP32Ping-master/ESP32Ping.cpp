@@ -22,14 +22,18 @@
 extern "C" void esp_schedule(void) {};
 extern "C" void esp_yield(void) {};
 
-PingClass::PingClass() {}
+PingClass::PingClass() : _probe_type(PING_PROBE_ICMP), _probe_port(0) {}
 
 bool PingClass::ping(IPAddress dest, byte count) {
     _expected_count = count;
     _errors = 0;
     _success = 0;
+    _late = 0;
+    _duplicates = 0;
+    _refused = 0;
 
     _avg_time = 0;
+    ping_hist_reset(&_histogram);
 
     memset(&_options, 0, sizeof(struct ping_option));
 
@@ -49,26 +53,123 @@ bool PingClass::ping(IPAddress dest, byte count) {
     esp_yield(); // ????????? Where should this be placed?
     
     // Let's go!
-    ping_start(&_options); // Here we do all the work
+    if (_probe_type == PING_PROBE_ICMP) {
+        ping_start(&_options); // Here we do all the work
+    }
+    else {
+        ping_start_probe(_probe_type, dest, _probe_port, count, _options.coarse_time * 1000, 0, 0, &_options);
+    }
 
     // Returns true if at least 1 ping had a pong response 
     return (_success > 0); //_success variable is changed by the callback function
 }
 
 bool PingClass::ping(const char *host, byte count) {
-    IPAddress remote_addr;
+    uint32_t remote_addr;
 
-    if (WiFi.hostByName(host, remote_addr))
-        return ping(remote_addr, count);
+    // Cached, asynchronous lookup instead of a DNS round-trip per call
+    if (ping_dns_resolve(host, &remote_addr, PING_DNS_QUERY_TIMEOUT_MS))
+        return ping(IPAddress(remote_addr), count);
 
     return false;
 }
 
+void PingClass::setProbeType(ping_probe_type type, uint16_t port) {
+    _probe_type = type;
+    _probe_port = port;
+}
+
+void PingClass::setBackend(ping_backend backend) {
+    ping_set_backend(backend);
+}
+
+bool PingClass::pingWindow(IPAddress dest, uint16_t count, uint8_t window, uint16_t intervalMs, uint16_t timeoutMs) {
+    // Reuse the classic setup for the callbacks and counters
+    _expected_count = count;
+    _errors = 0;
+    _success = 0;
+    _late = 0;
+    _duplicates = 0;
+    _refused = 0;
+    _avg_time = 0;
+    ping_hist_reset(&_histogram);
+
+    memset(&_options, 0, sizeof(struct ping_option));
+    _options.count = count;
+    _options.ip = dest;
+    _options.recv_function = reinterpret_cast<ping_recv_function>(&PingClass::_ping_recv_cb);
+
+    ping_start_window(dest, count, window, intervalMs, 0, timeoutMs, &_options);
+
+    return (_success > 0);
+}
+
+uint16_t PingClass::pathMTU(IPAddress dest, uint16_t maxMtu, uint16_t timeoutMs) {
+    ping_pmtu_result result;
+
+    ping_pmtu(dest, maxMtu, timeoutMs, 0, &result);
+    return result.mtu;
+}
+
+uint32_t PingClass::bandwidth(IPAddress dest, ping_sweep_result *result, uint16_t timeoutMs) {
+    ping_sweep_result local;
+
+    if (result == NULL) {
+        result = &local;
+    }
+    ping_sweep(dest, 0, 0, 0, 0, timeoutMs, result);
+    return result->kbps;
+}
+
+bool PingClass::traceroute(IPAddress dest, ping_trace_result &result, uint8_t maxHops, uint8_t probes, uint16_t timeoutMs) {
+    return ping_traceroute(dest, maxHops, probes, timeoutMs, &result);
+}
+
+bool PingClass::timestamp(IPAddress dest, ping_ts_result &result, uint8_t count, uint16_t intervalMs, uint16_t timeoutMs) {
+    return ping_timestamp(dest, count, intervalMs, timeoutMs, &result);
+}
+
 float PingClass::averageTime() {
     return _avg_time;
 }
 
-void PingClass::_ping_recv_cb(void *opt, void *resp) {
+uint32_t PingClass::percentile(float p) {
+    return ping_hist_percentile(&_histogram, p);
+}
+
+uint32_t PingClass::jitter() {
+    return ping_hist_jitter(&_histogram);
+}
+
+uint32_t PingClass::lateReplies() {
+    return _late;
+}
+
+uint32_t PingClass::duplicateReplies() {
+    return _duplicates;
+}
+
+uint32_t PingClass::refusedConnects() {
+    return _refused;
+}
+
+float PingClass::packetLoss() {
+    return ping_hist_loss(&_histogram);
+}
+
+const ping_histogram &PingClass::histogram() {
+    return _histogram;
+}
+
+void PingClass::end() {
+    ping_socket_close();
+}
+
+const ping_socket_stats &PingClass::socketStats() {
+    return *ping_socket_get_stats();
+}
+
+void PingClass::_ping_recv_cb(void *, void *resp) {
     // Cast the parameters to get some usable info
     ping_resp *ping_resp = reinterpret_cast<struct ping_resp *>(resp);
     //ping_option* ping_opt  = reinterpret_cast<struct ping_option*>(opt);
@@ -77,6 +178,12 @@ void PingClass::_ping_recv_cb(void *opt, void *resp) {
     _errors = ping_resp->timeout_count;
     _success = ping_resp->total_count - ping_resp->timeout_count;
     _avg_time = ping_resp->resp_time;
+    _late = ping_resp->late_count;
+    _duplicates = ping_resp->duplicate_count;
+    _refused = ping_resp->refused_count;
+    if (ping_resp->histogram) {
+        _histogram = *ping_resp->histogram;
+    }
     
 
     // Some debug info
@@ -107,9 +214,13 @@ void PingClass::_ping_recv_cb(void *opt, void *resp) {
     }
 }
 
-byte PingClass::_expected_count = 0;
-byte PingClass::_errors = 0;
-byte PingClass::_success = 0;
+uint32_t PingClass::_expected_count = 0;
+uint32_t PingClass::_errors = 0;
+uint32_t PingClass::_success = 0;
+uint32_t PingClass::_late = 0;
+uint32_t PingClass::_duplicates = 0;
+uint32_t PingClass::_refused = 0;
 float PingClass::_avg_time = 0;
+ping_histogram PingClass::_histogram;
 
 PingClass Ping;
@@ -25,6 +25,7 @@
 
 //extern "C" {
 #include <ping.h>
+#include <ping_dns.h>
 //}
 
 #ifdef ENABLE_DEBUG_PING
@@ -52,8 +53,68 @@ public:
 
     bool ping(const char *host, byte count = 5);
 
+    // Probe with a TCP connect or a UDP echo to port instead of ICMP in the
+    // ping() calls that follow. All results below apply to every type.
+    void setProbeType(ping_probe_type type, uint16_t port = 0);
+
+    // Receive path of pingWindow(): the raw socket, or a raw PCB whose
+    // replies are matched and timestamped in the tcpip thread. See ping_raw.h.
+    void setBackend(ping_backend backend);
+
+    // Keep up to `window` probes in flight, sending one every intervalMs.
+    // Replies are matched out of order. Duplicates are reported separately
+    // and never counted as answers; a late reply leaves its probe counted as
+    // lost, lateReplies() says how many of those did turn up.
+    bool pingWindow(IPAddress dest, uint16_t count, uint8_t window = 4, uint16_t intervalMs = 100, uint16_t timeoutMs = 1000);
+
+    // Largest IP datagram, up to maxMtu bytes, that makes the round trip
+    // unfragmented; 0 when dest does not answer. Costs one probe on a clean
+    // path and about log2(maxMtu) otherwise.
+    uint16_t pathMTU(IPAddress dest, uint16_t maxMtu = PING_PMTU_MAX, uint16_t timeoutMs = 1000);
+
+    // Bottleneck bandwidth to dest in kbit/s from a payload size sweep, see
+    // ping_sweep(); 0 when it could not be measured. Pass result for the
+    // base latency and the per size minimums.
+    uint32_t bandwidth(IPAddress dest, ping_sweep_result *result = NULL, uint16_t timeoutMs = 1000);
+
+    // Hop by hop route to dest, see ping_traceroute(). Blocks for up to
+    // maxHops * timeoutMs; run it from a background task if that is too long.
+    bool traceroute(IPAddress dest, ping_trace_result &result, uint8_t maxHops = PING_TRACE_MAX_HOPS,
+                    uint8_t probes = 3, uint16_t timeoutMs = 1000);
+
+    // Clock offset and one-way delays to dest from `count` ICMP timestamp
+    // exchanges, see ping_timestamp(). Most routers answer them, the ESP32
+    // itself does not.
+    bool timestamp(IPAddress dest, ping_ts_result &result, uint8_t count = 8, uint16_t intervalMs = 100,
+                   uint16_t timeoutMs = 1000);
+
     float averageTime();
 
+    // Latency distribution of the last ping() call, in microseconds
+    uint32_t percentile(float p);
+
+    uint32_t jitter();
+
+    uint32_t lateReplies();
+
+    uint32_t duplicateReplies();
+
+    // TCP probes the host answered with a reset: it is up but nothing
+    // listens on the port. They are counted as lost, not as answers.
+    uint32_t refusedConnects();
+
+    float packetLoss();
+
+    // Copy of the last session's histogram, suitable for ping_hist_merge()
+    const ping_histogram &histogram();
+
+    // The ICMP socket is kept open between calls. The next call recreates
+    // it after PING_SOCKET_IDLE_MS without use or a WiFi disconnect; only
+    // end() or ping_socket_expire() close it in between.
+    void end();
+
+    const ping_socket_stats &socketStats();
+
 protected:
     static void _ping_sent_cb(void *opt, void *pdata);
 
@@ -61,9 +122,12 @@ protected:
 
     IPAddress _dest;
     ping_option _options;
+    ping_probe_type _probe_type;
+    uint16_t _probe_port;
 
-    static byte _expected_count, _errors, _success;
+    static uint32_t _expected_count, _errors, _success, _late, _duplicates, _refused;
     static float _avg_time;
+    static ping_histogram _histogram;
 };
 
 
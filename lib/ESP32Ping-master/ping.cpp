@@ -58,6 +58,7 @@
 */
 
 #include <Arduino.h>
+#include <WiFi.h>
 
 #include <math.h>
 #include <float.h>
@@ -65,8 +66,12 @@
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/time.h>
 
 #include "ping.h"
+#include "ping_histogram.h"
+#include "ping_dns.h"
+#include "ping_raw.h"
 
 #include "lwip/inet_chksum.h"
 #include "lwip/ip.h"
@@ -78,6 +83,9 @@
 #include "lwip/netdb.h"
 #include "lwip/dns.h"
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
 static uint16_t ping_seq_num;
 static uint8_t stopped = 0;
 
@@ -91,6 +99,52 @@ static float max_time = 0;
 static float mean_time = 0;
 static float last_mean_time = 0;
 static float var_time = 0;
+static uint32_t late = 0;
+static uint32_t duplicates = 0;
+static uint32_t refused = 0;
+static struct ping_histogram histogram;
+
+/*
+* Windowed mode, one slot per probe in flight indexed by seqno
+*/
+enum {
+    PING_SLOT_FREE = 0,
+    PING_SLOT_PENDING,
+    PING_SLOT_ANSWERED,
+    PING_SLOT_EXPIRED,
+    PING_SLOT_LATE
+};
+
+struct ping_slot {
+    uint16_t seqno;
+    uint8_t state;
+    uint32_t sent_us;
+};
+
+// Slots are picked by seq % PING_MAX_WINDOW, which only stays consistent
+// across the 16-bit sequence wrap for a power of two
+static_assert((PING_MAX_WINDOW & (PING_MAX_WINDOW - 1)) == 0, "PING_MAX_WINDOW must be a power of two");
+
+static struct ping_slot window_ring[PING_MAX_WINDOW];
+static int window_in_flight = 0;
+static int window_backend = PING_BACKEND_SOCKET;
+
+/*
+* Reusable ICMP socket
+*/
+static int icmp_socket = -1;
+static int icmp_socket_timeout = -1;
+static unsigned long icmp_socket_last_used = 0;
+static volatile uint8_t icmp_socket_stale = 0;
+static uint8_t wifi_hooked = 0;
+static struct ping_socket_stats socket_stats;
+
+/*
+* Sessions share all of the state above, so only one runs at a time. The
+* mutex is recursive because ping_socket_close() is also used internally.
+*/
+static StaticSemaphore_t ping_mutex_buffer;
+static SemaphoreHandle_t ping_mutex = xSemaphoreCreateRecursiveMutexStatic(&ping_mutex_buffer);
 
 #define PING_ID 0xAFAF
 
@@ -106,6 +160,66 @@ static float var_time = 0;
 #ifndef PING_DEFAULT_TIMEOUT
 #define PING_DEFAULT_TIMEOUT   1
 #endif
+#ifndef PING_DEFAULT_WINDOW
+#define PING_DEFAULT_WINDOW    4
+#endif
+#ifndef PING_SOCKET_IDLE_MS
+#define PING_SOCKET_IDLE_MS    30000
+#endif
+#ifndef PING_PMTU_TRIES
+#define PING_PMTU_TRIES        2
+#endif
+#ifndef PING_SWEEP_STEPS
+#define PING_SWEEP_STEPS       8
+#endif
+#ifndef PING_SWEEP_TRAIN
+#define PING_SWEEP_TRAIN       5
+#endif
+#ifndef PING_TRACE_PROBES
+#define PING_TRACE_PROBES      3
+#endif
+#ifndef PING_TRACE_SIZE
+#define PING_TRACE_SIZE        32
+#endif
+
+#ifndef PING_TS_COUNT
+#define PING_TS_COUNT          8
+#endif
+
+#define PING_TS_DAY_MS         86400000UL
+#define PING_TS_NONSTANDARD    0x80000000UL
+
+/*
+* lwIP has no socket option for the don't-fragment bit and never sets it.
+* Probes up to the interface MTU are not fragmented locally though, and with
+* IP reassembly disabled (the ESP-IDF default) a reply that was fragmented on
+* its way back is dropped. Every probe therefore behaves as if DF was set: it
+* comes back whole or not at all.
+*/
+#if IP_REASSEMBLY
+#define PING_PMTU_EXACT        0
+#else
+#define PING_PMTU_EXACT        1
+#endif
+
+/*
+* ICMP timestamp request and reply (RFC 792): the echo header followed by
+* three times in milliseconds since midnight UT, in network order.
+*/
+struct ping_ts_msg {
+    struct icmp_echo_hdr hdr;
+    uint32_t originate;
+    uint32_t receive;
+    uint32_t transmit;
+};
+
+struct ping_ts_sample {
+    uint64_t t1_us;         // Local send, microseconds since midnight
+    uint32_t t2_ms;         // Remote receive
+    uint32_t t3_ms;         // Remote transmit
+    uint64_t t4_us;         // Local receive
+    uint32_t rtt_us;
+};
 
 /*
 * Helper functions
@@ -147,85 +261,157 @@ static err_t ping_send(int s, ip4_addr_t *addr, int size) {
     to.sin_family = AF_INET;
     inet_addr_from_ip4addr(&to.sin_addr, addr);
 
-    if ((err = sendto(s, iecho, ping_size, 0, (struct sockaddr*)&to, sizeof(to)))) {
+    if ((err = sendto(s, iecho, ping_size, 0, (struct sockaddr*)&to, sizeof(to))) > 0) {
         transmitted++;
+        ping_hist_record_sent(&histogram);
     }
     mem_free(iecho);
-    return (err ? ERR_OK : ERR_VAL);
+    return ((err > 0) ? ERR_OK : ERR_VAL);
+}
+
+static void ping_record(uint32_t elapsed_us) {
+    float elapsed = (float)elapsed_us / (float)1000.0;
+
+    received++;
+
+    // Update statistics
+    // Mean and variance are computed in an incremental way
+    if (elapsed < min_time) {
+        min_time = elapsed;
+    }
+
+    if (elapsed > max_time) {
+        max_time = elapsed;
+    }
+
+    last_mean_time = mean_time;
+    mean_time = (((received - 1) * mean_time) + elapsed) / received;
+
+    if (received > 1) {
+        var_time = var_time + ((elapsed - last_mean_time) * (elapsed - mean_time));
+    }
+
+    ping_hist_record(&histogram, elapsed_us);
+}
+
+/*
+* Return the echo reply header carried by a received datagram, or NULL when
+* it is too short or is not a reply to one of our probes.
+*/
+static struct icmp_echo_hdr *ping_parse_reply(char *buf, int len) {
+    struct ip_hdr *iphdr = (struct ip_hdr *)buf;
+    struct icmp_echo_hdr *iecho;
+
+    if (len < (int)(sizeof(struct ip_hdr) + sizeof(struct icmp_echo_hdr))) {
+        return NULL;
+    }
+    if (len < (int)(IPH_HL(iphdr) * 4 + sizeof(struct icmp_echo_hdr))) {
+        return NULL;
+    }
+
+    iecho = (struct icmp_echo_hdr *)(buf + (IPH_HL(iphdr) * 4));
+    if ((ICMPH_TYPE(iecho) != ICMP_ER) || (iecho->id != PING_ID)) {
+        return NULL;
+    }
+    return iecho;
+}
+
+/*
+* Return our echo request as quoted by an ICMP time exceeded or destination
+* unreachable message, or NULL. `type` receives the type of the message.
+*/
+static struct icmp_echo_hdr *ping_parse_error(char *buf, int len, uint8_t *type) {
+    struct ip_hdr *iphdr = (struct ip_hdr *)buf;
+    struct icmp_echo_hdr *icmp;
+    struct icmp_echo_hdr *iecho;
+    struct ip_hdr *inner;
+    int hlen;
+    int inner_hlen;
+
+    if (len < (int)sizeof(struct ip_hdr)) {
+        return NULL;
+    }
+    hlen = IPH_HL(iphdr) * 4;
+    if (len < hlen + (int)(sizeof(struct icmp_echo_hdr) + sizeof(struct ip_hdr))) {
+        return NULL;
+    }
+
+    // The error header is as long as an echo header: type, code, checksum, unused
+    icmp = (struct icmp_echo_hdr *)(buf + hlen);
+    if ((ICMPH_TYPE(icmp) != ICMP_TE) && (ICMPH_TYPE(icmp) != ICMP_DUR)) {
+        return NULL;
+    }
+
+    inner = (struct ip_hdr *)(buf + hlen + sizeof(struct icmp_echo_hdr));
+    inner_hlen = IPH_HL(inner) * 4;
+    if ((IPH_PROTO(inner) != IP_PROTO_ICMP) ||
+        (len < hlen + (int)sizeof(struct icmp_echo_hdr) + inner_hlen + (int)sizeof(struct icmp_echo_hdr))) {
+        return NULL;
+    }
+
+    iecho = (struct icmp_echo_hdr *)((char *)inner + inner_hlen);
+    if ((ICMPH_TYPE(iecho) != ICMP_ECHO) || (iecho->id != PING_ID)) {
+        return NULL;
+    }
+    *type = ICMPH_TYPE(icmp);
+    return iecho;
 }
 
 static void ping_recv(int s) {
     char buf[64];
-    int fromlen, len;
+    int len;
     struct sockaddr_in from;
-    struct ip_hdr *iphdr;
+    socklen_t fromlen = sizeof(from);
     struct icmp_echo_hdr *iecho = NULL;
     char ipa[16];
     struct timeval begin;
     struct timeval end;
     uint64_t micros_begin;
     uint64_t micros_end;
-    float elapsed;
 
     // Register begin time
     gettimeofday(&begin, NULL);
 
     // Send
-    while ((len = recvfrom(s, buf, sizeof(buf), 0, (struct sockaddr*)&from, (socklen_t*)&fromlen)) > 0) {
-        if (len >= (int)(sizeof(struct ip_hdr) + sizeof(struct icmp_echo_hdr))) {
-            // Register end time
-            gettimeofday(&end, NULL);
-
-            /// Get from IP address
-            ip4_addr_t fromaddr;
-            inet_addr_to_ip4addr(&fromaddr, &from.sin_addr);
+    while ((len = recvfrom(s, buf, sizeof(buf), 0, (struct sockaddr*)&from, &fromlen)) > 0) {
+        fromlen = sizeof(from);
 
-            strcpy(ipa, inet_ntoa(fromaddr));
-
-            // Get echo
-            iphdr = (struct ip_hdr *)buf;
-            iecho = (struct icmp_echo_hdr *)(buf + (IPH_HL(iphdr) * 4));
-
-            // Print ....
-            if ((iecho->id == PING_ID) && (iecho->seqno == htons(ping_seq_num))) {
-                received++;
-
-                // Get elapsed time in milliseconds
-                micros_begin = begin.tv_sec * 1000000;
-                micros_begin += begin.tv_usec;
+        // Skip anything that is not an echo reply to us, a raw socket also
+        // sees other ICMP traffic
+        if ((iecho = ping_parse_reply(buf, len)) == NULL) {
+            continue;
+        }
 
-                micros_end = end.tv_sec * 1000000;
-                micros_end += end.tv_usec;
+        // Register end time
+        gettimeofday(&end, NULL);
 
-                elapsed = (float)(micros_end - micros_begin) / (float)1000.0;
+        /// Get from IP address
+        ip4_addr_t fromaddr;
+        inet_addr_to_ip4addr(&fromaddr, &from.sin_addr);
 
-                // Update statistics
-                // Mean and variance are computed in an incremental way
-                if (elapsed < min_time) {
-                    min_time = elapsed;
-                }
+        strcpy(ipa, inet_ntoa(fromaddr));
 
-                if (elapsed > max_time) {
-                    max_time = elapsed;
-                }
+        // Print ....
+        if (iecho->seqno == htons(ping_seq_num)) {
+            // Get elapsed time in microseconds
+            micros_begin = begin.tv_sec * 1000000;
+            micros_begin += begin.tv_usec;
 
-                last_mean_time = mean_time;
-                mean_time = (((received - 1) * mean_time) + elapsed) / received;
+            micros_end = end.tv_sec * 1000000;
+            micros_end += end.tv_usec;
 
-                if (received > 1) {
-                    var_time = var_time + ((elapsed - last_mean_time) * (elapsed - mean_time));
-                }
+            ping_record((uint32_t)(micros_end - micros_begin));
 
-                // Print ...
-                log_d("%d bytes from %s: icmp_seq=%d time=%.3f ms\r\n", len, ipa,
-                      ntohs(iecho->seqno), elapsed
-                );
+            // Print ...
+            log_d("%d bytes from %s: icmp_seq=%d time=%.3f ms\r\n", len, ipa,
+                  ntohs(iecho->seqno), (micros_end - micros_begin) / 1000.0
+            );
 
-                return;
-            }
-            else {
-                // TODO
-            }
+            return;
+        }
+        else {
+            // Reply to an earlier probe of this session that already timed out
+            late++;
         }
     }
 
@@ -233,134 +419,1362 @@ static void ping_recv(int s) {
         log_d("Request timeout for icmp_seq %d\r\n", ping_seq_num);
     }
 }
-/*
-static void stop_action(int i) {
-	signal(i, SIG_DFL);
 
-	stopped = 1;
-}
-*/
 /*
-* Operation functions
-*
+* Account for the echo reply with sequence number seq that arrived at `now`.
 */
-void ping(const char *name, int count, int interval, int size, int timeout) {
-    // Resolve name
-    hostent * target = gethostbyname(name);
-    IPAddress adr = *target->h_addr_list[0];
-    if (target->h_length == 0) {
-        // TODO: error not found target?????
+static void ping_window_match(uint16_t seq, uint32_t now, uint16_t first_seq) {
+    struct ping_slot *slot;
+
+    // Ignore anything that was not sent by this session
+    if ((uint16_t)(seq - first_seq) > (uint16_t)(ping_seq_num - first_seq)) {
         return;
     }
-    ping_start(adr, count, interval, size, timeout);
+
+    slot = &window_ring[seq % PING_MAX_WINDOW];
+    if (slot->seqno != seq) {
+        // The slot was recycled long ago, so this reply is very late
+        late++;
+        return;
+    }
+
+    switch (slot->state) {
+        case PING_SLOT_PENDING:
+            slot->state = PING_SLOT_ANSWERED;
+            window_in_flight--;
+            ping_record(now - slot->sent_us);
+            log_d("icmp_seq=%d time=%.3f ms\r\n", seq, (now - slot->sent_us) / 1000.0);
+            break;
+        case PING_SLOT_EXPIRED:
+            slot->state = PING_SLOT_LATE;
+            late++;
+            break;
+        default:
+            duplicates++;
+            break;
+    }
 }
 
-bool ping_start(struct ping_option *ping_o) {
+static void ping_window_recv(int s, uint16_t first_seq) {
+    char buf[64];
+    int len;
+    struct sockaddr_in from;
+    socklen_t fromlen = sizeof(from);
+    struct icmp_echo_hdr *iecho;
+    uint32_t now;
 
+    while ((len = recvfrom(s, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr*)&from, &fromlen)) > 0) {
+        now = micros();
+        fromlen = sizeof(from);
 
-    return ping_start(ping_o->ip,ping_o->count,0,0,0,ping_o);
+        if ((iecho = ping_parse_reply(buf, len)) == NULL) {
+            continue;
+        }
+        ping_window_match(ntohs(iecho->seqno), now, first_seq);
+    }
+}
+
+/*
+* Same as ping_window_recv() for the raw PCB backend. The replies were
+* already parsed and timestamped on arrival by the tcpip thread.
+*/
+static void ping_window_recv_raw(uint16_t first_seq) {
+    struct ping_raw_reply reply;
 
+    while (ping_raw_pop(&reply)) {
+        ping_window_match(reply.seqno, reply.arrival_us, first_seq);
+    }
 }
-bool ping_start(IPAddress adr, int count=0, int interval=0, int size=0, int timeout=0, struct ping_option *ping_o) {
-//	driver_error_t *error;
-    struct sockaddr_in address;
-    ip4_addr_t ping_target;
-    int s;
-    // Get default values if argument are not provided
-    if (count == 0) {
-        count = PING_DEFAULT_COUNT;
+
+static err_t ping_send_raw(ip4_addr_t *addr, int size) {
+    struct icmp_echo_hdr *iecho;
+    size_t ping_size = sizeof(struct icmp_echo_hdr) + size;
+    bool sent;
+
+    if ((iecho = (struct icmp_echo_hdr *)mem_malloc((mem_size_t)ping_size)) == NULL) {
+        return ERR_MEM;
     }
 
-    if (interval == 0) {
-        interval = PING_DEFAULT_INTERVAL;
+    ping_prepare_echo(iecho, (uint16_t)ping_size);
+    if ((sent = ping_raw_send(ip4_addr_get_u32(addr), iecho, (uint16_t)ping_size))) {
+        transmitted++;
+        ping_hist_record_sent(&histogram);
     }
+    mem_free(iecho);
+    return (sent ? ERR_OK : ERR_VAL);
+}
 
-    if (size == 0) {
-        size = PING_DEFAULT_SIZE;
+/*
+* Send one echo request that makes an IP datagram of `mtu` bytes and wait for
+* the complete reply. Returns the round-trip time in microseconds, or -1.
+*/
+static int32_t ping_pmtu_probe(int s, ip4_addr_t *addr, uint16_t mtu, uint32_t timeout_us, char *buf, int buflen) {
+    int payload = mtu - IP_HLEN - sizeof(struct icmp_echo_hdr);
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    struct icmp_echo_hdr *iecho;
+    struct ip_hdr *iphdr;
+    struct timeval tv;
+    fd_set rfds;
+    uint32_t sent;
+    uint32_t now;
+    int len;
+
+    sent = micros();
+    if (ping_send(s, addr, payload) != ERR_OK) {
+        return -1;
     }
 
-    if (timeout == 0) {
-        timeout = PING_DEFAULT_TIMEOUT;
+    now = sent;
+    while (now - sent < timeout_us) {
+        FD_ZERO(&rfds);
+        FD_SET(s, &rfds);
+        tv.tv_sec = (timeout_us - (now - sent)) / 1000000;
+        tv.tv_usec = (timeout_us - (now - sent)) % 1000000;
+        if (select(s + 1, &rfds, NULL, NULL, &tv) > 0) {
+            fromlen = sizeof(from);
+            while ((len = recvfrom(s, buf, buflen, MSG_DONTWAIT, (struct sockaddr*)&from, &fromlen)) > 0) {
+                now = micros();
+                fromlen = sizeof(from);
+
+                if ((iecho = ping_parse_reply(buf, len)) == NULL) {
+                    continue;
+                }
+                if (iecho->seqno != htons(ping_seq_num)) {
+                    // Reply to a larger probe that was given up on
+                    late++;
+                    continue;
+                }
+
+                // Only a reply that came back at full size counts
+                iphdr = (struct ip_hdr *)buf;
+                if (len - IPH_HL(iphdr) * 4 != payload + (int)sizeof(struct icmp_echo_hdr)) {
+                    log_d("icmp_seq=%d came back short, %d bytes\r\n", ping_seq_num, len);
+                    return -1;
+                }
+                ping_record(now - sent);
+                return (int32_t)(now - sent);
+            }
+        }
+        now = micros();
     }
+    return -1;
+}
 
-    // Create socket
-    if ((s = socket(AF_INET, SOCK_RAW, IP_PROTO_ICMP)) < 0) {
-        // TODO: error
-        return false;
+static bool ping_pmtu_try(int s, ip4_addr_t *addr, uint16_t mtu, uint32_t timeout_us, int tries,
+                          char *buf, int buflen, struct ping_pmtu_result *result) {
+    // A lost probe must not be taken for one that was too big
+    while (tries-- > 0) {
+        result->probes++;
+        if (ping_pmtu_probe(s, addr, mtu, timeout_us, buf, buflen) >= 0) {
+            log_d("%d bytes: ok\r\n", mtu);
+            return true;
+        }
     }
+    log_d("%d bytes: no reply\r\n", mtu);
+    return false;
+}
 
+/*
+* Collect the answers to the probes of one traceroute hop, sent with
+* sequence numbers first_seq onwards at sent_us[], until all are in or the
+* timeout after the last send has passed.
+*/
+static void ping_trace_collect(int s, struct ping_trace_hop *hop, struct ping_trace_result *result,
+                               uint16_t first_seq, int probes, const uint32_t *sent_us, uint32_t timeout_us) {
+    char buf[128];
+    int len;
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    struct icmp_echo_hdr *iecho;
+    struct timeval tv;
+    fd_set rfds;
+    uint64_t sum_us = 0;
+    uint32_t answered = 0;
+    uint32_t deadline = sent_us[probes - 1] + timeout_us;
+    uint32_t elapsed;
+    uint32_t now;
+    uint8_t type;
+    int index;
 
-    address.sin_addr.s_addr = adr;
-    ping_target.addr = address.sin_addr.s_addr;
+    now = micros();
+    while ((hop->received < hop->sent) && ((int32_t)(deadline - now) > 0)) {
+        FD_ZERO(&rfds);
+        FD_SET(s, &rfds);
+        tv.tv_sec = (deadline - now) / 1000000;
+        tv.tv_usec = (deadline - now) % 1000000;
+        if (select(s + 1, &rfds, NULL, NULL, &tv) > 0) {
+            fromlen = sizeof(from);
+            while ((len = recvfrom(s, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr*)&from, &fromlen)) > 0) {
+                now = micros();
+                fromlen = sizeof(from);
 
-    // Setup socket
-    struct timeval tout;
+                type = ICMP_ER;
+                if (((iecho = ping_parse_reply(buf, len)) == NULL) &&
+                    ((iecho = ping_parse_error(buf, len, &type)) == NULL)) {
+                    continue;
+                }
 
-    // Timeout
-    tout.tv_sec = timeout;
-    tout.tv_usec = 0;
+                index = (uint16_t)(ntohs(iecho->seqno) - first_seq);
+                if ((index >= probes) || (answered & (1UL << index))) {
+                    // Answer to an earlier hop or a repeat
+                    late++;
+                    continue;
+                }
+                answered |= 1UL << index;
 
-    if (setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tout, sizeof(tout)) < 0) {
-        closesocket(s);
-        // TODO: error
-        return false;
+                elapsed = now - sent_us[index];
+                if ((hop->received == 0) || (elapsed < hop->min_us)) {
+                    hop->min_us = elapsed;
+                }
+                if (elapsed > hop->max_us) {
+                    hop->max_us = elapsed;
+                }
+                sum_us += elapsed;
+                hop->received++;
+                hop->mean_us = (uint32_t)(sum_us / hop->received);
+                if (hop->addr == 0) {
+                    hop->addr = from.sin_addr.s_addr;
+                }
+
+                if (type == ICMP_ER) {
+                    result->reached = 1;
+                }
+                else if (type == ICMP_DUR) {
+                    result->unreachable = 1;
+                }
+            }
+        }
+        now = micros();
     }
+}
 
-    stopped = 0;
-    transmitted = 0;
-    received = 0;
-    min_time = 1.E+9;// FLT_MAX;
-    max_time = 0.0;
-    mean_time = 0.0;
-    var_time = 0.0;
+/*
+* Time one TCP handshake with a non-blocking connect(). A refused connection
+* reached the host but not the service, so it is counted in refused and not
+* as an answer. The socket is reset rather than closed, so a probe every few
+* seconds does not leave a PCB in TIME_WAIT each time.
+*/
+static int32_t ping_tcp_probe(ip4_addr_t *addr, uint16_t port, uint32_t timeout_us) {
+    struct sockaddr_in to;
+    struct linger reset = { 1, 0 };
+    struct timeval tv;
+    fd_set wfds;
+    socklen_t optlen;
+    uint32_t begin;
+    int32_t elapsed = -1;
+    int err;
+    int s;
 
-    // Register signal for stop ping
-    //signal(SIGINT, stop_action);
+    if ((s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+        return -1;
+    }
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+    setsockopt(s, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
 
-    // Begin ping ...
-    char ipa[16];
+    memset(&to, 0, sizeof(to));
+    to.sin_len = sizeof(to);
+    to.sin_family = AF_INET;
+    to.sin_port = htons(port);
+    inet_addr_from_ip4addr(&to.sin_addr, addr);
 
-    strcpy(ipa, inet_ntoa(ping_target));
-    log_i("PING %s: %d data bytes\r\n",  ipa, size);
+    transmitted++;
+    ping_hist_record_sent(&histogram);
+    ping_seq_num++;
 
-    ping_seq_num = 0;
-    
-    unsigned long ping_started_time = millis();
-    while ((ping_seq_num < count) && (!stopped)) {
-        if (ping_send(s, &ping_target, size) == ERR_OK) {
-            ping_recv(s);
-        }
-        if(ping_seq_num < count){
-            delay( interval*1000L);
+    begin = micros();
+    if (connect(s, (struct sockaddr*)&to, sizeof(to)) == 0) {
+        elapsed = micros() - begin;
+    }
+    else if (errno == EINPROGRESS) {
+        FD_ZERO(&wfds);
+        FD_SET(s, &wfds);
+        tv.tv_sec = timeout_us / 1000000;
+        tv.tv_usec = timeout_us % 1000000;
+        if (select(s + 1, NULL, &wfds, NULL, &tv) > 0) {
+            err = 0;
+            optlen = sizeof(err);
+            if (getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &optlen) == 0) {
+                if (err == 0) {
+                    elapsed = micros() - begin;
+                }
+                else if (err == ECONNREFUSED) {
+                    refused++;
+                }
+            }
         }
     }
+    else if (errno == ECONNREFUSED) {
+        refused++;
+    }
 
     closesocket(s);
+    return elapsed;
+}
 
-    log_i("%d packets transmitted, %d packets received, %.1f%% packet loss\r\n",
-          transmitted,
-          received,
-          ((((float)transmitted - (float)received) / (float)transmitted) * 100.0)
-    );
-    
-    
-    if (ping_o) {
-        ping_resp pingresp;
-        log_i("round-trip min/avg/max/stddev = %.3f/%.3f/%.3f/%.3f ms\r\n", min_time, mean_time, max_time, sqrt(var_time / received));
-        pingresp.total_count = count; //Number of pings
-        pingresp.resp_time = mean_time; //Average time for the pings
-        pingresp.seqno = 0; //not relevant
-        pingresp.timeout_count = transmitted - received; //number of pings which failed
-        pingresp.bytes = size; //number of bytes received for 1 ping
-        pingresp.total_bytes = size * count; //number of bytes for all pings
-        pingresp.total_time = (millis() - ping_started_time) / 1000.0; //Time consumed for all pings; it takes into account also timeout pings
-        pingresp.ping_err = transmitted - received; //number of pings failed
-        // Call the callback function
-        ping_o->recv_function(ping_o, &pingresp);
+/*
+* Send one datagram to a UDP echo service and wait for it to come back. The
+* first four bytes carry PING_ID and the sequence number to match replies.
+*/
+static int32_t ping_udp_probe(int s, struct sockaddr_in *to, char *buf, int size, uint32_t timeout_us) {
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    struct timeval tv;
+    fd_set rfds;
+    uint16_t hdr[2];
+    uint32_t sent;
+    uint32_t now;
+    int len;
+    int i;
+
+    hdr[0] = PING_ID;
+    hdr[1] = htons(++ping_seq_num);
+    memcpy(buf, hdr, sizeof(hdr));
+    for (i = sizeof(hdr); i < size; i++) {
+        buf[i] = (char)i;
     }
-    
-    // Return true if at least one ping had a successfull "pong" 
-    return (received > 0);
+
+    sent = micros();
+    if (sendto(s, buf, size, 0, (struct sockaddr*)to, sizeof(*to)) <= 0) {
+        return -1;
+    }
+    transmitted++;
+    ping_hist_record_sent(&histogram);
+
+    now = sent;
+    while (now - sent < timeout_us) {
+        FD_ZERO(&rfds);
+        FD_SET(s, &rfds);
+        tv.tv_sec = (timeout_us - (now - sent)) / 1000000;
+        tv.tv_usec = (timeout_us - (now - sent)) % 1000000;
+        if (select(s + 1, &rfds, NULL, NULL, &tv) > 0) {
+            fromlen = sizeof(from);
+            while ((len = recvfrom(s, buf, size, MSG_DONTWAIT, (struct sockaddr*)&from, &fromlen)) > 0) {
+                now = micros();
+                fromlen = sizeof(from);
+
+                if ((len < (int)sizeof(hdr)) || (from.sin_addr.s_addr != to->sin_addr.s_addr) ||
+                    (((uint16_t *)buf)[0] != PING_ID)) {
+                    continue;
+                }
+                if (((uint16_t *)buf)[1] != htons(ping_seq_num)) {
+                    late++;
+                    continue;
+                }
+                return (int32_t)(now - sent);
+            }
+        }
+        now = micros();
+    }
+    return -1;
+}
+
+/*
+* Our wall clock in microseconds since midnight, the timebase of ICMP
+* timestamps. Only differences are used, so a clock that was never set
+* still gives the one-way times, just with a large offset.
+*/
+static uint64_t ping_ts_now_us(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (uint64_t)(tv.tv_sec % (PING_TS_DAY_MS / 1000)) * 1000000 + tv.tv_usec;
+}
+
+/*
+* later - earlier for two times of day, folded into +/- half a day so the
+* result stays right across midnight.
+*/
+static int64_t ping_ts_diff(uint64_t later_us, uint64_t earlier_us) {
+    const int64_t day_us = (int64_t)PING_TS_DAY_MS * 1000;
+    int64_t d = (int64_t)later_us - (int64_t)earlier_us;
+
+    if (d > day_us / 2) {
+        d -= day_us;
+    }
+    else if (d < -day_us / 2) {
+        d += day_us;
+    }
+    return d;
+}
+
+/*
+* Return the timestamp reply carried by a received datagram, or NULL when it
+* is too short or is not a reply to one of our requests.
+*/
+static struct ping_ts_msg *ping_parse_timestamp(char *buf, int len) {
+    struct ip_hdr *iphdr = (struct ip_hdr *)buf;
+    struct ping_ts_msg *reply;
+
+    if ((len < (int)sizeof(struct ip_hdr)) || (len < (int)(IPH_HL(iphdr) * 4 + sizeof(struct ping_ts_msg)))) {
+        return NULL;
+    }
+
+    reply = (struct ping_ts_msg *)(buf + (IPH_HL(iphdr) * 4));
+    if ((ICMPH_TYPE(&reply->hdr) != ICMP_TSR) || (reply->hdr.id != PING_ID)) {
+        return NULL;
+    }
+    return reply;
+}
+
+/*
+* Send one timestamp request and wait for its reply. Returns 0 with the
+* sample filled in, 1 when the reply is not in milliseconds since midnight
+* UT, or -1 when nothing came back.
+*/
+static int ping_ts_probe(int s, ip4_addr_t *addr, uint32_t timeout_us, struct ping_ts_sample *sample) {
+    struct ping_ts_msg msg;
+    struct ping_ts_msg *reply;
+    struct sockaddr_in to;
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    struct timeval tv;
+    fd_set rfds;
+    char buf[64];
+    uint32_t sent;
+    uint32_t now;
+    int len;
+
+    memset(&msg, 0, sizeof(msg));
+    ICMPH_TYPE_SET(&msg.hdr, ICMP_TS);
+    ICMPH_CODE_SET(&msg.hdr, 0);
+    msg.hdr.id = PING_ID;
+    msg.hdr.seqno = htons(++ping_seq_num);
+
+    to.sin_len = sizeof(to);
+    to.sin_family = AF_INET;
+    inet_addr_from_ip4addr(&to.sin_addr, addr);
+
+    sample->t1_us = ping_ts_now_us();
+    msg.originate = htonl((uint32_t)(sample->t1_us / 1000));
+    msg.hdr.chksum = inet_chksum(&msg, sizeof(msg));
+
+    sent = micros();
+    if (sendto(s, &msg, sizeof(msg), 0, (struct sockaddr*)&to, sizeof(to)) <= 0) {
+        return -1;
+    }
+    transmitted++;
+    ping_hist_record_sent(&histogram);
+
+    now = sent;
+    while (now - sent < timeout_us) {
+        FD_ZERO(&rfds);
+        FD_SET(s, &rfds);
+        tv.tv_sec = (timeout_us - (now - sent)) / 1000000;
+        tv.tv_usec = (timeout_us - (now - sent)) % 1000000;
+        if (select(s + 1, &rfds, NULL, NULL, &tv) > 0) {
+            fromlen = sizeof(from);
+            while ((len = recvfrom(s, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr*)&from, &fromlen)) > 0) {
+                now = micros();
+                fromlen = sizeof(from);
+
+                if ((reply = ping_parse_timestamp(buf, len)) == NULL) {
+                    continue;
+                }
+                if (reply->hdr.seqno != msg.hdr.seqno) {
+                    late++;
+                    continue;
+                }
+
+                sample->t4_us = ping_ts_now_us();
+                sample->rtt_us = now - sent;
+                sample->t2_ms = ntohl(reply->receive);
+                sample->t3_ms = ntohl(reply->transmit);
+                ping_record(sample->rtt_us);
+                return ((sample->t2_ms | sample->t3_ms) & PING_TS_NONSTANDARD) ? 1 : 0;
+            }
+        }
+        now = micros();
+    }
+    return -1;
+}
+
+static void ping_wifi_disconnected(system_event_id_t) {
+    // Runs on the event task, only flag the socket for recreation
+    ping_socket_invalidate();
+}
+
+static void ping_session_lock(void) {
+    xSemaphoreTakeRecursive(ping_mutex, portMAX_DELAY);
+
+    // Every entry point comes through here, so the socket and the raw PCB
+    // are dropped after a disconnect whichever API opened them.
+    if (!wifi_hooked) {
+        WiFi.onEvent(&ping_wifi_disconnected, SYSTEM_EVENT_STA_DISCONNECTED);
+        wifi_hooked = 1;
+    }
+}
+
+static void ping_session_unlock(void) {
+    xSemaphoreGiveRecursive(ping_mutex);
+}
+
+static void ping_socket_drain(int s) {
+    char buf[64];
+    struct sockaddr_in from;
+    socklen_t fromlen = sizeof(from);
+
+    // Replies that arrived after the previous session timed out are still
+    // queued on a reused socket, throw them away before sending anything.
+    while (recvfrom(s, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr*)&from, &fromlen) > 0) {
+        socket_stats.drained++;
+        fromlen = sizeof(from);
+    }
+}
+
+static int ping_socket_acquire(int timeout) {
+    unsigned long begin = micros();
+    bool opened = false;
+
+    if ((icmp_socket >= 0) &&
+        (icmp_socket_stale || (millis() - icmp_socket_last_used > PING_SOCKET_IDLE_MS))) {
+        ping_socket_close();
+    }
+
+    if (icmp_socket < 0) {
+        if ((icmp_socket = socket(AF_INET, SOCK_RAW, IP_PROTO_ICMP)) < 0) {
+            return -1;
+        }
+        icmp_socket_timeout = -1;
+        icmp_socket_stale = 0;
+        opened = true;
+    }
+    else {
+        ping_socket_drain(icmp_socket);
+    }
+
+    // Only touch the socket options when they differ from the last session
+    if (timeout != icmp_socket_timeout) {
+        struct timeval tout;
+
+        tout.tv_sec = timeout;
+        tout.tv_usec = 0;
+        if (setsockopt(icmp_socket, SOL_SOCKET, SO_RCVTIMEO, &tout, sizeof(tout)) < 0) {
+            ping_socket_close();
+            return -1;
+        }
+        icmp_socket_timeout = timeout;
+    }
+
+    if (opened) {
+        socket_stats.opens++;
+        socket_stats.open_us += micros() - begin;
+    }
+    else {
+        socket_stats.reuses++;
+        socket_stats.reuse_us += micros() - begin;
+    }
+    return icmp_socket;
+}
+
+static void ping_session_reset(void) {
+    stopped = 0;
+    transmitted = 0;
+    received = 0;
+    late = 0;
+    duplicates = 0;
+    refused = 0;
+    min_time = 1.E+9;// FLT_MAX;
+    max_time = 0.0;
+    mean_time = 0.0;
+    var_time = 0.0;
+    ping_hist_reset(&histogram);
+}
+
+static void ping_session_report(int count, int size, unsigned long ping_started_time, struct ping_option *ping_o) {
+    icmp_socket_last_used = millis();
+
+    log_i("%d packets transmitted, %d packets received, %.1f%% packet loss\r\n",
+          transmitted,
+          received,
+          ((((float)transmitted - (float)received) / (float)transmitted) * 100.0)
+    );
+    if (late || duplicates) {
+        log_i("%d late replies, %d duplicate replies\r\n", late, duplicates);
+    }
+    if (refused) {
+        log_i("%d connections refused\r\n", refused);
+    }
+    
+    
+    if (ping_o) {
+        ping_resp pingresp;
+        log_i("round-trip min/avg/max/stddev = %.3f/%.3f/%.3f/%.3f ms\r\n", min_time, mean_time, max_time, sqrt(var_time / received));
+        log_i("round-trip p50/p90/p99/max = %u/%u/%u/%u us, jitter %u us\r\n",
+              ping_hist_percentile(&histogram, 50), ping_hist_percentile(&histogram, 90),
+              ping_hist_percentile(&histogram, 99), histogram.max_us, ping_hist_jitter(&histogram));
+        pingresp.total_count = count; //Number of pings
+        pingresp.resp_time = mean_time; //Average time for the pings
+        pingresp.seqno = 0; //not relevant
+        pingresp.timeout_count = transmitted - received; //number of pings which failed
+        pingresp.bytes = size; //number of bytes received for 1 ping
+        pingresp.total_bytes = size * count; //number of bytes for all pings
+        pingresp.total_time = (millis() - ping_started_time) / 1000.0; //Time consumed for all pings; it takes into account also timeout pings
+        pingresp.ping_err = transmitted - received; //number of pings failed
+        pingresp.min_time = (received > 0) ? min_time : 0.0; //Fastest reply in ms
+        pingresp.max_time = max_time; //Slowest reply in ms
+        pingresp.stddev_time = (received > 0) ? sqrt(var_time / received) : 0.0; //Standard deviation in ms
+        pingresp.histogram = &histogram; //Latency distribution, only valid during the callback
+        pingresp.late_count = late; //Replies that arrived after their timeout
+        pingresp.duplicate_count = duplicates; //Extra copies of replies already counted
+        pingresp.refused_count = refused; //TCP probes the host answered with a reset
+        // Call the callback function
+        ping_o->recv_function(ping_o, &pingresp);
+    }
+}
+
+/*
+static void stop_action(int i) {
+	signal(i, SIG_DFL);
+
+	stopped = 1;
+}
+*/
+/*
+* Operation functions
+*
+*/
+void ping(const char *name, int count, int interval, int size, int timeout) {
+    uint32_t adr;
+
+    // Resolve name, served from the cache after the first call
+    if (!ping_dns_resolve(name, &adr, PING_DNS_QUERY_TIMEOUT_MS)) {
+        log_i("PING %s: unknown host\r\n", name);
+        return;
+    }
+    ping_start(IPAddress(adr), count, interval, size, timeout);
+}
+
+bool ping_start(struct ping_option *ping_o) {
+
+
+    return ping_start(ping_o->ip,ping_o->count,0,0,0,ping_o);
+
+}
+bool ping_start(IPAddress adr, int count=0, int interval=0, int size=0, int timeout=0, struct ping_option *ping_o) {
+//	driver_error_t *error;
+    struct sockaddr_in address;
+    ip4_addr_t ping_target;
+    int s;
+    // Get default values if argument are not provided
+    if (count == 0) {
+        count = PING_DEFAULT_COUNT;
+    }
+
+    if (interval == 0) {
+        interval = PING_DEFAULT_INTERVAL;
+    }
+
+    if (size == 0) {
+        size = PING_DEFAULT_SIZE;
+    }
+
+    if (timeout == 0) {
+        timeout = PING_DEFAULT_TIMEOUT;
+    }
+
+    // Get the shared socket, created on first use
+    ping_session_lock();
+    if ((s = ping_socket_acquire(timeout)) < 0) {
+        // TODO: error
+        ping_session_unlock();
+        return false;
+    }
+
+    address.sin_addr.s_addr = adr;
+    ping_target.addr = address.sin_addr.s_addr;
+
+    ping_session_reset();
+
+    // Register signal for stop ping
+    //signal(SIGINT, stop_action);
+
+    // Begin ping ...
+    char ipa[16];
+
+    strcpy(ipa, inet_ntoa(ping_target));
+    log_i("PING %s: %d data bytes\r\n",  ipa, size);
+
+    // The sequence number keeps running across sessions so that a late reply
+    // to an earlier session can never be taken for one of ours.
+    int probes = 0;
+
+    unsigned long ping_started_time = millis();
+    while ((probes < count) && (!stopped)) {
+        probes++;
+        if (ping_send(s, &ping_target, size) == ERR_OK) {
+            ping_recv(s);
+        }
+        if(probes < count){
+            delay( interval*1000L);
+        }
+    }
+
+    ping_session_report(count, size, ping_started_time, ping_o);
+
+    // Return true if at least one ping had a successfull "pong" 
+    bool result = (received > 0);
+    ping_session_unlock();
+    return result;
+}
+
+/*
+* Same session as ping_start(), with a TCP connect or a UDP echo round trip
+* as the probe instead of an ICMP echo. These work where raw ICMP sockets
+* are unavailable or filtered and time the path application traffic takes.
+* The statistics, histogram and callback are shared with the ICMP modes.
+*/
+bool ping_start_probe(int type, IPAddress adr, uint16_t port, int count, int interval_ms, int size, int timeout_ms, struct ping_option *ping_o) {
+    ip4_addr_t ping_target;
+    struct sockaddr_in to;
+    uint32_t timeout_us;
+    int32_t elapsed;
+    char *buf = NULL;
+    int probes = 0;
+    int s = -1;
+
+    if (type == PING_PROBE_ICMP) {
+        return ping_start(adr, count, (interval_ms + 999) / 1000, size, (timeout_ms + 999) / 1000, ping_o);
+    }
+
+    if (count <= 0) {
+        count = PING_DEFAULT_COUNT;
+    }
+    if (interval_ms <= 0) {
+        interval_ms = PING_DEFAULT_INTERVAL * 1000;
+    }
+    if (size < (int)(2 * sizeof(uint16_t))) {
+        size = PING_DEFAULT_SIZE;
+    }
+    if (timeout_ms <= 0) {
+        timeout_ms = PING_DEFAULT_TIMEOUT * 1000;
+    }
+    timeout_us = (uint32_t)timeout_ms * 1000;
+    ping_target.addr = adr;
+
+    if (type == PING_PROBE_UDP) {
+        if ((buf = (char *)mem_malloc((mem_size_t)size)) == NULL) {
+            return false;
+        }
+        if ((s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+            mem_free(buf);
+            return false;
+        }
+        memset(&to, 0, sizeof(to));
+        to.sin_len = sizeof(to);
+        to.sin_family = AF_INET;
+        to.sin_port = htons(port);
+        inet_addr_from_ip4addr(&to.sin_addr, &ping_target);
+    }
+
+    ping_session_lock();
+    ping_session_reset();
+
+    char ipa[16];
+
+    strcpy(ipa, inet_ntoa(ping_target));
+    log_i("%s %s:%d\r\n", (type == PING_PROBE_TCP) ? "TCPING" : "UDPING", ipa, port);
+
+    unsigned long ping_started_time = millis();
+    while ((probes < count) && (!stopped)) {
+        probes++;
+        if (type == PING_PROBE_TCP) {
+            elapsed = ping_tcp_probe(&ping_target, port, timeout_us);
+        }
+        else {
+            elapsed = ping_udp_probe(s, &to, buf, size, timeout_us);
+        }
+
+        if (elapsed >= 0) {
+            ping_record((uint32_t)elapsed);
+            log_d("%s:%d seq=%d time=%.3f ms\r\n", ipa, port, ping_seq_num, elapsed / 1000.0);
+        }
+        else {
+            log_d("Request timeout for seq %d\r\n", ping_seq_num);
+        }
+        if (probes < count) {
+            delay(interval_ms);
+        }
+    }
+
+    ping_session_report(count, size, ping_started_time, ping_o);
+
+    bool result = (received > 0);
+    ping_session_unlock();
+    if (s >= 0) {
+        closesocket(s);
+    }
+    if (buf != NULL) {
+        mem_free(buf);
+    }
+    return result;
+}
+
+bool ping_start_window(IPAddress adr, int count, int window, int interval_ms, int size, int timeout_ms, struct ping_option *ping_o) {
+    ip4_addr_t ping_target;
+    uint32_t timeout_us;
+    uint32_t next_send;
+    uint32_t now;
+    uint32_t wait_us;
+    uint16_t first_seq;
+    bool can_send;
+    bool raw;
+    err_t err;
+    int probes = 0;
+    int s = -1;
+    int i;
+
+    if (count <= 0) {
+        count = PING_DEFAULT_COUNT;
+    }
+    if (window <= 0) {
+        window = PING_DEFAULT_WINDOW;
+    }
+    if (window > PING_MAX_WINDOW) {
+        window = PING_MAX_WINDOW;
+    }
+    if (size <= 0) {
+        size = PING_DEFAULT_SIZE;
+    }
+    if (timeout_ms <= 0) {
+        timeout_ms = PING_DEFAULT_TIMEOUT * 1000;
+    }
+    timeout_us = (uint32_t)timeout_ms * 1000;
+
+    // Replies are collected with select(), the receive timeout is only a backstop
+    ping_session_lock();
+    raw = (window_backend == PING_BACKEND_RAW_PCB);
+    if (raw ? !ping_raw_open(PING_ID) : ((s = ping_socket_acquire((timeout_ms + 999) / 1000)) < 0)) {
+        ping_session_unlock();
+        return false;
+    }
+    if (raw) {
+        ping_raw_activate(true);
+    }
+
+    ping_target.addr = adr;
+    ping_session_reset();
+    memset(window_ring, 0, sizeof(window_ring));
+    window_in_flight = 0;
+    first_seq = ping_seq_num + 1;
+
+    char ipa[16];
+
+    strcpy(ipa, inet_ntoa(ping_target));
+    log_i("PING %s: %d data bytes, window %d%s\r\n", ipa, size, window, raw ? ", raw PCB" : "");
+
+    unsigned long ping_started_time = millis();
+    next_send = micros();
+    while (((probes < count) || (window_in_flight > 0)) && (!stopped)) {
+        now = micros();
+
+        // Expire probes that outlived the timeout, they may still turn up late
+        for (i = 0; i < PING_MAX_WINDOW; i++) {
+            if ((window_ring[i].state == PING_SLOT_PENDING) && (now - window_ring[i].sent_us >= timeout_us)) {
+                window_ring[i].state = PING_SLOT_EXPIRED;
+                window_in_flight--;
+                log_d("Request timeout for icmp_seq %d\r\n", window_ring[i].seqno);
+            }
+        }
+
+        // A slot is only reused once its probe was answered or expired, a
+        // lost probe holds up sending until its timeout
+        can_send = (probes < count) && (window_in_flight < window) &&
+                   (window_ring[(uint16_t)(ping_seq_num + 1) % PING_MAX_WINDOW].state != PING_SLOT_PENDING);
+
+        if (can_send && ((int32_t)(now - next_send) >= 0)) {
+            probes++;
+            next_send = now + (uint32_t)interval_ms * 1000;
+            err = raw ? ping_send_raw(&ping_target, size) : ping_send(s, &ping_target, size);
+            if (err == ERR_OK) {
+                struct ping_slot *slot = &window_ring[ping_seq_num % PING_MAX_WINDOW];
+
+                slot->seqno = ping_seq_num;
+                slot->state = PING_SLOT_PENDING;
+                slot->sent_us = now;
+                window_in_flight++;
+            }
+            continue;
+        }
+
+        // Sleep in select() until a reply arrives or the next send or expiry is due
+        wait_us = timeout_us;
+        if (can_send) {
+            wait_us = ((int32_t)(next_send - now) > 0) ? next_send - now : 0;
+        }
+        for (i = 0; i < PING_MAX_WINDOW; i++) {
+            if (window_ring[i].state == PING_SLOT_PENDING) {
+                uint32_t left = timeout_us - (now - window_ring[i].sent_us);
+                if (left < wait_us) {
+                    wait_us = left;
+                }
+            }
+        }
+
+        if (raw) {
+            if (ping_raw_wait(wait_us)) {
+                ping_window_recv_raw(first_seq);
+            }
+            continue;
+        }
+
+        fd_set rfds;
+        struct timeval tv;
+
+        FD_ZERO(&rfds);
+        FD_SET(s, &rfds);
+        tv.tv_sec = wait_us / 1000000;
+        tv.tv_usec = wait_us % 1000000;
+        if (select(s + 1, &rfds, NULL, NULL, &tv) > 0) {
+            ping_window_recv(s, first_seq);
+        }
+    }
+
+    if (raw) {
+        ping_raw_activate(false);
+    }
+    ping_session_report(count, size, ping_started_time, ping_o);
+
+    bool result = (received > 0);
+    ping_session_unlock();
+    return result;
+}
+
+/*
+* Find the largest IP datagram, up to max_mtu bytes, that makes the round
+* trip to adr unfragmented. The largest size is tried first, so a clean path
+* costs a single probe; otherwise the size is binary searched between
+* PING_PMTU_MIN and max_mtu in about log2(max_mtu) probes. Each size gets
+* `tries` attempts before it is taken as too big.
+*/
+bool ping_pmtu(IPAddress adr, int max_mtu, int timeout_ms, int tries, struct ping_pmtu_result *result) {
+    ip4_addr_t ping_target;
+    uint32_t timeout_us;
+    uint16_t lo;
+    uint16_t hi;
+    uint16_t mid;
+    char *buf;
+    int s;
+
+    if ((max_mtu <= 0) || (max_mtu > PING_PMTU_MAX)) {
+        max_mtu = PING_PMTU_MAX;
+    }
+    if (max_mtu < PING_PMTU_MIN) {
+        max_mtu = PING_PMTU_MIN;
+    }
+    if (timeout_ms <= 0) {
+        timeout_ms = PING_DEFAULT_TIMEOUT * 1000;
+    }
+    if (tries <= 0) {
+        tries = PING_PMTU_TRIES;
+    }
+    timeout_us = (uint32_t)timeout_ms * 1000;
+
+    memset(result, 0, sizeof(*result));
+    result->exact = PING_PMTU_EXACT;
+
+    // Replies are never larger than the largest probe
+    if ((buf = (char *)mem_malloc((mem_size_t)max_mtu)) == NULL) {
+        return false;
+    }
+
+    ping_session_lock();
+    if ((s = ping_socket_acquire((timeout_ms + 999) / 1000)) < 0) {
+        ping_session_unlock();
+        mem_free(buf);
+        return false;
+    }
+
+    ping_target.addr = adr;
+    ping_session_reset();
+
+    char ipa[16];
+
+    strcpy(ipa, inet_ntoa(ping_target));
+    log_i("PMTU %s: up to %d bytes\r\n", ipa, max_mtu);
+
+    // lo always came back, everything above hi did not
+    lo = 0;
+    hi = max_mtu;
+    if (ping_pmtu_try(s, &ping_target, max_mtu, timeout_us, tries, buf, max_mtu, result)) {
+        lo = max_mtu;
+    }
+    else if (ping_pmtu_try(s, &ping_target, PING_PMTU_MIN, timeout_us, tries, buf, max_mtu, result)) {
+        lo = PING_PMTU_MIN;
+        hi = max_mtu - 1;
+    }
+
+    while ((lo > 0) && (lo < hi) && (!stopped)) {
+        mid = lo + (hi - lo + 1) / 2;
+        if (ping_pmtu_try(s, &ping_target, mid, timeout_us, tries, buf, max_mtu, result)) {
+            lo = mid;
+        }
+        else {
+            hi = mid - 1;
+        }
+    }
+
+    result->mtu = lo;
+    result->payload = lo ? lo - IP_HLEN - sizeof(struct icmp_echo_hdr) : 0;
+    icmp_socket_last_used = millis();
+
+    if (lo > 0) {
+        log_i("path MTU %d bytes (%d data bytes), %d probes\r\n", result->mtu, result->payload, result->probes);
+    }
+    else {
+        log_i("%s does not answer, %d probes\r\n", ipa, result->probes);
+    }
+
+    ping_session_unlock();
+    mem_free(buf);
+    return (lo > 0);
+}
+
+/*
+* Estimate the bottleneck bandwidth to adr the way pathchar does: send echo
+* trains of `steps` datagram sizes between min_size and max_size, keep the
+* fastest round trip at each size (queueing only ever adds delay) and fit a
+* line through them. Every extra byte is serialized twice, on the way out
+* and back, so the slope is 2 / bandwidth and the intercept is the base
+* latency. Sizes are interleaved within each train so that drift in the
+* path affects all of them alike.
+*/
+bool ping_sweep(IPAddress adr, int min_size, int max_size, int steps, int train, int timeout_ms, struct ping_sweep_result *result) {
+    ip4_addr_t ping_target;
+    uint32_t timeout_us;
+    int32_t elapsed;
+    float sx = 0, sy = 0, sxx = 0, sxy = 0;
+    float n = 0;
+    char *buf;
+    int s;
+    int i;
+    int t;
+
+    if ((max_size <= 0) || (max_size > PING_PMTU_MAX)) {
+        max_size = PING_PMTU_MAX;
+    }
+    if (min_size < IP_HLEN + (int)sizeof(struct icmp_echo_hdr)) {
+        min_size = PING_PMTU_MIN;
+    }
+    if (min_size > max_size) {
+        min_size = max_size;
+    }
+    if (steps <= 0) {
+        steps = PING_SWEEP_STEPS;
+    }
+    if (steps > PING_SWEEP_MAX_STEPS) {
+        steps = PING_SWEEP_MAX_STEPS;
+    }
+    if (train <= 0) {
+        train = PING_SWEEP_TRAIN;
+    }
+    if (timeout_ms <= 0) {
+        timeout_ms = PING_DEFAULT_TIMEOUT * 1000;
+    }
+    timeout_us = (uint32_t)timeout_ms * 1000;
+
+    memset(result, 0, sizeof(*result));
+    result->steps = steps;
+    for (i = 0; i < steps; i++) {
+        result->size[i] = (steps > 1) ? min_size + (max_size - min_size) * i / (steps - 1) : max_size;
+    }
+
+    // Full size replies, not just the headers
+    if ((buf = (char *)mem_malloc((mem_size_t)max_size)) == NULL) {
+        return false;
+    }
+
+    ping_session_lock();
+    if ((s = ping_socket_acquire((timeout_ms + 999) / 1000)) < 0) {
+        ping_session_unlock();
+        mem_free(buf);
+        return false;
+    }
+
+    ping_target.addr = adr;
+    ping_session_reset();
+
+    char ipa[16];
+
+    strcpy(ipa, inet_ntoa(ping_target));
+    log_i("SWEEP %s: %d to %d bytes in %d steps, %d probes each\r\n", ipa, min_size, max_size, steps, train);
+
+    for (t = 0; (t < train) && (!stopped); t++) {
+        for (i = 0; i < steps; i++) {
+            elapsed = ping_pmtu_probe(s, &ping_target, result->size[i], timeout_us, buf, max_size);
+            if ((elapsed >= 0) && ((result->min_us[i] == 0) || ((uint32_t)elapsed < result->min_us[i]))) {
+                result->min_us[i] = (elapsed > 0) ? elapsed : 1;
+            }
+        }
+    }
+    icmp_socket_last_used = millis();
+    ping_session_unlock();
+    mem_free(buf);
+
+    // Least squares fit of the minimum round trip against size
+    for (i = 0; i < steps; i++) {
+        if (result->min_us[i] > 0) {
+            n++;
+            sx += result->size[i];
+            sy += result->min_us[i];
+            sxx += (float)result->size[i] * result->size[i];
+            sxy += (float)result->size[i] * result->min_us[i];
+        }
+    }
+    if ((n < 2) || ((n * sxx - sx * sx) <= 0)) {
+        log_i("%s: not enough sizes answered for a fit\r\n", ipa);
+        return false;
+    }
+    result->us_per_byte = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+    result->base_us = (sy - result->us_per_byte * sx) / n;
+    if (result->us_per_byte > 0) {
+        // 2 * 8 bits per us_per_byte microseconds, in kbit/s
+        result->kbps = (uint32_t)(16000.0f / result->us_per_byte);
+    }
+
+    log_i("base %.1f us, %.3f us/byte, %u kbps\r\n", result->base_us, result->us_per_byte, result->kbps);
+    return (result->kbps > 0);
+}
+
+/*
+* Trace the route to adr one TTL at a time, with `probes` echo requests in
+* flight per hop. Stops at the target, at a destination unreachable report
+* or after max_hops hops, so it takes at most max_hops * timeout_ms and no
+* memory beyond the caller's result. Safe to run from a background task; it
+* waits for any other ping session to finish first.
+*/
+bool ping_traceroute(IPAddress adr, int max_hops, int probes, int timeout_ms, struct ping_trace_result *result) {
+    ip4_addr_t ping_target;
+    uint32_t sent_us[PING_TRACE_MAX_PROBES];
+    uint32_t timeout_us;
+    uint16_t first_seq;
+    socklen_t optlen;
+    unsigned long started;
+    bool ttl_saved;
+    int old_ttl;
+    int ttl;
+    int s;
+    int i;
+
+    if ((max_hops <= 0) || (max_hops > PING_TRACE_MAX_HOPS)) {
+        max_hops = PING_TRACE_MAX_HOPS;
+    }
+    if (probes <= 0) {
+        probes = PING_TRACE_PROBES;
+    }
+    if (probes > PING_TRACE_MAX_PROBES) {
+        probes = PING_TRACE_MAX_PROBES;
+    }
+    if (timeout_ms <= 0) {
+        timeout_ms = PING_DEFAULT_TIMEOUT * 1000;
+    }
+    timeout_us = (uint32_t)timeout_ms * 1000;
+    memset(result, 0, sizeof(*result));
+
+    ping_session_lock();
+    if ((s = ping_socket_acquire((timeout_ms + 999) / 1000)) < 0) {
+        ping_session_unlock();
+        return false;
+    }
+
+    // The socket is shared with the other modes, put its TTL back afterwards
+    optlen = sizeof(old_ttl);
+    ttl_saved = (getsockopt(s, IPPROTO_IP, IP_TTL, &old_ttl, &optlen) == 0);
+
+    ping_target.addr = adr;
+    ping_session_reset();
+
+    char ipa[16];
+
+    strcpy(ipa, inet_ntoa(ping_target));
+    log_i("TRACEROUTE %s: %d hops max, %d probes per hop\r\n", ipa, max_hops, probes);
+
+    started = millis();
+    for (ttl = 1; (ttl <= max_hops) && !result->reached && !result->unreachable && (!stopped); ttl++) {
+        struct ping_trace_hop *hop = &result->hop[result->hops];
+
+        if (setsockopt(s, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl)) < 0) {
+            break;
+        }
+        result->hops++;
+
+        first_seq = ping_seq_num + 1;
+        for (i = 0; i < probes; i++) {
+            sent_us[i] = micros();
+            if (ping_send(s, &ping_target, PING_TRACE_SIZE) == ERR_OK) {
+                hop->sent++;
+            }
+        }
+        ping_trace_collect(s, hop, result, first_seq, probes, sent_us, timeout_us);
+
+        if (hop->received > 0) {
+            log_i("%2d  %s  %.3f/%.3f/%.3f ms, %d/%d\r\n", ttl, inet_ntoa(hop->addr),
+                  hop->min_us / 1000.0, hop->mean_us / 1000.0, hop->max_us / 1000.0, hop->received, hop->sent);
+        }
+        else {
+            log_i("%2d  *\r\n", ttl);
+        }
+    }
+    result->elapsed_ms = millis() - started;
+
+    if (!ttl_saved || (setsockopt(s, IPPROTO_IP, IP_TTL, &old_ttl, sizeof(old_ttl)) < 0)) {
+        // Start the next session with a fresh socket rather than a short TTL
+        ping_socket_close();
+    }
+    icmp_socket_last_used = millis();
+
+    ping_session_unlock();
+    return (result->reached != 0);
+}
+
+/*
+* Estimate the offset between our clock and adr's, and the one-way delays,
+* from `count` ICMP timestamp exchanges (types 13 and 14). Each exchange
+* gives the four NTP times: T1 sent, T2 received there, T3 sent back, T4
+* received here. Queueing on either leg only ever adds delay, so as in NTP's
+* clock filter the offset comes from the exchange with the least delay, and
+* the one-way times are the least seen over all exchanges.
+*
+* forward_us and back_us include the clock offset. Against a synchronised
+* clock they are the one-way delays; otherwise a change in one of them shows
+* which direction the queueing is on. The remote side only has millisecond
+* resolution, so everything is good to about half a millisecond.
+*/
+bool ping_timestamp(IPAddress adr, int count, int interval_ms, int timeout_ms, struct ping_ts_result *result) {
+    ip4_addr_t ping_target;
+    struct ping_ts_sample sample;
+    uint32_t timeout_us;
+    int64_t forward;
+    int64_t back;
+    int64_t delay_us;
+    int s;
+    int i;
+
+    if (count <= 0) {
+        count = PING_TS_COUNT;
+    }
+    if (count > 255) {
+        count = 255;
+    }
+    if (interval_ms < 0) {
+        interval_ms = 0;
+    }
+    if (timeout_ms <= 0) {
+        timeout_ms = PING_DEFAULT_TIMEOUT * 1000;
+    }
+    timeout_us = (uint32_t)timeout_ms * 1000;
+    memset(result, 0, sizeof(*result));
+
+    ping_session_lock();
+    if ((s = ping_socket_acquire((timeout_ms + 999) / 1000)) < 0) {
+        ping_session_unlock();
+        return false;
+    }
+
+    ping_target.addr = adr;
+    ping_session_reset();
+
+    char ipa[16];
+
+    strcpy(ipa, inet_ntoa(ping_target));
+    log_i("TIMESTAMP %s: %d requests\r\n", ipa, count);
+
+    for (i = 0; (i < count) && (!stopped); i++) {
+        if ((i > 0) && (interval_ms > 0)) {
+            delay(interval_ms);
+        }
+        result->sent++;
+        switch (ping_ts_probe(s, &ping_target, timeout_us, &sample)) {
+            case 0:
+                break;
+            case 1:
+                result->nonstandard++;
+                continue;
+            default:
+                continue;
+        }
+
+        // Remote times are whole milliseconds, take the middle of each
+        forward = ping_ts_diff((uint64_t)sample.t2_ms * 1000 + 500, sample.t1_us);
+        back = ping_ts_diff(sample.t4_us, (uint64_t)sample.t3_ms * 1000 + 500);
+        delay_us = (int64_t)sample.rtt_us - ping_ts_diff((uint64_t)sample.t3_ms * 1000, (uint64_t)sample.t2_ms * 1000);
+        if (delay_us < 0) {
+            delay_us = 0;
+        }
+
+        if ((result->received == 0) || ((uint32_t)delay_us < result->delay_us)) {
+            result->delay_us = (uint32_t)delay_us;
+            result->offset_us = (forward - back) / 2;
+        }
+        if ((result->received == 0) || (forward < result->forward_us)) {
+            result->forward_us = forward;
+        }
+        if ((result->received == 0) || (back < result->back_us)) {
+            result->back_us = back;
+        }
+        result->received++;
+    }
+    icmp_socket_last_used = millis();
+
+    if (result->received > 0) {
+        log_i("offset %lld us, delay %u us, forward %lld us, back %lld us, %d/%d\r\n",
+              (long long)result->offset_us, result->delay_us, (long long)result->forward_us,
+              (long long)result->back_us, result->received, result->sent);
+    }
+    else {
+        log_i("%s: no timestamp replies (%d nonstandard)\r\n", ipa, result->nonstandard);
+    }
+
+    ping_session_unlock();
+    return (result->received > 0);
+}
+
+/*
+* Backend for ping_start_window(), one of enum ping_backend. Takes effect
+* from the next session.
+*/
+void ping_set_backend(int backend) {
+    ping_session_lock();
+    window_backend = backend;
+    ping_session_unlock();
+}
+
+int ping_get_backend(void) {
+    return window_backend;
+}
+
+void ping_socket_close(void) {
+    ping_session_lock();
+    if (icmp_socket >= 0) {
+        closesocket(icmp_socket);
+        icmp_socket = -1;
+        icmp_socket_timeout = -1;
+    }
+    ping_raw_close();
+    ping_session_unlock();
+}
+
+void ping_socket_invalidate(void) {
+    // May be called from the WiFi event task, the socket and the raw PCB are
+    // closed and recreated by the next session on the calling task.
+    icmp_socket_stale = 1;
+    ping_raw_invalidate();
+}
+
+bool ping_socket_expire(uint32_t idle_ms) {
+    bool expired = false;
+
+    ping_session_lock();
+    if ((icmp_socket >= 0) && (millis() - icmp_socket_last_used >= idle_ms)) {
+        ping_socket_close();
+        expired = true;
+    }
+    ping_session_unlock();
+    return expired;
+}
+
+const struct ping_socket_stats *ping_socket_get_stats(void) {
+    return &socket_stats;
 }
 
 bool ping_regist_recv(struct ping_option *ping_opt, ping_recv_function ping_recv)
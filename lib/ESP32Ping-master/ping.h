@@ -1,6 +1,25 @@
 #ifndef PING_H
 #define PING_H
 #include <Arduino.h>
+#include "ping_histogram.h"
+#include "ping_raw.h"
+
+#ifndef PING_MAX_WINDOW
+#define PING_MAX_WINDOW       16    // Power of two, slots are picked by seq % PING_MAX_WINDOW
+#endif
+#ifndef PING_PMTU_MAX
+#define PING_PMTU_MAX         1500  // WiFi interface MTU, lwIP fragments anything larger
+#endif
+#define PING_PMTU_MIN         68    // Every IPv4 link carries at least this much
+#ifndef PING_SWEEP_MAX_STEPS
+#define PING_SWEEP_MAX_STEPS  16
+#endif
+#ifndef PING_TRACE_MAX_HOPS
+#define PING_TRACE_MAX_HOPS   16
+#endif
+#ifndef PING_TRACE_MAX_PROBES
+#define PING_TRACE_MAX_PROBES 8     // Probes in flight per hop
+#endif
 
 typedef void(*ping_recv_function)(void* arg, void *pdata);
 typedef void(*ping_sent_function)(void* arg, void *pdata);
@@ -23,10 +42,88 @@ struct ping_resp {
     uint32_t total_bytes;
     float total_time;
     int8_t  ping_err;
+    float min_time;
+    float max_time;
+    float stddev_time;
+    const struct ping_histogram *histogram;
+    uint32_t late_count;
+    uint32_t duplicate_count;
+    uint32_t refused_count;
+};
+
+struct ping_socket_stats {
+    uint32_t opens;         // Sessions that had to create the ICMP socket
+    uint32_t reuses;        // Sessions served by the cached socket
+    uint32_t drained;       // Stale replies discarded before reuse
+    uint32_t open_us;       // Total setup time of sessions that created the socket
+    uint32_t reuse_us;      // Total setup time of sessions that reused it
+};
+
+enum ping_probe_type {
+    PING_PROBE_ICMP = 0,    // ICMP echo, needs a raw socket
+    PING_PROBE_TCP,         // Time a non-blocking TCP connect() to port
+    PING_PROBE_UDP          // Round trip through a UDP echo service on port
+};
+
+struct ping_pmtu_result {
+    uint16_t mtu;           // Largest IP datagram that came back whole, 0 if none did
+    uint16_t payload;       // ICMP data bytes in that datagram
+    uint16_t probes;        // Echo requests sent
+    uint8_t exact;          // 0 when lwIP reassembles fragments, mtu is then only an upper bound
+};
+
+struct ping_sweep_result {
+    uint8_t steps;                          // Entries used in size[] and min_us[]
+    uint16_t size[PING_SWEEP_MAX_STEPS];    // IP datagram size of each step
+    uint32_t min_us[PING_SWEEP_MAX_STEPS];  // Fastest round trip at that size, 0 if none came back
+    float base_us;          // Fitted round trip of an empty datagram
+    float us_per_byte;      // Fitted extra round trip per datagram byte, both directions
+    uint32_t kbps;          // Bottleneck bandwidth, 0 when the slope could not be measured
+};
+
+struct ping_trace_hop {
+    uint32_t addr;          // Router, or the target itself, that answered; 0 if nobody did
+    uint8_t sent;
+    uint8_t received;
+    uint32_t min_us;
+    uint32_t mean_us;
+    uint32_t max_us;
+};
+
+struct ping_trace_result {
+    uint8_t hops;           // Entries used in hop[], hop[0] is TTL 1
+    uint8_t reached;        // The last hop is the target
+    uint8_t unreachable;    // A router reported the target unreachable
+    uint32_t elapsed_ms;
+    struct ping_trace_hop hop[PING_TRACE_MAX_HOPS];
+};
+
+struct ping_ts_result {
+    uint8_t sent;
+    uint8_t received;
+    uint8_t nonstandard;    // Replies not in milliseconds since midnight UT, left out
+    int64_t offset_us;      // Remote clock minus ours, from the exchange with the least delay
+    uint32_t delay_us;      // Least round trip minus the remote turnaround
+    int64_t forward_us;     // Least remote receive minus local send: delay out plus offset
+    int64_t back_us;        // Least local receive minus remote send: delay back minus offset
 };
 
 bool ping_start(struct ping_option *ping_opt);
 void ping(const char *name, int count, int interval, int size, int timeout);
 bool ping_start(IPAddress adr, int count, int interval, int size, int timeout, struct ping_option *ping_o = NULL);
+bool ping_start_window(IPAddress adr, int count, int window, int interval_ms, int size, int timeout_ms, struct ping_option *ping_o = NULL);
+bool ping_start_probe(int type, IPAddress adr, uint16_t port, int count, int interval_ms, int size, int timeout_ms, struct ping_option *ping_o = NULL);
+bool ping_pmtu(IPAddress adr, int max_mtu, int timeout_ms, int tries, struct ping_pmtu_result *result);
+bool ping_sweep(IPAddress adr, int min_size, int max_size, int steps, int train, int timeout_ms, struct ping_sweep_result *result);
+bool ping_traceroute(IPAddress adr, int max_hops, int probes, int timeout_ms, struct ping_trace_result *result);
+bool ping_timestamp(IPAddress adr, int count, int interval_ms, int timeout_ms, struct ping_ts_result *result);
+
+void ping_set_backend(int backend);
+int ping_get_backend(void);
+
+void ping_socket_close(void);
+void ping_socket_invalidate(void);
+bool ping_socket_expire(uint32_t idle_ms);
+const struct ping_socket_stats *ping_socket_get_stats(void);
 
 #endif // PING_H
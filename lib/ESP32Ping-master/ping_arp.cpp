@@ -0,0 +1,145 @@
+/*
+* ESP32 Ping library - ARP reachability probe
+*
+* See ping_arp.h for how the probe works.
+*/
+
+#include <Arduino.h>
+
+#include <string.h>
+
+#include "ping_arp.h"
+
+#include "lwip/ip_addr.h"
+#include "lwip/err.h"
+#include "lwip/netif.h"
+#include "lwip/etharp.h"
+#include "lwip/tcpip.h"
+#include "lwip/priv/tcpip_priv.h"
+
+/*
+* State shared with the tcpip thread for one call. It lives on the caller's
+* stack; tcpip_api_call() blocks until the tcpip thread is done with it.
+*/
+struct ping_arp_call {
+    struct tcpip_api_call_data api;     // First, the callbacks cast back from it
+    ip4_addr_t addr;
+    uint8_t routed;         // A netif is up on the subnet of addr
+    uint8_t found;
+    err_t err;
+    uint8_t mac[6];
+};
+
+/*
+* Helper functions
+*
+*/
+
+/*
+* The interface that reaches addr without a router, or NULL. Runs on the
+* tcpip thread.
+*/
+static struct netif *ping_arp_netif(const ip4_addr_t *addr) {
+    struct netif *netif;
+
+    for (netif = netif_list; netif != NULL; netif = netif->next) {
+        if (netif_is_up(netif) && !ip4_addr_isany_val(*netif_ip4_addr(netif)) &&
+            ip4_addr_netcmp(addr, netif_ip4_addr(netif), netif_ip4_netmask(netif))) {
+            return netif;
+        }
+    }
+    return NULL;
+}
+
+static err_t ping_arp_lookup_cb(struct tcpip_api_call_data *api) {
+    struct ping_arp_call *call = (struct ping_arp_call *)api;
+    struct netif *netif = ping_arp_netif(&call->addr);
+    struct eth_addr *eth;
+    const ip4_addr_t *ip;
+
+    call->routed = (netif != NULL);
+    call->found = 0;
+    if ((netif != NULL) && (etharp_find_addr(netif, &call->addr, &eth, &ip) >= 0)) {
+        memcpy(call->mac, eth->addr, sizeof(call->mac));
+        call->found = 1;
+    }
+    return ERR_OK;
+}
+
+static err_t ping_arp_request_cb(struct tcpip_api_call_data *api) {
+    struct ping_arp_call *call = (struct ping_arp_call *)api;
+    struct netif *netif = ping_arp_netif(&call->addr);
+
+    call->routed = (netif != NULL);
+    call->err = (netif != NULL) ? etharp_request(netif, &call->addr) : ERR_RTE;
+    return ERR_OK;
+}
+
+/*
+* Run fn on the tcpip thread and sleep on a semaphore until it is done.
+* ESP-IDF's lwIP keeps one such semaphore per thread, so nothing is
+* allocated and the caller gives up its core instead of spinning.
+*/
+static bool ping_arp_run(tcpip_api_call_fn fn, struct ping_arp_call *call) {
+    return (tcpip_api_call(fn, &call->api) == ERR_OK);
+}
+
+/*
+* Operation functions
+*
+*/
+bool ping_arp(IPAddress adr, uint32_t timeout_ms, struct ping_arp_result *result) {
+    struct ping_arp_call call;
+    uint32_t timeout_us = timeout_ms * 1000;
+    uint32_t sent, elapsed;
+
+    memset(result, 0, sizeof(*result));
+    memset(&call, 0, sizeof(call));
+    ip4_addr_set_u32(&call.addr, (uint32_t)adr);
+
+    if (!ping_arp_run(ping_arp_lookup_cb, &call) || !call.routed) {
+        log_d("ARP: no interface on the subnet of the target");
+        return false;
+    }
+    if (call.found) {
+        memcpy(result->mac, call.mac, sizeof(result->mac));
+        result->present = 1;
+        result->cached = 1;
+    }
+
+    sent = micros();
+    if (!ping_arp_run(ping_arp_request_cb, &call) || (call.err != ERR_OK)) {
+        log_d("ARP: request not sent (%d)", call.err);
+        return result->present;
+    }
+    if (result->cached) {
+        return true;
+    }
+
+    for (;;) {
+        elapsed = micros() - sent;
+        if (elapsed >= timeout_us) {
+            break;
+        }
+        if (elapsed < PING_ARP_SPIN_US) {
+            delayMicroseconds(PING_ARP_POLL_US);
+        }
+        else {
+            delay(1);
+        }
+        if (!ping_arp_run(ping_arp_lookup_cb, &call)) {
+            break;
+        }
+        result->polls++;
+        if (call.found) {
+            result->latency_us = micros() - sent;
+            memcpy(result->mac, call.mac, sizeof(result->mac));
+            result->present = 1;
+            break;
+        }
+    }
+
+    log_i("ARP: %s after %u us, %u polls", result->present ? "answered" : "no answer",
+          result->present ? result->latency_us : (uint32_t)(micros() - sent), result->polls);
+    return result->present;
+}
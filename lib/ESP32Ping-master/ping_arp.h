@@ -0,0 +1,45 @@
+/*
+* ESP32 Ping library - ARP reachability probe
+*
+* Checks whether a host on the local subnet is present by sending it an ARP
+* request through lwIP's etharp_request() and watching the ARP table for the
+* answer with etharp_find_addr(). No socket and no ICMP is involved, so it
+* also works for hosts that drop pings, and the cost on our side is a couple
+* of tcpip thread messages per poll.
+*
+* Both lwIP calls run on the tcpip thread through tcpip_api_call(). The table
+* is polled every PING_ARP_POLL_US for the first PING_ARP_SPIN_US (a LAN
+* normally answers within that), then once per tick until the timeout.
+*
+* lwIP keeps an answered entry for about five minutes and offers no way to
+* see its age. A host that is already in the table is reported present
+* straight away, with cached set and no latency; the request is still sent
+* so a host that has gone away drops out when its entry expires.
+*/
+
+#ifndef PING_ARP_H
+#define PING_ARP_H
+
+#include <Arduino.h>
+
+#ifndef PING_ARP_TIMEOUT_MS
+#define PING_ARP_TIMEOUT_MS   100
+#endif
+#ifndef PING_ARP_POLL_US
+#define PING_ARP_POLL_US      100
+#endif
+#ifndef PING_ARP_SPIN_US
+#define PING_ARP_SPIN_US      2000
+#endif
+
+struct ping_arp_result {
+    uint8_t present;        // Host answered, or was already in the ARP table
+    uint8_t cached;         // Entry existed before the request, latency_us not measured
+    uint8_t mac[6];
+    uint32_t latency_us;    // Request sent to entry seen in the table
+    uint16_t polls;         // Table lookups made while waiting
+};
+
+bool ping_arp(IPAddress adr, uint32_t timeout_ms, struct ping_arp_result *result);
+
+#endif // PING_ARP_H
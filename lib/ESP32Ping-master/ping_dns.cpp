@@ -0,0 +1,279 @@
+/*
+* ESP32 Ping library - resolver cache
+*
+* See ping_dns.h for the caching rules.
+*/
+
+#include <Arduino.h>
+
+#include <string.h>
+
+#include "ping_dns.h"
+
+#include "lwip/ip_addr.h"
+#include "lwip/err.h"
+#include "lwip/dns.h"
+#include "lwip/tcpip.h"
+#include "lwip/priv/tcpip_priv.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+enum {
+    DNS_ENTRY_EMPTY = 0,
+    DNS_ENTRY_PENDING,      // Query outstanding, addr may hold a stale answer
+    DNS_ENTRY_RESOLVED,
+    DNS_ENTRY_FAILED
+};
+
+struct ping_dns_entry {
+    char name[PING_DNS_NAME_LEN];
+    uint32_t addr;
+    uint32_t expires_ms;    // For PENDING entries: when to give up on the query
+    uint32_t last_used_ms;
+    uint8_t has_addr;       // addr holds a usable (possibly stale) answer
+    volatile uint8_t state;
+};
+
+static struct ping_dns_entry dns_cache[PING_DNS_ENTRIES];
+static struct ping_dns_stats dns_stats;
+
+/*
+* The cache is shared by the app tasks and lwIP's callback on the tcpip
+* thread. It has its own lock rather than the ping session mutex, which is
+* held for a whole session while the session waits on the tcpip thread.
+* The lock is only held for cache bookkeeping, never across
+* tcpip_api_call(), so the tcpip thread never waits for long.
+*/
+static StaticSemaphore_t dns_mutex_buffer;
+static SemaphoreHandle_t dns_mutex = xSemaphoreCreateRecursiveMutexStatic(&dns_mutex_buffer);
+
+/*
+* Query handed to the tcpip thread. It lives on the caller's stack;
+* tcpip_api_call() blocks until the tcpip thread is done with it.
+*/
+struct ping_dns_call {
+    struct tcpip_api_call_data api;     // First, the callback casts back from it
+    struct ping_dns_entry *entry;
+    char name[PING_DNS_NAME_LEN];
+    ip_addr_t addr;
+    err_t result;
+};
+
+/*
+* Helper functions
+*
+*/
+static void ping_dns_lock(void) {
+    xSemaphoreTakeRecursive(dns_mutex, portMAX_DELAY);
+}
+
+static void ping_dns_unlock(void) {
+    xSemaphoreGiveRecursive(dns_mutex);
+}
+
+/*
+* Record the outcome of a query. Called with the lock held. Only entries
+* still waiting for this very name are updated, the slot may have been
+* flushed or reused in the meantime.
+*/
+static void ping_dns_update(struct ping_dns_entry *entry, const char *name, const ip_addr_t *ipaddr) {
+    if ((entry->state != DNS_ENTRY_PENDING) || (strncmp(entry->name, name, PING_DNS_NAME_LEN) != 0)) {
+        return;
+    }
+
+    if ((ipaddr != NULL) && IP_IS_V4(ipaddr)) {
+        entry->addr = ip4_addr_get_u32(ip_2_ip4(ipaddr));
+        entry->has_addr = 1;
+        entry->expires_ms = millis() + PING_DNS_TTL_MS;
+        entry->state = DNS_ENTRY_RESOLVED;
+    }
+    else if (entry->has_addr) {
+        // A failed refresh keeps the last address and tries again later
+        entry->expires_ms = millis() + PING_DNS_NEGATIVE_TTL_MS;
+        entry->state = DNS_ENTRY_RESOLVED;
+    }
+    else {
+        entry->expires_ms = millis() + PING_DNS_NEGATIVE_TTL_MS;
+        entry->state = DNS_ENTRY_FAILED;
+    }
+}
+
+static void ping_dns_found(const char *name, const ip_addr_t *ipaddr, void *arg) {
+    // Runs on the tcpip thread
+    ping_dns_lock();
+    ping_dns_update((struct ping_dns_entry *)arg, name, ipaddr);
+    ping_dns_unlock();
+}
+
+static err_t ping_dns_query_cb(struct tcpip_api_call_data *api) {
+    struct ping_dns_call *call = (struct ping_dns_call *)api;
+
+    call->result = dns_gethostbyname(call->name, &call->addr, &ping_dns_found, call->entry);
+    return ERR_OK;
+}
+
+static struct ping_dns_entry *ping_dns_find(const char *name) {
+    int i;
+
+    for (i = 0; i < PING_DNS_ENTRIES; i++) {
+        if ((dns_cache[i].state != DNS_ENTRY_EMPTY) && (strncmp(dns_cache[i].name, name, PING_DNS_NAME_LEN) == 0)) {
+            return &dns_cache[i];
+        }
+    }
+    return NULL;
+}
+
+static struct ping_dns_entry *ping_dns_alloc(const char *name) {
+    struct ping_dns_entry *victim = NULL;
+    int i;
+
+    // Prefer an empty slot, otherwise the least recently used one that is
+    // not waiting for a callback.
+    for (i = 0; i < PING_DNS_ENTRIES; i++) {
+        if (dns_cache[i].state == DNS_ENTRY_EMPTY) {
+            victim = &dns_cache[i];
+            break;
+        }
+        if ((dns_cache[i].state != DNS_ENTRY_PENDING) &&
+            ((victim == NULL) || ((int32_t)(dns_cache[i].last_used_ms - victim->last_used_ms) < 0))) {
+            victim = &dns_cache[i];
+        }
+    }
+    if (victim == NULL) {
+        return NULL;
+    }
+    if (victim->state != DNS_ENTRY_EMPTY) {
+        dns_stats.evictions++;
+    }
+
+    memset(victim, 0, sizeof(*victim));
+    strncpy(victim->name, name, PING_DNS_NAME_LEN - 1);
+    return victim;
+}
+
+/*
+* Hand the name to lwIP on the tcpip thread. Called with the lock held; it
+* is dropped around tcpip_api_call() because the answer for another entry
+* may be waiting for it on the tcpip thread.
+*/
+static void ping_dns_query(struct ping_dns_entry *entry) {
+    struct ping_dns_call call;
+
+    entry->expires_ms = millis() + PING_DNS_QUERY_TIMEOUT_MS;
+    entry->state = DNS_ENTRY_PENDING;
+    dns_stats.queries++;
+
+    memset(&call, 0, sizeof(call));
+    call.entry = entry;
+    memcpy(call.name, entry->name, sizeof(call.name));
+
+    ping_dns_unlock();
+    if (tcpip_api_call(ping_dns_query_cb, &call.api) != ERR_OK) {
+        call.result = ERR_VAL;
+    }
+    ping_dns_lock();
+
+    if (call.result == ERR_OK) {
+        // Literal address, or still valid in lwIP's own table
+        ping_dns_update(entry, call.name, &call.addr);
+    }
+    else if (call.result != ERR_INPROGRESS) {
+        ping_dns_update(entry, call.name, NULL);
+    }
+}
+
+/*
+* The lookup itself, called with the lock held.
+*/
+static int ping_dns_lookup_locked(const char *name, uint32_t *addr) {
+    struct ping_dns_entry *entry;
+    uint32_t now = millis();
+    bool fresh = false;
+
+    if ((entry = ping_dns_find(name)) == NULL) {
+        if ((entry = ping_dns_alloc(name)) == NULL) {
+            return PING_DNS_FAILED;
+        }
+        ping_dns_query(entry);
+        fresh = true;
+    }
+    entry->last_used_ms = now;
+
+    switch (entry->state) {
+        case DNS_ENTRY_PENDING:
+            if ((int32_t)(now - entry->expires_ms) >= 0) {
+                // lwIP never called back, treat it as a failed lookup
+                ping_dns_update(entry, entry->name, NULL);
+            }
+            break;
+        case DNS_ENTRY_RESOLVED:
+            if ((int32_t)(now - entry->expires_ms) >= 0) {
+                ping_dns_query(entry);
+            }
+            break;
+        case DNS_ENTRY_FAILED:
+            if ((int32_t)(now - entry->expires_ms) >= 0) {
+                ping_dns_query(entry);
+                break;
+            }
+            if (!fresh) {
+                dns_stats.negative_hits++;
+            }
+            return PING_DNS_FAILED;
+        default:
+            break;
+    }
+
+    if (entry->state == DNS_ENTRY_FAILED) {
+        return PING_DNS_FAILED;
+    }
+    if (entry->has_addr) {
+        if (!fresh) {
+            dns_stats.hits++;
+        }
+        *addr = entry->addr;
+        return PING_DNS_OK;
+    }
+    return PING_DNS_PENDING;
+}
+
+/*
+* Operation functions
+*
+*/
+int ping_dns_lookup(const char *name, uint32_t *addr) {
+    int result;
+
+    if ((name == NULL) || (strlen(name) >= PING_DNS_NAME_LEN)) {
+        return PING_DNS_FAILED;
+    }
+
+    ping_dns_lock();
+    result = ping_dns_lookup_locked(name, addr);
+    ping_dns_unlock();
+    return result;
+}
+
+bool ping_dns_resolve(const char *name, uint32_t *addr, uint32_t timeout_ms) {
+    uint32_t start = millis();
+    int result;
+
+    while ((result = ping_dns_lookup(name, addr)) == PING_DNS_PENDING) {
+        if (millis() - start >= timeout_ms) {
+            return false;
+        }
+        delay(10);
+    }
+    return (result == PING_DNS_OK);
+}
+
+void ping_dns_flush(void) {
+    ping_dns_lock();
+    memset(dns_cache, 0, sizeof(dns_cache));
+    ping_dns_unlock();
+}
+
+const struct ping_dns_stats *ping_dns_get_stats(void) {
+    return &dns_stats;
+}
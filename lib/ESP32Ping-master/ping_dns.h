@@ -0,0 +1,58 @@
+/*
+* ESP32 Ping library - resolver cache
+*
+* Small, bounded cache of hostname to IPv4 address lookups for pinging
+* named hosts. Misses are resolved asynchronously with lwIP's
+* dns_gethostbyname(), called on the tcpip thread through tcpip_api_call();
+* the answer arrives through a callback on the same thread and is picked up
+* by the next lookup. The cache has its own lock, so any task may look up. Failures are cached too, for a
+* shorter time, so an unresolvable host does not cost a query on every call.
+*
+* lwIP does not pass the record TTL to the callback. Entries are kept for at
+* most PING_DNS_TTL_MS and are then refreshed through dns_gethostbyname(),
+* which answers straight from lwIP's own table while the record TTL is still
+* running. An expired entry keeps serving its last address while the refresh
+* is outstanding, and for PING_DNS_NEGATIVE_TTL_MS more if it fails, so
+* repeated health checks never wait on DNS.
+*/
+
+#ifndef PING_DNS_H
+#define PING_DNS_H
+
+#include <stdint.h>
+
+#ifndef PING_DNS_ENTRIES
+#define PING_DNS_ENTRIES          8
+#endif
+#ifndef PING_DNS_NAME_LEN
+#define PING_DNS_NAME_LEN         64
+#endif
+#ifndef PING_DNS_TTL_MS
+#define PING_DNS_TTL_MS           60000
+#endif
+#ifndef PING_DNS_NEGATIVE_TTL_MS
+#define PING_DNS_NEGATIVE_TTL_MS  10000
+#endif
+#ifndef PING_DNS_QUERY_TIMEOUT_MS
+#define PING_DNS_QUERY_TIMEOUT_MS 5000
+#endif
+
+enum ping_dns_result {
+    PING_DNS_OK = 0,        // Address returned
+    PING_DNS_PENDING,       // Lookup in progress, ask again later
+    PING_DNS_FAILED         // Name does not resolve (possibly cached failure)
+};
+
+struct ping_dns_stats {
+    uint32_t hits;          // Answered from the cache
+    uint32_t negative_hits; // Failures answered from the cache
+    uint32_t queries;       // Lookups handed to lwIP
+    uint32_t evictions;     // Entries dropped to make room
+};
+
+int ping_dns_lookup(const char *name, uint32_t *addr);
+bool ping_dns_resolve(const char *name, uint32_t *addr, uint32_t timeout_ms);
+void ping_dns_flush(void);
+const struct ping_dns_stats *ping_dns_get_stats(void);
+
+#endif // PING_DNS_H
@@ -0,0 +1,177 @@
+/*
+* ESP32 Ping library - latency histogram
+*
+* See ping_histogram.h for the bucket layout.
+*/
+
+#include <string.h>
+
+#include "ping_histogram.h"
+
+/*
+* Helper functions
+*
+*/
+static uint8_t hist_log2(uint32_t value) {
+    uint8_t e = 0;
+
+    while (value >>= 1) {
+        e++;
+    }
+    return e;
+}
+
+uint16_t ping_hist_bucket_index(uint32_t value_us) {
+    uint8_t e;
+
+    if (value_us < PING_HIST_SUB_COUNT) {
+        return (uint16_t)value_us;
+    }
+
+    e = hist_log2(value_us);
+    if (e >= PING_HIST_MAX_BITS) {
+        // Off the top of the scale, pin to the last bucket (max_us stays exact)
+        return PING_HIST_BUCKETS - 1;
+    }
+
+    return (uint16_t)(((e - PING_HIST_SUB_BITS + 1) << PING_HIST_SUB_BITS) +
+                      ((value_us >> (e - PING_HIST_SUB_BITS)) - PING_HIST_SUB_COUNT));
+}
+
+uint32_t ping_hist_bucket_low(uint16_t index) {
+    uint16_t group = index >> PING_HIST_SUB_BITS;
+    uint32_t sub = index & (PING_HIST_SUB_COUNT - 1);
+
+    if (group == 0) {
+        return sub;
+    }
+    return (PING_HIST_SUB_COUNT + sub) << (group - 1);
+}
+
+uint32_t ping_hist_bucket_high(uint16_t index) {
+    uint16_t group = index >> PING_HIST_SUB_BITS;
+
+    if (group == 0) {
+        return ping_hist_bucket_low(index);
+    }
+    return ping_hist_bucket_low(index) + (1UL << (group - 1)) - 1;
+}
+
+/*
+* Operation functions
+*
+*/
+void ping_hist_reset(struct ping_histogram *h) {
+    memset(h, 0, sizeof(*h));
+    h->min_us = UINT32_MAX;
+}
+
+void ping_hist_record_sent(struct ping_histogram *h) {
+    h->sent++;
+}
+
+void ping_hist_record(struct ping_histogram *h, uint32_t rtt_us) {
+    if (rtt_us < h->min_us) {
+        h->min_us = rtt_us;
+    }
+    if (rtt_us > h->max_us) {
+        h->max_us = rtt_us;
+    }
+
+    // Interarrival jitter as in RFC 3550 section 6.4.1 / appendix A.8, with
+    // the transit time difference taken between consecutive round trips.
+    if (h->count > 0) {
+        uint32_t d = (rtt_us > h->last_us) ? rtt_us - h->last_us : h->last_us - rtt_us;
+        h->jitter_x16 += d - ((h->jitter_x16 + 8) >> 4);
+    }
+    h->last_us = rtt_us;
+
+    h->count++;
+    h->sum_us += rtt_us;
+    h->buckets[ping_hist_bucket_index(rtt_us)]++;
+}
+
+void ping_hist_merge(struct ping_histogram *dst, const struct ping_histogram *src) {
+    uint16_t i;
+
+    if (src->count > 0) {
+        if (src->min_us < dst->min_us) {
+            dst->min_us = src->min_us;
+        }
+        if (src->max_us > dst->max_us) {
+            dst->max_us = src->max_us;
+        }
+        // Jitter is a running filter and cannot be merged exactly, so weight
+        // each side by the number of samples behind it.
+        dst->jitter_x16 = (uint32_t)(((uint64_t)dst->jitter_x16 * dst->count +
+                                      (uint64_t)src->jitter_x16 * src->count) /
+                                     (dst->count + src->count));
+        dst->last_us = src->last_us;
+    }
+
+    dst->sent += src->sent;
+    dst->count += src->count;
+    dst->sum_us += src->sum_us;
+    for (i = 0; i < PING_HIST_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+}
+
+uint32_t ping_hist_percentile(const struct ping_histogram *h, float percentile) {
+    uint32_t rank;
+    uint32_t seen = 0;
+    uint32_t value;
+    uint16_t i;
+
+    if (h->count == 0) {
+        return 0;
+    }
+    if (percentile >= 100.0) {
+        return h->max_us;
+    }
+    if (percentile <= 0.0) {
+        return h->min_us;
+    }
+
+    // Nearest rank, rounded up
+    rank = (uint32_t)((percentile / 100.0) * h->count);
+    if ((float)rank < (percentile / 100.0) * h->count) {
+        rank++;
+    }
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    for (i = 0; i < PING_HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            value = ping_hist_bucket_low(i) + (ping_hist_bucket_high(i) - ping_hist_bucket_low(i)) / 2;
+            if (value < h->min_us) {
+                value = h->min_us;
+            }
+            if (value > h->max_us) {
+                value = h->max_us;
+            }
+            return value;
+        }
+    }
+    return h->max_us;
+}
+
+uint32_t ping_hist_mean(const struct ping_histogram *h) {
+    if (h->count == 0) {
+        return 0;
+    }
+    return (uint32_t)(h->sum_us / h->count);
+}
+
+uint32_t ping_hist_jitter(const struct ping_histogram *h) {
+    return (h->jitter_x16 + 8) >> 4;
+}
+
+float ping_hist_loss(const struct ping_histogram *h) {
+    if (h->sent == 0 || h->count >= h->sent) {
+        return 0.0;
+    }
+    return ((float)(h->sent - h->count) / (float)h->sent) * 100.0;
+}
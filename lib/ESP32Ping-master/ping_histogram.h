@@ -0,0 +1,58 @@
+/*
+* ESP32 Ping library - latency histogram
+*
+* Fixed memory, log bucketed (HDR style) histogram of round trip times in
+* integer microseconds. Values below 2^PING_HIST_SUB_BITS us get one bucket
+* each, every power of two above that is split into 2^PING_HIST_SUB_BITS
+* linear sub-buckets, so the relative error of any reported value is bounded
+* by 1 / 2^(PING_HIST_SUB_BITS + 1) (3.1% with the default of 4 bits).
+*
+* The structure is plain old data with no pointers, so a snapshot is a copy
+* and snapshots taken on different sessions or devices can be combined with
+* ping_hist_merge().
+*
+* This file has no Arduino or lwIP dependencies so it can be built and tested
+* on the host.
+*/
+
+#ifndef PING_HISTOGRAM_H
+#define PING_HISTOGRAM_H
+
+#include <stdint.h>
+
+#ifndef PING_HIST_SUB_BITS
+#define PING_HIST_SUB_BITS    4
+#endif
+#ifndef PING_HIST_MAX_BITS
+#define PING_HIST_MAX_BITS    26     // Largest tracked bucket covers ~67 s
+#endif
+
+#define PING_HIST_SUB_COUNT   (1UL << PING_HIST_SUB_BITS)
+#define PING_HIST_BUCKETS     ((PING_HIST_MAX_BITS - PING_HIST_SUB_BITS + 1) * PING_HIST_SUB_COUNT)
+
+struct ping_histogram {
+    uint32_t sent;          // Probes transmitted
+    uint32_t count;         // Replies recorded
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t last_us;       // Previous sample, used for the jitter estimate
+    uint32_t jitter_x16;    // RFC 3550 interarrival jitter, scaled by 16
+    uint32_t buckets[PING_HIST_BUCKETS];
+};
+
+void ping_hist_reset(struct ping_histogram *h);
+void ping_hist_record_sent(struct ping_histogram *h);
+void ping_hist_record(struct ping_histogram *h, uint32_t rtt_us);
+void ping_hist_merge(struct ping_histogram *dst, const struct ping_histogram *src);
+
+uint32_t ping_hist_percentile(const struct ping_histogram *h, float percentile);
+uint32_t ping_hist_mean(const struct ping_histogram *h);
+uint32_t ping_hist_jitter(const struct ping_histogram *h);
+float ping_hist_loss(const struct ping_histogram *h);
+
+uint16_t ping_hist_bucket_index(uint32_t value_us);
+uint32_t ping_hist_bucket_low(uint16_t index);
+uint32_t ping_hist_bucket_high(uint16_t index);
+
+#endif // PING_HISTOGRAM_H
@@ -0,0 +1,266 @@
+/*
+* ESP32 Ping library - raw PCB backend
+*
+* See ping_raw.h for how replies get from the tcpip thread to a session.
+*/
+
+#include <Arduino.h>
+
+#include <string.h>
+
+#include "ping_raw.h"
+
+#include "lwip/ip_addr.h"
+#include "lwip/ip.h"
+#include "lwip/icmp.h"
+#include "lwip/err.h"
+#include "lwip/pbuf.h"
+#include "lwip/raw.h"
+#include "lwip/tcpip.h"
+#include "lwip/priv/tcpip_priv.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#define PING_RAW_HEADERS    (IP_HLEN + sizeof(struct icmp_echo_hdr))
+
+/*
+* Work handed to the tcpip thread. It lives on the caller's stack;
+* tcpip_api_call() blocks until the tcpip thread is done with it.
+*/
+struct ping_raw_call {
+    struct tcpip_api_call_data api;     // First, the callbacks cast back from it
+    uint8_t ok;
+    uint32_t addr;
+    const void *data;
+    uint16_t len;
+};
+
+static struct raw_pcb *raw_pcb_handle = NULL;
+static uint16_t raw_id = 0;
+static volatile uint8_t raw_active = 0;
+static volatile uint8_t raw_stale = 0;
+static struct ping_raw_stats raw_stats;
+
+/*
+* Lock-free ring, written only by the tcpip thread (raw_head) and read only
+* by the session task (raw_tail). Each side publishes its index with release
+* order after touching the entry, and reads the other side's with acquire.
+*/
+static struct ping_raw_reply raw_ring[PING_RAW_QUEUE];
+static uint32_t raw_head = 0;
+static uint32_t raw_tail = 0;
+
+static StaticSemaphore_t raw_signal_buffer;
+static SemaphoreHandle_t raw_signal = xSemaphoreCreateBinaryStatic(&raw_signal_buffer);
+
+/*
+* Helper functions
+*
+*/
+static bool ping_raw_push(const struct ping_raw_reply *reply) {
+    uint32_t head = raw_head;
+
+    if (head - __atomic_load_n(&raw_tail, __ATOMIC_ACQUIRE) >= PING_RAW_QUEUE) {
+        raw_stats.overflows++;
+        return false;
+    }
+    raw_ring[head % PING_RAW_QUEUE] = *reply;
+    __atomic_store_n(&raw_head, head + 1, __ATOMIC_RELEASE);
+    raw_stats.queued++;
+    return true;
+}
+
+/*
+* Runs on the tcpip thread for every ICMP datagram. p->payload points at the
+* IP header. Returning 0 leaves the pbuf to lwIP, 1 means it was consumed.
+*/
+static u8_t ping_raw_recv_cb(void *, struct raw_pcb *, struct pbuf *p, const ip_addr_t *addr) {
+    uint32_t now = micros();
+    uint8_t copy[PING_RAW_HEADERS + 40];
+    const uint8_t *headers = (const uint8_t *)p->payload;
+    const struct ip_hdr *iphdr;
+    const struct icmp_echo_hdr *iecho;
+    struct ping_raw_reply reply;
+    uint16_t avail = p->len;
+    uint16_t hlen;
+
+    if (!raw_active || (p->tot_len < PING_RAW_HEADERS)) {
+        return 0;
+    }
+
+    // A WiFi frame arrives in one pbuf, only fall back to a copy if it did not
+    if (p->len < PING_RAW_HEADERS) {
+        avail = pbuf_copy_partial(p, copy, sizeof(copy), 0);
+        headers = copy;
+        raw_stats.copied++;
+    }
+
+    iphdr = (const struct ip_hdr *)headers;
+    hlen = IPH_HL(iphdr) * 4;
+    if (hlen + sizeof(struct icmp_echo_hdr) > avail) {
+        return 0;
+    }
+
+    iecho = (const struct icmp_echo_hdr *)(headers + hlen);
+    if ((ICMPH_TYPE(iecho) != ICMP_ER) || (iecho->id != raw_id)) {
+        return 0;
+    }
+
+    reply.arrival_us = now;
+    reply.from = ip4_addr_get_u32(ip_2_ip4(addr));
+    reply.seqno = ntohs(iecho->seqno);
+    reply.len = p->tot_len;
+    if (ping_raw_push(&reply)) {
+        xSemaphoreGive(raw_signal);
+    }
+    pbuf_free(p);
+    return 1;
+}
+
+static err_t ping_raw_open_cb(struct tcpip_api_call_data *api) {
+    struct ping_raw_call *call = (struct ping_raw_call *)api;
+
+    if (raw_pcb_handle == NULL) {
+        if ((raw_pcb_handle = raw_new(IP_PROTO_ICMP)) != NULL) {
+            raw_recv(raw_pcb_handle, ping_raw_recv_cb, NULL);
+        }
+    }
+    call->ok = (raw_pcb_handle != NULL);
+    return ERR_OK;
+}
+
+static err_t ping_raw_close_cb(struct tcpip_api_call_data *api) {
+    struct ping_raw_call *call = (struct ping_raw_call *)api;
+
+    if (raw_pcb_handle != NULL) {
+        raw_remove(raw_pcb_handle);
+        raw_pcb_handle = NULL;
+    }
+    call->ok = 1;
+    return ERR_OK;
+}
+
+static err_t ping_raw_send_cb(struct tcpip_api_call_data *api) {
+    struct ping_raw_call *call = (struct ping_raw_call *)api;
+    struct pbuf *p;
+    ip_addr_t dest;
+
+    call->ok = 0;
+    if ((raw_pcb_handle != NULL) && ((p = pbuf_alloc(PBUF_IP, call->len, PBUF_RAM)) != NULL)) {
+        ip_addr_set_ip4_u32(&dest, call->addr);
+        if (pbuf_take(p, call->data, call->len) == ERR_OK) {
+            call->ok = (raw_sendto(raw_pcb_handle, p, &dest) == ERR_OK);
+        }
+        pbuf_free(p);
+    }
+    return ERR_OK;
+}
+
+/*
+* Run fn on the tcpip thread and sleep until it is done, see ping_arp_run().
+*/
+static bool ping_raw_run(tcpip_api_call_fn fn, struct ping_raw_call *call) {
+    if (tcpip_api_call(fn, &call->api) != ERR_OK) {
+        return false;
+    }
+    return call->ok;
+}
+
+/*
+* Operation functions
+*
+*/
+
+/*
+* Create the PCB on first use and keep it until ping_raw_close(), or until
+* ping_raw_invalidate() asks for a new one; replies are only taken once a
+* session calls ping_raw_activate(). id is the echo identifier to match.
+*/
+bool ping_raw_open(uint16_t id) {
+    struct ping_raw_call call;
+
+    if (raw_stale) {
+        ping_raw_close();
+    }
+    raw_id = id;
+    memset(&call, 0, sizeof(call));
+    return ping_raw_run(ping_raw_open_cb, &call);
+}
+
+void ping_raw_close(void) {
+    struct ping_raw_call call;
+
+    raw_active = 0;
+    raw_stale = 0;
+    if (raw_pcb_handle != NULL) {
+        memset(&call, 0, sizeof(call));
+        ping_raw_run(ping_raw_close_cb, &call);
+    }
+}
+
+/*
+* Safe from any task: the PCB is removed and recreated by the next
+* ping_raw_open(), on the session task.
+*/
+void ping_raw_invalidate(void) {
+    raw_stale = 1;
+}
+
+/*
+* Start or stop taking replies. Starting also throws away anything left in
+* the ring by an earlier session.
+*/
+void ping_raw_activate(bool active) {
+    struct ping_raw_reply stale;
+
+    raw_active = active;
+    if (active) {
+        while (ping_raw_pop(&stale)) {
+        }
+        xSemaphoreTake(raw_signal, 0);
+    }
+}
+
+/*
+* Send an ICMP message, echo header first, from the PCB.
+*/
+bool ping_raw_send(uint32_t addr, const void *echo, uint16_t len) {
+    struct ping_raw_call call;
+
+    memset(&call, 0, sizeof(call));
+    call.addr = addr;
+    call.data = echo;
+    call.len = len;
+    return ping_raw_run(ping_raw_send_cb, &call);
+}
+
+bool ping_raw_pop(struct ping_raw_reply *reply) {
+    uint32_t tail = raw_tail;
+
+    if (tail == __atomic_load_n(&raw_head, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    *reply = raw_ring[tail % PING_RAW_QUEUE];
+    __atomic_store_n(&raw_tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*
+* Sleep until a reply is queued or timeout_us has passed. Returns true when
+* the ring has something in it.
+*/
+bool ping_raw_wait(uint32_t timeout_us) {
+    TickType_t ticks;
+
+    if (raw_tail != __atomic_load_n(&raw_head, __ATOMIC_ACQUIRE)) {
+        return true;
+    }
+    ticks = (timeout_us + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000);
+    xSemaphoreTake(raw_signal, ticks);
+    return (raw_tail != __atomic_load_n(&raw_head, __ATOMIC_ACQUIRE));
+}
+
+const struct ping_raw_stats *ping_raw_get_stats(void) {
+    return &raw_stats;
+}
@@ -0,0 +1,53 @@
+/*
+* ESP32 Ping library - raw PCB backend
+*
+* Alternative to the raw socket for the windowed mode. An lwIP raw PCB for
+* ICMP is registered with raw_recv(), so echo replies are matched in the
+* tcpip thread straight on the received pbuf, without a copy into a socket
+* buffer and a wakeup of the session task first. Each reply is timestamped
+* there, on arrival, and passed to the session as a small record through a
+* single producer, single consumer lock-free ring. The session task only
+* sleeps on a binary semaphore while the ring is empty.
+*
+* The callback only takes echo replies carrying our identifier while a
+* session is using the backend; everything else is left to lwIP, so the
+* socket backend keeps working alongside.
+*/
+
+#ifndef PING_RAW_H
+#define PING_RAW_H
+
+#include <Arduino.h>
+
+#ifndef PING_RAW_QUEUE
+#define PING_RAW_QUEUE        32    // Ring entries, a power of two
+#endif
+
+enum ping_backend {
+    PING_BACKEND_SOCKET = 0,        // Raw socket, replies read with recvfrom()
+    PING_BACKEND_RAW_PCB            // Raw PCB, replies matched in the tcpip thread
+};
+
+struct ping_raw_reply {
+    uint32_t arrival_us;    // micros() when lwIP handed the reply to the PCB
+    uint32_t from;
+    uint16_t seqno;         // Host order
+    uint16_t len;           // IP datagram length
+};
+
+struct ping_raw_stats {
+    uint32_t queued;        // Replies handed to sessions
+    uint32_t overflows;     // Replies dropped because the ring was full
+    uint32_t copied;        // Replies whose headers spanned pbufs and had to be copied
+};
+
+bool ping_raw_open(uint16_t id);
+void ping_raw_close(void);
+void ping_raw_invalidate(void);
+void ping_raw_activate(bool active);
+bool ping_raw_send(uint32_t addr, const void *echo, uint16_t len);
+bool ping_raw_pop(struct ping_raw_reply *reply);
+bool ping_raw_wait(uint32_t timeout_us);
+const struct ping_raw_stats *ping_raw_get_stats(void);
+
+#endif // PING_RAW_H
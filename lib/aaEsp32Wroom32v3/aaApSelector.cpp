@@ -0,0 +1,304 @@
+#include <aaApSelector.h> // Header file for linking.
+
+static_assert((AP_SELECTOR_INDEX_SIZE & (AP_SELECTOR_INDEX_SIZE - 1)) == 0, "AP_SELECTOR_INDEX_SIZE must be a power of two");
+static_assert(AP_SELECTOR_INDEX_SIZE >= 2 * AP_SELECTOR_MAX_KNOWN, "AP_SELECTOR_INDEX_SIZE must be at least twice AP_SELECTOR_MAX_KNOWN");
+static_assert(AP_SELECTOR_MAX_KNOWN <= 16384, "known network numbers must fit an int16_t index");
+
+/**
+ * @brief This is the constructor for this class.
+ * @details Starts with an empty index and no candidates.
+ * @param null.
+ * @return null.
+ ******************************************************************************/
+aaApSelector::aaApSelector()
+{
+   memset(_index, -1, sizeof(_index));
+   memset(_history, 0, sizeof(_history));
+} // aaApSelector::aaApSelector()
+
+/**
+ * @brief This is the destructor for this class.
+ * @param null.
+ * @return null.
+ ******************************************************************************/
+aaApSelector::~aaApSelector()
+{
+} // aaApSelector::~aaApSelector()
+
+/**
+ * @brief Add a known network to the hash index.
+ * @details The SSID is not copied and must outlive the selector. Done once
+ * per known network, normally before the first scan.
+ * @param const char* SSID of the known network.
+ * @param uint8_t Configured priority, higher is preferred.
+ * @return bool false if the index is full, the SSID is longer than 32 bytes
+ * or already known.
+ ******************************************************************************/
+bool aaApSelector::addKnown(const char* ssid, uint8_t priority)
+{
+   size_t length = strlen(ssid);
+   if(length > 32)
+   {
+      return false;
+   } // if
+   return addKnown(ssid, length, hash(ssid, length), priority);
+} // aaApSelector::addKnown()
+
+/**
+ * @brief Add a known network whose SSID length and hash are already known.
+ * @details Used for a known network table built at compile time, so adding 
+ * hundreds of networks at boot costs no hashing.
+ * @param const char* SSID of the known network, not copied.
+ * @param uint8_t Length of the SSID.
+ * @param uint32_t FNV-1a hash of the SSID, see apSsidHash().
+ * @param uint8_t Configured priority, higher is preferred.
+ * @return bool false if the index is full, the SSID is longer than 32 bytes
+ * or already known.
+ ******************************************************************************/
+bool aaApSelector::addKnown(const char* ssid, uint8_t length, uint32_t ssidHash, uint8_t priority)
+{
+   uint16_t slot;
+   if(_known >= AP_SELECTOR_MAX_KNOWN || length > 32 || _find(ssid, length, ssidHash) >= 0)
+   {
+      return false;
+   } // if
+   slot = ssidHash & (AP_SELECTOR_INDEX_SIZE - 1);
+   while(_index[slot] >= 0)
+   {
+      slot = (slot + 1) & (AP_SELECTOR_INDEX_SIZE - 1);
+   } // while
+   _ssid[_known] = ssid;
+   _ssidLen[_known] = length;
+   _hash[_known] = ssidHash;
+   _priority[_known] = priority;
+   _index[slot] = _known;
+   _known++;
+   return true;
+} // aaApSelector::addKnown()
+
+/**
+ * @brief Report how many known networks are in the index.
+ * @param null.
+ * @return uint16_t Number of known networks.
+ ******************************************************************************/
+uint16_t aaApSelector::knownCount()
+{
+   return _known;
+} // aaApSelector::knownCount()
+
+/**
+ * @brief Look an SSID up in the hash index.
+ * @details The index is at most half full, so a probe sequence is short and
+ * ends at an empty slot. Only an SSID whose hash matches is compared.
+ * @param const char* SSID bytes, need not be null terminated.
+ * @param uint8_t Length of the SSID.
+ * @return int16_t Known network number, or -1 if the SSID is not known.
+ ******************************************************************************/
+int16_t aaApSelector::findKnown(const char* ssid, uint8_t length)
+{
+   return _find(ssid, length, hash(ssid, length));
+} // aaApSelector::findKnown()
+
+/**
+ * @brief Probe the hash index for an SSID whose hash is already known.
+ * @param const char* SSID bytes, need not be null terminated.
+ * @param uint8_t Length of the SSID.
+ * @param uint32_t FNV-1a hash of the SSID.
+ * @return int16_t Known network number, or -1 if the SSID is not known.
+ ******************************************************************************/
+int16_t aaApSelector::_find(const char* ssid, uint8_t length, uint32_t ssidHash)
+{
+   uint16_t slot = ssidHash & (AP_SELECTOR_INDEX_SIZE - 1);
+   int16_t known;
+   while((known = _index[slot]) >= 0)
+   {
+      if(_hash[known] == ssidHash && _ssidLen[known] == length && memcmp(_ssid[known], ssid, length) == 0)
+      {
+         return known;
+      } // if
+      slot = (slot + 1) & (AP_SELECTOR_INDEX_SIZE - 1);
+   } // while
+   return -1;
+} // aaApSelector::_find()
+
+/**
+ * @brief Forget the candidates of the previous scan.
+ * @param null.
+ * @return null.
+ ******************************************************************************/
+void aaApSelector::clearCandidates()
+{
+   _candidateCount = 0;
+} // aaApSelector::clearCandidates()
+
+/**
+ * @brief Rank one scanned Access Point.
+ * @details Unknown networks are dropped after the lookup. A known one is
+ * inserted in score order; when AP_SELECTOR_MAX_CANDIDATES are already kept
+ * the weakest falls off. Equal scores keep the order of the scan.
+ * @param const char* SSID bytes, need not be null terminated.
+ * @param uint8_t Length of the SSID.
+ * @param int8_t Signal strength in db.
+ * @param uint8_t Primary channel.
+ * @param const uint8_t* BSSID, 6 bytes.
+ * @return bool true if the Access Point is a known network.
+ ******************************************************************************/
+bool aaApSelector::offer(const char* ssid, uint8_t length, int8_t rssi, uint8_t channel, const uint8_t* bssid)
+{
+   return offer(ssid, length, hash(ssid, length), rssi, channel, bssid);
+} // aaApSelector::offer()
+
+/**
+ * @brief Rank one scanned Access Point whose SSID hash is already known.
+ * @details Used with an aaScanStore snapshot, which hashes every SSID once 
+ * when the scan reports it.
+ * @param const char* SSID bytes, need not be null terminated.
+ * @param uint8_t Length of the SSID.
+ * @param uint32_t FNV-1a hash of the SSID.
+ * @param int8_t Signal strength in db.
+ * @param uint8_t Primary channel.
+ * @param const uint8_t* BSSID, 6 bytes.
+ * @return bool true if the Access Point is a known network.
+ ******************************************************************************/
+bool aaApSelector::offer(const char* ssid, uint8_t length, uint32_t ssidHash, int8_t rssi, uint8_t channel, const uint8_t* bssid)
+{
+   int16_t known = _find(ssid, length, ssidHash);
+   int16_t points;
+   uint8_t rank;
+   if(known < 0)
+   {
+      return false;
+   } // if
+   points = score(known, rssi);
+   rank = _candidateCount;
+   while(rank > 0 && _candidates[rank - 1].score < points)
+   {
+      rank--;
+   } // while
+   if(rank >= AP_SELECTOR_MAX_CANDIDATES)
+   {
+      return true;
+   } // if
+   if(_candidateCount < AP_SELECTOR_MAX_CANDIDATES)
+   {
+      _candidateCount++;
+   } // if
+   memmove(&_candidates[rank + 1], &_candidates[rank], (_candidateCount - 1 - rank) * sizeof(apCandidate));
+   _candidates[rank].known = known;
+   _candidates[rank].rssi = rssi;
+   _candidates[rank].channel = channel;
+   memcpy(_candidates[rank].bssid, bssid, sizeof(_candidates[rank].bssid));
+   _candidates[rank].score = points;
+   return true;
+} // aaApSelector::offer()
+
+/**
+ * @brief Report how many candidates were ranked since clearCandidates().
+ * @param null.
+ * @return uint8_t Number of candidates, at most AP_SELECTOR_MAX_CANDIDATES.
+ ******************************************************************************/
+uint8_t aaApSelector::candidateCount()
+{
+   return _candidateCount;
+} // aaApSelector::candidateCount()
+
+/**
+ * @brief Return a candidate by rank.
+ * @param uint8_t Rank, 0 is the best.
+ * @return const apCandidate* Candidate, NULL past the last one.
+ ******************************************************************************/
+const apCandidate* aaApSelector::candidate(uint8_t rank)
+{
+   if(rank >= _candidateCount)
+   {
+      return NULL;
+   } // if
+   return &_candidates[rank];
+} // aaApSelector::candidate()
+
+/**
+ * @brief Feed the result of a connection attempt back into the ranking.
+ * @details Connect times are smoothed with a weight of 1/4 so that one slow
+ * attempt does not bury a network.
+ * @param int16_t Known network number.
+ * @param bool true if the attempt got an IP address.
+ * @param uint32_t Time the attempt took in milliseconds, ignored on failure.
+ * @return null.
+ ******************************************************************************/
+void aaApSelector::recordAttempt(int16_t known, bool success, uint32_t connectMs)
+{
+   if(known < 0 || known >= _known)
+   {
+      return;
+   } // if
+   apHistory &history = _history[known];
+   if(history.attempts == UINT16_MAX)
+   {
+      history.attempts /= 2; // Keep the success share, forget the distant past.
+      history.successes /= 2;
+   } // if
+   history.attempts++;
+   if(success)
+   {
+      history.successes++;
+      if(history.connectMs == 0)
+      {
+         history.connectMs = connectMs;
+      } // if
+      else
+      {
+         history.connectMs = (history.connectMs * 3 + connectMs) / 4;
+      } // else
+   } // if
+} // aaApSelector::recordAttempt()
+
+/**
+ * @brief Return a copy of one known network's connection history.
+ * @param int16_t Known network number.
+ * @return apHistory History, all zero for an unknown number.
+ ******************************************************************************/
+apHistory aaApSelector::getHistory(int16_t known)
+{
+   apHistory history = apHistory();
+   if(known >= 0 && known < _known)
+   {
+      history = _history[known];
+   } // if
+   return history;
+} // aaApSelector::getHistory()
+
+/**
+ * @brief Score a known network at a given signal strength.
+ * @param int16_t Known network number.
+ * @param int8_t Signal strength in db.
+ * @return int16_t Score in quarter db, higher is better.
+ ******************************************************************************/
+int16_t aaApSelector::score(int16_t known, int8_t rssi)
+{
+   const apHistory &history = _history[known];
+   int32_t points = (int32_t)rssi * 4;
+   points += _priority[known] * AP_SELECTOR_PRIORITY_DB * 4;
+   // 4 * HISTORY_DB * ((successes + 1) / (attempts + 2) - 1/2)
+   points += (int32_t)AP_SELECTOR_HISTORY_DB * 2 * (2 * (int32_t)history.successes - history.attempts) / (history.attempts + 2);
+   if(history.successes > 0)
+   {
+      points -= (int32_t)min(history.connectMs * 4 / AP_SELECTOR_MS_PER_DB, (uint32_t)AP_SELECTOR_MAX_SLOW_DB * 4);
+   } // if
+   return points;
+} // aaApSelector::score()
+
+/**
+ * @brief FNV-1a hash of an SSID.
+ * @param const char* SSID bytes, need not be null terminated.
+ * @param uint8_t Length of the SSID.
+ * @return uint32_t 32 bit hash.
+ ******************************************************************************/
+uint32_t aaApSelector::hash(const char* ssid, uint8_t length)
+{
+   uint32_t ssidHash = AP_SELECTOR_FNV_OFFSET;
+   for(uint8_t i = 0; i < length; i++)
+   {
+      ssidHash = (ssidHash ^ (uint8_t)ssid[i]) * AP_SELECTOR_FNV_PRIME;
+   } // for
+   return ssidHash;
+} // aaApSelector::hash()
@@ -0,0 +1,118 @@
+/*
+aaApSelector - ranks scanned Access Points against the known network list.
+
+Part of the Aging Apprentice's Arduino API for ESP32 core.
+Github: https://github.com/theAgingApprentice/icUnderware/tree/main/lib/aaEsp32Wroom32v3
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+*/
+
+#ifndef aaApSelector_h // Start precompiler code block.
+   #define aaApSelector_h // Precompiler macro to prevent duplicate inclusions.
+
+/**
+ * Compiler substitution macros.
+ ******************************************************************************/
+#ifndef AP_SELECTOR_MAX_KNOWN // Raise both with build flags for a large known network table.
+   #define AP_SELECTOR_MAX_KNOWN 16 // Most known networks the selector can index, up to 16384.
+#endif
+#ifndef AP_SELECTOR_INDEX_SIZE
+   #define AP_SELECTOR_INDEX_SIZE 32 // Hash index slots. A power of two, at least twice AP_SELECTOR_MAX_KNOWN.
+#endif
+#define AP_SELECTOR_FNV_OFFSET 2166136261u // FNV-1a 32 bit offset basis.
+#define AP_SELECTOR_FNV_PRIME 16777619u // FNV-1a 32 bit prime.
+#define AP_SELECTOR_MAX_CANDIDATES 4 // Best candidates kept from one scan.
+#define AP_SELECTOR_PRIORITY_DB 6 // Signal strength (db) that one level of configured priority is worth.
+#define AP_SELECTOR_HISTORY_DB 10 // Spread (db) between a network that always connects and one that never does.
+#define AP_SELECTOR_MS_PER_DB 250 // Average connect time (ms) that costs one db.
+#define AP_SELECTOR_MAX_SLOW_DB 10 // Cap on the connect time penalty (db).
+
+/**
+ * Included libraries.
+ ******************************************************************************/
+#include <Arduino.h> // Arduino Core for ESP32. Comes with Platform.io.
+
+/**
+ * Global variables.
+ ******************************************************************************/
+struct apCandidate ///< A scanned Access Point that is on the known network list.
+{
+   int16_t known; ///< Index into the known network list.
+   int8_t rssi; ///< Signal strength in db.
+   uint8_t channel; ///< Primary channel.
+   uint8_t bssid[6]; ///< BSSID of the Access Point.
+   int16_t score; ///< Ranking score in quarter db, higher is better.
+}; //struct
+
+struct apHistory ///< Connection history of one known network.
+{
+   uint16_t attempts; ///< Connection attempts made.
+   uint16_t successes; ///< Attempts that got an IP address.
+   uint32_t connectMs; ///< EWMA of the time successful attempts took, 0 until the first one.
+}; //struct
+
+/**
+ * @brief FNV-1a hash of an SSID, usable in constant expressions.
+ * @details Gives the same value as aaApSelector::hash(), so hashes of the 
+ * known network table can be worked out by the compiler.
+ * @param const char* SSID bytes.
+ * @param uint8_t Length of the SSID.
+ * @param uint32_t Hash of the bytes before ssid.
+ * @return uint32_t 32 bit hash.
+ ******************************************************************************/
+constexpr uint32_t apSsidHash(const char* ssid, uint8_t length, uint32_t ssidHash = AP_SELECTOR_FNV_OFFSET)
+{
+   return length == 0 ? ssidHash : apSsidHash(ssid + 1, length - 1, (ssidHash ^ (uint8_t)*ssid) * AP_SELECTOR_FNV_PRIME);
+} // apSsidHash()
+
+/**
+ * The aaApSelector class picks which Access Point to connect to.
+ *
+ * Known networks are added once, by SSID, into an open addressing hash index
+ * so that each scanned Access Point costs one FNV-1a hash and usually one
+ * memcmp() instead of a string compare against every known network.
+ * Scanned Access Points are offered one at a time with raw SSID bytes, so
+ * nothing is allocated on the heap, and only the AP_SELECTOR_MAX_CANDIDATES
+ * best known ones are kept, in rank order.
+ *
+ * The score, in quarter db, starts from the RSSI and adds:
+ * - AP_SELECTOR_PRIORITY_DB per level of configured priority,
+ * - up to +/- AP_SELECTOR_HISTORY_DB / 2 for the share of past attempts on
+ *   the network that got an IP address (Laplace smoothed, so a network
+ *   never tried scores 0), and
+ * - minus one db per AP_SELECTOR_MS_PER_DB of average connect time, capped
+ *   at AP_SELECTOR_MAX_SLOW_DB.
+ *
+ * The class only depends on Arduino.h so it also runs in the host tests.
+ ******************************************************************************/
+class aaApSelector
+{
+   public:
+      aaApSelector(); // Class constructor.
+      ~aaApSelector(); // Class destructor.
+      bool addKnown(const char*, uint8_t priority = 0); // Add a known network to the index.
+      bool addKnown(const char*, uint8_t, uint32_t, uint8_t); // Add a known network with a precomputed hash.
+      uint16_t knownCount(); // Number of known networks in the index.
+      int16_t findKnown(const char*, uint8_t); // Hashed lookup of an SSID, -1 if unknown.
+      void clearCandidates(); // Forget the candidates of the previous scan.
+      bool offer(const char*, uint8_t, int8_t, uint8_t, const uint8_t*); // Rank one scanned Access Point.
+      bool offer(const char*, uint8_t, uint32_t, int8_t, uint8_t, const uint8_t*); // Rank one with a precomputed hash.
+      uint8_t candidateCount(); // Number of candidates ranked since clearCandidates().
+      const apCandidate* candidate(uint8_t); // Candidate by rank, 0 is the best.
+      void recordAttempt(int16_t, bool, uint32_t); // Feed the result of a connection attempt back.
+      apHistory getHistory(int16_t); // Copy of one known network's connection history.
+      int16_t score(int16_t, int8_t); // Score of a known network at a signal strength.
+      static uint32_t hash(const char*, uint8_t); // FNV-1a hash of an SSID.
+   private:
+      int16_t _find(const char*, uint8_t, uint32_t); // Probe the index with a known hash.
+      const char* _ssid[AP_SELECTOR_MAX_KNOWN]; // SSIDs of the known networks, not copied.
+      uint8_t _ssidLen[AP_SELECTOR_MAX_KNOWN]; // Length of each known SSID.
+      uint32_t _hash[AP_SELECTOR_MAX_KNOWN]; // Hash of each known SSID.
+      uint8_t _priority[AP_SELECTOR_MAX_KNOWN]; // Configured priority of each known network.
+      apHistory _history[AP_SELECTOR_MAX_KNOWN]; // Connection history of each known network.
+      uint16_t _known = 0; // Number of known networks in the index.
+      int16_t _index[AP_SELECTOR_INDEX_SIZE]; // Hash slots holding known network numbers, -1 when empty.
+      apCandidate _candidates[AP_SELECTOR_MAX_CANDIDATES]; // Best candidates, in rank order.
+      uint8_t _candidateCount = 0; // Number of candidates in use.
+}; //class aaApSelector
+
+#endif // End of precompiler protected code block
@@ -1,5 +1,29 @@
 #include <aaEsp32Wroom32v3.h> // Header file for linking.
 
+aaEsp32Wroom32v3* aaEsp32Wroom32v3::_wifiOwner = NULL; // Set by connectWifi() or startScan().
+
+/**
+ * @brief Allocation free access to the scan results held by the WiFi core.
+ * @details WiFi.SSID(i) and friends build a String on every call. The core 
+ * keeps the raw wifi_ap_record_t array but only exposes it to subclasses.
+ ******************************************************************************/
+class scanRecords : public WiFiScanClass
+{
+   public:
+      static uint16_t count() // Number of records held.
+      {
+         return _scanCount;
+      } // scanRecords::count()
+      static const wifi_ap_record_t* get(int16_t i) // Scan record i, NULL when out of range.
+      {
+         return (const wifi_ap_record_t*)_getScanInfoByIndex(i);
+      } // scanRecords::get()
+}; //class scanRecords
+
+RTC_DATA_ATTR static wifiFastCache rtcWifiCache; // Survives deep sleep, NVS covers power loss.
+RTC_NOINIT_ATTR static uint32_t rtcClockToken; // Drawn once per run of the RTC clock behind time(). Kept over resets and deep sleep.
+RTC_NOINIT_ATTR static uint32_t rtcClockCheck; // ~rtcClockToken while it is valid, anything else after a power on.
+
 /**
  * @fn aaEsp32Wroom32v3::aaEsp32Wroom32v3()
  * @brief This is the first constructor form for this class.
@@ -149,9 +173,14 @@ void aaEsp32Wroom32v3::logSubsystemDetails()
    char _buffer[_BUFFER_SIZE]; // Buffer to hold formatted uint32_t numbers. 
    const int8_t _DETAIL_SIZE = 80; // Size of buffer holding details about memory.
    char _details[_DETAIL_SIZE]; // Text version of flash memory mode.
-   wifi_auth_mode_t encryption = WiFi.encryptionType(_SSIDIndex);
-   int8_t _dataReadings = 10; // Number of data readings to average to determine Wifi signal strength.
-   long _signalStrength = rfSignalStrength(_dataReadings); // Get average signal strength reading.
+   wifi_auth_mode_t encryption = WIFI_AUTH_OPEN; // Found below from the scan snapshot or the driver.
+   wifi_ap_record_t _apInfo; // Access Point in use, when it is not in the scan snapshot.
+   const scanEntry* _heard = _scanStore.get(_scanStore.find(WiFi.BSSID())); // Last scan's reading of the Access Point in use.
+   rssiStats _signal = getRssiStats(); // Signal strength sampled in the background.
+   wifiEventStats _events = getWifiEventStats(); // WiFi event queue health.
+   wifiStatus _link = getWifiStatus(); // Timing of the last connect.
+   wifiBootTiming _bootTiming = getBootTiming(); // Connection phase times of this boot.
+   wifiPhaseHistory _history = getPhaseHistory(); // Connection phase times across boots.
    char _bluetoothAddress[30]; // Hold Bluetooth address in a character array.
    Log.noticeln("<aaEsp32Wroom32v3::logSubsystemDetails> Core subsystem details.");
    // Core CPU
@@ -179,9 +208,27 @@ void aaEsp32Wroom32v3::logSubsystemDetails()
    // Wireless 
    _btAddress(_bluetoothAddress); // Copy formatted Bluetooth address into the character array.
    Log.noticeln("<aaEsp32Wroom32v3::logSubsystemDetails> ... WiFi details."); 
+   Log.noticeln("<aaEsp32Wroom32v3::logSubsystemDetails> ...... Connection manager state = %s.", wifiStateName(getWifiState())); 
+   Log.noticeln("<aaEsp32Wroom32v3::logSubsystemDetails> ...... Power profile = %s.", powerProfileName(getPowerProfile()));
+   Log.noticeln("<aaEsp32Wroom32v3::logSubsystemDetails> ...... Connection phases this boot (%d attempts) and across %u boots.", _bootTiming.attempts, _history.boots);
+   for(uint8_t i = 0; i < wifiPhases; i++)
+   {
+      Log.noticeln("<aaEsp32Wroom32v3::logSubsystemDetails> ......... %s = %D ms, average %D ms, min %D ms, max %D ms.", wifiPhaseName((wifiPhase)i), _bootTiming.phaseUs[i] / 1000.0, _history.phase[i].avgUs / 1000.0, _history.phase[i].minUs / 1000.0, _history.phase[i].maxUs / 1000.0);
+   } // for
+   Log.noticeln("<aaEsp32Wroom32v3::logSubsystemDetails> ...... IP address %u ms after association (%s), %u ms saved.", _link.dhcpMs, _link.cachedLease ? "cached lease" : "DHCP", _link.dhcpSavedMs);
+   Log.noticeln("<aaEsp32Wroom32v3::logSubsystemDetails> ...... Event queue depth = %d (max %d), dispatch latency %D us (max %u us), %u dropped.", _events.depth, _events.maxDepth, _events.avgLatencyUs, _events.maxLatencyUs, _events.dropped);
    Log.noticeln("<aaEsp32Wroom32v3::logSubsystemDetails> ...... Access Point Name = %s.",WiFi.SSID().c_str()); 
-   Log.noticeln("<aaEsp32Wroom32v3::logSubsystemDetails> ...... Access Point Encryption method = %X (%s).", encryption, _translateEncryptionType(WiFi.encryptionType(encryption)));
-   Log.noticeln("<aaEsp32Wroom32v3::logSubsystemDetails> ...... Wifi signal strength = %l (%s).", _signalStrength, evalSignal(_signalStrength));
+   if(_heard != NULL)
+   {
+      encryption = (wifi_auth_mode_t)_heard->auth;
+   } // if
+   else if(esp_wifi_sta_get_ap_info(&_apInfo) == ESP_OK)
+   {
+      encryption = _apInfo.authmode;
+   } // else if
+   Log.noticeln("<aaEsp32Wroom32v3::logSubsystemDetails> ...... Access Point Encryption method = %X (%s).", encryption, _translateEncryptionType(encryption));
+   Log.noticeln("<aaEsp32Wroom32v3::logSubsystemDetails> ...... Last scan found %d Access Points, %u ms ago.", _scanStore.count(), _scanStore.ageMs(millis()));
+   Log.noticeln("<aaEsp32Wroom32v3::logSubsystemDetails> ...... Wifi signal strength = %l (%s), min %d, max %d over %u samples.", rfSignalStrength(), evalSignal(), _signal.min, _signal.max, _signal.samples);
    Log.noticeln("<aaEsp32Wroom32v3::logSubsystemDetails> ...... Local Wifi MAC address: %s.", WiFi.macAddress().c_str());
    Log.noticeln(F("<aaEsp32Wroom32v3::logSubsystemDetails> ...... Local WiFi IP address: %p."), WiFi.localIP()); 
    Log.noticeln("<aaEsp32Wroom32v3::logSubsystemDetails> ... Bluetooth details."); 
@@ -349,207 +396,2414 @@ const char* aaEsp32Wroom32v3::_connectionStatus(wl_status_t status)
  ******************************************************************************/
 bool aaEsp32Wroom32v3::configure()
 {
-   connectWifi(); // Establish WiFi connection.
+   connectWifi(); // Start the WiFi connection manager. Does not wait for the connection.
    _initBluetooth(); // Initialize Bluetooth radio.
    return true;
 } // aaEsp32Wroom32v3::configure()
 
 /**
- * @brief Connect to Wifi.
+ * @brief Start the non-blocking WiFi connection manager.
+ * @details Returns straight away. A low priority FreeRTOS task walks the 
+ * connection through explicit states, so setup() and loop() keep running 
+ * while WiFi is down:
+ * 
+ * 1. wifiScan - asynchronous scan of the channels known networks were last 
+ * seen on, or of the whole 2.4GHz band if there are none or none of them is 
+ * found there.
+ * 2. wifiSelect - best ranked known Access Point picked from the results.
+ * 3. wifiAssociate - WiFi.begin() until SYSTEM_EVENT_STA_CONNECTED.
+ * 4. wifiDhcp - waiting for SYSTEM_EVENT_STA_GOT_IP.
+ * 5. wifiConnected - until SYSTEM_EVENT_STA_DISCONNECTED.
+ * 
+ * A scan, association or DHCP timeout, a disconnect before an IP address 
+ * arrives, or no known Access Point in range counts as a failed attempt and 
+ * puts the manager in wifiBackoff. The wait doubles from WIFI_BACKOFF_MIN_MS 
+ * with every consecutive failure up to WIFI_BACKOFF_MAX_MS. Only the lower 
+ * half of it is fixed, the upper half is random, so robots rebooted by the 
+ * same power cut do not all hit the Access Point in step. Losing an 
+ * established connection goes straight back to wifiAssociate with the same 
+ * Access Point and only falls back to a scan if that fails.
+ * 
+ * Each successful connection stores the BSSID, channel and known network 
+ * index of the Access Point in RTC memory and NVS. When that cache is valid, 
+ * the first attempt after boot, and after a lost connection, skips the scan 
+ * and goes straight to wifiAssociate pinned to the cached channel and BSSID. 
+ * If that does not get an IP address within WIFI_FAST_CONNECT_TIMEOUT_MS the 
+ * manager falls back to a scan without backing off. The time saved against 
+ * the last scan based connect is logged and kept in wifiStatus.
+ * 
+ * The lease DHCP grants is cached per network in NVS. While it is certainly 
+ * still valid it is applied as a static address before association, which 
+ * skips the DHCP exchange, see setDhcpCache().
+ * 
+ * The power profile, see setPowerProfile(), is written into the station 
+ * configuration on every association, between WiFi.begin() and the 
+ * connect, see _wifiJoin(). Its sleep mode is applied again on every 
+ * SYSTEM_EVENT_STA_START, because the core resets it there.
+ * 
+ * While connected the manager roams, see _roamStep(). When the smoothed RSSI 
+ * drops to notGood it scans in the background for a known Access Point at 
+ * least WIFI_ROAM_MIN_GAIN_DB stronger and moves to it in wifiRoam. If the 
+ * move fails it goes back to the previous Access Point through the fast 
+ * reconnect cache.
+ * 
+ * Until the first IP address of the boot, the time spent in each phase 
+ * (scan, authentication and association, DHCP and backoff) is added up from 
+ * the timestamps of the WiFi events that end them, see getBootTiming(). The 
+ * result is folded into statistics across boots kept in NVS, see 
+ * getPhaseHistory().
+ * 
+ * WiFi events reach the manager as task notifications from 
+ * _wifiCoreEvent(), so every transition happens on the manager task. The 
+ * Arduino core's own reconnect is turned off so that it does not fight the 
+ * manager, and so is its copy of the station config in flash, which is 
+ * rewritten on every WiFi.begin().
  * @param null.
- * @return null.
+ * @return bool true if the manager is running.
  ******************************************************************************/
-void aaEsp32Wroom32v3::connectWifi()
+bool aaEsp32Wroom32v3::connectWifi()
 {
-   if(_lookForAP() == _unknownAP) // Scan the 2.4Ghz band for known Access Points and select the one with the strongest signal 
+   Preferences nvs;
+   wifiPhaseHistory history;
+   if(_wifiTask != NULL)
    {
-      Log.verboseln("<aaEsp32Wroom32v3::connect> No known Access Point SSID was detected. Cannot connect to WiFi at this time.");
+      return true;
    } // if
-   else // Found a known Access Point to connect to
+   if(!_wifiEventsStart())
    {
-      WiFi.onEvent(_wiFiEvent); // Set up WiFi event handler
-      WiFi.begin(_ssid, _password); // Connect too strongest AP found
-      Log.verboseln("<aaEsp32Wroom32v3::connect> Attempting to connect to Access Point with the SSID %s." , _ssid);
-      while(WiFi.waitForConnectResult() != WL_CONNECTED) // Hold boot process here until IP assigned
+      return false;
+   } // if
+   if(_apSelector.knownCount() == 0) // Index the known networks once.
+   {
+      for(uint16_t j = 0; j < _networkCount; j++)
       {
-         delay(500);
-      } //while
-      Log.verboseln("<aaEsp32Wroom32v3::connect> Connected to Access Point with the SSID %s with status code %u (%s).", _ssid, WiFi.status(), _connectionStatus(WiFi.status()));
-   } //else
-} // aaEsp32Wroom32v3::connect()
+         const knownNetwork &network = _networks[j];
+         if(!_apSelector.addKnown(network.ssid, network.ssidLen, network.ssidHash, network.priority))
+         {
+            Log.errorln("<aaEsp32Wroom32v3::connectWifi> Known network %s is a duplicate or beyond AP_SELECTOR_MAX_KNOWN.", network.ssid);
+         } // if
+      } // for
+   } // if
+   WiFi.persistent(false); // The fast reconnect cache replaces the core's copy.
+   WiFi.mode(WIFI_STA);
+   WiFi.setAutoReconnect(false); // The manager decides when to reconnect.
+   memset(&history, 0, sizeof(wifiPhaseHistory)); // getBytes() leaves it alone if the key is missing.
+   nvs.begin(WIFI_PHASE_NAMESPACE, true);
+   nvs.getBytes("phases", &history, sizeof(wifiPhaseHistory));
+   nvs.end();
+   if(history.magic != WIFI_PHASE_MAGIC)
+   {
+      memset(&history, 0, sizeof(wifiPhaseHistory));
+   } // if
+   portENTER_CRITICAL(&_wifiMux);
+   _wifi = wifiStatus();
+   if(!_boot.complete)
+   {
+      _boot = wifiBootTiming();
+      _boot.startUs = micros();
+      _phaseStartUs = _boot.startUs;
+   } // if
+   _phases = history;
+   portEXIT_CRITICAL(&_wifiMux);
+   if(xTaskCreatePinnedToCore(_wifiManagerTask, "wifiManager", WIFI_MANAGER_STACK_SIZE, this, 1, &_wifiTask, 1) != pdPASS)
+   {
+      _wifiTask = NULL;
+      Log.errorln("<aaEsp32Wroom32v3::connectWifi> Unable to create WiFi manager task.");
+      return false;
+   } // if
+   Log.verboseln("<aaEsp32Wroom32v3::connectWifi> WiFi manager started.");
+   return true;
+} // aaEsp32Wroom32v3::connectWifi()
 
 /**
- * @brief Collect an average WiFi signal strength. 
- * @param int8_t Number of datapoints to use to create average. 
- * @return long Average signal strength of AP connection in decibels (db).
+ * @brief Stop the WiFi connection manager and drop the connection.
+ * @details The manager task is sent WIFI_EVENT_STOP rather than deleted, so 
+ * it never dies part way through a step holding _wifiMux. It finishes the 
+ * step it is on, drops the connection and deletes itself. This waits for 
+ * that, which takes at most one step.
+ * @param null.
+ * @return null.
  ******************************************************************************/
-long aaEsp32Wroom32v3::rfSignalStrength(int8_t dataPoints)
+void aaEsp32Wroom32v3::disconnectWifi()
 {
-   long rssi = 0;
-   long averageRSSI = 0;
-   for(int i=0; i < dataPoints; i++)
+   if(_wifiTask == NULL)
    {
-      rssi += WiFi.RSSI();
-      delay(20);
-   } //for
-   averageRSSI = rssi / dataPoints;
-   return averageRSSI;
-} // aaEsp32Wroom32v3::rfSignalStrength()
+      return;
+   } // if
+   xTaskNotify(_wifiTask, WIFI_EVENT_STOP, eSetBits);
+   while(_wifiTask != NULL)
+   {
+      vTaskDelay(pdMS_TO_TICKS(10));
+   } // while
+   Log.verboseln("<aaEsp32Wroom32v3::disconnectWifi> WiFi manager stopped.");
+} // aaEsp32Wroom32v3::disconnectWifi()
 
 /**
- * @brief Return human readable assessment of signal strength.
- * @param int16_t Signal strength as measured in decibels (db). 
- * @return const char* Assessment of signal quality in one or two words.
+ * @brief Report the state of the WiFi connection manager.
+ * @details Never blocks.
+ * @param null.
+ * @return wifiState current state, wifiIdle when the manager is not running.
  ******************************************************************************/
-const char* aaEsp32Wroom32v3::evalSignal(int16_t signalStrength)
+wifiState aaEsp32Wroom32v3::getWifiState()
 {
-   if(signalStrength <= unusable) return "Unusable";
-   if(signalStrength <= notGood) return "Not good";
-   if(signalStrength <= okay) return "Okay";
-   if(signalStrength <= veryGood) return "Very Good";
-   return "Amazing";
-} // aaEsp32Wroom32v3::evalSignal()
+   return _wifi.state;
+} // aaEsp32Wroom32v3::getWifiState()
 
 /**
- * @fn bool aaEsp32Wroom32v3::pingIP(IPAddress address)
- * @brief Ping IP address once and return the response.
- * @param IPAddress Address to ping. 
- * @return bool Result of ping. 
+ * @brief Return a copy of the WiFi connection manager state and timestamps.
+ * @param null.
+ * @return wifiStatus Snapshot of the connection manager.
  ******************************************************************************/
-bool aaEsp32Wroom32v3::pingIP(IPAddress address)
+wifiStatus aaEsp32Wroom32v3::getWifiStatus()
 {
-   int8_t numPings = 1; // How many pings to send to verify IP address
-   IPAddress tmpIp; 
-   return Ping.ping(address, numPings);
-} // aaEsp32Wroom32v3::pingIP()
+   wifiStatus snapshot;
+   portENTER_CRITICAL(&_wifiMux);
+   snapshot = _wifi;
+   portEXIT_CRITICAL(&_wifiMux);
+   return snapshot;
+} // aaEsp32Wroom32v3::getWifiStatus()
 
 /**
- * @overload bool aaEsp32Wroom32v3::pingIP(IPAddress address, int8_t numPings)
- * @brief Ping IP address usert specified number of times and return response.
- * @param IPAddress Address to ping. 
- * @param int8_t Number of times to ping address. 
- * @return bool Result of pings. 
+ * @brief Provide human readable text for WiFi connection manager states.
+ * @param wifiState state to name.
+ * @return const char* Name of the state.
  ******************************************************************************/
-bool aaEsp32Wroom32v3::pingIP(IPAddress address, int8_t numPings)
+const char* aaEsp32Wroom32v3::wifiStateName(wifiState state)
 {
-   IPAddress tmpIp; 
-   return Ping.ping(address, numPings);
-} // aaEsp32Wroom32v3::pingIP()
+   switch(state)
+   {
+      case wifiIdle: return "idle";
+      case wifiScan: return "scan";
+      case wifiSelect: return "select";
+      case wifiAssociate: return "associate";
+      case wifiDhcp: return "DHCP";
+      case wifiConnected: return "connected";
+      case wifiBackoff: return "backoff";
+      case wifiRoam: return "roam";
+      default: return "unknown";
+   } //switch
+} // aaEsp32Wroom32v3::wifiStateName()
 
 /**
- * @brief Scan 2.4GHz radio spectrum for known Access Point.
- * @param null.
- * @return const char* Service Set IDentifier (SSID). 
+ * @brief FreeRTOS task body of the WiFi connection manager.
+ * @details Sleeps until a WiFi event arrives or WIFI_MANAGER_TICK_MS has 
+ * passed, then advances the state machine. On WIFI_EVENT_STOP it drops the 
+ * connection, clears _wifiTask and deletes itself.
+ * @param void* Pointer to the owning aaEsp32Wroom32v3 object.
+ * @return null.
  ******************************************************************************/
-const char* aaEsp32Wroom32v3::_lookForAP()
+void aaEsp32Wroom32v3::_wifiManagerTask(void* param)
 {
-   _ssid = _unknownAP; //  At the start no known Access Point has been foundto connect to
-   int numberOfNetworks = WiFi.scanNetworks(); // Used to track how many APs are detected by the scan
-   int StrongestSignal = -127; // Used to find the strongest signal. Set as low as possible to start
-   bool APknown; // Flag to indicate if the current AP appears in the known AP list
-   Log.verboseln("<aaEsp32Wroom32v3::_lookForAP> Scanning the 2.4GHz radio spectrum for one of the %d known Access Points.", numberOfNetworks);
-
-   // Loop through all detected APs
-   for(int i = 0; i < numberOfNetworks; i++)
+   aaEsp32Wroom32v3* self = (aaEsp32Wroom32v3*)param;
+   uint32_t events = 0;
+   self->_wifiAttemptMs = millis();
+   self->_wifiFast = self->_wifiLoadCache();
+   self->_wifiEnter(self->_wifiFast ? wifiAssociate : wifiScan);
+   while(!(events & WIFI_EVENT_STOP))
    {
-      APknown = false;
-   
-      // Scan table of known APs to see if the current AP is known to us
-      for (int j = 0; j < numKnownAPs; j++)
+      if(xTaskNotifyWait(0, ULONG_MAX, &events, pdMS_TO_TICKS(WIFI_MANAGER_TICK_MS)) != pdTRUE)
       {
-         // If the current scanned AP appears in the known AP list note the index value and flag found
-         if(WiFi.SSID(i) == SSID[j])
-         {
-            APknown = true;
-            _SSIDIndex = j;
-         } //if
-      }   //for
-
-      // If the current AP is known and has a stronger signal than the others that have been checked
-      // then store it in the variables that will be used to connect to the AP later
-      if((APknown == true) && (WiFi.SSID(i).toInt() > StrongestSignal))
-      {
-         _ssid = SSID[_SSIDIndex].c_str();
-         _password = Password[_SSIDIndex].c_str();
-         StrongestSignal = WiFi.SSID(i).toInt();
-      } //if
-   } //for
-   return _ssid;
-} // aaEsp32Wroom32v3::_lookForAP()
+         events = 0;
+      } // if
+      if(!(events & WIFI_EVENT_STOP))
+      {
+         self->_wifiStep(events);
+      } // if
+   } // while
+   self->stopScan();
+   WiFi.disconnect();
+   self->_wifiEnter(wifiIdle);
+   portENTER_CRITICAL(&self->_wifiMux);
+   self->_wifiTask = NULL; // _wifiCoreEvent() checks this under the lock before notifying.
+   portEXIT_CRITICAL(&self->_wifiMux);
+   vTaskDelete(NULL);
+} // aaEsp32Wroom32v3::_wifiManagerTask()
 
 /**
- * @brief Provide human readable Wifi encryption method.
- * @details Wifi encryptions options are:
- * 1. OPEN
- * 2. WEP
- * 3. WPA_PSK
- * 4. WPA2_PSK
- * 5. WPA_WPA2_PSK
- * 6. WPA2_ENTERPRISE
- * @param wifi_auth_mode_t Wifi encryption type code.
- * @return const char* Encryption type in one word. 
+ * @brief Advance the WiFi connection manager.
+ * @details Events are handled before timeouts. Only the manager task 
+ * changes state, so the state can be read here without the lock.
+ * @param uint32_t WIFI_EVENT_* bits received since the last step.
+ * @return null.
  ******************************************************************************/
-const char* aaEsp32Wroom32v3::_translateEncryptionType(wifi_auth_mode_t encryptionType)
+void aaEsp32Wroom32v3::_wifiStep(uint32_t events)
 {
-   switch (encryptionType)
+   wifiState state = _wifi.state;
+   unsigned long inState = millis() - _wifi.stateSinceMs;
+   if((events & WIFI_EVENT_DISCONNECTED) && state == wifiRoam && _wifiReason == WIFI_REASON_ASSOC_LEAVE)
    {
-      case (WIFI_AUTH_OPEN): return "Open";
-      case (WIFI_AUTH_WEP): return "WEP";
-      case (WIFI_AUTH_WPA_PSK): return "WPA_PSK";
-      case (WIFI_AUTH_WPA2_PSK): return "WPA2_PSK";
-      case (WIFI_AUTH_WPA_WPA2_PSK): return "WPA_WPA2_PSK";
-      case (WIFI_AUTH_WPA2_ENTERPRISE): return "WPA2_ENTERPRISE";
-      default: return "UNKNOWN";
-   } //switch
-} // aaEsp32Wroom32v3::_translateEncryptionType()
-
-/**
- * @brief Event handler for wifi.
- * @details Tracks all wifi event activity even though we do not act on any of 
- * it at this time. At the very least the logs help us trouble shoot wifi issues 
- * but this routine also acts as a reminder of what functional possibilities 
- * exist for future consideration.
- * @param WiFiEvent_t Type of event that triggered this handler.
- * @param WiFiEventInfo_t Additional information about the triggering event.
- ******************************************************************************/
-void aaEsp32Wroom32v3::_wiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info)
-{
-   switch(event) 
+      events &= ~WIFI_EVENT_DISCONNECTED; // Leaving the old Access Point is part of the move.
+   } // if
+   if((events & WIFI_EVENT_DISCONNECTED) && (state == wifiAssociate || state == wifiDhcp || state == wifiConnected || state == wifiRoam))
    {
-      case SYSTEM_EVENT_AP_START:
-//         WiFi.softAP(AP_SSID, AP_PASS); //can set ap hostname here   
-//         WiFi.softAPenableIpV6(); //enable ap ipv6 here
-         Log.verboseln("<aaEsp32Wroom32v3::WiFiEvent> Detected SYSTEM_EVENT_AP_START");            
+      portENTER_CRITICAL(&_wifiMux);
+      _wifi.disconnectedAtMs = millis();
+      _wifi.lastReason = _wifiReason;
+      if(state == wifiConnected)
+      {
+         _wifi.disconnects++;
+      } // if
+      portEXIT_CRITICAL(&_wifiMux);
+      if(state == wifiConnected)
+      {
+         Log.warningln("<aaEsp32Wroom32v3::_wifiStep> Lost connection to %s (reason %d). Reconnecting.", _ssid, _wifiReason);
+         _wifiAttemptMs = millis();
+         _wifiFast = (_wifiCache.magic == WIFI_CACHE_MAGIC);
+         _wifiEnter(_wifiFast ? wifiAssociate : wifiScan);
+      } // if
+      else
+      {
+         _wifiFail("disconnected");
+      } // else
+      return;
+   } // if
+   if((events & WIFI_EVENT_GOT_IP) && (state == wifiAssociate || state == wifiDhcp || state == wifiRoam))
+   {
+      _wifiConnected();
+      return;
+   } // if
+   if((events & WIFI_EVENT_CONNECTED) && (state == wifiAssociate || state == wifiRoam))
+   {
+      _wifiEnter(wifiDhcp);
+      return;
+   } // if
+   if((events & WIFI_EVENT_LOST_IP) && state == wifiConnected)
+   {
+      _wifiEnter(wifiDhcp);
+      return;
+   } // if
+   switch(state)
+   {
+      case wifiScan:
+         if(isScanning() && inState < WIFI_SCAN_TIMEOUT_MS)
+         {
+            break;
+         } // if
+         if(isScanning())
+         {
+            stopScan();
+            _wifiFail("scan timed out");
+            break;
+         } // if
+         _wifiEnter(wifiSelect);
+         if(_lookForAP() != _unknownAP)
+         {
+            _wifiEnter(wifiAssociate);
+         } // if
+         else if(_scanConfig.channels != 0)
+         {
+            Log.verboseln("<aaEsp32Wroom32v3::_wifiStep> No known Access Point on the usual channels. Scanning them all.");
+            _wifiFullScan = true;
+            _wifiEnter(wifiScan);
+         } // else if
+         else
+         {
+            _wifiFail("no known Access Point in range");
+         } // else
          break;
-      case SYSTEM_EVENT_STA_START:         
-//         WiFi.setHostname(AP_SSID); //set sta hostname here
-         Log.verboseln("<aaEsp32Wroom32v3::WiFiEvent> Detected SYSTEM_EVENT_STA_START");            
+      case wifiAssociate:
+         if(inState >= (_wifiFast ? WIFI_FAST_CONNECT_TIMEOUT_MS : WIFI_ASSOCIATE_TIMEOUT_MS))
+         {
+            _wifiFail("association timed out");
+         } // if
          break;
-      case SYSTEM_EVENT_STA_CONNECTED:         
-//         WiFi.enableIpV6(); //enable sta ipv6 here
-         Log.verboseln("<aaEsp32Wroom32v3::WiFiEvent> Detected SYSTEM_EVENT_STA_CONNECTED");            
+      case wifiDhcp:
+         if(inState >= WIFI_DHCP_TIMEOUT_MS || (_wifiFast && millis() - _wifiAttemptMs >= WIFI_FAST_CONNECT_TIMEOUT_MS))
+         {
+            _wifiFail("no IP address");
+         } // if
          break;
-      case SYSTEM_EVENT_AP_STA_GOT_IP6:
-         Log.verboseln("<aaEsp32Wroom32v3::WiFiEvent> Detected SYSTEM_EVENT_AP_STA_GOT_IP6");            
+      case wifiConnected:
+         _rssiSample();
+         _dhcpStep();
+         _roamStep();
          break;
-      case SYSTEM_EVENT_STA_GOT_IP:
-//         wifiOnConnect(); // Call function to do things dependant upon getting wifi connected
-         Log.verboseln("<aaEsp32Wroom32v3::WiFiEvent> Detected SYSTEM_EVENT_STA_GOT_IP");            
+      case wifiRoam:
+         if(inState >= WIFI_ROAM_TIMEOUT_MS)
+         {
+            _wifiFail("roam timed out");
+         } // if
          break;
-      case SYSTEM_EVENT_STA_DISCONNECTED:
-         Log.verboseln("<aaEsp32Wroom32v3::WiFiEvent> Detected SYSTEM_EVENT_STA_DISCONNECTED");            
+      case wifiBackoff:
+         if((long)(millis() - _wifi.nextAttemptMs) >= 0)
+         {
+            _wifiAttemptMs = millis();
+            _wifiEnter(wifiScan);
+         } // if
+         break;
+      default:
          break;
-      case WL_NO_SSID_AVAIL:
-         Log.verboseln("<aaEsp32Wroom32v3::WiFiEvent> WL_NO_SSID_AVAIL");            
+   } //switch
+} // aaEsp32Wroom32v3::_wifiStep()
+
+/**
+ * @brief Change the state of the WiFi connection manager.
+ * @details Stamps the time of the change and performs the entry action of 
+ * the new state: wifiScan starts an asynchronous scan, wifiAssociate starts 
+ * connecting to the selected Access Point and wifiRoam starts moving to it. 
+ * Leaving wifiConnected abandons a background scan of the roaming manager. 
+ * Until the first connection of the boot the time spent in the state being 
+ * left is added to its phase.
+ * @param wifiState state to enter.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_wifiEnter(wifiState state)
+{
+   unsigned long now = millis();
+   uint32_t nowUs = micros();
+   bool firstConnect = false; // First IP address of the boot.
+   wifiScanConfig scan = {0, false, false, WIFI_SCAN_DWELL_MIN_MS, WIFI_SCAN_DWELL_MAX_MS};
+   portENTER_CRITICAL(&_wifiMux);
+   if(!_boot.complete && _wifiTask != NULL)
+   {
+      _phaseClose(_wifi.state, state, nowUs);
+      firstConnect = _boot.complete;
+   } // if
+   _phaseStartUs = nowUs;
+   _wifi.state = state;
+   _wifi.stateSinceMs = now;
+   if(state == wifiConnected)
+   {
+      _wifi.connectedSinceMs = now;
+      _wifi.failures = 0;
+      _wifi.connects++;
+   } // if
+   portEXIT_CRITICAL(&_wifiMux);
+   if(firstConnect)
+   {
+      _phaseRecord();
+   } // if
+   if(_roamScan && state != wifiConnected)
+   {
+      stopScan();
+      _roamScan = false;
+   } // if
+   Log.verboseln("<aaEsp32Wroom32v3::_wifiEnter> WiFi manager state %s.", wifiStateName(state));
+   switch(state)
+   {
+      case wifiScan:
+         _wifiScanMs = now;
+         if(!_wifiFullScan && _knownChannels != 0)
+         {
+            scan.channels = _knownChannels;
+            scan.minDwellMs = 0;
+            scan.maxDwellMs = WIFI_KNOWN_SCAN_DWELL_MS;
+         } // if
+         _wifiFullScan = false;
+         if(!startScan(scan)) // Results are collected by _wifiStep().
+         {
+            _wifiFail("scan not started");
+         } // if
+         break;
+      case wifiAssociate:
+         _wifiAssociateMs = now;
+         if(_boot.attempts < UINT8_MAX)
+         {
+            _boot.attempts++;
+         } // if
+         if(_wifiFast)
+         {
+            _SSIDIndex = _wifiCache.index;
+            _ssid = _networks[_SSIDIndex].ssid;
+            _password = _networks[_SSIDIndex].password;
+            Log.verboseln("<aaEsp32Wroom32v3::_wifiEnter> Attempting fast reconnect to %s on channel %d.", _ssid, _wifiCache.channel);
+            _dhcpApplyLease();
+            _wifiJoin(_wifiCache.channel, _wifiCache.bssid);
+         } // if
+         else
+         {
+            Log.verboseln("<aaEsp32Wroom32v3::_wifiEnter> Attempting to connect to Access Point with the SSID %s on channel %d.", _ssid, _selected.channel);
+            _dhcpApplyLease();
+            _wifiJoin(_selected.channel, _selected.bssid); // Pinned to the ranked BSSID, no second scan.
+         } // else
          break;
-      case WL_IDLE_STATUS: 
-         Log.verboseln("<aaEsp32Wroom32v3::WiFiEvent> Detected WL_IDLE_STATUS");            
+      case wifiRoam:
+         _wifiAssociateMs = now;
+         _wifiAttemptMs = now;
+         _roamSwitching = true;
+         if(_dhcpStatic && _lease.ssidHash != _networks[_SSIDIndex].ssidHash)
+         {
+            _dhcpUseDhcp(); // The static address belongs to the network being left.
+         } // if
+         _wifiJoin(_selected.channel, _selected.bssid); // Drops the old Access Point once the driver switches.
          break;
       default:
-         Log.verboseln(F("<aaEsp32Wroom32v3::WiFiEvent> ERROR - UNKNOW SYSTEM EVENT %p."), event); 
          break;
    } //switch
-} // aaEsp32Wroom32v3::_wiFiEvent()
+} // aaEsp32Wroom32v3::_wifiEnter()
+
+/**
+ * @brief Count a failed connection attempt and back off.
+ * @details The ceiling is WIFI_BACKOFF_MIN_MS doubled once per earlier 
+ * consecutive failure, capped at WIFI_BACKOFF_MAX_MS. The lower half of the 
+ * wait is fixed at half the ceiling and the upper half is random, so the 
+ * wait falls between half the ceiling and the ceiling. A failed fast reconnect is not counted, the 
+ * manager goes straight on to a scan. A failed roam is not counted either, 
+ * the manager goes back to the previous Access Point, which is still in the 
+ * fast reconnect cache.
+ * @param const char* What went wrong, for the log.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_wifiFail(const char* reason)
+{
+   uint32_t ceiling;
+   uint32_t waitMs;
+   uint16_t failures;
+   WiFi.disconnect(); // Stop the driver retrying on its own.
+   if(_wifi.state == wifiAssociate || _wifi.state == wifiDhcp || _wifi.state == wifiRoam)
+   {
+      _apSelector.recordAttempt(_SSIDIndex, false, 0);
+   } // if
+   if(_roamSwitching)
+   {
+      _roamSwitching = false;
+      _wifiAttemptMs = millis();
+      _wifiFast = (_wifiCache.magic == WIFI_CACHE_MAGIC);
+      Log.warningln("<aaEsp32Wroom32v3::_wifiFail> Roam failed (%s). Going back.", reason);
+      _wifiEnter(_wifiFast ? wifiAssociate : wifiScan);
+      return;
+   } // if
+   if(_wifiFast)
+   {
+      _wifiFast = false;
+      Log.warningln("<aaEsp32Wroom32v3::_wifiFail> Fast reconnect failed (%s). Scanning.", reason);
+      _wifiEnter(wifiScan);
+      return;
+   } // if
+   portENTER_CRITICAL(&_wifiMux);
+   if(_wifi.failures < UINT16_MAX)
+   {
+      _wifi.failures++;
+   } // if
+   failures = _wifi.failures;
+   portEXIT_CRITICAL(&_wifiMux);
+   ceiling = (uint32_t)WIFI_BACKOFF_MIN_MS << min((int)failures - 1, 16);
+   ceiling = min(ceiling, (uint32_t)WIFI_BACKOFF_MAX_MS);
+   waitMs = ceiling / 2 + esp_random() % (ceiling / 2 + 1);
+   portENTER_CRITICAL(&_wifiMux);
+   _wifi.nextAttemptMs = millis() + waitMs;
+   portEXIT_CRITICAL(&_wifiMux);
+   Log.warningln("<aaEsp32Wroom32v3::_wifiFail> WiFi attempt %u failed (%s). Retrying in %u ms.", failures, reason, waitMs);
+   _wifiEnter(wifiBackoff);
+} // aaEsp32Wroom32v3::_wifiFail()
+
+/**
+ * @brief Finish a successful connection attempt.
+ * @details Times the attempt from its start to the IP address. A scan based 
+ * connect is remembered as the baseline, a fast reconnect is reported 
+ * against it and a roam is timed from WiFi.begin(), which is as long as the 
+ * link was down. An address from a cached lease is checked first when 
+ * dhcpCacheStaticArp asks for it, and its saving is reported against the 
+ * DHCP exchange that granted it. A fresh lease is cached. The Access Point 
+ * is then written to the fast reconnect cache and the roaming manager 
+ * starts watching the new signal.
+ * @param null.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_wifiConnected()
+{
+   unsigned long now = millis();
+   uint32_t took = now - _wifiAttemptMs;
+   uint32_t saved = 0;
+   uint32_t dhcpMs = _wifi.state == wifiDhcp ? now - _wifi.stateSinceMs : 0; // GOT_IP can beat CONNECTED.
+   uint32_t dhcpSaved = 0;
+   bool fast = _wifiFast;
+   bool roamed = _roamSwitching;
+   if(_dhcpStatic && _dhcpMode == dhcpCacheStaticArp && !_dhcpCheckLease())
+   {
+      _dhcpUseDhcp();
+      _wifiEnter(wifiDhcp);
+      return;
+   } // if
+   if(fast && _wifiCache.scanConnectMs > took)
+   {
+      saved = _wifiCache.scanConnectMs - took;
+   } // if
+   if(_dhcpStatic && _lease.dhcpMs > dhcpMs)
+   {
+      dhcpSaved = _lease.dhcpMs - dhcpMs;
+   } // if
+   portENTER_CRITICAL(&_wifiMux);
+   _wifi.connectMs = took;
+   _wifi.savedMs = saved;
+   _wifi.fastConnect = fast;
+   _wifi.cachedLease = _dhcpStatic;
+   _wifi.dhcpMs = dhcpMs;
+   _wifi.dhcpSavedMs = dhcpSaved;
+   _rssi = rssiStats();
+   if(roamed)
+   {
+      _wifi.roams++;
+   } // if
+   portEXIT_CRITICAL(&_wifiMux);
+   _apSelector.recordAttempt(_SSIDIndex, true, now - _wifiAssociateMs);
+   _wifiFast = false;
+   _roamSwitching = false;
+   _roamWeak = false;
+   _roamScanMs = now;
+   _wifiEnter(wifiConnected);
+   if(fast)
+   {
+      Log.noticeln("<aaEsp32Wroom32v3::_wifiConnected> Fast reconnect to %s in %u ms, %u ms saved. IP address %p.", _ssid, took, saved, WiFi.localIP());
+   } // if
+   else if(roamed)
+   {
+      Log.noticeln("<aaEsp32Wroom32v3::_wifiConnected> Roamed to %s on channel %d in %u ms. IP address %p.", _ssid, _selected.channel, took, WiFi.localIP());
+   } // else if
+   else
+   {
+      _wifiCache.scanConnectMs = now - _wifiScanMs;
+      Log.noticeln("<aaEsp32Wroom32v3::_wifiConnected> Connected to %s in %u ms. IP address %p.", _ssid, took, WiFi.localIP());
+   } // else
+   if(_dhcpStatic)
+   {
+      Log.noticeln("<aaEsp32Wroom32v3::_wifiConnected> Cached lease used, IP address %u ms after association, %u ms saved.", dhcpMs, dhcpSaved);
+   } // if
+   else
+   {
+      _dhcpSaveLease(dhcpMs);
+   } // else
+   _wifiSaveCache();
+} // aaEsp32Wroom32v3::_wifiConnected()
+
+/**
+ * @brief Take a background RSSI sample when one is due.
+ * @details Called by _wifiStep() on every tick in wifiConnected, so the 
+ * RSSI is read from the driver once every WIFI_RSSI_SAMPLE_MS without 
+ * anyone waiting for it. The first sample after a connection seeds the EWMA, 
+ * later ones move it by 1/4. Minimum and maximum cover the connection to the 
+ * current Access Point and are kept after it is lost.
+ * @param null.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_rssiSample()
+{
+   unsigned long now = millis();
+   int8_t rssi;
+   if(_rssi.samples != 0 && now - _rssi.sampledAtMs < WIFI_RSSI_SAMPLE_MS)
+   {
+      return;
+   } // if
+   rssi = WiFi.RSSI();
+   if(rssi == 0) // Not associated after all.
+   {
+      return;
+   } // if
+   portENTER_CRITICAL(&_wifiMux);
+   if(_rssi.samples == 0)
+   {
+      _rssi.ewma = rssi;
+      _rssi.min = rssi;
+      _rssi.max = rssi;
+   } // if
+   else
+   {
+      _rssi.ewma += (rssi - _rssi.ewma) / 4;
+      _rssi.min = min(_rssi.min, rssi);
+      _rssi.max = max(_rssi.max, rssi);
+   } // else
+   _rssi.samples++;
+   _rssi.sampledAtMs = now;
+   portEXIT_CRITICAL(&_wifiMux);
+} // aaEsp32Wroom32v3::_rssiSample()
+
+/**
+ * @brief Configure the cached DHCP lease of the selected network.
+ * @details Called just before WiFi.begin() while the station is down. Not 
+ * on a roam: with the interface up WiFi.config() reports an IP address at 
+ * once, before the new Access Point is joined, and within one network the 
+ * address carries over anyway. A lease is only trusted while it is 
+ * certainly inside its renewal time (half the lease): it must have been 
+ * granted on the same run of the RTC clock behind time(), which survives 
+ * deep sleep and software resets but not a power loss. rtcClockToken lives 
+ * in RTC memory that is not cleared on boot for that reason, unlike 
+ * RTC_DATA_ATTR, which is reloaded on every boot but a deep sleep wake. A 
+ * trusted lease is applied with WiFi.config(), so the address is in place 
+ * as soon as the station associates. Otherwise DHCP is turned back on if a 
+ * lease had been applied.
+ * @param null.
+ * @return bool true if a cached lease was applied.
+ ******************************************************************************/
+bool aaEsp32Wroom32v3::_dhcpApplyLease()
+{
+   Preferences nvs;
+   char key[16]; // NVS keys are at most 15 characters.
+   uint32_t now = time(NULL);
+   memset(&_lease, 0, sizeof(dhcpLease));
+   if(_dhcpMode != dhcpCacheOff && nvs.begin(WIFI_CACHE_NAMESPACE, true))
+   {
+      snprintf(key, sizeof(key), "dhcp%08x", _networks[_SSIDIndex].ssidHash);
+      nvs.getBytes(key, &_lease, sizeof(dhcpLease));
+      nvs.end();
+   } // if
+   if(_lease.magic != WIFI_LEASE_MAGIC || _lease.ssidHash != _networks[_SSIDIndex].ssidHash || 
+      rtcClockCheck != ~rtcClockToken || _lease.clockToken != rtcClockToken || now < _lease.obtainedS || now - _lease.obtainedS >= _lease.leaseS / 2)
+   {
+      if(_dhcpStatic)
+      {
+         _dhcpUseDhcp();
+      } // if
+      return false;
+   } // if
+   WiFi.config(IPAddress(_lease.ip), IPAddress(_lease.gateway), IPAddress(_lease.netmask), IPAddress(_lease.dns1), IPAddress(_lease.dns2));
+   _dhcpStatic = true;
+   Log.verboseln("<aaEsp32Wroom32v3::_dhcpApplyLease> Using cached lease of %p, %u s left.", IPAddress(_lease.ip), _lease.leaseS - (now - _lease.obtainedS));
+   return true;
+} // aaEsp32Wroom32v3::_dhcpApplyLease()
+
+/**
+ * @brief Check a cached lease by ARP once the station is associated.
+ * @details The address is only kept if no other host answers ARP for it 
+ * and the gateway does. If another host answers, the lease is also erased 
+ * from NVS. Blocks the manager task for up to two PING_ARP_TIMEOUT_MS 
+ * waits.
+ * 
+ * This is not an RFC 5227 conflict check. The address was configured 
+ * before association and is already in use, and lwIP sends the request 
+ * from it, so the other host is told our MAC for it. The Arduino core 
+ * offers no way to associate without an address and probe from 0.0.0.0 
+ * first. The check only catches a lease that has been handed out again, 
+ * and moves us off it after the fact.
+ * @param null.
+ * @return bool true if the address is safe to use.
+ ******************************************************************************/
+bool aaEsp32Wroom32v3::_dhcpCheckLease()
+{
+   Preferences nvs;
+   char key[16]; // NVS keys are at most 15 characters.
+   if(arpProbe(IPAddress(_lease.ip)))
+   {
+      Log.warningln("<aaEsp32Wroom32v3::_dhcpCheckLease> Another host has %p. Running DHCP.", IPAddress(_lease.ip));
+      if(nvs.begin(WIFI_CACHE_NAMESPACE, false))
+      {
+         snprintf(key, sizeof(key), "dhcp%08x", _lease.ssidHash);
+         nvs.remove(key);
+         nvs.end();
+      } // if
+      return false;
+   } // if
+   if(!arpProbe(IPAddress(_lease.gateway)))
+   {
+      Log.warningln("<aaEsp32Wroom32v3::_dhcpCheckLease> Gateway %p of the cached lease is not there. Running DHCP.", IPAddress(_lease.gateway));
+      return false;
+   } // if
+   return true;
+} // aaEsp32Wroom32v3::_dhcpCheckLease()
+
+/**
+ * @brief Store the lease DHCP just granted.
+ * @details The lease time is read from the lwIP DHCP client of the station 
+ * interface. A lease without one is not cached.
+ * @param uint32_t How long the DHCP exchange took.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_dhcpSaveLease(uint32_t dhcpMs)
+{
+   Preferences nvs;
+   char key[16]; // NVS keys are at most 15 characters.
+   struct netif* netif = NULL;
+   struct dhcp* client = NULL;
+   dhcpLease lease;
+   if(_dhcpMode == dhcpCacheOff)
+   {
+      return;
+   } // if
+   memset(&lease, 0, sizeof(dhcpLease));
+   if(tcpip_adapter_get_netif(TCPIP_ADAPTER_IF_STA, (void**)&netif) == ESP_OK && netif != NULL)
+   {
+      client = netif_dhcp_data(netif);
+   } // if
+   if(client == NULL || client->offered_t0_lease == 0)
+   {
+      return;
+   } // if
+   if(rtcClockCheck != ~rtcClockToken) // First lease since power on.
+   {
+      rtcClockToken = esp_random();
+      rtcClockCheck = ~rtcClockToken;
+   } // if
+   lease.magic = WIFI_LEASE_MAGIC;
+   lease.ssidHash = _networks[_SSIDIndex].ssidHash;
+   lease.ip = WiFi.localIP();
+   lease.gateway = WiFi.gatewayIP();
+   lease.netmask = WiFi.subnetMask();
+   lease.dns1 = WiFi.dnsIP(0);
+   lease.dns2 = WiFi.dnsIP(1);
+   lease.leaseS = client->offered_t0_lease;
+   lease.obtainedS = time(NULL);
+   lease.clockToken = rtcClockToken;
+   lease.dhcpMs = dhcpMs;
+   if(!nvs.begin(WIFI_CACHE_NAMESPACE, false))
+   {
+      return;
+   } // if
+   snprintf(key, sizeof(key), "dhcp%08x", lease.ssidHash);
+   nvs.putBytes(key, &lease, sizeof(dhcpLease));
+   nvs.end();
+   Log.verboseln("<aaEsp32Wroom32v3::_dhcpSaveLease> Cached lease of %p for %u s, DHCP took %u ms.", WiFi.localIP(), lease.leaseS, dhcpMs);
+} // aaEsp32Wroom32v3::_dhcpSaveLease()
+
+/**
+ * @brief Go back to DHCP when a cached lease is due for renewal.
+ * @details Called by _wifiStep() on every tick in wifiConnected. A static 
+ * address is never renewed, so once the lease reaches its renewal time the 
+ * manager runs DHCP, which normally hands out the same address again.
+ * @param null.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_dhcpStep()
+{
+   uint32_t now;
+   if(!_dhcpStatic)
+   {
+      return;
+   } // if
+   now = time(NULL);
+   if(now >= _lease.obtainedS && now - _lease.obtainedS < _lease.leaseS / 2)
+   {
+      return;
+   } // if
+   Log.noticeln("<aaEsp32Wroom32v3::_dhcpStep> Cached lease of %p is due for renewal. Running DHCP.", IPAddress(_lease.ip));
+   _dhcpUseDhcp();
+   _wifiEnter(wifiDhcp);
+} // aaEsp32Wroom32v3::_dhcpStep()
+
+/**
+ * @brief Drop the static address of a cached lease and run DHCP.
+ * @param null.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_dhcpUseDhcp()
+{
+   WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE); // An empty address turns the DHCP client back on.
+   _dhcpStatic = false;
+} // aaEsp32Wroom32v3::_dhcpUseDhcp()
+
+/**
+ * @brief Choose how cached DHCP leases are reused.
+ * @details dhcpCacheStaticArp by default. Takes effect on the next 
+ * association.
+ * @param dhcpCacheMode dhcpCacheOff, dhcpCacheStatic or dhcpCacheStaticArp.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::setDhcpCache(dhcpCacheMode mode)
+{
+   _dhcpMode = mode;
+} // aaEsp32Wroom32v3::setDhcpCache()
+
+/**
+ * @brief Apply a power profile.
+ * @details The modem sleep mode changes at once. The listen interval is 
+ * announced to the Access Point when associating, so a change to or from 
+ * wifiPowerLow only shows in it from the next association.
+ * @param wifiPowerProfile wifiPowerMax, wifiPowerBalanced or wifiPowerLow.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::setPowerProfile(wifiPowerProfile profile)
+{
+   if(profile >= wifiPowerProfiles)
+   {
+      return;
+   } // if
+   _power = profile;
+   _powerApply(_power);
+   Log.verboseln("<aaEsp32Wroom32v3::setPowerProfile> Power profile %s.", powerProfileName(profile));
+} // aaEsp32Wroom32v3::setPowerProfile()
+
+/**
+ * @brief Return the power profile in use.
+ * @param null.
+ * @return wifiPowerProfile Power profile.
+ ******************************************************************************/
+wifiPowerProfile aaEsp32Wroom32v3::getPowerProfile()
+{
+   return _power;
+} // aaEsp32Wroom32v3::getPowerProfile()
+
+/**
+ * @brief Return the human readable name of a power profile.
+ * @param wifiPowerProfile Power profile.
+ * @return const char* Name of the profile.
+ ******************************************************************************/
+const char* aaEsp32Wroom32v3::powerProfileName(wifiPowerProfile profile)
+{
+   switch(profile)
+   {
+      case wifiPowerMax: return "max-performance";
+      case wifiPowerBalanced: return "balanced";
+      case wifiPowerLow: return "low-power";
+      default: return "unknown";
+   } //switch
+} // aaEsp32Wroom32v3::powerProfileName()
+
+/**
+ * @brief Apply a power profile to the modem.
+ * @details Writing the listen interval rewrites the station configuration, 
+ * which must not happen while associated, so it is only asked for by 
+ * _wifiJoin(), between WiFi.begin() writing the configuration and the 
+ * connect.
+ * @param wifiPowerProfile Profile to apply.
+ * @param bool true to write the listen interval as well as the sleep mode.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_powerApply(wifiPowerProfile profile, bool listen)
+{
+   wifi_config_t config;
+   uint16_t interval = profile == wifiPowerLow ? WIFI_POWER_LISTEN_INTERVAL : 0; // 0 is the ESP-IDF default of 3.
+   switch(profile)
+   {
+      case wifiPowerMax: esp_wifi_set_ps(WIFI_PS_NONE); break;
+      case wifiPowerLow: esp_wifi_set_ps(WIFI_PS_MAX_MODEM); break;
+      default: esp_wifi_set_ps(WIFI_PS_MIN_MODEM); break;
+   } //switch
+   if(listen && esp_wifi_get_config(WIFI_IF_STA, &config) == ESP_OK)
+   {
+      if(config.sta.listen_interval != interval)
+      {
+         config.sta.listen_interval = interval;
+         esp_wifi_set_config(WIFI_IF_STA, &config);
+      } // if
+      _powerListen = interval;
+   } // if
+} // aaEsp32Wroom32v3::_powerApply()
+
+/**
+ * @brief Start associating with the selected network.
+ * @details WiFi.begin() writes a fresh station configuration, with the 
+ * listen interval zeroed, and would connect straight away. It is asked not 
+ * to connect, the power profile is written into the configuration it left, 
+ * and only then is the driver told to connect, so the Access Point hears 
+ * the listen interval of the profile.
+ * @param int32_t Channel to join on.
+ * @param const uint8_t* BSSID to join.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_wifiJoin(int32_t channel, const uint8_t* bssid)
+{
+   WiFi.begin(_ssid, _password, channel, bssid, false);
+   _powerApply(_power, true);
+   esp_wifi_connect();
+} // aaEsp32Wroom32v3::_wifiJoin()
+
+/**
+ * @brief Measure gateway latency and throughput under every power profile.
+ * @details Each profile's sleep mode is applied and given 
+ * WIFI_POWER_SETTLE_MS to settle, then the gateway is pinged and the 
+ * bandwidth to it swept with PingClass::bandwidth(). The profile in use is 
+ * left as it is and its sleep mode put back afterwards. Roaming waits while 
+ * this runs, so the measurement stays on one Access Point.
+ * 
+ * Everything is measured on the current association. The listen interval 
+ * of wifiPowerLow is only announced when associating, so it is only 
+ * measured when the current association was made under wifiPowerLow; 
+ * otherwise its result has measured false. The other profiles do not 
+ * depend on the listen interval. Blocks for a few seconds per profile; do 
+ * not call it from a latency sensitive task.
+ * @param powerProfileResult* Array of wifiPowerProfiles results, filled in 
+ * profile order.
+ * @param uint8_t Pings sent to the gateway under each profile.
+ * @return bool false if there is no connection to measure.
+ ******************************************************************************/
+bool aaEsp32Wroom32v3::measurePowerProfiles(powerProfileResult* results, uint8_t pings)
+{
+   IPAddress gateway = WiFi.gatewayIP();
+   _powerMeasuring = true; // Before the state check, so no roam can start after it.
+   if(getWifiState() != wifiConnected || gateway == INADDR_NONE)
+   {
+      _powerMeasuring = false;
+      Log.warningln("<aaEsp32Wroom32v3::measurePowerProfiles> Not connected. Nothing to measure.");
+      return false;
+   } // if
+   for(uint8_t i = 0; i < wifiPowerProfiles; i++)
+   {
+      powerProfileResult &result = results[i];
+      memset(&result, 0, sizeof(powerProfileResult));
+      result.profile = (wifiPowerProfile)i;
+      if(result.profile == wifiPowerLow && _powerListen != WIFI_POWER_LISTEN_INTERVAL)
+      {
+         Log.noticeln("<aaEsp32Wroom32v3::measurePowerProfiles> %s: not measurable, this association did not announce its listen interval.", powerProfileName(result.profile));
+         continue;
+      } // if
+      result.measured = true;
+      _powerApply(result.profile);
+      delay(WIFI_POWER_SETTLE_MS);
+      Ping.ping(gateway, pings);
+      result.rttMs = Ping.averageTime();
+      result.rttP95Us = Ping.percentile(95);
+      result.lossPct = Ping.packetLoss();
+      result.kbps = Ping.bandwidth(gateway);
+      Log.noticeln("<aaEsp32Wroom32v3::measurePowerProfiles> %s: RTT %D ms (p95 %u us), %D%% loss, %u kbit/s.", powerProfileName(result.profile), result.rttMs, result.rttP95Us, result.lossPct, result.kbps);
+   } // for
+   _powerApply(_power);
+   _powerMeasuring = false;
+   return true;
+} // aaEsp32Wroom32v3::measurePowerProfiles()
+
+/**
+ * @brief Add the time spent in a connection manager state to its phase.
+ * @details A phase ends at the timestamp of the WiFi event that finished it 
+ * rather than when the manager task got round to it. A static lease can 
+ * bring GOT_IP in the same step as CONNECTED, then the association is split 
+ * at the CONNECTED event and the rest is DHCP. Called with _wifiMux held.
+ * @param wifiState State being left.
+ * @param wifiState State being entered.
+ * @param uint32_t micros() timestamp of the change.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_phaseClose(wifiState from, wifiState to, uint32_t nowUs)
+{
+   uint32_t endUs = nowUs;
+   wifiPhase phase;
+   switch(from)
+   {
+      case wifiScan:
+         phase = wifiPhaseScan;
+         endUs = _scanDoneUs;
+         break;
+      case wifiAssociate:
+      case wifiRoam:
+         phase = wifiPhaseAssociate;
+         endUs = _connectedUs;
+         break;
+      case wifiDhcp:
+         phase = wifiPhaseDhcp;
+         endUs = _gotIpUs;
+         break;
+      case wifiBackoff:
+         phase = wifiPhaseBackoff;
+         break;
+      default:
+         return;
+   } //switch
+   if((int32_t)(endUs - _phaseStartUs) < 0 || (int32_t)(nowUs - endUs) < 0)
+   {
+      endUs = nowUs; // The event belongs to an earlier state, or never came.
+   } // if
+   _boot.phaseUs[phase] += endUs - _phaseStartUs;
+   if(phase == wifiPhaseAssociate && to == wifiConnected)
+   {
+      _boot.phaseUs[wifiPhaseDhcp] += nowUs - endUs;
+   } // if
+   if(to == wifiConnected)
+   {
+      _boot.phaseUs[wifiPhaseTotal] = nowUs - _boot.startUs;
+      _boot.bootMs = millis();
+      _boot.fastConnect = _wifi.fastConnect;
+      _boot.cachedLease = _wifi.cachedLease;
+      _boot.complete = true;
+   } // if
+} // aaEsp32Wroom32v3::_phaseClose()
+
+/**
+ * @brief Fold this boot's phase times into the statistics across boots.
+ * @details Runs once per boot on the first connection. The averages are 
+ * plain means for the first WIFI_PHASE_EWMA_BOOTS boots, after that each 
+ * boot moves them by 1/WIFI_PHASE_EWMA_BOOTS, so they follow a changed 
+ * network within a few boots. One NVS write per boot.
+ * @param null.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_phaseRecord()
+{
+   Preferences nvs;
+   wifiPhaseHistory history;
+   uint32_t weight;
+   portENTER_CRITICAL(&_wifiMux);
+   history = _phases;
+   history.magic = WIFI_PHASE_MAGIC;
+   history.boots++;
+   weight = min(history.boots, (uint32_t)WIFI_PHASE_EWMA_BOOTS);
+   for(uint8_t i = 0; i < wifiPhases; i++)
+   {
+      wifiPhaseStat &stat = history.phase[i];
+      uint32_t us = _boot.phaseUs[i];
+      stat.avgUs += ((float)us - stat.avgUs) / weight;
+      stat.minUs = history.boots == 1 ? us : min(stat.minUs, us);
+      stat.maxUs = max(stat.maxUs, us);
+   } // for
+   _phases = history;
+   portEXIT_CRITICAL(&_wifiMux);
+   if(nvs.begin(WIFI_PHASE_NAMESPACE, false))
+   {
+      nvs.putBytes("phases", &history, sizeof(wifiPhaseHistory));
+      nvs.end();
+   } // if
+   Log.noticeln("<aaEsp32Wroom32v3::_phaseRecord> First IP address %D ms after connectWifi(): scan %D ms, associate %D ms, DHCP %D ms, backoff %D ms.", 
+      _boot.phaseUs[wifiPhaseTotal] / 1000.0, _boot.phaseUs[wifiPhaseScan] / 1000.0, _boot.phaseUs[wifiPhaseAssociate] / 1000.0, 
+      _boot.phaseUs[wifiPhaseDhcp] / 1000.0, _boot.phaseUs[wifiPhaseBackoff] / 1000.0);
+} // aaEsp32Wroom32v3::_phaseRecord()
+
+/**
+ * @brief Return a copy of this boot's connection phase times.
+ * @details complete is false until the first IP address of the boot, the 
+ * times so far are filled in.
+ * @param null.
+ * @return wifiBootTiming Phase times of this boot.
+ ******************************************************************************/
+wifiBootTiming aaEsp32Wroom32v3::getBootTiming()
+{
+   wifiBootTiming snapshot;
+   portENTER_CRITICAL(&_wifiMux);
+   snapshot = _boot;
+   portEXIT_CRITICAL(&_wifiMux);
+   return snapshot;
+} // aaEsp32Wroom32v3::getBootTiming()
+
+/**
+ * @brief Return a copy of the connection phase statistics across boots.
+ * @param null.
+ * @return wifiPhaseHistory Phase statistics, boots is 0 before the first.
+ ******************************************************************************/
+wifiPhaseHistory aaEsp32Wroom32v3::getPhaseHistory()
+{
+   wifiPhaseHistory snapshot;
+   portENTER_CRITICAL(&_wifiMux);
+   snapshot = _phases;
+   portEXIT_CRITICAL(&_wifiMux);
+   return snapshot;
+} // aaEsp32Wroom32v3::getPhaseHistory()
+
+/**
+ * @brief Return the human readable name of a connection phase.
+ * @param wifiPhase Phase.
+ * @return const char* Name of the phase.
+ ******************************************************************************/
+const char* aaEsp32Wroom32v3::wifiPhaseName(wifiPhase phase)
+{
+   switch(phase)
+   {
+      case wifiPhaseScan: return "Scan";
+      case wifiPhaseAssociate: return "Authentication and association";
+      case wifiPhaseDhcp: return "DHCP";
+      case wifiPhaseBackoff: return "Backoff";
+      case wifiPhaseTotal: return "Total";
+      default: return "Unknown";
+   } //switch
+} // aaEsp32Wroom32v3::wifiPhaseName()
+
+/**
+ * @brief Erase the connection phase statistics from NVS.
+ * @details This boot's phase times are kept.
+ * @param null.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::forgetPhaseHistory()
+{
+   Preferences nvs;
+   portENTER_CRITICAL(&_wifiMux);
+   _phases = wifiPhaseHistory();
+   portEXIT_CRITICAL(&_wifiMux);
+   if(nvs.begin(WIFI_PHASE_NAMESPACE, false))
+   {
+      nvs.clear();
+      nvs.end();
+   } // if
+} // aaEsp32Wroom32v3::forgetPhaseHistory()
+
+/**
+ * @brief Watch the signal of the connection and look for a better Access 
+ * Point.
+ * @details Called by _wifiStep() on every tick in wifiConnected. Works on 
+ * the EWMA kept by _rssiSample(), so a single deep fade does not start a 
+ * roam. Once the smoothed RSSI reaches 
+ * notGood the link counts as weak until it climbs WIFI_ROAM_HYSTERESIS_DB 
+ * above it again. While weak, the channels known networks were last seen on 
+ * are scanned every WIFI_ROAM_SCAN_INTERVAL_MS, or every 
+ * WIFI_ROAM_URGENT_SCAN_MS once the signal is unusable. After a fast 
+ * reconnect those are only the cached channel, so the first scan after the 
+ * signal turns weak, and every WIFI_ROAM_FULL_SCAN_EVERY scans after that, 
+ * covers the whole band and relearns them, see _roamPick(). The scan is active 
+ * with a short dwell so the radio is back on the current channel before 
+ * traffic queues up, and the connection stays up while it runs.
+ * @param null.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_roamStep()
+{
+   unsigned long now = millis();
+   unsigned long interval;
+   float rssi = _rssi.ewma; // Only the manager task writes it.
+   wifiScanConfig scan = {_knownChannels, false, false, 0, WIFI_ROAM_SCAN_DWELL_MS};
+   if(!_roamWeak && _rssi.samples != 0 && rssi <= notGood)
+   {
+      _roamWeak = true;
+      _roamScans = 0;
+      _roamScanMs = now - WIFI_ROAM_SCAN_INTERVAL_MS; // Look straight away.
+      Log.noticeln("<aaEsp32Wroom32v3::_roamStep> Signal from %s is weak (%d db).", _ssid, (int)rssi);
+   } // if
+   else if(_roamWeak && rssi >= notGood + WIFI_ROAM_HYSTERESIS_DB)
+   {
+      _roamWeak = false;
+      Log.noticeln("<aaEsp32Wroom32v3::_roamStep> Signal from %s recovered (%d db).", _ssid, (int)rssi);
+   } // else if
+   if(_roamScan)
+   {
+      if(isScanning())
+      {
+         if(now - _roamScanMs >= WIFI_SCAN_TIMEOUT_MS)
+         {
+            stopScan();
+            _roamScan = false;
+         } // if
+         return;
+      } // if
+      _roamScan = false;
+      if(_roaming && _roamWeak && !_powerMeasuring)
+      {
+         _roamPick();
+      } // if
+      return;
+   } // if
+   if(!_roaming || !_roamWeak || _powerMeasuring)
+   {
+      return;
+   } // if
+   interval = rssi <= unusable ? WIFI_ROAM_URGENT_SCAN_MS : WIFI_ROAM_SCAN_INTERVAL_MS;
+   if(now - _roamScanMs < interval)
+   {
+      return;
+   } // if
+   if(_roamScans++ % WIFI_ROAM_FULL_SCAN_EVERY == 0)
+   {
+      scan.channels = 0; // Whole band.
+   } // if
+   _roamScanMs = now;
+   _roamScan = startScan(scan);
+} // aaEsp32Wroom32v3::_roamStep()
+
+/**
+ * @brief Move to the best known Access Point found by a background scan.
+ * @details The current Access Point is left out. Candidates are taken in 
+ * rank order and the first one at least WIFI_ROAM_MIN_GAIN_DB stronger than 
+ * the smoothed RSSI of the connection wins, so the link is not dropped for 
+ * a marginal gain. A whole band scan also relearns the channels known 
+ * networks are on, as in _lookForAP(), including that of the current one.
+ * @param null.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_roamPick()
+{
+   scanEntry entry; // One Access Point found by the scan.
+   const apCandidate* option = NULL; // Candidate being weighed.
+   uint16_t seen = 1 << WiFi.channel(); // Channels known networks were found on.
+   uint8_t current[6]; // BSSID of the Access Point in use.
+   uint8_t* bssid = WiFi.BSSID();
+   if(bssid == NULL)
+   {
+      return;
+   } // if
+   memcpy(current, bssid, sizeof(current));
+   _apSelector.clearCandidates();
+   for(uint8_t i = 0; getScanResult(i, entry); i++)
+   {
+      if(memcmp(entry.bssid, current, sizeof(current)) != 0 &&
+         _apSelector.offer(entry.ssid, entry.ssidLen, entry.ssidHash, entry.rssi, entry.channel, entry.bssid))
+      {
+         seen |= 1 << entry.channel;
+      } // if
+   } //for
+   if(_scanConfig.channels == 0)
+   {
+      _knownChannels = seen;
+   } // if
+   for(uint8_t rank = 0; rank < _apSelector.candidateCount(); rank++)
+   {
+      option = _apSelector.candidate(rank);
+      if(option->rssi >= _rssi.ewma + WIFI_ROAM_MIN_GAIN_DB)
+      {
+         break;
+      } // if
+      option = NULL;
+   } // for
+   if(option == NULL)
+   {
+      Log.verboseln("<aaEsp32Wroom32v3::_roamPick> No known Access Point is %d db stronger than %s (%d db).", WIFI_ROAM_MIN_GAIN_DB, _ssid, (int)_rssi.ewma);
+      return;
+   } // if
+   Log.noticeln("<aaEsp32Wroom32v3::_roamPick> Roaming from %s (%d db) to %s (%d db) on channel %d.", _ssid, (int)_rssi.ewma, _networks[option->known].ssid, option->rssi, option->channel);
+   _selected = *option;
+   _SSIDIndex = option->known;
+   _ssid = _networks[_SSIDIndex].ssid;
+   _password = _networks[_SSIDIndex].password;
+   _wifiEnter(wifiRoam);
+} // aaEsp32Wroom32v3::_roamPick()
+
+/**
+ * @brief Turn roaming to stronger known Access Points on or off.
+ * @details On by default. The RSSI of the connection is still sampled when 
+ * roaming is off.
+ * @param bool true to roam.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::setRoaming(bool on)
+{
+   _roaming = on;
+   Log.verboseln("<aaEsp32Wroom32v3::setRoaming> Roaming turned %s.", on ? "on" : "off");
+} // aaEsp32Wroom32v3::setRoaming()
+
+/**
+ * @brief Load the fast reconnect cache.
+ * @details RTC memory is tried first because it is free to read and survives 
+ * deep sleep. After a power loss the copy in NVS is used. An entry whose 
+ * SSID hash no longer matches the known network table is ignored.
+ * @param null.
+ * @return bool true if a usable entry was loaded.
+ ******************************************************************************/
+bool aaEsp32Wroom32v3::_wifiLoadCache()
+{
+   Preferences nvs;
+   const char* source = "RTC memory";
+   _wifiCache = rtcWifiCache;
+   if(_wifiCache.magic != WIFI_CACHE_MAGIC)
+   {
+      source = "NVS";
+      memset(&_wifiCache, 0, sizeof(wifiFastCache));
+      if(nvs.begin(WIFI_CACHE_NAMESPACE, true))
+      {
+         nvs.getBytes("fast", &_wifiCache, sizeof(wifiFastCache));
+         nvs.end();
+      } // if
+   } // if
+   if(_wifiCache.magic != WIFI_CACHE_MAGIC || _wifiCache.index < 0 || _wifiCache.index >= _networkCount ||
+      _wifiCache.ssidHash != _networks[_wifiCache.index].ssidHash)
+   {
+      memset(&_wifiCache, 0, sizeof(wifiFastCache));
+      Log.verboseln("<aaEsp32Wroom32v3::_wifiLoadCache> No fast reconnect cache.");
+      return false;
+   } // if
+   rtcWifiCache = _wifiCache;
+   _knownChannels |= 1 << _wifiCache.channel;
+   Log.verboseln("<aaEsp32Wroom32v3::_wifiLoadCache> Fast reconnect cache from %s: %s on channel %d.", source, _networks[_wifiCache.index].ssid, _wifiCache.channel);
+   return true;
+} // aaEsp32Wroom32v3::_wifiLoadCache()
+
+/**
+ * @brief Store the current Access Point in the fast reconnect cache.
+ * @details RTC memory is always updated. NVS is only written when the entry 
+ * has changed, which spares the flash on every reconnect to the same AP.
+ * @param null.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_wifiSaveCache()
+{
+   Preferences nvs;
+   wifiFastCache stored;
+   uint8_t* bssid = WiFi.BSSID();
+   _wifiCache.magic = WIFI_CACHE_MAGIC;
+   _wifiCache.index = _SSIDIndex;
+   _wifiCache.ssidHash = _networks[_SSIDIndex].ssidHash;
+   _wifiCache.channel = WiFi.channel();
+   if(bssid != NULL)
+   {
+      memcpy(_wifiCache.bssid, bssid, sizeof(_wifiCache.bssid));
+   } // if
+   rtcWifiCache = _wifiCache;
+   if(!nvs.begin(WIFI_CACHE_NAMESPACE, false))
+   {
+      Log.warningln("<aaEsp32Wroom32v3::_wifiSaveCache> Unable to open NVS namespace %s.", WIFI_CACHE_NAMESPACE);
+      return;
+   } // if
+   memset(&stored, 0, sizeof(wifiFastCache));
+   nvs.getBytes("fast", &stored, sizeof(wifiFastCache));
+   if(memcmp(&stored, &_wifiCache, sizeof(wifiFastCache)) != 0)
+   {
+      nvs.putBytes("fast", &_wifiCache, sizeof(wifiFastCache));
+   } // if
+   nvs.end();
+} // aaEsp32Wroom32v3::_wifiSaveCache()
+
+/**
+ * @brief Erase the fast reconnect cache from RTC memory and NVS.
+ * @details The next connection attempt after this starts with a scan. The 
+ * cached DHCP leases, which share the NVS namespace, go too.
+ * @param null.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::forgetWifiCache()
+{
+   Preferences nvs;
+   memset(&rtcWifiCache, 0, sizeof(wifiFastCache));
+   _wifiCache = rtcWifiCache;
+   if(nvs.begin(WIFI_CACHE_NAMESPACE, false))
+   {
+      nvs.clear();
+      nvs.end();
+   } // if
+} // aaEsp32Wroom32v3::forgetWifiCache()
+
+/**
+ * @brief Use the known networks stored in a data partition.
+ * @details Replaces the built in table of knownNetworks.cpp, so credentials 
+ * can be changed without a new build. The partition is memory mapped and 
+ * used in place, the records are neither copied nor allocated, so it can 
+ * hold hundreds of networks (raise AP_SELECTOR_MAX_KNOWN to index them all). 
+ * The image is a knownNetworkImage header followed by count knownNetwork 
+ * records. Every record is checked, one with a bad SSID length, terminator 
+ * or hash rejects the whole image and the built in table stays in use. 
+ * Call before connectWifi().
+ * @param const char* Label of the data partition.
+ * @return bool true if the partition's networks are now in use.
+ ******************************************************************************/
+bool aaEsp32Wroom32v3::loadKnownNetworks(const char* label)
+{
+   const esp_partition_t* partition;
+   const void* mapped;
+   spi_flash_mmap_handle_t handle;
+   const knownNetworkImage* image;
+   const knownNetwork* records;
+   if(_wifiTask != NULL || _apSelector.knownCount() != 0)
+   {
+      Log.warningln("<aaEsp32Wroom32v3::loadKnownNetworks> Known networks are already indexed, call before connectWifi().");
+      return false;
+   } // if
+   partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+   if(partition == NULL)
+   {
+      Log.warningln("<aaEsp32Wroom32v3::loadKnownNetworks> No partition labelled %s.", label);
+      return false;
+   } // if
+   if(esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &mapped, &handle) != ESP_OK)
+   {
+      Log.errorln("<aaEsp32Wroom32v3::loadKnownNetworks> Unable to map partition %s.", label);
+      return false;
+   } // if
+   image = (const knownNetworkImage*)mapped;
+   records = (const knownNetwork*)(image + 1);
+   if(image->magic != KNOWN_NETWORKS_MAGIC || image->recordSize != sizeof(knownNetwork) || image->count == 0 ||
+      sizeof(knownNetworkImage) + (size_t)image->count * sizeof(knownNetwork) > partition->size)
+   {
+      spi_flash_munmap(handle);
+      Log.errorln("<aaEsp32Wroom32v3::loadKnownNetworks> Partition %s does not hold a known network table.", label);
+      return false;
+   } // if
+   for(uint16_t i = 0; i < image->count; i++)
+   {
+      const knownNetwork &network = records[i];
+      if(network.ssidLen > 32 || network.ssid[network.ssidLen] != 0 || network.password[sizeof(network.password) - 1] != 0 ||
+         network.ssidHash != aaApSelector::hash(network.ssid, network.ssidLen))
+      {
+         spi_flash_munmap(handle);
+         Log.errorln("<aaEsp32Wroom32v3::loadKnownNetworks> Record %u of partition %s is corrupt.", i, label);
+         return false;
+      } // if
+   } // for
+   _networks = records; // Stays mapped for as long as it is in use.
+   _networkCount = image->count;
+   if(_networkCount > AP_SELECTOR_MAX_KNOWN)
+   {
+      Log.warningln("<aaEsp32Wroom32v3::loadKnownNetworks> Only the first %d of %u known networks will be indexed.", AP_SELECTOR_MAX_KNOWN, _networkCount);
+   } // if
+   Log.noticeln("<aaEsp32Wroom32v3::loadKnownNetworks> Using %u known networks from partition %s.", _networkCount, label);
+   return true;
+} // aaEsp32Wroom32v3::loadKnownNetworks()
+
+/**
+ * @brief Start an asynchronous scan.
+ * @details Returns straight away. With config.channels set, the channels in 
+ * the list are scanned one after the other, one esp_wifi_scan_start() per 
+ * channel, so a scan limited to the two or three channels the known networks 
+ * use takes a fraction of the time of a full sweep of 13. With no channels 
+ * set all are covered in one pass. Dwell times apply per channel.
+ * 
+ * Results from all channels are merged into an aaScanStore snapshot, an 
+ * Access Point heard on more than one channel is kept once with its 
+ * strongest reading, and when more than WIFI_SCAN_MAX_RESULTS are heard the 
+ * weakest are dropped. The snapshot is sorted strongest first and stays 
+ * valid until the next scan starts.
+ * 
+ * The callback runs on the WiFi event dispatch task once the last channel 
+ * is done. 
+ * Keep it short. Scans fail to start while another scan is in progress or 
+ * while the radio is busy associating.
+ * @param wifiScanConfig Channels, mode and dwell times.
+ * @param scanCallback Called with the results, or NULL to poll isScanning().
+ * @return bool true if the scan started.
+ ******************************************************************************/
+bool aaEsp32Wroom32v3::startScan(const wifiScanConfig& config, scanCallback callback)
+{
+   bool busy; // Another task's scan is in progress.
+   portENTER_CRITICAL(&_wifiMux); // The manager, the roam step and the app may all start scans.
+   busy = _scanning;
+   _scanning = true;
+   portEXIT_CRITICAL(&_wifiMux);
+   if(busy)
+   {
+      return false;
+   } // if
+   if(!_wifiEventsStart()) // Scan done events are needed without the connection manager too.
+   {
+      _scanning = false;
+      return false;
+   } // if
+   WiFi.enableSTA(true);
+   WiFi.scanDelete();
+   _scanConfig = config;
+   _scanConfig.channels &= 0x7FFE; // Channels 1 to 14.
+   _scanCallback = callback;
+   _scanChannel = 0;
+   _scanStartMs = millis();
+   portENTER_CRITICAL(&_wifiMux);
+   _scanStore.clear(_scanStartMs);
+   portEXIT_CRITICAL(&_wifiMux);
+   if(!_scanNext())
+   {
+      _scanning = false;
+      Log.warningln("<aaEsp32Wroom32v3::startScan> Unable to start scan.");
+      return false;
+   } // if
+   return true;
+} // aaEsp32Wroom32v3::startScan()
+
+/**
+ * @brief Abandon the scan in progress.
+ * @details The results gathered so far are kept, the callback is not called.
+ * @param null.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::stopScan()
+{
+   if(_scanning)
+   {
+      _scanning = false;
+      esp_wifi_scan_stop();
+      _scanDurationMs = millis() - _scanStartMs;
+   } // if
+} // aaEsp32Wroom32v3::stopScan()
+
+/**
+ * @brief Report whether a scan started by startScan() is still running.
+ * @param null.
+ * @return bool true until the last channel has been scanned.
+ ******************************************************************************/
+bool aaEsp32Wroom32v3::isScanning()
+{
+   return _scanning;
+} // aaEsp32Wroom32v3::isScanning()
+
+/**
+ * @brief Report how many Access Points the last scan found.
+ * @param null.
+ * @return uint8_t Number of results, at most WIFI_SCAN_MAX_RESULTS.
+ ******************************************************************************/
+uint8_t aaEsp32Wroom32v3::scanResultCount()
+{
+   return _scanStore.count();
+} // aaEsp32Wroom32v3::scanResultCount()
+
+/**
+ * @brief Copy one Access Point found by the last scan.
+ * @details The entry is copied under _wifiMux, as the event dispatch task 
+ * rewrites the snapshot when a scan started by any task runs.
+ * @param uint8_t Result index, 0 is the strongest.
+ * @param scanEntry& Receives the entry.
+ * @return bool true if there is an entry at the index.
+ ******************************************************************************/
+bool aaEsp32Wroom32v3::getScanResult(uint8_t index, scanEntry& entry)
+{
+   const scanEntry* found; // Entry in the snapshot.
+   portENTER_CRITICAL(&_wifiMux);
+   found = _scanStore.get(index);
+   if(found != NULL)
+   {
+      entry = *found;
+   } // if
+   portEXIT_CRITICAL(&_wifiMux);
+   return found != NULL;
+} // aaEsp32Wroom32v3::getScanResult()
+
+/**
+ * @brief Return a copy of the snapshot of the last scan.
+ * @details Answers lookups by BSSID or SSID and how old the scan is without 
+ * going back to the driver. The event dispatch task fills the snapshot while 
+ * a scan runs, so the copy is taken under _wifiMux. While isScanning() is 
+ * true it holds the channels scanned so far, unsorted.
+ * @param null.
+ * @return aaScanStore Copy of the snapshot, free to sort or keep.
+ ******************************************************************************/
+aaScanStore aaEsp32Wroom32v3::getScanStore()
+{
+   aaScanStore copy;
+   portENTER_CRITICAL(&_wifiMux);
+   copy = _scanStore;
+   portEXIT_CRITICAL(&_wifiMux);
+   return copy;
+} // aaEsp32Wroom32v3::getScanStore()
+
+/**
+ * @brief Report how long the last scan took.
+ * @param null.
+ * @return uint32_t Milliseconds from startScan() to the last channel done.
+ ******************************************************************************/
+uint32_t aaEsp32Wroom32v3::scanDurationMs()
+{
+   return _scanDurationMs;
+} // aaEsp32Wroom32v3::scanDurationMs()
+
+/**
+ * @brief Start the scan of the next channel in the list.
+ * @details With no channel list the first call scans them all and there is 
+ * no next one.
+ * @param null.
+ * @return bool true if a scan pass was started, false when the list is done 
+ * or the driver refused.
+ ******************************************************************************/
+bool aaEsp32Wroom32v3::_scanNext()
+{
+   wifi_scan_config_t config;
+   if(_scanConfig.channels == 0 && _scanChannel != 0)
+   {
+      return false;
+   } // if
+   if(_scanConfig.channels == 0)
+   {
+      _scanChannel = 0xFF; // One pass over every channel.
+   } // if
+   else
+   {
+      do
+      {
+         _scanChannel++;
+      } while(_scanChannel <= 14 && !(_scanConfig.channels & (1 << _scanChannel)));
+      if(_scanChannel > 14)
+      {
+         return false;
+      } // if
+   } // else
+   memset(&config, 0, sizeof(config));
+   config.channel = _scanChannel == 0xFF ? 0 : _scanChannel;
+   config.show_hidden = _scanConfig.showHidden;
+   if(_scanConfig.passive)
+   {
+      config.scan_type = WIFI_SCAN_TYPE_PASSIVE;
+      config.scan_time.passive = _scanConfig.maxDwellMs;
+   } // if
+   else
+   {
+      config.scan_type = WIFI_SCAN_TYPE_ACTIVE;
+      config.scan_time.active.min = _scanConfig.minDwellMs;
+      config.scan_time.active.max = _scanConfig.maxDwellMs;
+   } // else
+   return esp_wifi_scan_start(&config, false) == ESP_OK;
+} // aaEsp32Wroom32v3::_scanNext()
+
+/**
+ * @brief Collect the results of one scan pass and start the next.
+ * @details Called from _wifiCoreEvent() on SYSTEM_EVENT_SCAN_DONE, after 
+ * the WiFi core has copied the driver's records into its own array. Each 
+ * record is copied once into the scan snapshot, which is sorted strongest 
+ * first when the last pass is done. Scans not started by startScan() are 
+ * left to their owner.
+ * @param uint8_t Status reported with the event, 0 for success.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_scanDone(uint8_t status)
+{
+   const wifi_ap_record_t* record; // One record held by the WiFi core.
+   unsigned long now = millis();
+   if(!_scanning)
+   {
+      return;
+   } // if
+   if(status == 0)
+   {
+      for(uint16_t i = 0; i < scanRecords::count(); i++)
+      {
+         record = scanRecords::get(i);
+         portENTER_CRITICAL(&_wifiMux);
+         _scanStore.keep((const char*)record->ssid, strnlen((const char*)record->ssid, sizeof(record->ssid)), record->bssid, record->primary, record->rssi, record->authmode, now);
+         portEXIT_CRITICAL(&_wifiMux);
+      } // for
+   } // if
+   WiFi.scanDelete();
+   if(_scanning && _scanNext())
+   {
+      return;
+   } // if
+   _scanDurationMs = millis() - _scanStartMs;
+   portENTER_CRITICAL(&_wifiMux);
+   _scanStore.sort(scanByRssi);
+   portEXIT_CRITICAL(&_wifiMux);
+   _scanning = false;
+   Log.verboseln("<aaEsp32Wroom32v3::_scanDone> Scan found %d Access Points in %u ms.", _scanStore.count(), _scanDurationMs);
+   if(_scanCallback != NULL)
+   {
+      _scanCallback(_scanStore.get(0), _scanStore.count());
+   } // if
+} // aaEsp32Wroom32v3::_scanDone()
+
+/**
+ * @brief Report the smoothed WiFi signal strength. 
+ * @details Reads the EWMA the WiFi connection manager keeps in the 
+ * background, see _rssiSample(), so it never blocks. 
+ * @param null. 
+ * @return long Smoothed signal strength of AP connection in decibels (db), 
+ * 0 before the first sample.
+ ******************************************************************************/
+long aaEsp32Wroom32v3::rfSignalStrength()
+{
+   return lroundf(_rssi.ewma);
+} // aaEsp32Wroom32v3::rfSignalStrength()
+
+/**
+ * @brief Return a copy of the background RSSI samples.
+ * @param null.
+ * @return rssiStats EWMA, minimum and maximum of the current connection.
+ ******************************************************************************/
+rssiStats aaEsp32Wroom32v3::getRssiStats()
+{
+   rssiStats snapshot;
+   portENTER_CRITICAL(&_wifiMux);
+   snapshot = _rssi;
+   portEXIT_CRITICAL(&_wifiMux);
+   return snapshot;
+} // aaEsp32Wroom32v3::getRssiStats()
+
+/**
+ * @brief Return human readable assessment of the smoothed signal strength.
+ * @param null.
+ * @return const char* Assessment of signal quality in one or two words.
+ ******************************************************************************/
+const char* aaEsp32Wroom32v3::evalSignal()
+{
+   if(_rssi.samples == 0) return "No signal";
+   return evalSignal(rfSignalStrength());
+} // aaEsp32Wroom32v3::evalSignal()
+
+/**
+ * @brief Return human readable assessment of signal strength.
+ * @param int16_t Signal strength as measured in decibels (db). 
+ * @return const char* Assessment of signal quality in one or two words.
+ ******************************************************************************/
+const char* aaEsp32Wroom32v3::evalSignal(int16_t signalStrength)
+{
+   if(signalStrength <= unusable) return "Unusable";
+   if(signalStrength <= notGood) return "Not good";
+   if(signalStrength <= okay) return "Okay";
+   if(signalStrength <= veryGood) return "Very Good";
+   return "Amazing";
+} // aaEsp32Wroom32v3::evalSignal()
+
+/**
+ * @fn bool aaEsp32Wroom32v3::pingIP(IPAddress address)
+ * @brief Ping IP address once and return the response.
+ * @param IPAddress Address to ping. 
+ * @return bool Result of ping. 
+ ******************************************************************************/
+bool aaEsp32Wroom32v3::pingIP(IPAddress address)
+{
+   int8_t numPings = 1; // How many pings to send to verify IP address
+   IPAddress tmpIp; 
+   return Ping.ping(address, numPings);
+} // aaEsp32Wroom32v3::pingIP()
+
+/**
+ * @overload bool aaEsp32Wroom32v3::pingIP(IPAddress address, int8_t numPings)
+ * @brief Ping IP address usert specified number of times and return response.
+ * @param IPAddress Address to ping. 
+ * @param int8_t Number of times to ping address. 
+ * @return bool Result of pings. 
+ ******************************************************************************/
+bool aaEsp32Wroom32v3::pingIP(IPAddress address, int8_t numPings)
+{
+   IPAddress tmpIp; 
+   return Ping.ping(address, numPings);
+} // aaEsp32Wroom32v3::pingIP()
+
+/**
+ * @fn bool aaEsp32Wroom32v3::arpProbe(IPAddress address)
+ * @brief Check that a host on the local subnet answers ARP.
+ * @details Cheaper than a ping and works for hosts that drop ICMP. Only
+ * reaches hosts on the same subnet as the WiFi interface.
+ * @param IPAddress Address to probe. 
+ * @return bool True if the host answered or is already in the ARP table. 
+ ******************************************************************************/
+bool aaEsp32Wroom32v3::arpProbe(IPAddress address)
+{
+   ping_arp_result result;
+   return arpProbe(address, result, PING_ARP_TIMEOUT_MS);
+} // aaEsp32Wroom32v3::arpProbe()
+
+/**
+ * @overload bool aaEsp32Wroom32v3::arpProbe(IPAddress address, ping_arp_result &result, uint32_t timeoutMs)
+ * @brief Check that a host on the local subnet answers ARP and time the answer.
+ * @param IPAddress Address to probe. 
+ * @param ping_arp_result Filled with the MAC address, resolution latency and 
+ * whether the answer came from an existing ARP table entry. 
+ * @param uint32_t How long to wait for the answer in milliseconds. 
+ * @return bool True if the host answered or is already in the ARP table. 
+ ******************************************************************************/
+bool aaEsp32Wroom32v3::arpProbe(IPAddress address, ping_arp_result &result, uint32_t timeoutMs)
+{
+   bool present = ping_arp(address, timeoutMs, &result);
+   if(present && !result.cached)
+   {
+      Log.verboseln("<aaEsp32Wroom32v3::arpProbe> %p answered ARP in %u us.", address, result.latency_us);
+   } // if
+   else
+   {
+      Log.verboseln("<aaEsp32Wroom32v3::arpProbe> %p %s.", address, present ? "in ARP table" : "did not answer ARP");
+   } // else
+   return present;
+} // aaEsp32Wroom32v3::arpProbe()
+
+/**
+ * @brief Start background monitoring of the link to the gateway.
+ * @details The link monitor is opt-in. It creates a low priority FreeRTOS 
+ * task that sends one ICMP echo to the gateway, and then to each extra target 
+ * added with addLinkMonitorTarget(), every intervalMs milliseconds. For every 
+ * target it keeps exponentially weighted moving averages (EWMA) of round trip 
+ * time, loss and jitter. When the gateway gauges cross the thresholds set by 
+ * setLinkThresholds() the onLinkDegraded() callback fires. Once both gauges 
+ * drop below half their thresholds the onLinkRecovered() callback fires. The 
+ * gap between the two levels stops the state from flapping.
+ * 
+ * Cost is bounded: a fixed table of LINK_MONITOR_MAX_TARGETS targets, one 
+ * LINK_MONITOR_STACK_SIZE byte task, and at most one probe in flight that 
+ * waits no longer than the 1 second ping timeout. Probes share the ping 
+ * library with the application and are serialized with its calls.
+ * 
+ * Callbacks run on the monitor task. Keep them short.
+ * @param intervalMs time between probe cycles, at least 
+ * LINK_MONITOR_MIN_INTERVAL_MS.
+ * @return bool true if the monitor is running.
+ ******************************************************************************/
+bool aaEsp32Wroom32v3::startLinkMonitor(uint32_t intervalMs)
+{
+   if(_linkTask != NULL)
+   {
+      return true;
+   } // if
+   _linkIntervalMs = max(intervalMs, (uint32_t)LINK_MONITOR_MIN_INTERVAL_MS);
+   for(uint8_t i = 0; i < LINK_MONITOR_MAX_TARGETS; i++)
+   {
+      IPAddress target = _link[i].target; // Keep targets added before the start.
+      _link[i] = linkQuality();
+      _link[i].target = target;
+   } // for
+   _linkStop = false;
+   if(xTaskCreatePinnedToCore(_linkMonitorTask, "linkMonitor", LINK_MONITOR_STACK_SIZE, this, 1, &_linkTask, 1) != pdPASS)
+   {
+      _linkTask = NULL;
+      Log.errorln("<aaEsp32Wroom32v3::startLinkMonitor> Unable to create link monitor task.");
+      return false;
+   } // if
+   Log.verboseln("<aaEsp32Wroom32v3::startLinkMonitor> Link monitor probing %d target(s) every %u ms.", _linkTargets, _linkIntervalMs);
+   return true;
+} // aaEsp32Wroom32v3::startLinkMonitor()
+
+/**
+ * @brief Stop background monitoring of the gateway link.
+ * @details The task is asked to stop rather than deleted, so it never dies 
+ * holding the ping library lock or inside a critical section. Waits for the 
+ * probe in flight, at most about 1 second per target, before returning. 
+ * Called from a link callback it returns at once and the task exits after 
+ * the callback.
+ * @param null.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::stopLinkMonitor()
+{
+   if(_linkTask == NULL)
+   {
+      return;
+   } // if
+   _linkStop = true;
+   if(xTaskGetCurrentTaskHandle() == _linkTask)
+   {
+      return; // Called from a callback, the task exits when it returns.
+   } // if
+   xTaskNotifyGive(_linkTask);
+   while(_linkTask != NULL)
+   {
+      vTaskDelay(pdMS_TO_TICKS(10));
+   } // while
+   Log.verboseln("<aaEsp32Wroom32v3::stopLinkMonitor> Link monitor stopped.");
+} // aaEsp32Wroom32v3::stopLinkMonitor()
+
+/**
+ * @brief Add a host to be probed by the link monitor alongside the gateway.
+ * @param IPAddress Address of the extra host. 
+ * @return bool false when LINK_MONITOR_MAX_TARGETS targets are already in use.
+ ******************************************************************************/
+bool aaEsp32Wroom32v3::addLinkMonitorTarget(IPAddress address)
+{
+   bool added = false;
+   portENTER_CRITICAL(&_linkMux);
+   if(_linkTargets < LINK_MONITOR_MAX_TARGETS)
+   {
+      _link[_linkTargets] = linkQuality();
+      _link[_linkTargets].target = address;
+      _linkTargets++;
+      added = true;
+   } // if
+   portEXIT_CRITICAL(&_linkMux);
+   if(!added)
+   {
+      Log.warningln("<aaEsp32Wroom32v3::addLinkMonitorTarget> No room for %p, %d targets already in use.", address, LINK_MONITOR_MAX_TARGETS);
+   } // if
+   return added;
+} // aaEsp32Wroom32v3::addLinkMonitorTarget()
+
+/**
+ * @brief Set the thresholds at which the gateway link counts as degraded.
+ * @param rttMs smoothed round trip time in milliseconds.
+ * @param lossPct smoothed probe loss in percent.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::setLinkThresholds(float rttMs, float lossPct)
+{
+   _linkRttThreshold = rttMs;
+   _linkLossThreshold = lossPct;
+} // aaEsp32Wroom32v3::setLinkThresholds()
+
+/**
+ * @brief Register the function called when the gateway link degrades.
+ * @param linkCallback function to call, runs on the link monitor task.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::onLinkDegraded(linkCallback callback)
+{
+   _linkDegradedCb = callback;
+} // aaEsp32Wroom32v3::onLinkDegraded()
+
+/**
+ * @brief Register the function called when the gateway link recovers.
+ * @param linkCallback function to call, runs on the link monitor task.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::onLinkRecovered(linkCallback callback)
+{
+   _linkRecoveredCb = callback;
+} // aaEsp32Wroom32v3::onLinkRecovered()
+
+/**
+ * @brief Report whether the gateway link is currently degraded.
+ * @details Reads the state kept by the link monitor. Never blocks.
+ * @param null.
+ * @return bool true while the gateway link is degraded.
+ ******************************************************************************/
+bool aaEsp32Wroom32v3::isLinkDegraded()
+{
+   return _link[0].degraded;
+} // aaEsp32Wroom32v3::isLinkDegraded()
+
+/**
+ * @brief Return a copy of the gauges kept for one link monitor target.
+ * @param uint8_t Target index, 0 is the gateway. 
+ * @return linkQuality Snapshot of the gauges. All zero for unused targets.
+ ******************************************************************************/
+linkQuality aaEsp32Wroom32v3::getLinkQuality(uint8_t target)
+{
+   linkQuality snapshot = linkQuality();
+   if(target < LINK_MONITOR_MAX_TARGETS)
+   {
+      portENTER_CRITICAL(&_linkMux);
+      snapshot = _link[target];
+      portEXIT_CRITICAL(&_linkMux);
+   } // if
+   return snapshot;
+} // aaEsp32Wroom32v3::getLinkQuality()
+
+/**
+ * @brief FreeRTOS task body of the link monitor.
+ * @details Probes every target once per cycle while WiFi is connected. The 
+ * gateway address is refreshed each cycle because it can change on reconnect.
+ * Between cycles the task sleeps on its notification, so stopLinkMonitor() 
+ * wakes it early. It checks the stop flag between probes and deletes itself, 
+ * never while a probe holds the ping library.
+ * @param void* Pointer to the owning aaEsp32Wroom32v3 object.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_linkMonitorTask(void* param)
+{
+   aaEsp32Wroom32v3* self = (aaEsp32Wroom32v3*)param;
+   while(!self->_linkStop)
+   {
+      if(WiFi.status() == WL_CONNECTED)
+      {
+         IPAddress gateway = WiFi.gatewayIP();
+         portENTER_CRITICAL(&self->_linkMux);
+         self->_link[0].target = gateway;
+         portEXIT_CRITICAL(&self->_linkMux);
+         for(uint8_t i = 0; i < self->_linkTargets && !self->_linkStop; i++)
+         {
+            self->_linkProbe(i);
+         } // for
+      } // if
+      if(!self->_linkStop)
+      {
+         ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(self->_linkIntervalMs));
+      } // if
+   } // while
+   self->_linkTask = NULL;
+   vTaskDelete(NULL);
+} // aaEsp32Wroom32v3::_linkMonitorTask()
+
+/**
+ * @brief Ping result callback used by the link monitor.
+ * @param void* The ping_option of the probe, carrying the owning object.
+ * @param void* The ping_resp with the probe result.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_linkProbeCb(void* opt, void* resp)
+{
+   ping_option* option = (ping_option*)opt;
+   ping_resp* result = (ping_resp*)resp;
+   aaEsp32Wroom32v3* self = (aaEsp32Wroom32v3*)option->reverse;
+   self->_linkProbeOk = (result->timeout_count == 0);
+   self->_linkProbeRtt = result->resp_time;
+} // aaEsp32Wroom32v3::_linkProbeCb()
+
+/**
+ * @brief Probe one target and update its gauges.
+ * @details Sends a single echo with a 1 second timeout and folds the result 
+ * into EWMA gauges with a weight of 1/8 for RTT and loss. Jitter follows 
+ * RFC 3550: the difference between this round trip and the last answered 
+ * one, smoothed with a weight of 1/16. Only the gateway (target 0) drives 
+ * the degraded and recovered callbacks.
+ * @param uint8_t Target index.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_linkProbe(uint8_t index)
+{
+   const float rttWeight = 1.0 / 8;
+   const float lossWeight = 1.0 / 8;
+   const float jitterWeight = 1.0 / 16;
+   ping_option option;
+   linkQuality gauges;
+   IPAddress target;
+   bool crossed = false;
+   portENTER_CRITICAL(&_linkMux);
+   target = _link[index].target;
+   portEXIT_CRITICAL(&_linkMux);
+   memset(&option, 0, sizeof(ping_option));
+   option.count = 1;
+   option.ip = target;
+   option.recv_function = &_linkProbeCb;
+   option.reverse = this;
+   _linkProbeOk = false;
+   _linkProbeRtt = 0;
+   ping_start(target, 1, 0, 0, 1, &option); // One echo, 1 second timeout.
+
+   portENTER_CRITICAL(&_linkMux);
+   linkQuality &link = _link[index];
+   if(_linkProbeOk)
+   {
+      if(link.answers == 0)
+      {
+         link.rttMs = _linkProbeRtt;
+      } // if
+      else
+      {
+         link.jitterMs += (fabs(_linkProbeRtt - link.lastRttMs) - link.jitterMs) * jitterWeight;
+         link.rttMs += (_linkProbeRtt - link.rttMs) * rttWeight;
+      } // else
+      link.lastRttMs = _linkProbeRtt;
+      link.answers++;
+   } // if
+   link.lossPct += ((_linkProbeOk ? 0.0 : 100.0) - link.lossPct) * lossWeight;
+   link.probes++;
+   link.lastProbeMs = millis();
+   if(index == 0)
+   {
+      if(!link.degraded && (link.rttMs >= _linkRttThreshold || link.lossPct >= _linkLossThreshold))
+      {
+         link.degraded = true;
+         crossed = true;
+      } // if
+      else if(link.degraded && link.rttMs < _linkRttThreshold / 2 && link.lossPct < _linkLossThreshold / 2)
+      {
+         link.degraded = false;
+         crossed = true;
+      } // else if
+   } // if
+   gauges = link;
+   portEXIT_CRITICAL(&_linkMux);
+
+   if(crossed)
+   {
+      Log.noticeln("<aaEsp32Wroom32v3::_linkProbe> Gateway link %s. RTT %D ms, loss %D%%, jitter %D ms.", gauges.degraded ? "degraded" : "recovered", gauges.rttMs, gauges.lossPct, gauges.jitterMs);
+      linkCallback callback = gauges.degraded ? _linkDegradedCb : _linkRecoveredCb;
+      if(callback != NULL)
+      {
+         callback(gauges);
+      } // if
+   } // if
+} // aaEsp32Wroom32v3::_linkProbe()
+
+/**
+ * @brief Pick the best ranked known Access Point from the scan results.
+ * @details Each Access Point found by the last scan is offered to the 
+ * selector, straight from the scan snapshot with the SSID hash worked out 
+ * when the scan reported it, so no String is built or SSID hashed again. The selector looks the SSID up in its hash index of the known 
+ * networks and ranks the known ones by RSSI, configured priority and past 
+ * connection success and connect time. The BSSID and channel of the winner 
+ * are kept so that the association is pinned to it. The channels known 
+ * networks turn up on are remembered for the next scan.
+ * @param null.
+ * @return const char* Service Set IDentifier (SSID). 
+ ******************************************************************************/
+const char* aaEsp32Wroom32v3::_lookForAP()
+{
+   scanEntry entry; // One Access Point found by the scan.
+   const apCandidate* best; // Highest ranked known Access Point.
+   uint16_t seen = 0; // Channels known networks were found on.
+   _ssid = _unknownAP; //  At the start no known Access Point has been foundto connect to
+   _apSelector.clearCandidates();
+   for(uint8_t i = 0; getScanResult(i, entry); i++)
+   {
+      if(_apSelector.offer(entry.ssid, entry.ssidLen, entry.ssidHash, entry.rssi, entry.channel, entry.bssid))
+      {
+         seen |= 1 << entry.channel;
+      } // if
+   } //for
+   if(_scanConfig.channels == 0 && seen != 0)
+   {
+      _knownChannels = seen; // A full scan shows where the known networks are now.
+   } // if
+   best = _apSelector.candidate(0);
+   if(best == NULL)
+   {
+      Log.verboseln("<aaEsp32Wroom32v3::_lookForAP> None of the %d Access Points found by the scan is known.", scanResultCount());
+      return _ssid;
+   } // if
+   _selected = *best;
+   _SSIDIndex = best->known;
+   _ssid = _networks[_SSIDIndex].ssid;
+   _password = _networks[_SSIDIndex].password;
+   Log.verboseln("<aaEsp32Wroom32v3::_lookForAP> Picked %s (%d db, channel %d, score %d) out of %d Access Points.", _ssid, best->rssi, best->channel, best->score, scanResultCount());
+   return _ssid;
+} // aaEsp32Wroom32v3::_lookForAP()
+
+/**
+ * @brief Provide human readable Wifi encryption method.
+ * @details Wifi encryptions options are:
+ * 1. OPEN
+ * 2. WEP
+ * 3. WPA_PSK
+ * 4. WPA2_PSK
+ * 5. WPA_WPA2_PSK
+ * 6. WPA2_ENTERPRISE
+ * @param wifi_auth_mode_t Wifi encryption type code.
+ * @return const char* Encryption type in one word. 
+ ******************************************************************************/
+const char* aaEsp32Wroom32v3::_translateEncryptionType(wifi_auth_mode_t encryptionType)
+{
+   switch (encryptionType)
+   {
+      case (WIFI_AUTH_OPEN): return "Open";
+      case (WIFI_AUTH_WEP): return "WEP";
+      case (WIFI_AUTH_WPA_PSK): return "WPA_PSK";
+      case (WIFI_AUTH_WPA2_PSK): return "WPA2_PSK";
+      case (WIFI_AUTH_WPA_WPA2_PSK): return "WPA_WPA2_PSK";
+      case (WIFI_AUTH_WPA2_ENTERPRISE): return "WPA2_ENTERPRISE";
+      default: return "UNKNOWN";
+   } //switch
+} // aaEsp32Wroom32v3::_translateEncryptionType()
+
+/**
+ * @brief Event handler for wifi.
+ * @details Runs on the system event task, which also drives the network 
+ * stack, so it only turns the event into a wifiEventRecord, queues it and 
+ * wakes the dispatch task. Logging and everything else happens in the 
+ * subscribers, see _wifiEventTask().
+ * @param WiFiEvent_t Type of event that triggered this handler.
+ * @param WiFiEventInfo_t Additional information about the triggering event.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_wiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info)
+{
+   aaEsp32Wroom32v3* owner = _wifiOwner;
+   wifiEventRecord record = {(uint32_t)micros(), 0, (uint8_t)event};
+   switch(event) 
+   {
+      case SYSTEM_EVENT_SCAN_DONE:
+         record.data = info.scan_done.status;
+         break;
+      case SYSTEM_EVENT_STA_GOT_IP:
+         record.data = info.got_ip.ip_info.ip.addr;
+         break;
+      case SYSTEM_EVENT_STA_DISCONNECTED:
+         record.data = info.disconnected.reason;
+         break;
+      default:
+         break;
+   } //switch
+   if(owner != NULL && owner->_eventTask != NULL && owner->_eventPush(record))
+   {
+      xTaskNotifyGive(owner->_eventTask);
+   } // if
+} // aaEsp32Wroom32v3::_wiFiEvent()
+
+/**
+ * @brief Register the WiFi event handler and start the dispatch task.
+ * @details Done once, by connectWifi(), startScan() or 
+ * subscribeWifiEvents(). _wifiCoreEvent() is always the first subscriber so 
+ * the scan and the connection manager see an event before user code does.
+ * @param null.
+ * @return bool true if events are being dispatched.
+ ******************************************************************************/
+bool aaEsp32Wroom32v3::_wifiEventsStart()
+{
+   if(_eventTask == NULL)
+   {
+      portENTER_CRITICAL(&_wifiMux);
+      _eventSubscriber[0] = _wifiCoreEvent;
+      _eventContext[0] = this;
+      portEXIT_CRITICAL(&_wifiMux);
+      if(xTaskCreatePinnedToCore(_wifiEventTask, "wifiEvents", WIFI_EVENT_STACK_SIZE, this, 2, &_eventTask, 1) != pdPASS)
+      {
+         _eventTask = NULL;
+         Log.errorln("<aaEsp32Wroom32v3::_wifiEventsStart> Unable to create WiFi event dispatch task.");
+         return false;
+      } // if
+   } // if
+   if(_wifiOwner != this)
+   {
+      _wifiOwner = this;
+      WiFi.onEvent(_wiFiEvent); // Set up WiFi event handler
+   } // if
+   return true;
+} // aaEsp32Wroom32v3::_wifiEventsStart()
+
+/**
+ * @brief Queue a WiFi event for the dispatch task.
+ * @details Called from _wiFiEvent() on the core's system event task, which 
+ * also delivers the driver's events to lwIP, so it must never wait on a 
+ * subscriber. _eventHead and _eventTail count events forever and wrap 
+ * together, so their difference is the depth even across the wrap and a 
+ * slot is the count modulo WIFI_EVENT_QUEUE. The record is copied in before 
+ * the new head is stored, so the dispatch task never sees a half written 
+ * slot. A full queue drops the new event rather than overwrite one the 
+ * dispatch task may be copying out. Only the counters in _eventStats take 
+ * _wifiMux, for a few instructions.
+ * @param wifiEventRecord Event to queue.
+ * @return bool true if the event was queued.
+ ******************************************************************************/
+bool aaEsp32Wroom32v3::_eventPush(const wifiEventRecord& record)
+{
+   uint32_t head = _eventHead;
+   uint32_t depth = head - __atomic_load_n(&_eventTail, __ATOMIC_ACQUIRE);
+   if(depth >= WIFI_EVENT_QUEUE)
+   {
+      portENTER_CRITICAL(&_wifiMux);
+      _eventStats.dropped++;
+      portEXIT_CRITICAL(&_wifiMux);
+      return false;
+   } // if
+   _eventRing[head % WIFI_EVENT_QUEUE] = record;
+   __atomic_store_n(&_eventHead, head + 1, __ATOMIC_RELEASE);
+   portENTER_CRITICAL(&_wifiMux);
+   _eventStats.queued++;
+   _eventStats.maxDepth = max(_eventStats.maxDepth, (uint8_t)(depth + 1));
+   portEXIT_CRITICAL(&_wifiMux);
+   return true;
+} // aaEsp32Wroom32v3::_eventPush()
+
+/**
+ * @brief Take the oldest WiFi event off the queue.
+ * @param wifiEventRecord& Filled in with the event.
+ * @return bool false if the queue is empty.
+ ******************************************************************************/
+bool aaEsp32Wroom32v3::_eventPop(wifiEventRecord& record)
+{
+   uint32_t tail = _eventTail;
+   if(tail == __atomic_load_n(&_eventHead, __ATOMIC_ACQUIRE))
+   {
+      return false;
+   } // if
+   record = _eventRing[tail % WIFI_EVENT_QUEUE];
+   __atomic_store_n(&_eventTail, tail + 1, __ATOMIC_RELEASE);
+   return true;
+} // aaEsp32Wroom32v3::_eventPop()
+
+/**
+ * @brief FreeRTOS task body of the WiFi event dispatcher.
+ * @details Sleeps until _wiFiEvent() queues something, then hands every 
+ * queued event to each subscriber in the order they subscribed. The time an 
+ * event waited between the system event task and dispatch is kept in 
+ * wifiEventStats. Runs one priority above the manager and link monitor so 
+ * events are not held up behind their work.
+ * @param void* Pointer to the owning aaEsp32Wroom32v3 object.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_wifiEventTask(void* param)
+{
+   aaEsp32Wroom32v3* self = (aaEsp32Wroom32v3*)param;
+   wifiEventRecord record;
+   wifiEventCallback subscriber[WIFI_EVENT_MAX_SUBSCRIBERS];
+   void* context[WIFI_EVENT_MAX_SUBSCRIBERS];
+   uint32_t latencyUs;
+   for(;;)
+   {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      while(self->_eventPop(record))
+      {
+         latencyUs = micros() - record.stampUs;
+         portENTER_CRITICAL(&self->_wifiMux);
+         memcpy(subscriber, self->_eventSubscriber, sizeof(subscriber));
+         memcpy(context, self->_eventContext, sizeof(context));
+         wifiEventStats &stats = self->_eventStats;
+         stats.dispatched++;
+         stats.lastLatencyUs = latencyUs;
+         stats.maxLatencyUs = max(stats.maxLatencyUs, latencyUs);
+         stats.avgLatencyUs = stats.dispatched == 1 ? latencyUs : stats.avgLatencyUs + (latencyUs - stats.avgLatencyUs) / 8;
+         portEXIT_CRITICAL(&self->_wifiMux);
+         for(uint8_t i = 0; i < WIFI_EVENT_MAX_SUBSCRIBERS; i++)
+         {
+            if(subscriber[i] != NULL)
+            {
+               subscriber[i](record, context[i]);
+            } // if
+         } // for
+      } // while
+   } // for
+} // aaEsp32Wroom32v3::_wifiEventTask()
+
+/**
+ * @brief Subscriber that feeds WiFi events to this object.
+ * @details Logs all wifi event activity and passes the station connect, got 
+ * IP, lost IP and disconnect events on to the WiFi connection manager task as 
+ * notification bits. Scan done events are handed to _scanDone(). Station 
+ * start puts back the sleep mode of the power profile. The 
+ * timestamps of scan done, connect and got IP events are kept for the 
+ * connection phase times.
+ * @param wifiEventRecord Event to handle.
+ * @param void* Pointer to the owning aaEsp32Wroom32v3 object.
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::_wifiCoreEvent(const wifiEventRecord& record, void* context)
+{
+   aaEsp32Wroom32v3* self = (aaEsp32Wroom32v3*)context;
+   uint32_t notify = 0; // WIFI_EVENT_* bits for the connection manager.
+   switch(record.event) 
+   {
+      case SYSTEM_EVENT_AP_START:
+//         WiFi.softAP(AP_SSID, AP_PASS); //can set ap hostname here   
+//         WiFi.softAPenableIpV6(); //enable ap ipv6 here
+         Log.verboseln("<aaEsp32Wroom32v3::WiFiEvent> Detected SYSTEM_EVENT_AP_START");            
+         break;
+      case SYSTEM_EVENT_SCAN_DONE:
+         Log.verboseln("<aaEsp32Wroom32v3::WiFiEvent> Detected SYSTEM_EVENT_SCAN_DONE");            
+         self->_scanDoneUs = record.stampUs;
+         self->_scanDone(record.data);
+         break;
+      case SYSTEM_EVENT_STA_START:         
+//         WiFi.setHostname(AP_SSID); //set sta hostname here
+         Log.verboseln("<aaEsp32Wroom32v3::WiFiEvent> Detected SYSTEM_EVENT_STA_START");            
+         self->_powerApply(self->_power); // The core has just reset the sleep mode.
+         break;
+      case SYSTEM_EVENT_STA_CONNECTED:         
+//         WiFi.enableIpV6(); //enable sta ipv6 here
+         Log.verboseln("<aaEsp32Wroom32v3::WiFiEvent> Detected SYSTEM_EVENT_STA_CONNECTED");            
+         self->_connectedUs = record.stampUs;
+         notify = WIFI_EVENT_CONNECTED;
+         break;
+      case SYSTEM_EVENT_AP_STA_GOT_IP6:
+         Log.verboseln("<aaEsp32Wroom32v3::WiFiEvent> Detected SYSTEM_EVENT_AP_STA_GOT_IP6");            
+         break;
+      case SYSTEM_EVENT_STA_GOT_IP:
+//         wifiOnConnect(); // Call function to do things dependant upon getting wifi connected
+         Log.verboseln("<aaEsp32Wroom32v3::WiFiEvent> Detected SYSTEM_EVENT_STA_GOT_IP");            
+         self->_gotIpUs = record.stampUs;
+         notify = WIFI_EVENT_GOT_IP;
+         break;
+      case SYSTEM_EVENT_STA_LOST_IP:
+         Log.verboseln("<aaEsp32Wroom32v3::WiFiEvent> Detected SYSTEM_EVENT_STA_LOST_IP");            
+         notify = WIFI_EVENT_LOST_IP;
+         break;
+      case SYSTEM_EVENT_STA_DISCONNECTED:
+         Log.verboseln("<aaEsp32Wroom32v3::WiFiEvent> Detected SYSTEM_EVENT_STA_DISCONNECTED, reason %d", record.data);            
+         self->_wifiReason = record.data;
+         notify = WIFI_EVENT_DISCONNECTED;
+         break;
+      default:
+         Log.verboseln(F("<aaEsp32Wroom32v3::WiFiEvent> ERROR - UNKNOW SYSTEM EVENT %p."), record.event); 
+         break;
+   } //switch
+   if(notify != 0)
+   {
+      portENTER_CRITICAL(&self->_wifiMux);
+      if(self->_wifiTask != NULL)
+      {
+         xTaskNotify(self->_wifiTask, notify, eSetBits);
+      } // if
+      portEXIT_CRITICAL(&self->_wifiMux);
+   } // if
+} // aaEsp32Wroom32v3::_wifiCoreEvent()
+
+/**
+ * @brief Call a function for every WiFi event.
+ * @details The function runs on the WiFi event dispatch task, after the 
+ * scan and the connection manager have seen the event, and may block for a 
+ * while without stalling the network stack. Events that arrive meanwhile 
+ * wait on the queue, up to WIFI_EVENT_QUEUE of them.
+ * @param wifiEventCallback Function to call.
+ * @param void* Passed back to the function with every event.
+ * @return bool false if WIFI_EVENT_MAX_SUBSCRIBERS are already subscribed.
+ ******************************************************************************/
+bool aaEsp32Wroom32v3::subscribeWifiEvents(wifiEventCallback callback, void* context)
+{
+   int8_t slot = -1;
+   if(callback == NULL || !_wifiEventsStart())
+   {
+      return false;
+   } // if
+   portENTER_CRITICAL(&_wifiMux);
+   for(uint8_t i = 0; i < WIFI_EVENT_MAX_SUBSCRIBERS; i++)
+   {
+      if(_eventSubscriber[i] == callback && _eventContext[i] == context)
+      {
+         slot = i;
+         break;
+      } // if
+      if(_eventSubscriber[i] == NULL && slot < 0)
+      {
+         slot = i;
+      } // if
+   } // for
+   if(slot >= 0)
+   {
+      _eventSubscriber[slot] = callback;
+      _eventContext[slot] = context;
+   } // if
+   portEXIT_CRITICAL(&_wifiMux);
+   return slot >= 0;
+} // aaEsp32Wroom32v3::subscribeWifiEvents()
+
+/**
+ * @brief Stop calling a subscribed function.
+ * @param wifiEventCallback Function passed to subscribeWifiEvents().
+ * @param void* Context passed to subscribeWifiEvents().
+ * @return null.
+ ******************************************************************************/
+void aaEsp32Wroom32v3::unsubscribeWifiEvents(wifiEventCallback callback, void* context)
+{
+   portENTER_CRITICAL(&_wifiMux);
+   for(uint8_t i = 0; i < WIFI_EVENT_MAX_SUBSCRIBERS; i++)
+   {
+      if(_eventSubscriber[i] == callback && _eventContext[i] == context && callback != _wifiCoreEvent)
+      {
+         _eventSubscriber[i] = NULL;
+         _eventContext[i] = NULL;
+      } // if
+   } // for
+   portEXIT_CRITICAL(&_wifiMux);
+} // aaEsp32Wroom32v3::unsubscribeWifiEvents()
+
+/**
+ * @brief Return a copy of the WiFi event queue counters.
+ * @param null.
+ * @return wifiEventStats Queue depth now and at worst, and dispatch latency.
+ ******************************************************************************/
+wifiEventStats aaEsp32Wroom32v3::getWifiEventStats()
+{
+   wifiEventStats snapshot;
+   portENTER_CRITICAL(&_wifiMux);
+   snapshot = _eventStats;
+   portEXIT_CRITICAL(&_wifiMux);
+   snapshot.depth = __atomic_load_n(&_eventHead, __ATOMIC_ACQUIRE) - __atomic_load_n(&_eventTail, __ATOMIC_ACQUIRE);
+   return snapshot;
+} // aaEsp32Wroom32v3::getWifiEventStats()
 
 /**
  * @brief Initialize Bluetooth system.
@@ -22,7 +22,47 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 /**
  * Compiler substitution macros.
  ******************************************************************************/
-//#define 
+#define LINK_MONITOR_MAX_TARGETS 4 // Gateway plus up to 3 extra hosts probed by the link monitor.
+#define LINK_MONITOR_MIN_INTERVAL_MS 1000 // Fastest allowed probe cycle of the link monitor.
+#define LINK_MONITOR_STACK_SIZE 3072 // Stack size (bytes) of the link monitor task.
+#define LINK_DEGRADED_RTT_MS 150 // Smoothed gateway RTT at or above which the link is degraded.
+#define LINK_DEGRADED_LOSS_PCT 20 // Smoothed gateway loss at or above which the link is degraded.
+#define WIFI_MANAGER_STACK_SIZE 4096 // Stack size (bytes) of the WiFi connection manager task.
+#define WIFI_MANAGER_TICK_MS 100 // Longest the WiFi connection manager sleeps between steps.
+#define WIFI_SCAN_TIMEOUT_MS 8000 // Give up on a scan that has not completed after this long.
+#define WIFI_ASSOCIATE_TIMEOUT_MS 10000 // Give up on authentication and association after this long.
+#define WIFI_DHCP_TIMEOUT_MS 10000 // Give up waiting for an IP address after this long.
+#define WIFI_BACKOFF_MIN_MS 500 // Backoff after the first failed connection attempt.
+#define WIFI_BACKOFF_MAX_MS 60000 // Backoff never grows past this.
+#define WIFI_FAST_CONNECT_TIMEOUT_MS 1500 // Give up on a channel pinned connect from the cache after this long.
+#define WIFI_CACHE_MAGIC 0xAA5710C2 // Marks a valid fast reconnect cache entry.
+#define WIFI_CACHE_NAMESPACE "aaWifi" // NVS namespace holding the fast reconnect cache.
+#define WIFI_LEASE_MAGIC 0xAA5710D1 // Marks a valid cached DHCP lease.
+#define WIFI_PHASE_MAGIC 0xAA5710E1 // Marks valid connection phase statistics.
+#define WIFI_PHASE_NAMESPACE "aaWifiPhase" // NVS namespace holding the connection phase statistics.
+#define WIFI_PHASE_EWMA_BOOTS 8 // Phase averages are plain means up to this many boots, then EWMAs with weight 1/8.
+#define WIFI_POWER_LISTEN_INTERVAL 10 // Beacon intervals the low power profile sleeps through between wakeups.
+#define WIFI_POWER_SETTLE_MS 500 // Time a power profile is given to settle before it is measured.
+#define WIFI_SCAN_MAX_RESULTS SCAN_STORE_MAX_ENTRIES // Access Points kept from one scan, the strongest win.
+#define WIFI_SCAN_DWELL_MIN_MS 100 // Default least time an active scan spends on a channel.
+#define WIFI_SCAN_DWELL_MAX_MS 300 // Default most time an active scan (or any passive scan) spends on a channel.
+#define WIFI_KNOWN_SCAN_DWELL_MS 120 // Time the connection manager spends on each channel known networks use.
+#define WIFI_RSSI_SAMPLE_MS 1000 // Time between background RSSI samples while connected.
+#define WIFI_ROAM_HYSTERESIS_DB 5 // Smoothed RSSI must climb this far above notGood before roaming stands down.
+#define WIFI_ROAM_MIN_GAIN_DB 8 // Another Access Point must be this much stronger to be worth the switch.
+#define WIFI_ROAM_SCAN_INTERVAL_MS 15000 // Time between background scans while the signal is not good.
+#define WIFI_ROAM_URGENT_SCAN_MS 4000 // Time between background scans while the signal is unusable.
+#define WIFI_ROAM_SCAN_DWELL_MS 60 // Time a background scan spends off the current channel per channel.
+#define WIFI_ROAM_TIMEOUT_MS 3000 // Give up on the new Access Point and go back after this long.
+#define WIFI_ROAM_FULL_SCAN_EVERY 4 // Every this many background scans covers the whole band to relearn the channels.
+#define WIFI_EVENT_QUEUE 16 // WiFi event records the dispatch queue holds. A power of two.
+#define WIFI_EVENT_MAX_SUBSCRIBERS 6 // Most functions that can subscribe to WiFi events.
+#define WIFI_EVENT_STACK_SIZE 3072 // Stack size (bytes) of the WiFi event dispatch task.
+#define WIFI_EVENT_CONNECTED 0x01 // Task notification bit for SYSTEM_EVENT_STA_CONNECTED.
+#define WIFI_EVENT_GOT_IP 0x02 // Task notification bit for SYSTEM_EVENT_STA_GOT_IP.
+#define WIFI_EVENT_DISCONNECTED 0x04 // Task notification bit for SYSTEM_EVENT_STA_DISCONNECTED.
+#define WIFI_EVENT_LOST_IP 0x08 // Task notification bit for SYSTEM_EVENT_STA_LOST_IP.
+#define WIFI_EVENT_STOP 0x10 // Task notification bit asking the manager task to exit.
 
 /**
  * Included libraries.
@@ -33,9 +73,17 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 #include <WiFi.h> // Required to connect to WiFi network. Comes with Platform.io.
 #include <aaFormat.h> // Collection of handy format conversion functions.
 #include <knownNetworks.h> // Defines Access points and passwords that the robot can scan for and connect to.
+#include <aaApSelector.h> // Ranks scanned Access Points against the known ones.
+#include <aaScanStore.h> // Compact snapshot of scan results.
 #include <ESP32Ping.h> // Verify IP addresses. https://github.com/marian-craciunescu/ESP32Ping.
+#include <ping_arp.h> // ARP reachability probe for hosts on the local subnet.
+#include <Preferences.h> // NVS key/value storage. Comes with Platform.io.
+#include "tcpip_adapter.h" // Station netif, to read the lease DHCP granted.
+#include "lwip/dhcp.h" // DHCP client state of a netif.
 #include "esp_bt_main.h" // Bluetooth support.
 #include "esp_bt_device.h" // Bluetooth support.
+#include "esp_wifi.h" // Modem sleep mode and station listen interval.
+#include "esp_partition.h" // Memory mapped known network partition.
 
 /**
  * Global variables.
@@ -51,6 +99,179 @@ enum signalStrength ///< Provides text translation of Wifi signal strength.
 
 static const int8_t HOST_NAME_SIZE = 30;  ///< Max size of network name.
 
+struct linkQuality ///< Smoothed gauges kept by the link monitor for one target.
+{
+   IPAddress target; ///< Address being probed.
+   float rttMs; ///< EWMA of round trip time in milliseconds.
+   float lossPct; ///< EWMA of probe loss in percent.
+   float jitterMs; ///< EWMA of the difference between consecutive round trips.
+   float lastRttMs; ///< Round trip of the last answered probe, the base of jitterMs.
+   uint32_t probes; ///< Number of probes sent to this target.
+   uint32_t answers; ///< Number of probes answered.
+   unsigned long lastProbeMs; ///< millis() timestamp of the last probe.
+   bool degraded; ///< True while the gauges are past the degraded thresholds.
+}; //struct
+
+typedef void (*linkCallback)(const linkQuality&); ///< Signature of link monitor threshold callbacks.
+
+enum wifiState ///< States walked by the WiFi connection manager.
+{
+   wifiIdle, ///< Manager not started.
+   wifiScan, ///< Scanning the 2.4GHz band.
+   wifiSelect, ///< Picking a known Access Point from the scan results.
+   wifiAssociate, ///< Authenticating and associating with the selected Access Point.
+   wifiDhcp, ///< Associated, waiting for an IP address.
+   wifiConnected, ///< Associated with an IP address.
+   wifiBackoff, ///< Waiting before the next attempt after a failure.
+   wifiRoam, ///< Connected, switching to a stronger known Access Point.
+}; //enum
+
+struct wifiStatus ///< Snapshot of the WiFi connection manager.
+{
+   wifiState state; ///< Current state.
+   unsigned long stateSinceMs; ///< millis() timestamp of entry into the current state.
+   unsigned long connectedSinceMs; ///< millis() timestamp of the last transition to wifiConnected.
+   unsigned long disconnectedAtMs; ///< millis() timestamp of the last disconnect event.
+   unsigned long nextAttemptMs; ///< millis() timestamp at which wifiBackoff ends.
+   uint16_t failures; ///< Consecutive failed attempts, drives the backoff.
+   uint32_t connects; ///< Number of times an IP address was obtained.
+   uint32_t disconnects; ///< Number of times an established connection was lost.
+   uint8_t lastReason; ///< 802.11 reason code of the last disconnect event.
+   uint32_t connectMs; ///< Time from the start of the last successful attempt to its IP address.
+   uint32_t savedMs; ///< Time the fast reconnect saved against the last scan based connect.
+   bool fastConnect; ///< True if the last connection came from the fast reconnect cache.
+   bool cachedLease; ///< True if the last connection reused a cached DHCP lease.
+   uint32_t dhcpMs; ///< Time from association to IP address on the last connect.
+   uint32_t dhcpSavedMs; ///< Time the cached lease saved against the DHCP exchange it replaced.
+   uint32_t roams; ///< Number of times the manager moved to a stronger Access Point.
+}; //struct
+
+struct rssiStats ///< Background RSSI samples of the current connection.
+{
+   float ewma; ///< EWMA of the samples in db with a weight of 1/4, 0 until the first sample.
+   int8_t min; ///< Weakest sample in db.
+   int8_t max; ///< Strongest sample in db.
+   uint32_t samples; ///< Samples taken since the connection came up.
+   unsigned long sampledAtMs; ///< millis() timestamp of the last sample.
+}; //struct
+
+enum dhcpCacheMode ///< How the connection manager reuses cached DHCP leases.
+{
+   dhcpCacheOff, ///< Always run DHCP.
+   dhcpCacheStatic, ///< Apply a cached lease as a static address while it is certainly still valid.
+   dhcpCacheStaticArp, ///< As dhcpCacheStatic, then ask by ARP whether another host still answers for the address and the gateway is there.
+}; //enum
+
+struct dhcpLease ///< Last DHCP lease granted on one known network, kept in NVS.
+{
+   uint32_t magic; ///< WIFI_LEASE_MAGIC when the entry is valid.
+   uint32_t ssidHash; ///< FNV-1a hash of the SSID the lease belongs to.
+   uint32_t ip; ///< Leased address.
+   uint32_t gateway; ///< Gateway the server handed out.
+   uint32_t netmask; ///< Subnet mask the server handed out.
+   uint32_t dns1; ///< Primary DNS server.
+   uint32_t dns2; ///< Secondary DNS server.
+   uint32_t leaseS; ///< Lease time granted, in seconds.
+   uint32_t obtainedS; ///< time() when the lease was granted.
+   uint32_t clockToken; ///< Identifies the RTC clock run time() was read from.
+   uint32_t dhcpMs; ///< How long the DHCP exchange that granted it took.
+}; //struct
+
+enum wifiPowerProfile ///< Trade between WiFi latency and current draw.
+{
+   wifiPowerMax, ///< No modem sleep. Lowest latency, highest current.
+   wifiPowerBalanced, ///< Modem sleeps between DTIM beacons. The ESP-IDF default.
+   wifiPowerLow, ///< Modem sleeps for WIFI_POWER_LISTEN_INTERVAL beacons at a time.
+   wifiPowerProfiles, ///< Number of profiles, not a profile.
+}; //enum
+
+struct powerProfileResult ///< Gateway latency and throughput measured under one power profile.
+{
+   wifiPowerProfile profile; ///< Profile measured.
+   bool measured; ///< false if the profile cannot be measured on the current association, the rest is then 0.
+   float rttMs; ///< Average ping round trip time to the gateway.
+   uint32_t rttP95Us; ///< 95th percentile round trip time.
+   float lossPct; ///< Share of pings lost.
+   uint32_t kbps; ///< Bottleneck bandwidth to the gateway in kbit/s, 0 if not measured.
+}; //struct
+
+struct wifiScanConfig ///< Settings of an asynchronous scan started with startScan().
+{
+   uint16_t channels; ///< Bit n set scans channel n (1 to 14). 0 scans every channel in one pass.
+   bool passive; ///< Listen for beacons instead of sending probe requests.
+   bool showHidden; ///< Include Access Points that hide their SSID.
+   uint16_t minDwellMs; ///< Active scans only, least time spent on a channel.
+   uint16_t maxDwellMs; ///< Most time spent on a channel. The only dwell time of a passive scan.
+}; //struct
+
+typedef void (*scanCallback)(const scanEntry*, uint8_t); ///< Signature of scan complete callbacks.
+
+struct wifiEventRecord ///< One WiFi event, as queued for the dispatch task.
+{
+   uint32_t stampUs; ///< micros() timestamp of the event on the system event task.
+   uint32_t data; ///< Disconnect reason, scan status or IPv4 address, depending on the event.
+   uint8_t event; ///< system_event_id_t of the event.
+}; //struct
+
+typedef void (*wifiEventCallback)(const wifiEventRecord&, void*); ///< Signature of WiFi event subscribers.
+
+struct wifiEventStats ///< Health of the WiFi event queue.
+{
+   uint32_t queued; ///< Events put on the queue.
+   uint32_t dropped; ///< Events lost because the queue was full.
+   uint32_t dispatched; ///< Events handed to the subscribers.
+   uint8_t depth; ///< Events waiting on the queue now.
+   uint8_t maxDepth; ///< Most events ever waiting at once.
+   uint32_t lastLatencyUs; ///< Time the last event waited before dispatch.
+   uint32_t maxLatencyUs; ///< Longest any event waited before dispatch.
+   float avgLatencyUs; ///< EWMA of the wait with a weight of 1/8.
+}; //struct
+
+enum wifiPhase ///< Phases of getting onto the network, timed from WiFi events.
+{
+   wifiPhaseScan, ///< Scanning for known Access Points, to SYSTEM_EVENT_SCAN_DONE.
+   wifiPhaseAssociate, ///< Authentication and association, to SYSTEM_EVENT_STA_CONNECTED.
+   wifiPhaseDhcp, ///< Getting an IP address, to SYSTEM_EVENT_STA_GOT_IP.
+   wifiPhaseBackoff, ///< Waiting between failed attempts.
+   wifiPhaseTotal, ///< connectWifi() to the first IP address.
+   wifiPhases, ///< Number of phases, not a phase.
+}; //enum
+
+struct wifiBootTiming ///< Time spent in each phase before the first IP address of this boot.
+{
+   uint32_t startUs; ///< micros() timestamp of connectWifi().
+   uint32_t phaseUs[wifiPhases]; ///< Time in each phase, summed over every attempt.
+   uint32_t bootMs; ///< millis() timestamp of the first IP address, time since power on.
+   uint8_t attempts; ///< Associations tried.
+   bool fastConnect; ///< The connection came from the fast reconnect cache.
+   bool cachedLease; ///< The address came from a cached DHCP lease.
+   bool complete; ///< The first IP address of this boot has arrived.
+}; //struct
+
+struct wifiPhaseStat ///< Rolling statistics of one phase across boots.
+{
+   float avgUs; ///< Mean, then EWMA, see WIFI_PHASE_EWMA_BOOTS.
+   uint32_t minUs; ///< Quickest boot.
+   uint32_t maxUs; ///< Slowest boot.
+}; //struct
+
+struct wifiPhaseHistory ///< Connection phase statistics across boots, kept in NVS.
+{
+   uint32_t magic; ///< WIFI_PHASE_MAGIC when valid.
+   uint32_t boots; ///< Boots folded in.
+   wifiPhaseStat phase[wifiPhases]; ///< Statistics of each phase.
+}; //struct
+
+struct wifiFastCache ///< Last good Access Point, kept in RTC memory and NVS.
+{
+   uint32_t magic; ///< WIFI_CACHE_MAGIC when the entry is valid.
+   uint32_t ssidHash; ///< FNV-1a hash of the SSID, catches a changed known network table.
+   uint32_t scanConnectMs; ///< Time the last scan based connect took.
+   uint8_t bssid[6]; ///< BSSID of the Access Point.
+   uint8_t channel; ///< Primary channel of the Access Point.
+   int16_t index; ///< Index of the Access Point in the known network table.
+}; //struct
+
 /**
  * The aaEsp32Wroom32v3 class provides a single object of authority regarding 
  * the ESP32Wroom32 version 3 SOC. Details are collected from both FreeRTOS and 
@@ -280,16 +501,54 @@ class aaEsp32Wroom32v3
       void logSubsystemDetails(); // Logs details of host micro controller.
       void getUniqueName(char&, const char*); // Construct a name that is sure to be unique on the network.
       bool areWeConnected(); // Return flag reporting if we are wifi connected or not.
-      void connectWifi(); // Connect to Wifi.
-      long rfSignalStrength(int8_t); // Collect an average WiFi signal strength. 
+      bool connectWifi(); // Start the non-blocking WiFi connection manager.
+      void disconnectWifi(); // Stop the WiFi connection manager and drop the connection.
+      wifiState getWifiState(); // O(1) non-blocking read of the connection manager state.
+      wifiStatus getWifiStatus(); // O(1) copy of the connection manager state and timestamps.
+      const char* wifiStateName(wifiState); // Human readable name of a connection manager state.
+      void forgetWifiCache(); // Erase the fast reconnect cache from RTC memory and NVS.
+      bool loadKnownNetworks(const char* label = KNOWN_NETWORKS_PARTITION); // Use the known networks in a data partition.
+      void setRoaming(bool); // Turn moving to stronger known Access Points on or off.
+      void setDhcpCache(dhcpCacheMode); // Choose how cached DHCP leases are reused.
+      void setPowerProfile(wifiPowerProfile); // Apply a modem sleep mode and listen interval.
+      wifiPowerProfile getPowerProfile(); // Power profile in use.
+      const char* powerProfileName(wifiPowerProfile); // Human readable name of a power profile.
+      bool measurePowerProfiles(powerProfileResult*, uint8_t pings = 20); // Gateway RTT and throughput under every profile.
+      bool startScan(const wifiScanConfig&, scanCallback callback = NULL); // Start an asynchronous scan.
+      void stopScan(); // Abandon the scan in progress.
+      bool isScanning(); // True until the scan in progress has finished.
+      uint8_t scanResultCount(); // Number of Access Points found by the last scan.
+      bool getScanResult(uint8_t, scanEntry&); // Copy of one Access Point found by the last scan, strongest first.
+      aaScanStore getScanStore(); // Copy of the snapshot of the last scan, for lookups.
+      uint32_t scanDurationMs(); // How long the last scan took.
+      long rfSignalStrength(); // Smoothed WiFi signal strength, never blocks.
+      rssiStats getRssiStats(); // Copy of the background RSSI samples.
+      const char* evalSignal(); // Human readable assessment of the smoothed signal strength.
       const char* evalSignal(int16_t); // Return human readable assessment of signal strength.
       bool pingIP(IPAddress); // Ping IP address and return response. Assume 1 ping.
       bool pingIP(IPAddress, int8_t); // Ping IP address and return response. User specified num pings.
+      bool arpProbe(IPAddress); // Check a host on the local subnet answers ARP.
+      bool arpProbe(IPAddress, ping_arp_result&, uint32_t timeoutMs = PING_ARP_TIMEOUT_MS); // ARP probe with MAC and resolution latency.
       bool configure(); // Configure the SOC.
+      bool startLinkMonitor(uint32_t intervalMs = 5000); // Start background probing of the gateway.
+      void stopLinkMonitor(); // Stop background probing.
+      bool addLinkMonitorTarget(IPAddress); // Probe an extra host alongside the gateway.
+      void setLinkThresholds(float rttMs, float lossPct); // Set the degraded thresholds.
+      void onLinkDegraded(linkCallback); // Called when the gateway link crosses a threshold.
+      void onLinkRecovered(linkCallback); // Called when the gateway link is healthy again.
+      bool isLinkDegraded(); // O(1) non-blocking read of the gateway link state.
+      linkQuality getLinkQuality(uint8_t target = 0); // O(1) copy of a target's gauges. Target 0 is the gateway.
+      bool subscribeWifiEvents(wifiEventCallback, void* context = NULL); // Call a function for every WiFi event.
+      void unsubscribeWifiEvents(wifiEventCallback, void* context = NULL); // Stop calling a subscribed function.
+      wifiEventStats getWifiEventStats(); // O(1) copy of the WiFi event queue depth and latency.
+      wifiBootTiming getBootTiming(); // O(1) copy of this boot's connection phase times.
+      wifiPhaseHistory getPhaseHistory(); // O(1) copy of the connection phase statistics across boots.
+      const char* wifiPhaseName(wifiPhase); // Human readable name of a connection phase.
+      void forgetPhaseHistory(); // Erase the connection phase statistics from NVS.
    private:
       void _transReasonCode(char&, RESET_REASON); // Translate reset reason codes.
       void _transFlashModeCode(char&); // Translate flash memory mode code.
-      const char* _lookForAP(); // Scan 2.4GHz radio spectrum for known Access Point.
+      const char* _lookForAP(); // Pick the best ranked known Access Point from the scan results.
       const char* _translateEncryptionType(wifi_auth_mode_t); // Provide human readable wifi encryption method.
       const char* _connectionStatus(wl_status_t); // Provide human readable text for wifi connection status codes. 
       static void _wiFiEvent(WiFiEvent_t, WiFiEventInfo_t); // Event handler for wifi.
@@ -300,10 +559,100 @@ class aaEsp32Wroom32v3
       const char* _ssid; // SSID of Access Point selected to connect to over Wifi. 
       const char* _password; // Password of Access Point selected to connect to over Wifi.
       aaFormat _convert; // Accept various variable type/formats and return a different variable type/format.
-      int8_t _SSIDIndex = 0; // Contains the SSID index number from the known list of APs.
+      int16_t _SSIDIndex = 0; // Contains the SSID index number from the known list of APs.
+      const knownNetwork* _networks = knownAPs; // Known network table in use, in flash.
+      uint16_t _networkCount = numKnownAPs; // Entries in the known network table in use.
       char _uniqueName[HOST_NAME_SIZE]; // Character array that holds unique name for Wifi network purposes. 
       char *_uniqueNamePtr = &_uniqueName[0]; // Pointer to first address position of unique name character array.
       const char* _HOST_NAME_PREFIX; // Prefix for unique network name. 
+      static void _linkMonitorTask(void*); // FreeRTOS task body of the link monitor.
+      static void _linkProbeCb(void*, void*); // Ping result callback used by the link monitor.
+      void _linkProbe(uint8_t); // Probe one target and update its gauges.
+      TaskHandle_t _linkTask = NULL; // Link monitor task, NULL when stopped.
+      volatile bool _linkStop = false; // Asks the link monitor task to exit.
+      uint32_t _linkIntervalMs = 5000; // Time between link monitor probe cycles.
+      uint8_t _linkTargets = 1; // Number of targets in use, the gateway is always target 0.
+      linkQuality _link[LINK_MONITOR_MAX_TARGETS]; // Gauges per target.
+      float _linkRttThreshold = LINK_DEGRADED_RTT_MS; // Degraded RTT threshold.
+      float _linkLossThreshold = LINK_DEGRADED_LOSS_PCT; // Degraded loss threshold.
+      linkCallback _linkDegradedCb = NULL; // User callback for degraded transitions.
+      linkCallback _linkRecoveredCb = NULL; // User callback for recovered transitions.
+      portMUX_TYPE _linkMux = portMUX_INITIALIZER_UNLOCKED; // Guards _link between the task and readers.
+      float _linkProbeRtt; // Result of the probe in flight, written by _linkProbeCb.
+      bool _linkProbeOk; // Result of the probe in flight, written by _linkProbeCb.
+      static aaEsp32Wroom32v3* _wifiOwner; // Object whose manager task receives WiFi events.
+      static void _wifiManagerTask(void*); // FreeRTOS task body of the WiFi connection manager.
+      void _wifiStep(uint32_t); // Advance the connection manager on events and timeouts.
+      void _wifiEnter(wifiState); // Change state and stamp the time.
+      void _wifiFail(const char*); // Count a failed attempt and back off.
+      void _wifiConnected(); // Time the connection and refresh the fast reconnect cache.
+      bool _wifiLoadCache(); // Load the fast reconnect cache from RTC memory or NVS.
+      void _wifiSaveCache(); // Store the current Access Point in the fast reconnect cache.
+      aaApSelector _apSelector; // Hashed index of the known networks and their connection history.
+      apCandidate _selected; // Access Point picked by _lookForAP().
+      unsigned long _wifiAssociateMs = 0; // millis() timestamp of the start of the current association.
+      uint16_t _knownChannels = 0; // Channels on which known networks were last seen, 0 if not yet learned.
+      bool _wifiFullScan = false; // Next manager scan covers every channel.
+      void _rssiSample(); // Take a background RSSI sample when one is due.
+      rssiStats _rssi = rssiStats(); // Background RSSI samples, written by the manager task.
+      void _roamStep(); // Watch the signal and look for a better Access Point while connected.
+      void _roamPick(); // Switch to the best stronger known Access Point from the background scan.
+      bool _roaming = true; // Roaming is turned on.
+      bool _roamWeak = false; // Smoothed RSSI fell to notGood and has not yet recovered.
+      bool _roamScan = false; // A background scan of the roaming manager is in progress.
+      bool _roamSwitching = false; // The current attempt is a roam, a failure goes back to the old AP.
+      unsigned long _roamScanMs = 0; // millis() timestamp of the last background scan.
+      uint8_t _roamScans = 0; // Background scans since the signal became weak.
+      bool _scanNext(); // Start the scan of the next channel in the list.
+      void _scanDone(uint8_t); // Collect the results of one scan pass. Runs on the dispatch task.
+      wifiScanConfig _scanConfig; // Settings of the scan in progress.
+      scanCallback _scanCallback = NULL; // Called when the scan in progress finishes.
+      aaScanStore _scanStore; // Access Points found by the last scan.
+      uint8_t _scanChannel = 0; // Channel being scanned, 0 for all.
+      volatile bool _scanning = false; // A scan started by startScan() is in progress.
+      unsigned long _scanStartMs = 0; // millis() timestamp of the start of the last scan.
+      uint32_t _scanDurationMs = 0; // How long the last scan took.
+      wifiFastCache _wifiCache; // Fast reconnect cache entry in use.
+      bool _wifiFast = false; // Current attempt is a channel pinned connect from the cache.
+      bool _dhcpApplyLease(); // Configure the cached lease of the selected network, or DHCP.
+      bool _dhcpCheckLease(); // ARP check of a lease applied as a static address.
+      void _dhcpSaveLease(uint32_t); // Store the lease DHCP just granted.
+      void _dhcpStep(); // Go back to DHCP when a cached lease is due for renewal.
+      void _dhcpUseDhcp(); // Drop the static address and run DHCP.
+      dhcpCacheMode _dhcpMode = dhcpCacheStaticArp; // How cached leases are reused.
+      void _powerApply(wifiPowerProfile, bool listen = false); // Apply a power profile to the modem.
+      void _wifiJoin(int32_t, const uint8_t*); // WiFi.begin() with the power profile written in before connecting.
+      wifiPowerProfile _power = wifiPowerBalanced; // Power profile in use.
+      uint16_t _powerListen = 0; // Listen interval announced by the current association, 0 for the default.
+      volatile bool _powerMeasuring = false; // measurePowerProfiles() is running, roaming waits.
+      dhcpLease _lease; // Cached lease of the network being connected to.
+      bool _dhcpStatic = false; // The station interface holds a cached lease as a static address.
+      void _phaseClose(wifiState, wifiState, uint32_t); // Add the time spent in a state to its phase.
+      void _phaseRecord(); // Fold this boot's phase times into the history.
+      wifiBootTiming _boot = wifiBootTiming(); // This boot's phase times, guarded by _wifiMux.
+      wifiPhaseHistory _phases = wifiPhaseHistory(); // Phase statistics across boots, guarded by _wifiMux.
+      uint32_t _phaseStartUs = 0; // micros() timestamp of entering the current state.
+      volatile uint32_t _scanDoneUs = 0; // Event timestamp of the last SYSTEM_EVENT_SCAN_DONE.
+      volatile uint32_t _connectedUs = 0; // Event timestamp of the last SYSTEM_EVENT_STA_CONNECTED.
+      volatile uint32_t _gotIpUs = 0; // Event timestamp of the last SYSTEM_EVENT_STA_GOT_IP.
+      unsigned long _wifiAttemptMs = 0; // millis() timestamp of the start of the current attempt.
+      unsigned long _wifiScanMs = 0; // millis() timestamp of the start of the last scan.
+      TaskHandle_t _wifiTask = NULL; // WiFi connection manager task, NULL when stopped.
+      wifiStatus _wifi = {wifiIdle}; // Connection manager state, guarded by _wifiMux.
+      volatile uint8_t _wifiReason = 0; // Reason code of the last disconnect, written by _wifiCoreEvent.
+      portMUX_TYPE _wifiMux = portMUX_INITIALIZER_UNLOCKED; // Guards _wifi between the task and readers.
+      bool _wifiEventsStart(); // Register the WiFi event handler and start the dispatch task.
+      static void _wifiEventTask(void*); // FreeRTOS task body of the WiFi event dispatcher.
+      static void _wifiCoreEvent(const wifiEventRecord&, void*); // Subscriber feeding the scan and manager.
+      bool _eventPush(const wifiEventRecord&); // Queue an event. Runs on the system event task.
+      bool _eventPop(wifiEventRecord&); // Take the oldest event. Runs on the dispatch task.
+      TaskHandle_t _eventTask = NULL; // WiFi event dispatch task, NULL until the handler is registered.
+      wifiEventRecord _eventRing[WIFI_EVENT_QUEUE]; // Lock-free single producer, single consumer queue.
+      uint32_t _eventHead = 0; // Next slot to write, only the system event task moves it.
+      uint32_t _eventTail = 0; // Next slot to read, only the dispatch task moves it.
+      wifiEventCallback _eventSubscriber[WIFI_EVENT_MAX_SUBSCRIBERS] = {}; // Subscribed functions, NULL when free.
+      void* _eventContext[WIFI_EVENT_MAX_SUBSCRIBERS] = {}; // Context passed to each subscribed function.
+      wifiEventStats _eventStats = wifiEventStats(); // Queue counters, guarded by _wifiMux.
 }; //class aaEsp32Wroom32v3
 
 #endif // End of precompiler protected code block
@@ -0,0 +1,236 @@
+#include <aaScanStore.h> // Header file for linking.
+
+static_assert(SCAN_STORE_MAX_ENTRIES <= 255, "entry positions must fit a uint8_t count");
+
+/**
+ * @brief This is the constructor for this class.
+ * @details Starts with an empty snapshot, which is stale.
+ * @param null.
+ * @return null.
+ ******************************************************************************/
+aaScanStore::aaScanStore()
+{
+   memset(_entries, 0, sizeof(_entries));
+} // aaScanStore::aaScanStore()
+
+/**
+ * @brief This is the destructor for this class.
+ * @param null.
+ * @return null.
+ ******************************************************************************/
+aaScanStore::~aaScanStore()
+{
+} // aaScanStore::~aaScanStore()
+
+/**
+ * @brief Forget the previous snapshot and start a new one.
+ * @param uint32_t millis() timestamp of the start of the scan.
+ * @return null.
+ ******************************************************************************/
+void aaScanStore::clear(uint32_t nowMs)
+{
+   _count = 0;
+   _takenMs = nowMs;
+} // aaScanStore::clear()
+
+/**
+ * @brief Add one Access Point to the snapshot.
+ * @details A BSSID already in the snapshot keeps the stronger reading. When
+ * the snapshot is full the new Access Point replaces the weakest one, if it
+ * is stronger. The SSID is hashed once here so that lookups, here and in
+ * aaApSelector, never hash it again.
+ * @param const char* SSID bytes, need not be null terminated.
+ * @param uint8_t Length of the SSID, longer than 32 is cut to 32.
+ * @param const uint8_t* BSSID, 6 bytes.
+ * @param uint8_t Primary channel.
+ * @param int8_t Signal strength in db.
+ * @param uint8_t wifi_auth_mode_t of the Access Point.
+ * @param uint32_t millis() timestamp of the reading.
+ * @return bool true if the Access Point is in the snapshot afterwards.
+ ******************************************************************************/
+bool aaScanStore::keep(const char* ssid, uint8_t length, const uint8_t* bssid, uint8_t channel, int8_t rssi, uint8_t auth, uint32_t nowMs)
+{
+   int16_t slot = find(bssid);
+   uint8_t weakest = 0;
+   if(slot >= 0 && rssi <= _entries[slot].rssi)
+   {
+      return true;
+   } // if
+   if(slot < 0)
+   {
+      for(uint8_t i = 1; i < _count; i++)
+      {
+         if(_entries[i].rssi < _entries[weakest].rssi)
+         {
+            weakest = i;
+         } // if
+      } // for
+      if(_count < SCAN_STORE_MAX_ENTRIES)
+      {
+         slot = _count++;
+      } // if
+      else if(rssi > _entries[weakest].rssi)
+      {
+         slot = weakest;
+      } // else if
+      else
+      {
+         return false;
+      } // else
+   } // if
+   scanEntry &entry = _entries[slot];
+   length = min(length, (uint8_t)32);
+   memcpy(entry.ssid, ssid, length);
+   entry.ssid[length] = '\0';
+   entry.ssidLen = length;
+   entry.ssidHash = aaApSelector::hash(ssid, length);
+   memcpy(entry.bssid, bssid, sizeof(entry.bssid));
+   entry.channel = channel;
+   entry.rssi = rssi;
+   entry.auth = auth;
+   entry.seenMs = nowMs;
+   return true;
+} // aaScanStore::keep()
+
+/**
+ * @brief Reorder the entries in place.
+ * @details Insertion sort, stable, so entries that compare equal keep the
+ * order they were heard in.
+ * @param scanOrder Order to sort in.
+ * @return null.
+ ******************************************************************************/
+void aaScanStore::sort(scanOrder order)
+{
+   scanEntry moving;
+   int16_t j;
+   for(uint8_t i = 1; i < _count; i++)
+   {
+      moving = _entries[i];
+      for(j = i - 1; j >= 0 && _before(moving, _entries[j], order); j--)
+      {
+         _entries[j + 1] = _entries[j];
+      } // for
+      _entries[j + 1] = moving;
+   } // for
+} // aaScanStore::sort()
+
+/**
+ * @brief Sort comparison.
+ * @param scanEntry Entry being placed.
+ * @param scanEntry Entry already placed.
+ * @param scanOrder Order to sort in.
+ * @return bool true if the first entry goes before the second.
+ ******************************************************************************/
+bool aaScanStore::_before(const scanEntry& a, const scanEntry& b, scanOrder order) const
+{
+   int compared;
+   switch(order)
+   {
+      case scanByChannel:
+         if(a.channel != b.channel)
+         {
+            return a.channel < b.channel;
+         } // if
+         break;
+      case scanBySsid:
+         compared = memcmp(a.ssid, b.ssid, min(a.ssidLen, b.ssidLen));
+         if(compared != 0 || a.ssidLen != b.ssidLen)
+         {
+            return compared != 0 ? compared < 0 : a.ssidLen < b.ssidLen;
+         } // if
+         break;
+      default:
+         break;
+   } //switch
+   return a.rssi > b.rssi;
+} // aaScanStore::_before()
+
+/**
+ * @brief Report how many Access Points the snapshot holds.
+ * @param null.
+ * @return uint8_t Number of entries, at most SCAN_STORE_MAX_ENTRIES.
+ ******************************************************************************/
+uint8_t aaScanStore::count() const
+{
+   return _count;
+} // aaScanStore::count()
+
+/**
+ * @brief Return one entry by position.
+ * @param uint8_t Position, in the order of the last sort().
+ * @return const scanEntry* Entry, NULL past the last one.
+ ******************************************************************************/
+const scanEntry* aaScanStore::get(uint8_t position) const
+{
+   if(position >= _count)
+   {
+      return NULL;
+   } // if
+   return &_entries[position];
+} // aaScanStore::get()
+
+/**
+ * @brief Look a BSSID up in the snapshot.
+ * @param const uint8_t* BSSID, 6 bytes.
+ * @return int16_t Position of the entry, -1 if the BSSID was not heard.
+ ******************************************************************************/
+int16_t aaScanStore::find(const uint8_t* bssid) const
+{
+   if(bssid == NULL)
+   {
+      return -1;
+   } // if
+   for(uint8_t i = 0; i < _count; i++)
+   {
+      if(memcmp(_entries[i].bssid, bssid, sizeof(_entries[i].bssid)) == 0)
+      {
+         return i;
+      } // if
+   } // for
+   return -1;
+} // aaScanStore::find()
+
+/**
+ * @brief Look an SSID up in the snapshot.
+ * @details Only entries whose hash matches are compared. One SSID is often
+ * served by several Access Points, call again from the position after the
+ * last match to walk them all.
+ * @param const char* SSID bytes, need not be null terminated.
+ * @param uint8_t Length of the SSID.
+ * @param uint8_t Position to start looking from.
+ * @return int16_t Position of the next entry with the SSID, -1 if none.
+ ******************************************************************************/
+int16_t aaScanStore::findSsid(const char* ssid, uint8_t length, uint8_t from) const
+{
+   uint32_t ssidHash = aaApSelector::hash(ssid, length);
+   for(uint8_t i = from; i < _count; i++)
+   {
+      const scanEntry &entry = _entries[i];
+      if(entry.ssidHash == ssidHash && entry.ssidLen == length && memcmp(entry.ssid, ssid, length) == 0)
+      {
+         return i;
+      } // if
+   } // for
+   return -1;
+} // aaScanStore::findSsid()
+
+/**
+ * @brief Report how old the snapshot is.
+ * @param uint32_t millis() timestamp now.
+ * @return uint32_t Milliseconds since clear().
+ ******************************************************************************/
+uint32_t aaScanStore::ageMs(uint32_t nowMs) const
+{
+   return nowMs - _takenMs;
+} // aaScanStore::ageMs()
+
+/**
+ * @brief Report whether the snapshot is too old to act on.
+ * @param uint32_t millis() timestamp now.
+ * @param uint32_t Oldest acceptable age in milliseconds.
+ * @return bool true if the snapshot is older than the limit or empty.
+ ******************************************************************************/
+bool aaScanStore::isStale(uint32_t nowMs, uint32_t maxAgeMs) const
+{
+   return _count == 0 || ageMs(nowMs) > maxAgeMs;
+} // aaScanStore::isStale()
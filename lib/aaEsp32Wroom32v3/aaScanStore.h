@@ -0,0 +1,84 @@
+/*
+aaScanStore - compact, allocation free snapshot of WiFi scan results.
+
+Part of the Aging Apprentice's Arduino API for ESP32 core.
+Github: https://github.com/theAgingApprentice/icUnderware/tree/main/lib/aaEsp32Wroom32v3
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+*/
+
+#ifndef aaScanStore_h // Start precompiler code block.
+   #define aaScanStore_h // Precompiler macro to prevent duplicate inclusions.
+
+/**
+ * Compiler substitution macros.
+ ******************************************************************************/
+#ifndef SCAN_STORE_MAX_ENTRIES
+   #define SCAN_STORE_MAX_ENTRIES 32 // Access Points one snapshot holds, the strongest win.
+#endif
+
+/**
+ * Included libraries.
+ ******************************************************************************/
+#include <Arduino.h> // Arduino Core for ESP32. Comes with Platform.io.
+#include <aaApSelector.h> // FNV-1a SSID hash shared with the known network index.
+
+/**
+ * Global variables.
+ ******************************************************************************/
+struct scanEntry ///< One Access Point heard by a scan.
+{
+   uint32_t ssidHash; ///< FNV-1a hash of the SSID, as aaApSelector::hash().
+   uint32_t seenMs; ///< millis() timestamp of the reading.
+   char ssid[33]; ///< SSID bytes, null terminated.
+   uint8_t ssidLen; ///< Length of the SSID, 0 for a hidden network.
+   uint8_t bssid[6]; ///< BSSID of the Access Point.
+   uint8_t channel; ///< Primary channel.
+   int8_t rssi; ///< Signal strength in db.
+   uint8_t auth; ///< wifi_auth_mode_t of the Access Point.
+}; //struct
+
+enum scanOrder ///< Orders a snapshot can be sorted in.
+{
+   scanByRssi, ///< Strongest first.
+   scanByChannel, ///< Lowest channel first, strongest first within a channel.
+   scanBySsid, ///< SSID bytes ascending, strongest first within an SSID.
+}; //enum
+
+/**
+ * The aaScanStore class keeps the results of one scan as a fixed array of
+ * scanEntry records.
+ *
+ * Each Access Point is copied in once when the scan reports it, so later
+ * questions about the scan never go back to the driver's list or build a
+ * String. An Access Point heard twice (on overlapping channels of a multi
+ * pass scan) keeps its stronger reading. Once the store is full the weakest
+ * Access Point gives way to a stronger one. Sorting is an in place
+ * insertion sort, which is cheap for SCAN_STORE_MAX_ENTRIES entries that
+ * are usually nearly in order already. Nothing is ever allocated and the
+ * class is plain data, so a copy is a consistent snapshot.
+ *
+ * Time is passed in rather than read, so the class only depends on
+ * Arduino.h and also runs in the host tests.
+ ******************************************************************************/
+class aaScanStore
+{
+   public:
+      aaScanStore(); // Class constructor.
+      ~aaScanStore(); // Class destructor.
+      void clear(uint32_t); // Start a new snapshot.
+      bool keep(const char*, uint8_t, const uint8_t*, uint8_t, int8_t, uint8_t, uint32_t); // Add one Access Point.
+      void sort(scanOrder order = scanByRssi); // Reorder the entries in place.
+      uint8_t count() const; // Number of entries.
+      const scanEntry* get(uint8_t) const; // Entry by position, NULL past the last one.
+      int16_t find(const uint8_t*) const; // Position of a BSSID, -1 if not heard.
+      int16_t findSsid(const char*, uint8_t, uint8_t from = 0) const; // Next position of an SSID, -1 if none.
+      uint32_t ageMs(uint32_t) const; // Time since the snapshot was started.
+      bool isStale(uint32_t, uint32_t) const; // True if the snapshot is older than a limit or empty.
+   private:
+      bool _before(const scanEntry&, const scanEntry&, scanOrder) const; // Sort comparison.
+      scanEntry _entries[SCAN_STORE_MAX_ENTRIES]; // The snapshot.
+      uint8_t _count = 0; // Number of entries in use.
+      uint32_t _takenMs = 0; // millis() timestamp passed to clear().
+}; //class aaScanStore
+
+#endif // End of precompiler protected code block
@@ -0,0 +1,21 @@
+/*************************************************************************************************************************************
+ @todo #41 Encrypt the knwonNetworks file.
+ *************************************************************************************************************************************/ 
+#include <knownNetworks.h> // Header file for linking.
+
+/**
+ * The built in known network table. It is a constant expression, so it is 
+ * placed in flash and nothing is constructed or copied to the heap before 
+ * setup(). One KNOWN_NETWORK() line per network: SSID, password and priority.
+ * A partition loaded with aaEsp32Wroom32v3::loadKnownNetworks() takes its 
+ * place.
+ ******************************************************************************/
+constexpr knownNetwork knownAPs[] =
+{
+   KNOWN_NETWORK("MN_LIVINGROOM", "5194741299", 0),
+   KNOWN_NETWORK("MN_WORKSHOP_2.4GHz", "5194741299", 0),
+   KNOWN_NETWORK("MN_DS_OFFICE_2.4GHz", "5194741299", 0),
+   KNOWN_NETWORK("MN_OUTSIDE", "5194741299", 0),
+   KNOWN_NETWORK("borfpiggle", "de15ab00be", 0),
+};
+const uint16_t numKnownAPs = sizeof(knownAPs) / sizeof(knownAPs[0]);
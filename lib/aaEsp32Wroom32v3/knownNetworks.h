@@ -4,8 +4,34 @@
 #ifndef knownNetworks_h // Start of precompiler check to avoid dupicate inclusion of this code block.
    #define knownNetworks_h // Precompiler macro used for precompiler check.
 
-static const int numKnownAPs = 5; // Number of known APs that the Robot knows how to connect to
-const String SSID[numKnownAPs] = { "MN_LIVINGROOM", "MN_WORKSHOP_2.4GHz", "MN_DS_OFFICE_2.4GHz", "MN_OUTSIDE", "borfpiggle"};
-const String Password[numKnownAPs] = { "5194741299", "5194741299", "5194741299", "5194741299", "de15ab00be"};
+#include <Arduino.h> // Arduino Core for ESP32. Comes with Platform.io.
+#include <aaApSelector.h> // apSsidHash() works out the SSID hashes at compile time.
 
-#endif
\ No newline at end of file
+#define KNOWN_NETWORKS_MAGIC 0x314E574B // "KWN1", first word of a known network partition image.
+#define KNOWN_NETWORKS_PARTITION "networks" // Label of the optional data partition holding known networks.
+
+struct knownNetwork ///< One network the robot knows how to connect to. Same layout in flash and in a partition image.
+{
+   uint32_t ssidHash; ///< FNV-1a hash of the SSID, see apSsidHash().
+   uint8_t ssidLen; ///< Length of the SSID.
+   uint8_t priority; ///< Higher is preferred. Each level is worth AP_SELECTOR_PRIORITY_DB of signal.
+   char ssid[33]; ///< SSID, null terminated.
+   char password[65]; ///< Passphrase, or PSK as 64 hex digits, null terminated.
+}; //struct
+
+struct knownNetworkImage ///< Header of a known network partition, followed by count knownNetwork records.
+{
+   uint32_t magic; ///< KNOWN_NETWORKS_MAGIC.
+   uint16_t count; ///< Number of knownNetwork records that follow.
+   uint16_t recordSize; ///< sizeof(knownNetwork), catches an image built for another layout.
+}; //struct
+
+static_assert(sizeof(knownNetwork) == 104, "knownNetwork is the partition image record, keep its layout");
+
+// One line of the known network table. The compiler works out the SSID length and hash. 
+#define KNOWN_NETWORK(ssid, password, priority) {apSsidHash(ssid, sizeof(ssid) - 1), sizeof(ssid) - 1, priority, ssid, password}
+
+extern const knownNetwork knownAPs[]; // Built in known network table, defined once in knownNetworks.cpp.
+extern const uint16_t numKnownAPs; // Number of known APs that the Robot knows how to connect to.
+
+#endif
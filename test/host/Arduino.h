@@ -0,0 +1,69 @@
+/*
+* Host stand-in for the parts of the ESP32 Arduino core used by the ping
+* library. Time comes from the simulator in ping_host.cpp, so delay() and
+* blocking receives advance a virtual clock instead of sleeping (unless the
+* real loopback backend is selected).
+*/
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+
+typedef uint8_t byte;
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(uint32_t us);
+
+#ifdef PING_HOST_VERBOSE
+#define log_e(format, ...) printf(format, ##__VA_ARGS__)
+#define log_w(format, ...) printf(format, ##__VA_ARGS__)
+#define log_i(format, ...) printf(format, ##__VA_ARGS__)
+#define log_d(format, ...) printf(format, ##__VA_ARGS__)
+#else
+#define log_e(format, ...) do {} while (0)
+#define log_w(format, ...) do {} while (0)
+#define log_i(format, ...) do {} while (0)
+#define log_d(format, ...) do {} while (0)
+#endif
+
+#ifndef max
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+/*
+* Same storage as the core's IPAddress: four bytes in network order, so a
+* conversion to uint32_t yields the value lwIP expects in s_addr.
+*/
+class IPAddress {
+public:
+    IPAddress() : _address(0) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+        uint8_t *bytes = (uint8_t *)&_address;
+        bytes[0] = a;
+        bytes[1] = b;
+        bytes[2] = c;
+        bytes[3] = d;
+    }
+    IPAddress(uint32_t address) : _address(address) {}
+
+    operator uint32_t() const { return _address; }
+    uint8_t operator[](int index) const { return ((const uint8_t *)&_address)[index]; }
+    bool operator==(const IPAddress &other) const { return _address == other._address; }
+
+private:
+    uint32_t _address;
+};
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,34 @@
+/*
+* Host stand-in for the WiFi object used by the ping library. Events are
+* raised by the simulator, see ping_host_wifi_disconnect().
+*/
+
+#ifndef HOST_WIFI_H
+#define HOST_WIFI_H
+
+#include "Arduino.h"
+
+typedef enum {
+    SYSTEM_EVENT_STA_START = 2,
+    SYSTEM_EVENT_STA_CONNECTED = 4,
+    SYSTEM_EVENT_STA_DISCONNECTED = 5,
+    SYSTEM_EVENT_STA_GOT_IP = 7,
+    SYSTEM_EVENT_MAX = 32
+} system_event_id_t;
+
+typedef void (*WiFiEventCb)(system_event_id_t event);
+
+class WiFiClass {
+public:
+    int onEvent(WiFiEventCb callback, system_event_id_t event = SYSTEM_EVENT_MAX);
+    void raise(system_event_id_t event);
+
+private:
+    WiFiEventCb _callbacks[8];
+    system_event_id_t _events[8];
+    int _count;
+};
+
+extern WiFiClass WiFi;
+
+#endif // HOST_WIFI_H
@@ -0,0 +1,55 @@
+/*
+* Host stand-in for the FreeRTOS recursive mutex, backed by pthreads, and
+* the binary semaphore. Taking the binary semaphore runs the simulator's
+* clock forward, see xSemaphoreTake() in ping_host.cpp.
+*/
+
+#ifndef HOST_SEMPHR_H
+#define HOST_SEMPHR_H
+
+#include <pthread.h>
+
+#include "FreeRTOS.h"
+
+typedef struct {
+    pthread_mutex_t mutex;
+    volatile int given;             // Binary semaphore state
+} StaticSemaphore_t;
+
+typedef StaticSemaphore_t *SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateRecursiveMutexStatic(StaticSemaphore_t *buffer) {
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&buffer->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return buffer;
+}
+
+static inline BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    (void)ticks;
+    return (pthread_mutex_lock(&semaphore->mutex) == 0) ? pdTRUE : pdFALSE;
+}
+
+static inline BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t semaphore) {
+    return (pthread_mutex_unlock(&semaphore->mutex) == 0) ? pdTRUE : pdFALSE;
+}
+
+static inline SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buffer) {
+    buffer->given = 0;
+    return buffer;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    if (semaphore->given) {
+        return pdFALSE;
+    }
+    semaphore->given = 1;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+
+#endif // HOST_SEMPHR_H
@@ -0,0 +1,302 @@
+/*
+* Host stand-in for the lwIP types, macros and socket API used by the ping
+* library. Every header under lwip/ in this directory includes this one file.
+*
+* As with LWIP_COMPAT_SOCKETS on the target, the BSD names are macros that
+* route to the simulator (sim_*), so the library source builds unchanged.
+* System socket headers must not be included after this file.
+*/
+
+#ifndef HOST_LWIP_H
+#define HOST_LWIP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+/*
+* lwip/err.h
+*/
+typedef int8_t err_t;
+typedef uint8_t u8_t;
+typedef uint16_t u16_t;
+
+#define ERR_OK          0
+#define ERR_MEM        -1
+#define ERR_BUF        -2
+#define ERR_TIMEOUT    -3
+#define ERR_RTE        -4
+#define ERR_INPROGRESS -5
+#define ERR_VAL        -6
+#define ERR_WOULDBLOCK -7
+#define ERR_ARG       -16
+
+/*
+* lwip/ip4_addr.h, lwip/ip_addr.h
+*/
+typedef struct ip4_addr {
+    uint32_t addr;
+} ip4_addr_t;
+
+typedef struct ip_addr {
+    ip4_addr_t ip4;
+    uint8_t type;
+} ip_addr_t;
+
+#define IPADDR_TYPE_V4          0
+#define IP_IS_V4(ipaddr)        ((ipaddr)->type == IPADDR_TYPE_V4)
+#define ip_2_ip4(ipaddr)        (&((ipaddr)->ip4))
+#define ip4_addr_get_u32(src)   ((src)->addr)
+#define ip4_addr_set_u32(dest, src) ((dest)->addr = (src))
+#define ip_addr_set_ip4_u32(ipaddr, val) do { (ipaddr)->ip4.addr = (val); (ipaddr)->type = IPADDR_TYPE_V4; } while (0)
+#define ip4_addr_isany_val(addr1)   ((addr1).addr == 0)
+#define ip4_addr_netcmp(addr1, addr2, mask) \
+    (((addr1)->addr & (mask)->addr) == ((addr2)->addr & (mask)->addr))
+
+/*
+* Byte order, the host is little endian like the ESP32
+*/
+static inline uint16_t lwip_htons(uint16_t n) { return (uint16_t)((n << 8) | (n >> 8)); }
+static inline uint32_t lwip_htonl(uint32_t n) { return __builtin_bswap32(n); }
+
+#define htons(x) lwip_htons(x)
+#define ntohs(x) lwip_htons(x)
+#define htonl(x) lwip_htonl(x)
+#define ntohl(x) lwip_htonl(x)
+
+/*
+* lwip/ip.h, lwip/icmp.h
+*/
+#define IP_PROTO_ICMP   1
+#define IP_PROTO_TCP    6
+#define IP_PROTO_UDP    17
+
+struct ip_hdr {
+    uint8_t _v_hl;
+    uint8_t _tos;
+    uint16_t _len;
+    uint16_t _id;
+    uint16_t _offset;
+    uint8_t _ttl;
+    uint8_t _proto;
+    uint16_t _chksum;
+    ip4_addr_t src;
+    ip4_addr_t dest;
+} __attribute__((packed));
+
+#define IPH_V(hdr)      ((hdr)->_v_hl >> 4)
+#define IPH_HL(hdr)     ((hdr)->_v_hl & 0x0f)
+#define IPH_LEN(hdr)    ((hdr)->_len)
+#define IPH_TTL(hdr)    ((hdr)->_ttl)
+#define IPH_PROTO(hdr)  ((hdr)->_proto)
+#define IP_HLEN         20
+#define IP_DF           0x4000U
+#define IP_REASSEMBLY   0           // As in the ESP-IDF default configuration
+
+#define ICMP_ER     0
+#define ICMP_DUR    3
+#define ICMP_ECHO   8
+#define ICMP_TE     11
+#define ICMP_TS     13
+#define ICMP_TSR    14
+
+struct icmp_echo_hdr {
+    uint8_t type;
+    uint8_t code;
+    uint16_t chksum;
+    uint16_t id;
+    uint16_t seqno;
+} __attribute__((packed));
+
+#define ICMPH_TYPE(hdr)         ((hdr)->type)
+#define ICMPH_CODE(hdr)         ((hdr)->code)
+#define ICMPH_TYPE_SET(hdr, t)  ((hdr)->type = (t))
+#define ICMPH_CODE_SET(hdr, c)  ((hdr)->code = (c))
+
+uint16_t inet_chksum(const void *dataptr, uint16_t len);
+
+/*
+* lwip/mem.h
+*/
+typedef size_t mem_size_t;
+
+void *mem_malloc(mem_size_t size);
+void mem_free(void *mem);
+
+/*
+* lwip/sockets.h
+*/
+#define AF_INET         2
+#define PF_INET         AF_INET
+#define SOCK_STREAM     1
+#define SOCK_DGRAM      2
+#define SOCK_RAW        3
+#define IPPROTO_IP      0
+#define IPPROTO_ICMP    1
+#define IPPROTO_TCP     6
+#define IPPROTO_UDP     17
+#define SOL_SOCKET      0xfff
+#define SO_ERROR        0x1007
+#define SO_RCVTIMEO     0x1006
+#define SO_RCVBUF       0x1002
+#define SO_LINGER       0x0080
+#define IP_TOS          1
+#define IP_TTL          2
+#define MSG_PEEK        0x01
+#define MSG_DONTWAIT    0x08
+#define F_GETFL         3
+#define F_SETFL         4
+#define O_NONBLOCK      1
+
+#ifndef __socklen_t_defined
+typedef uint32_t socklen_t;
+#define __socklen_t_defined
+#endif
+
+typedef uint8_t sa_family_t;
+typedef uint16_t in_port_t;
+
+struct in_addr {
+    uint32_t s_addr;
+};
+
+struct sockaddr_in {
+    uint8_t sin_len;
+    sa_family_t sin_family;
+    in_port_t sin_port;
+    struct in_addr sin_addr;
+    char sin_zero[8];
+};
+
+struct sockaddr {
+    uint8_t sa_len;
+    sa_family_t sa_family;
+    char sa_data[14];
+};
+
+struct linger {
+    int l_onoff;
+    int l_linger;
+};
+
+#define inet_addr_from_ip4addr(target_inaddr, source_ipaddr) ((target_inaddr)->s_addr = ip4_addr_get_u32(source_ipaddr))
+#define inet_addr_to_ip4addr(target_ipaddr, source_inaddr)   (ip4_addr_set_u32(target_ipaddr, (source_inaddr)->s_addr))
+
+char *sim_ip4addr_ntoa(const ip4_addr_t *addr);
+#define inet_ntoa(addr) sim_ip4addr_ntoa((const ip4_addr_t *)&(addr))
+
+int sim_socket(int domain, int type, int protocol);
+int sim_close(int s);
+int sim_setsockopt(int s, int level, int optname, const void *optval, socklen_t optlen);
+int sim_getsockopt(int s, int level, int optname, void *optval, socklen_t *optlen);
+int sim_fcntl(int s, int cmd, int val);
+int sim_connect(int s, const struct sockaddr *name, socklen_t namelen);
+int sim_sendto(int s, const void *data, size_t size, int flags, const struct sockaddr *to, socklen_t tolen);
+int sim_recvfrom(int s, void *mem, size_t len, int flags, struct sockaddr *from, socklen_t *fromlen);
+int sim_select(int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptset, struct timeval *timeout);
+int sim_gettimeofday(struct timeval *tv, void *tz);
+
+#define socket(domain, type, protocol)                  sim_socket(domain, type, protocol)
+#define closesocket(s)                                  sim_close(s)
+#define setsockopt(s, level, optname, opval, optlen)    sim_setsockopt(s, level, optname, opval, optlen)
+#define getsockopt(s, level, optname, opval, optlen)    sim_getsockopt(s, level, optname, opval, optlen)
+#define fcntl(s, cmd, val)                              sim_fcntl(s, cmd, val)
+#define connect(s, name, namelen)                       sim_connect(s, name, namelen)
+#define sendto(s, dataptr, size, flags, to, tolen)      sim_sendto(s, dataptr, size, flags, to, tolen)
+#define recvfrom(s, mem, len, flags, from, fromlen)     sim_recvfrom(s, mem, len, flags, from, fromlen)
+#define select(maxfdp1, readset, writeset, exceptset, timeout) sim_select(maxfdp1, readset, writeset, exceptset, timeout)
+#define gettimeofday(tv, tz)                            sim_gettimeofday(tv, tz)
+
+/*
+* lwip/dns.h
+*/
+typedef void (*dns_found_callback)(const char *name, const ip_addr_t *ipaddr, void *callback_arg);
+
+err_t dns_gethostbyname(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg);
+
+/*
+* lwip/netif.h, one interface configured by ping_host_set_netif()
+*/
+#define NETIF_FLAG_UP   0x01U
+
+struct netif {
+    struct netif *next;
+    ip4_addr_t ip_addr;
+    ip4_addr_t netmask;
+    uint8_t flags;
+};
+
+extern struct netif *netif_list;
+
+#define netif_is_up(netif)          (((netif)->flags & NETIF_FLAG_UP) ? 1 : 0)
+#define netif_ip4_addr(netif)       ((const ip4_addr_t *)&((netif)->ip_addr))
+#define netif_ip4_netmask(netif)    ((const ip4_addr_t *)&((netif)->netmask))
+
+/*
+* lwip/etharp.h, backed by the neighbours from ping_host_add_neighbour()
+*/
+struct eth_addr {
+    uint8_t addr[6];
+};
+
+err_t etharp_request(struct netif *netif, const ip4_addr_t *ipaddr);
+ssize_t etharp_find_addr(struct netif *netif, const ip4_addr_t *ipaddr, struct eth_addr **eth_ret, const ip4_addr_t **ip_ret);
+
+/*
+* lwip/tcpip.h, callbacks run at once on the calling thread
+*/
+typedef void (*tcpip_callback_fn)(void *ctx);
+
+err_t tcpip_callback(tcpip_callback_fn function, void *ctx);
+
+/*
+* lwip/priv/tcpip_priv.h, the same
+*/
+struct tcpip_api_call_data {
+    err_t err;
+};
+
+typedef err_t (*tcpip_api_call_fn)(struct tcpip_api_call_data *call);
+
+err_t tcpip_api_call(tcpip_api_call_fn fn, struct tcpip_api_call_data *call);
+
+/*
+* lwip/pbuf.h, always a single buffer
+*/
+typedef enum {
+    PBUF_IP = 36
+} pbuf_layer;
+
+typedef enum {
+    PBUF_RAM = 0
+} pbuf_type;
+
+struct pbuf {
+    struct pbuf *next;
+    void *payload;
+    u16_t tot_len;
+    u16_t len;
+    u8_t heap;                      // Stand-in only, allocated by pbuf_alloc()
+};
+
+struct pbuf *pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type);
+u8_t pbuf_free(struct pbuf *p);
+err_t pbuf_take(struct pbuf *buf, const void *dataptr, u16_t len);
+u16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, u16_t len, u16_t offset);
+
+/*
+* lwip/raw.h, one PCB whose replies come from the simulator
+*/
+struct raw_pcb;
+
+typedef u8_t (*raw_recv_fn)(void *arg, struct raw_pcb *pcb, struct pbuf *p, const ip_addr_t *addr);
+
+struct raw_pcb *raw_new(u8_t proto);
+void raw_recv(struct raw_pcb *pcb, raw_recv_fn recv, void *recv_arg);
+err_t raw_sendto(struct raw_pcb *pcb, struct pbuf *p, const ip_addr_t *ipaddr);
+void raw_remove(struct raw_pcb *pcb);
+
+#endif // HOST_LWIP_H
@@ -0,0 +1,2 @@
+// Host stand-in, see ../host_lwip.h
+#include "../host_lwip.h"
@@ -0,0 +1,1103 @@
+/*
+* Host stand-in network for the ping library. See ping_host.h.
+*/
+
+#include "Arduino.h"
+#include "WiFi.h"
+#include "lwip/sockets.h"
+#include "lwip/icmp.h"
+#include "lwip/ip.h"
+#include "lwip/dns.h"
+#include "lwip/netif.h"
+#include "lwip/etharp.h"
+#include "lwip/tcpip.h"
+#include "lwip/pbuf.h"
+#include "lwip/raw.h"
+#include "freertos/semphr.h"
+
+#include "ping_host.h"
+
+#define HOST_SOCKETS        16
+#define HOST_FD_BASE        64          // Keep simulated fds clear of real ones
+#define HOST_QUEUE          256
+#define HOST_PACKET         1600
+#define HOST_TARGETS        16
+#define HOST_NAMES          8
+#define HOST_NAME_LEN       64
+#define HOST_ROUTE          8
+#define HOST_NEIGHBOURS     8
+#define HOST_DEFAULT_TTL    64
+#define HOST_MAX_BLOCK_US   60000000ULL // Cap for receives without a timeout
+#define HOST_PCB_FD         (-2)        // Queue key of datagrams for the raw PCB
+
+struct host_socket {
+    bool used;
+    int type;
+    int protocol;
+    int real_fd;                        // >= 0 when backed by a real socket
+    uint32_t rcvtimeo_us;
+    int ttl;
+    int flags;                          // O_NONBLOCK
+};
+
+struct host_packet {
+    bool used;
+    int fd;
+    uint64_t deliver_us;
+    uint32_t from;
+    uint16_t len;
+    uint8_t data[HOST_PACKET];
+};
+
+struct host_target {
+    uint32_t addr;
+    struct ping_host_link link;
+    uint32_t route[HOST_ROUTE];
+    uint8_t route_len;
+};
+
+struct host_name {
+    char name[HOST_NAME_LEN];
+    uint32_t addr;
+    uint32_t latency_us;
+};
+
+struct host_dns_query {
+    bool used;
+    uint64_t due_us;
+    char name[HOST_NAME_LEN];
+    bool found;
+    uint32_t addr;
+    dns_found_callback callback;
+    void *arg;
+};
+
+struct host_neighbour {
+    ip4_addr_t addr;
+    struct eth_addr mac;
+    uint32_t latency_us;
+    bool requested;
+    uint64_t due_us;                    // Answer enters the ARP table
+};
+
+struct raw_pcb {
+    bool used;
+    raw_recv_fn recv;
+    void *recv_arg;
+};
+
+static struct host_socket sockets[HOST_SOCKETS];
+static struct host_packet queue[HOST_QUEUE];
+static struct host_target targets[HOST_TARGETS];
+static struct host_name names[HOST_NAMES];
+static struct host_dns_query dns_queries[HOST_NAMES];
+static struct host_neighbour neighbours[HOST_NEIGHBOURS];
+static struct netif host_netif;
+static struct raw_pcb host_pcb;
+static struct ping_host_counters counters;
+static uint64_t now_us = 0;
+static uint64_t real_epoch_us = 0;
+static bool real_time = false;
+static bool loopback = false;
+static uint32_t rng_state = 1;
+
+WiFiClass WiFi;
+struct netif *netif_list = &host_netif;
+
+/*
+* Helper functions
+*
+*/
+static uint32_t host_random(void) {
+    // xorshift32, deterministic for a given seed
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static float host_uniform(void) {
+    // (0, 1]
+    return ((host_random() >> 8) + 1) / 16777216.0f;
+}
+
+static bool host_chance(float pct) {
+    return (pct > 0) && (host_uniform() * 100.0f <= pct);
+}
+
+static uint32_t host_rtt_sample(const struct ping_host_link *link) {
+    double rtt = link->rtt_us;
+
+    switch (link->rtt_model) {
+        case PING_HOST_RTT_UNIFORM:
+            rtt += host_uniform() * link->spread_us;
+            break;
+        case PING_HOST_RTT_NORMAL:
+            rtt += sqrt(-2.0 * log(host_uniform())) * cos(2.0 * M_PI * host_uniform()) * link->spread_us;
+            break;
+        case PING_HOST_RTT_EXPONENTIAL:
+            rtt += -log(host_uniform()) * link->spread_us;
+            break;
+        default:
+            break;
+    }
+    return (rtt < 1) ? 1 : (uint32_t)rtt;
+}
+
+static uint64_t host_clock(void) {
+    if (real_time) {
+        return host_real_now_us() - real_epoch_us;
+    }
+    return now_us;
+}
+
+static void host_deliver_pcb(uint64_t t);
+
+static void host_advance_to(uint64_t t) {
+    int i;
+
+    if (real_time) {
+        uint64_t current = host_clock();
+        if (t > current) {
+            host_real_sleep_us(t - current);
+        }
+        host_deliver_pcb(host_clock());
+    }
+    else {
+        host_deliver_pcb(t);
+        if (t > now_us) {
+            now_us = t;
+        }
+    }
+
+    // Deliver DNS answers that became due, as lwIP would from its own thread
+    for (i = 0; i < HOST_NAMES; i++) {
+        if (dns_queries[i].used && (dns_queries[i].due_us <= host_clock())) {
+            ip_addr_t ipaddr;
+
+            dns_queries[i].used = false;
+            ipaddr.type = IPADDR_TYPE_V4;
+            ipaddr.ip4.addr = dns_queries[i].addr;
+            dns_queries[i].callback(dns_queries[i].name, dns_queries[i].found ? &ipaddr : NULL, dns_queries[i].arg);
+        }
+    }
+}
+
+/*
+* Switch to real time, carrying on from the current virtual time so that
+* timestamps taken before stay comparable.
+*/
+static void host_use_real_time(void) {
+    if (!real_time) {
+        real_epoch_us = host_real_now_us() - now_us;
+        real_time = true;
+    }
+}
+
+static struct host_socket *host_get_socket(int s) {
+    if ((s < HOST_FD_BASE) || (s >= HOST_FD_BASE + HOST_SOCKETS) || !sockets[s - HOST_FD_BASE].used) {
+        return NULL;
+    }
+    return &sockets[s - HOST_FD_BASE];
+}
+
+static struct host_target *host_find_target(uint32_t addr) {
+    int i;
+
+    for (i = 0; i < HOST_TARGETS; i++) {
+        if ((targets[i].addr == addr) && (addr != 0)) {
+            return &targets[i];
+        }
+    }
+    return NULL;
+}
+
+static bool host_enqueue(int fd, uint64_t deliver_us, uint32_t from, const void *data, int len) {
+    int i;
+
+    if (len > HOST_PACKET) {
+        len = HOST_PACKET;
+    }
+    for (i = 0; i < HOST_QUEUE; i++) {
+        if (!queue[i].used) {
+            queue[i].used = true;
+            queue[i].fd = fd;
+            queue[i].deliver_us = deliver_us;
+            queue[i].from = from;
+            queue[i].len = (uint16_t)len;
+            memcpy(queue[i].data, data, len);
+            return true;
+        }
+    }
+    return false;
+}
+
+static struct host_packet *host_next_packet(int fd) {
+    struct host_packet *next = NULL;
+    int i;
+
+    for (i = 0; i < HOST_QUEUE; i++) {
+        if (queue[i].used && (queue[i].fd == fd) && ((next == NULL) || (queue[i].deliver_us < next->deliver_us))) {
+            next = &queue[i];
+        }
+    }
+    return next;
+}
+
+/*
+* Hand the datagrams for the raw PCB that are due by t to its callback in
+* arrival order, each with the clock at its arrival time. The pbuf points
+* straight at the queued datagram.
+*/
+static void host_deliver_pcb(uint64_t t) {
+    struct host_packet *packet;
+    struct pbuf p;
+    ip_addr_t from;
+
+    while (((packet = host_next_packet(HOST_PCB_FD)) != NULL) && (packet->deliver_us <= t)) {
+        if (!real_time && (packet->deliver_us > now_us)) {
+            now_us = packet->deliver_us;
+        }
+        memset(&p, 0, sizeof(p));
+        p.payload = packet->data;
+        p.tot_len = packet->len;
+        p.len = packet->len;
+        from.type = IPADDR_TYPE_V4;
+        from.ip4.addr = packet->from;
+        if (host_pcb.used && (host_pcb.recv != NULL) && host_pcb.recv(host_pcb.recv_arg, &host_pcb, &p, &from)) {
+            counters.pcb_taken++;
+        }
+        else {
+            counters.pcb_passed++;
+        }
+        packet->used = false;
+    }
+}
+
+/*
+* Wrap an ICMP message from `from` in an IPv4 header, the way a raw socket
+* hands it to the application.
+*/
+static int host_build_ip(uint8_t *out, uint32_t from, uint8_t proto, const void *payload, int len) {
+    struct ip_hdr *iphdr = (struct ip_hdr *)out;
+
+    if (len + IP_HLEN > HOST_PACKET) {
+        len = HOST_PACKET - IP_HLEN;
+    }
+    memset(iphdr, 0, IP_HLEN);
+    iphdr->_v_hl = 0x45;
+    iphdr->_len = htons((uint16_t)(len + IP_HLEN));
+    iphdr->_ttl = 64;
+    iphdr->_proto = proto;
+    iphdr->src.addr = from;
+    memcpy(out + IP_HLEN, payload, len);
+    iphdr->_chksum = inet_chksum(iphdr, IP_HLEN);
+    return len + IP_HLEN;
+}
+
+/*
+* The router `hop` steps along the route answers an echo request whose TTL
+* ran out with a time exceeded message quoting its IP header and first eight
+* data bytes.
+*/
+static void host_answer_ttl(int fd, struct host_target *target, int hop, const uint8_t *request, int len) {
+    uint32_t router = target->route[hop - 1];
+    uint8_t message[8 + IP_HLEN + 8];
+    uint8_t packet[HOST_PACKET];
+    struct icmp_echo_hdr *icmp = (struct icmp_echo_hdr *)message;
+    uint64_t rtt;
+    int plen;
+
+    if (router == 0) {
+        counters.dropped++;
+        return;
+    }
+
+    memset(message, 0, sizeof(message));
+    host_build_ip(message + 8, target->addr, IP_PROTO_ICMP, request, 8);
+    ((struct ip_hdr *)(message + 8))->_len = htons((uint16_t)(len + IP_HLEN));
+    ((struct ip_hdr *)(message + 8))->_ttl = 1;
+    ((struct ip_hdr *)(message + 8))->src.addr = 0;
+    ((struct ip_hdr *)(message + 8))->dest.addr = target->addr;
+    ICMPH_TYPE_SET(icmp, ICMP_TE);
+    icmp->chksum = inet_chksum(message, sizeof(message));
+    plen = host_build_ip(packet, router, IP_PROTO_ICMP, message, sizeof(message));
+
+    rtt = (uint64_t)host_rtt_sample(&target->link) * hop / (target->route_len + 1);
+    if (host_enqueue(fd, host_clock() + rtt, router, packet, plen)) {
+        counters.ttl_exceeded++;
+    }
+}
+
+static void host_answer_echo(int fd, uint32_t dest, int ttl, const uint8_t *request, int len) {
+    struct host_target *target = host_find_target(dest);
+    uint8_t reply[HOST_PACKET];
+    uint8_t packet[HOST_PACKET];
+    struct icmp_echo_hdr *iecho;
+    uint64_t deliver;
+    int plen;
+
+    counters.echo_requests++;
+    if ((target == NULL) || host_chance(target->link.loss_pct)) {
+        counters.dropped++;
+        return;
+    }
+    if (ttl <= target->route_len) {
+        host_answer_ttl(fd, target, ttl, request, len);
+        return;
+    }
+    if (target->link.mtu && (len + IP_HLEN > target->link.mtu)) {
+        // lwIP does not reassemble, so a fragmented echo never comes back
+        counters.fragmented++;
+        return;
+    }
+
+    if (len > HOST_PACKET - IP_HLEN) {
+        len = HOST_PACKET - IP_HLEN;
+    }
+    memcpy(reply, request, len);
+    iecho = (struct icmp_echo_hdr *)reply;
+    ICMPH_TYPE_SET(iecho, ICMP_ER);
+    iecho->chksum = 0;
+    iecho->chksum = inet_chksum(reply, (uint16_t)len);
+    plen = host_build_ip(packet, dest, IP_PROTO_ICMP, reply, len);
+
+    deliver = host_clock() + host_rtt_sample(&target->link);
+    if (target->link.bandwidth_kbps) {
+        // Request and reply each cross the bottleneck once
+        deliver += (uint64_t)(len + IP_HLEN) * 16000 / target->link.bandwidth_kbps;
+    }
+    if (host_chance(target->link.reorder_pct)) {
+        deliver += target->link.reorder_delay_us;
+        counters.reordered++;
+    }
+    if (host_enqueue(fd, deliver, dest, packet, plen)) {
+        counters.replies_queued++;
+    }
+    if (host_chance(target->link.duplicate_pct) &&
+        host_enqueue(fd, deliver + target->link.duplicate_delay_us, dest, packet, plen)) {
+        counters.duplicated++;
+    }
+}
+
+/*
+* Answer an ICMP timestamp request with the target's time of day in
+* milliseconds when the request arrives, the RTT split by forward_pct.
+*/
+static void host_answer_timestamp(int fd, uint32_t dest, const uint8_t *request, int len) {
+    struct host_target *target = host_find_target(dest);
+    const int64_t day_us = 86400000000LL;
+    uint8_t reply[20];
+    uint8_t packet[HOST_PACKET];
+    struct icmp_echo_hdr *icmp = (struct icmp_echo_hdr *)reply;
+    uint32_t rtt;
+    uint32_t forward;
+    uint32_t stamp;
+    int64_t remote_us;
+    int plen;
+
+    counters.timestamp_requests++;
+    if ((target == NULL) || (len < (int)sizeof(reply)) || host_chance(target->link.loss_pct)) {
+        counters.dropped++;
+        return;
+    }
+
+    rtt = host_rtt_sample(&target->link);
+    forward = (uint32_t)((uint64_t)rtt * (target->link.forward_pct ? target->link.forward_pct : 50) / 100);
+    remote_us = ((int64_t)host_clock() + forward + target->link.clock_offset_us) % day_us;
+    if (remote_us < 0) {
+        remote_us += day_us;
+    }
+    stamp = (uint32_t)(remote_us / 1000);
+    if (target->link.nonstandard_time) {
+        stamp |= 0x80000000UL;
+    }
+
+    memcpy(reply, request, sizeof(reply));
+    ICMPH_TYPE_SET(icmp, ICMP_TSR);
+    ((uint32_t *)reply)[3] = htonl(stamp);
+    ((uint32_t *)reply)[4] = htonl(stamp);
+    icmp->chksum = 0;
+    icmp->chksum = inet_chksum(reply, sizeof(reply));
+    plen = host_build_ip(packet, dest, IP_PROTO_ICMP, reply, sizeof(reply));
+    if (host_enqueue(fd, host_clock() + rtt, dest, packet, plen)) {
+        counters.replies_queued++;
+    }
+}
+
+/*
+* Test control
+*
+*/
+void ping_host_reset(uint32_t seed) {
+    int i;
+
+    for (i = 0; i < HOST_SOCKETS; i++) {
+        if (sockets[i].used && (sockets[i].real_fd >= 0)) {
+            host_real_close(sockets[i].real_fd);
+        }
+    }
+    memset(sockets, 0, sizeof(sockets));
+    memset(queue, 0, sizeof(queue));
+    memset(targets, 0, sizeof(targets));
+    memset(names, 0, sizeof(names));
+    memset(dns_queries, 0, sizeof(dns_queries));
+    memset(neighbours, 0, sizeof(neighbours));
+    memset(&host_netif, 0, sizeof(host_netif));
+    memset(&host_pcb, 0, sizeof(host_pcb));
+    memset(&counters, 0, sizeof(counters));
+    now_us = 0;
+    real_time = false;
+    loopback = false;
+    rng_state = seed ? seed : 1;
+}
+
+bool ping_host_set_link(uint32_t addr, const struct ping_host_link *link) {
+    struct host_target *target = host_find_target(addr);
+    int i;
+
+    for (i = 0; (target == NULL) && (i < HOST_TARGETS); i++) {
+        if (targets[i].addr == 0) {
+            target = &targets[i];
+        }
+    }
+    if (target == NULL) {
+        return false;
+    }
+    target->addr = addr;
+    target->link = *link;
+    return true;
+}
+
+bool ping_host_set_route(uint32_t addr, const uint32_t *routers, uint8_t count) {
+    struct host_target *target = host_find_target(addr);
+
+    if ((target == NULL) || (count > HOST_ROUTE)) {
+        return false;
+    }
+    memcpy(target->route, routers, count * sizeof(uint32_t));
+    target->route_len = count;
+    return true;
+}
+
+bool ping_host_add_name(const char *name, uint32_t addr, uint32_t latency_us) {
+    int i;
+
+    for (i = 0; i < HOST_NAMES; i++) {
+        if (names[i].name[0] == 0) {
+            strncpy(names[i].name, name, HOST_NAME_LEN - 1);
+            names[i].addr = addr;
+            names[i].latency_us = latency_us;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ping_host_remove_name(const char *name) {
+    int i;
+
+    for (i = 0; i < HOST_NAMES; i++) {
+        if (strcmp(names[i].name, name) == 0) {
+            names[i].name[0] = 0;
+        }
+    }
+}
+
+void ping_host_set_netif(uint32_t addr, uint32_t netmask) {
+    host_netif.ip_addr.addr = addr;
+    host_netif.netmask.addr = netmask;
+    host_netif.flags = NETIF_FLAG_UP;
+}
+
+bool ping_host_add_neighbour(uint32_t addr, const uint8_t mac[6], uint32_t latency_us) {
+    int i;
+
+    for (i = 0; i < HOST_NEIGHBOURS; i++) {
+        if (neighbours[i].addr.addr == 0) {
+            neighbours[i].addr.addr = addr;
+            memcpy(neighbours[i].mac.addr, mac, sizeof(neighbours[i].mac.addr));
+            neighbours[i].latency_us = latency_us;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ping_host_use_loopback(void) {
+    int fd = host_real_socket(SOCK_RAW);
+
+    if (fd < 0) {
+        return false;
+    }
+    host_real_close(fd);
+    loopback = true;
+    host_use_real_time();
+    return true;
+}
+
+bool ping_host_loopback_active(void) {
+    return loopback;
+}
+
+void ping_host_wifi_disconnect(void) {
+    WiFi.raise(SYSTEM_EVENT_STA_DISCONNECTED);
+}
+
+uint64_t ping_host_now_us(void) {
+    return host_clock();
+}
+
+const struct ping_host_counters *ping_host_get_counters(void) {
+    return &counters;
+}
+
+/*
+* Arduino core
+*
+*/
+unsigned long millis(void) {
+    return (unsigned long)(host_clock() / 1000);
+}
+
+unsigned long micros(void) {
+    return (unsigned long)host_clock();
+}
+
+void delay(unsigned long ms) {
+    host_advance_to(host_clock() + (uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us) {
+    host_advance_to(host_clock() + us);
+}
+
+int WiFiClass::onEvent(WiFiEventCb callback, system_event_id_t event) {
+    if (_count >= 8) {
+        return -1;
+    }
+    _callbacks[_count] = callback;
+    _events[_count] = event;
+    return _count++;
+}
+
+void WiFiClass::raise(system_event_id_t event) {
+    int i;
+
+    for (i = 0; i < _count; i++) {
+        if ((_events[i] == event) || (_events[i] == SYSTEM_EVENT_MAX)) {
+            _callbacks[i](event);
+        }
+    }
+}
+
+/*
+* lwIP
+*
+*/
+uint16_t inet_chksum(const void *dataptr, uint16_t len) {
+    const uint8_t *p = (const uint8_t *)dataptr;
+    uint32_t acc = 0;
+
+    while (len > 1) {
+        acc += (uint16_t)(p[0] | (p[1] << 8));
+        p += 2;
+        len -= 2;
+    }
+    if (len) {
+        acc += p[0];
+    }
+    while (acc >> 16) {
+        acc = (acc & 0xffff) + (acc >> 16);
+    }
+    return (uint16_t)~acc;
+}
+
+void *mem_malloc(mem_size_t size) {
+    return malloc(size);
+}
+
+void mem_free(void *mem) {
+    free(mem);
+}
+
+char *sim_ip4addr_ntoa(const ip4_addr_t *addr) {
+    static char buf[16];
+    const uint8_t *b = (const uint8_t *)&addr->addr;
+
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", b[0], b[1], b[2], b[3]);
+    return buf;
+}
+
+/*
+* ARP table: a neighbour's entry appears latency_us after the first request
+* for it and is never aged out.
+*/
+err_t etharp_request(struct netif *netif, const ip4_addr_t *ipaddr) {
+    int i;
+
+    counters.arp_requests++;
+    for (i = 0; i < HOST_NEIGHBOURS; i++) {
+        if ((neighbours[i].addr.addr != 0) && (neighbours[i].addr.addr == ipaddr->addr) &&
+            !neighbours[i].requested) {
+            neighbours[i].requested = true;
+            neighbours[i].due_us = host_clock() + neighbours[i].latency_us;
+        }
+    }
+    return ERR_OK;
+}
+
+ssize_t etharp_find_addr(struct netif *netif, const ip4_addr_t *ipaddr, struct eth_addr **eth_ret, const ip4_addr_t **ip_ret) {
+    int i;
+
+    for (i = 0; i < HOST_NEIGHBOURS; i++) {
+        if ((neighbours[i].addr.addr != 0) && (neighbours[i].addr.addr == ipaddr->addr) &&
+            neighbours[i].requested && (neighbours[i].due_us <= host_clock())) {
+            *eth_ret = &neighbours[i].mac;
+            *ip_ret = &neighbours[i].addr;
+            return i;
+        }
+    }
+    return -1;
+}
+
+err_t tcpip_callback(tcpip_callback_fn function, void *ctx) {
+    function(ctx);
+    return ERR_OK;
+}
+
+err_t tcpip_api_call(tcpip_api_call_fn fn, struct tcpip_api_call_data *call) {
+    call->err = fn(call);
+    return call->err;
+}
+
+/*
+* Raw PCB and pbufs
+*
+*/
+struct raw_pcb *raw_new(u8_t proto) {
+    if (host_pcb.used || (proto != IP_PROTO_ICMP)) {
+        return NULL;
+    }
+    memset(&host_pcb, 0, sizeof(host_pcb));
+    host_pcb.used = true;
+    counters.pcbs_opened++;
+    return &host_pcb;
+}
+
+void raw_recv(struct raw_pcb *pcb, raw_recv_fn recv, void *recv_arg) {
+    pcb->recv = recv;
+    pcb->recv_arg = recv_arg;
+}
+
+err_t raw_sendto(struct raw_pcb *pcb, struct pbuf *p, const ip_addr_t *ipaddr) {
+    const struct icmp_echo_hdr *iecho = (const struct icmp_echo_hdr *)p->payload;
+
+    if (!pcb->used) {
+        return ERR_VAL;
+    }
+    if ((p->len >= sizeof(struct icmp_echo_hdr)) && (ICMPH_TYPE(iecho) == ICMP_ECHO)) {
+        host_answer_echo(HOST_PCB_FD, ipaddr->ip4.addr, HOST_DEFAULT_TTL, (const uint8_t *)p->payload, p->len);
+    }
+    return ERR_OK;
+}
+
+void raw_remove(struct raw_pcb *pcb) {
+    int i;
+
+    pcb->used = false;
+    for (i = 0; i < HOST_QUEUE; i++) {
+        if (queue[i].used && (queue[i].fd == HOST_PCB_FD)) {
+            queue[i].used = false;
+        }
+    }
+}
+
+struct pbuf *pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type) {
+    struct pbuf *p = (struct pbuf *)malloc(sizeof(struct pbuf) + length);
+
+    if (p != NULL) {
+        memset(p, 0, sizeof(*p));
+        p->payload = p + 1;
+        p->tot_len = length;
+        p->len = length;
+        p->heap = 1;
+    }
+    return p;
+}
+
+u8_t pbuf_free(struct pbuf *p) {
+    if (p->heap) {
+        free(p);
+    }
+    return 1;
+}
+
+err_t pbuf_take(struct pbuf *buf, const void *dataptr, u16_t len) {
+    if (len > buf->tot_len) {
+        return ERR_MEM;
+    }
+    memcpy(buf->payload, dataptr, len);
+    return ERR_OK;
+}
+
+u16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, u16_t len, u16_t offset) {
+    if (offset >= p->len) {
+        return 0;
+    }
+    if (len > p->len - offset) {
+        len = p->len - offset;
+    }
+    memcpy(dataptr, (const uint8_t *)p->payload + offset, len);
+    return len;
+}
+
+/*
+* Binary semaphore: wait by running the clock to the next datagram for the
+* raw PCB, whose callback is the only thing that gives it here.
+*/
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    uint64_t wait_us = (uint64_t)ticks * portTICK_PERIOD_MS * 1000;
+    uint64_t deadline = host_clock() + ((wait_us < HOST_MAX_BLOCK_US) ? wait_us : HOST_MAX_BLOCK_US);
+    struct host_packet *next;
+
+    while (!semaphore->given) {
+        next = host_next_packet(HOST_PCB_FD);
+        if ((next == NULL) || (next->deliver_us > deadline)) {
+            host_advance_to(deadline);
+            break;
+        }
+        host_advance_to(next->deliver_us);
+    }
+    if (!semaphore->given) {
+        return pdFALSE;
+    }
+    semaphore->given = 0;
+    return pdTRUE;
+}
+
+err_t dns_gethostbyname(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg) {
+    unsigned int a, b, c, d;
+    char tail;
+    int i;
+
+    if (sscanf(hostname, "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) == 4) {
+        addr->type = IPADDR_TYPE_V4;
+        addr->ip4.addr = (uint32_t)IPAddress(a, b, c, d);
+        return ERR_OK;
+    }
+
+    counters.dns_queries++;
+    for (i = 0; i < HOST_NAMES; i++) {
+        if (!dns_queries[i].used) {
+            struct host_dns_query *query = &dns_queries[i];
+            int j;
+
+            query->used = true;
+            query->found = false;
+            query->due_us = host_clock() + 10000;
+            strncpy(query->name, hostname, HOST_NAME_LEN - 1);
+            query->callback = found;
+            query->arg = callback_arg;
+            for (j = 0; j < HOST_NAMES; j++) {
+                if ((names[j].name[0] != 0) && (strcmp(names[j].name, hostname) == 0)) {
+                    query->found = true;
+                    query->addr = names[j].addr;
+                    query->due_us = host_clock() + names[j].latency_us;
+                }
+            }
+            return ERR_INPROGRESS;
+        }
+    }
+    return ERR_MEM;
+}
+
+/*
+* Sockets
+*
+*/
+static void host_fill_from(struct sockaddr *from, socklen_t *fromlen, uint32_t addr, uint16_t port) {
+    if ((from != NULL) && (fromlen != NULL) && (*fromlen >= sizeof(struct sockaddr_in))) {
+        struct sockaddr_in *sin = (struct sockaddr_in *)from;
+
+        memset(sin, 0, sizeof(*sin));
+        sin->sin_len = sizeof(*sin);
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        sin->sin_addr.s_addr = addr;
+        *fromlen = sizeof(*sin);
+    }
+}
+
+/*
+* Readiness of one socket for sim_select(). For a simulated socket that is
+* not readable yet, `next_us` is lowered to when its next packet is due.
+*/
+static bool host_ready(struct host_socket *sock, int s, bool writable, uint64_t *next_us) {
+    struct host_packet *packet;
+
+    if (sock->real_fd >= 0) {
+        return host_real_wait(sock->real_fd, 0, writable) > 0;
+    }
+    if (writable) {
+        return true;
+    }
+    packet = host_next_packet(s);
+    if ((packet != NULL) && (packet->deliver_us <= host_clock())) {
+        return true;
+    }
+    if ((packet != NULL) && (packet->deliver_us < *next_us)) {
+        *next_us = packet->deliver_us;
+    }
+    return false;
+}
+
+int sim_socket(int domain, int type, int protocol) {
+    int i;
+
+    for (i = 0; i < HOST_SOCKETS; i++) {
+        if (!sockets[i].used) {
+            memset(&sockets[i], 0, sizeof(sockets[i]));
+            sockets[i].real_fd = -1;
+            if ((type == SOCK_STREAM) || (type == SOCK_DGRAM) || loopback) {
+                // TCP and UDP always go to the host stack, and to real time
+                if ((sockets[i].real_fd = host_real_socket(type)) < 0) {
+                    return -1;
+                }
+                host_use_real_time();
+            }
+            sockets[i].used = true;
+            sockets[i].ttl = HOST_DEFAULT_TTL;
+            sockets[i].type = type;
+            sockets[i].protocol = protocol;
+            counters.sockets_opened++;
+            return HOST_FD_BASE + i;
+        }
+    }
+    errno = ENFILE;
+    return -1;
+}
+
+int sim_close(int s) {
+    struct host_socket *sock = host_get_socket(s);
+    int i;
+
+    if (sock == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+    if (sock->real_fd >= 0) {
+        host_real_close(sock->real_fd);
+    }
+    for (i = 0; i < HOST_QUEUE; i++) {
+        if (queue[i].fd == s) {
+            queue[i].used = false;
+        }
+    }
+    sock->used = false;
+    counters.sockets_closed++;
+    return 0;
+}
+
+int sim_setsockopt(int s, int level, int optname, const void *optval, socklen_t optlen) {
+    struct host_socket *sock = host_get_socket(s);
+
+    if (sock == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+    if ((level == SOL_SOCKET) && (optname == SO_RCVTIMEO) && (optlen >= sizeof(struct timeval))) {
+        const struct timeval *tv = (const struct timeval *)optval;
+
+        sock->rcvtimeo_us = (uint32_t)(tv->tv_sec * 1000000 + tv->tv_usec);
+        if (sock->real_fd >= 0) {
+            return host_real_set_timeout(sock->real_fd, sock->rcvtimeo_us);
+        }
+    }
+    if ((level == IPPROTO_IP) && (optname == IP_TTL) && (optlen >= sizeof(int))) {
+        sock->ttl = *(const int *)optval;
+        if (sock->real_fd >= 0) {
+            return host_real_set_ttl(sock->real_fd, sock->ttl);
+        }
+    }
+    return 0;
+}
+
+int sim_getsockopt(int s, int level, int optname, void *optval, socklen_t *optlen) {
+    struct host_socket *sock = host_get_socket(s);
+
+    if (sock == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+    if ((level == SOL_SOCKET) && (optname == SO_ERROR) && (*optlen >= sizeof(int))) {
+        *(int *)optval = (sock->real_fd >= 0) ? host_real_error(sock->real_fd) : 0;
+        *optlen = sizeof(int);
+    }
+    if ((level == IPPROTO_IP) && (optname == IP_TTL) && (*optlen >= sizeof(int))) {
+        *(int *)optval = sock->ttl;
+        *optlen = sizeof(int);
+    }
+    return 0;
+}
+
+int sim_fcntl(int s, int cmd, int val) {
+    struct host_socket *sock = host_get_socket(s);
+
+    if (sock == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+    if (cmd == F_GETFL) {
+        return sock->flags;
+    }
+    if (cmd == F_SETFL) {
+        sock->flags = val & O_NONBLOCK;
+        if (sock->real_fd >= 0) {
+            return host_real_set_nonblock(sock->real_fd, (val & O_NONBLOCK) != 0);
+        }
+        return 0;
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+int sim_connect(int s, const struct sockaddr *name, socklen_t namelen) {
+    struct host_socket *sock = host_get_socket(s);
+    const struct sockaddr_in *to = (const struct sockaddr_in *)name;
+
+    if ((sock == NULL) || (to == NULL) || (namelen < sizeof(struct sockaddr_in)) || (sock->real_fd < 0)) {
+        errno = (sock == NULL) ? EBADF : EINVAL;
+        return -1;
+    }
+    return host_real_connect(sock->real_fd, to->sin_addr.s_addr, ntohs(to->sin_port));
+}
+
+int sim_sendto(int s, const void *data, size_t size, int flags, const struct sockaddr *to, socklen_t tolen) {
+    struct host_socket *sock = host_get_socket(s);
+    const struct sockaddr_in *dest = (const struct sockaddr_in *)to;
+    const struct icmp_echo_hdr *iecho = (const struct icmp_echo_hdr *)data;
+
+    if ((sock == NULL) || (dest == NULL) || (tolen < sizeof(struct sockaddr_in))) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (sock->real_fd >= 0) {
+        return host_real_sendto(sock->real_fd, data, (int)size, flags & MSG_DONTWAIT,
+                                dest->sin_addr.s_addr, ntohs(dest->sin_port));
+    }
+
+    if ((sock->type == SOCK_RAW) && (sock->protocol == IP_PROTO_ICMP) &&
+        (size >= sizeof(struct icmp_echo_hdr)) && (ICMPH_TYPE(iecho) == ICMP_ECHO)) {
+        host_answer_echo(s, dest->sin_addr.s_addr, sock->ttl, (const uint8_t *)data, (int)size);
+    }
+    if ((sock->type == SOCK_RAW) && (sock->protocol == IP_PROTO_ICMP) &&
+        (size >= sizeof(struct icmp_echo_hdr)) && (ICMPH_TYPE(iecho) == ICMP_TS)) {
+        host_answer_timestamp(s, dest->sin_addr.s_addr, (const uint8_t *)data, (int)size);
+    }
+    return (int)size;
+}
+
+int sim_recvfrom(int s, void *mem, size_t len, int flags, struct sockaddr *from, socklen_t *fromlen) {
+    struct host_socket *sock = host_get_socket(s);
+    struct host_packet *packet;
+    uint64_t deadline;
+    int copied;
+
+    if (sock == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+    if (sock->real_fd >= 0) {
+        uint32_t addr = 0;
+        uint16_t port = 0;
+        int got = host_real_recvfrom(sock->real_fd, mem, (int)len, flags & MSG_DONTWAIT, &addr, &port);
+
+        if (got > 0) {
+            host_fill_from(from, fromlen, addr, port);
+        }
+        return got;
+    }
+
+    deadline = host_clock() + (sock->rcvtimeo_us ? sock->rcvtimeo_us : HOST_MAX_BLOCK_US);
+    packet = host_next_packet(s);
+    if ((packet == NULL) || (packet->deliver_us > host_clock())) {
+        if ((flags & MSG_DONTWAIT) || (packet == NULL) || (packet->deliver_us > deadline)) {
+            if (!(flags & MSG_DONTWAIT)) {
+                host_advance_to(deadline);
+            }
+            errno = EWOULDBLOCK;
+            return -1;
+        }
+        host_advance_to(packet->deliver_us);
+    }
+
+    copied = (packet->len < len) ? packet->len : (int)len;
+    memcpy(mem, packet->data, copied);
+    host_fill_from(from, fromlen, packet->from, 0);
+    if (!(flags & MSG_PEEK)) {
+        packet->used = false;
+    }
+    return copied;
+}
+
+int sim_select(int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptset, struct timeval *timeout) {
+    uint64_t deadline = host_clock() + (timeout ? (uint64_t)timeout->tv_sec * 1000000 + timeout->tv_usec : HOST_MAX_BLOCK_US);
+    fd_set *sets[2] = {readset, writeset};
+    fd_set ready_sets[2];
+    int ready;
+    int s;
+    int i;
+
+    (void)exceptset;
+    for (;;) {
+        uint64_t next_us = UINT64_MAX;
+        bool any_real = false;
+
+        ready = 0;
+        FD_ZERO(&ready_sets[0]);
+        FD_ZERO(&ready_sets[1]);
+        for (s = HOST_FD_BASE; (s < maxfdp1) && (s < HOST_FD_BASE + HOST_SOCKETS); s++) {
+            struct host_socket *sock = host_get_socket(s);
+
+            for (i = 0; (sock != NULL) && (i < 2); i++) {
+                if ((sets[i] != NULL) && FD_ISSET(s, sets[i])) {
+                    any_real |= (sock->real_fd >= 0);
+                    if (host_ready(sock, s, i == 1, &next_us)) {
+                        FD_SET(s, &ready_sets[i]);
+                        ready++;
+                    }
+                }
+            }
+        }
+        if ((ready > 0) || (host_clock() >= deadline)) {
+            break;
+        }
+
+        if (any_real) {
+            // Poll the host sockets in short real-time steps
+            uint64_t step = deadline - host_clock();
+
+            host_real_sleep_us((step < 200) ? step : 200);
+        }
+        else {
+            host_advance_to((next_us < deadline) ? next_us : deadline);
+        }
+    }
+
+    for (i = 0; i < 2; i++) {
+        if (sets[i] != NULL) {
+            *sets[i] = ready_sets[i];
+        }
+    }
+    return ready;
+}
+
+int sim_gettimeofday(struct timeval *tv, void *tz) {
+    uint64_t t = host_clock();
+
+    (void)tz;
+    tv->tv_sec = (time_t)(t / 1000000);
+    tv->tv_usec = (suseconds_t)(t % 1000000);
+    return 0;
+}
@@ -0,0 +1,134 @@
+/*
+* Host stand-in network for the ping library.
+*
+* Implements the sim_* socket calls declared in host_lwip.h. By default
+* every socket is simulated in-process: echo requests to a configured target
+* are answered after an RTT drawn from the target's distribution, with
+* optional loss, reordering and duplication. Time is virtual, so a blocking
+* receive or delay() jumps the clock forward instead of sleeping and tests
+* with long timeouts finish instantly and deterministically.
+*
+* A raw PCB (raw_new()) gets its replies through its receive callback, called
+* with the clock set to the arrival time of each datagram as the tcpip thread
+* would. Taking a binary semaphore runs the clock up to the next delivery.
+*
+* TCP and UDP sockets are always real host sockets, so the TCP and UDP
+* probes are tested against local listeners (ping_host_tcp_listen(),
+* ping_host_udp_echo()) and switch the clock to real time.
+*
+* ping_host_use_loopback() switches new sockets to real raw ICMP sockets
+* (needs CAP_NET_RAW) and the clock to real time, for checks against the
+* host's own network stack.
+*/
+
+#ifndef PING_HOST_H
+#define PING_HOST_H
+
+#include <stdint.h>
+
+enum ping_host_rtt_model {
+    PING_HOST_RTT_CONSTANT = 0,     // rtt_us
+    PING_HOST_RTT_UNIFORM,          // rtt_us .. rtt_us + spread_us
+    PING_HOST_RTT_NORMAL,           // mean rtt_us, standard deviation spread_us
+    PING_HOST_RTT_EXPONENTIAL       // rtt_us plus an exponential tail of mean spread_us
+};
+
+struct ping_host_link {
+    uint8_t rtt_model;
+    uint32_t rtt_us;
+    uint32_t spread_us;
+    float loss_pct;                 // Requests dropped without a reply
+    float reorder_pct;              // Replies held back by reorder_delay_us
+    uint32_t reorder_delay_us;
+    float duplicate_pct;            // Replies delivered twice, duplicate_delay_us apart
+    uint32_t duplicate_delay_us;
+    uint16_t mtu;                   // Path MTU, larger datagrams arrive fragmented and are dropped (0 = none)
+    uint32_t bandwidth_kbps;        // Bottleneck serializing each datagram both ways (0 = infinitely fast)
+    int64_t clock_offset_us;        // Target's clock minus ours, for timestamp replies
+    uint8_t forward_pct;            // Share of the RTT spent on the way out (0 = half)
+    bool nonstandard_time;          // Timestamp replies carry the nonstandard flag
+};
+
+struct ping_host_counters {
+    uint32_t sockets_opened;
+    uint32_t sockets_closed;
+    uint32_t echo_requests;
+    uint32_t timestamp_requests;
+    uint32_t replies_queued;
+    uint32_t dropped;
+    uint32_t fragmented;
+    uint32_t ttl_exceeded;
+    uint32_t reordered;
+    uint32_t duplicated;
+    uint32_t dns_queries;
+    uint32_t arp_requests;
+    uint32_t pcbs_opened;           // Raw PCBs created by raw_new()
+    uint32_t pcb_taken;             // Datagrams the raw PCB callback consumed
+    uint32_t pcb_passed;            // Datagrams it left to lwIP
+};
+
+// Forget all targets, names, sockets and queued packets, restart the virtual
+// clock at zero and reseed the random source.
+void ping_host_reset(uint32_t seed);
+
+// Make addr answer pings over the given link. Addresses that were never
+// configured swallow every request.
+bool ping_host_set_link(uint32_t addr, const struct ping_host_link *link);
+
+// Put routers between us and addr, nearest first. An echo request whose TTL
+// runs out at router n is answered by routers[n - 1] with an ICMP time
+// exceeded message after n / (count + 1) of the link RTT. A router address
+// of 0 stays silent. The link of addr must be set first.
+bool ping_host_set_route(uint32_t addr, const uint32_t *routers, uint8_t count);
+
+// Make name resolve to addr after latency_us, for dns_gethostbyname().
+bool ping_host_add_name(const char *name, uint32_t addr, uint32_t latency_us);
+
+// Make name fail to resolve again.
+void ping_host_remove_name(const char *name);
+
+// Bring up the stand-in interface with the given address and netmask. It is
+// down after ping_host_reset().
+void ping_host_set_netif(uint32_t addr, uint32_t netmask);
+
+// Put a neighbour on the local link that answers ARP requests for addr after
+// latency_us. Its entry then stays in the ARP table until the next reset.
+bool ping_host_add_neighbour(uint32_t addr, const uint8_t mac[6], uint32_t latency_us);
+
+// Use real raw ICMP sockets and real time from now on. Returns false (and
+// stays simulated) when raw sockets are not permitted.
+bool ping_host_use_loopback(void);
+bool ping_host_loopback_active(void);
+
+// Raise SYSTEM_EVENT_STA_DISCONNECTED on the stand-in WiFi object.
+void ping_host_wifi_disconnect(void);
+
+uint64_t ping_host_now_us(void);
+const struct ping_host_counters *ping_host_get_counters(void);
+
+// Local listeners on 127.0.0.1 for the TCP and UDP probes: a TCP port that
+// accepts connections and a UDP echo service on a thread. The port numbers
+// are picked by the system.
+bool ping_host_tcp_listen(uint16_t *port);
+bool ping_host_udp_echo(uint16_t *port);
+void ping_host_stop_listeners(void);
+
+/*
+* Real socket backend, see ping_host_loopback.cpp. Plain types only, so that
+* file can use the system socket headers. TCP and UDP sockets always use it,
+* raw sockets only in loopback mode; either switches the clock to real time.
+*/
+int host_real_socket(int type);
+int host_real_close(int fd);
+int host_real_set_timeout(int fd, uint32_t timeout_us);
+int host_real_set_ttl(int fd, int ttl);
+int host_real_set_nonblock(int fd, bool nonblock);
+int host_real_connect(int fd, uint32_t addr, uint16_t port);
+int host_real_error(int fd);
+int host_real_sendto(int fd, const void *data, int len, int dontwait, uint32_t addr, uint16_t port);
+int host_real_recvfrom(int fd, void *buf, int len, int dontwait, uint32_t *from, uint16_t *port);
+int host_real_wait(int fd, uint32_t timeout_us, bool writable);
+uint64_t host_real_now_us(void);
+void host_real_sleep_us(uint64_t us);
+
+#endif // PING_HOST_H
@@ -0,0 +1,215 @@
+/*
+* Real socket backend for the host stand-in network: raw ICMP sockets for
+* the loopback mode, TCP and UDP sockets, and the local listeners the tests
+* probe. Kept in its own file because it needs the system socket headers,
+* which clash with the lwIP stand-ins used everywhere else.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "ping_host.h"
+
+#define HOST_LISTENERS 4
+
+static int listeners[HOST_LISTENERS];
+static int listener_count = 0;
+static pthread_t echo_thread;
+static int echo_fd = -1;
+static volatile bool echo_stop = false;
+
+static void host_fill_addr(struct sockaddr_in *sin, uint32_t addr, uint16_t port) {
+    memset(sin, 0, sizeof(*sin));
+    sin->sin_family = AF_INET;
+    sin->sin_addr.s_addr = addr;
+    sin->sin_port = htons(port);
+}
+
+static int host_bind_local(int type, uint16_t *port) {
+    struct sockaddr_in sin;
+    socklen_t sinlen = sizeof(sin);
+    int fd = socket(AF_INET, type, 0);
+
+    host_fill_addr(&sin, htonl(INADDR_LOOPBACK), 0);
+    if ((fd < 0) || (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) ||
+        (getsockname(fd, (struct sockaddr *)&sin, &sinlen) < 0)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    *port = ntohs(sin.sin_port);
+    return fd;
+}
+
+static void *host_echo_loop(void *arg) {
+    char buf[2048];
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    struct pollfd p;
+    int got;
+
+    (void)arg;
+    p.fd = echo_fd;
+    p.events = POLLIN;
+    while (!echo_stop) {
+        if (poll(&p, 1, 10) <= 0) {
+            continue;
+        }
+        fromlen = sizeof(from);
+        if ((got = (int)recvfrom(echo_fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromlen)) > 0) {
+            sendto(echo_fd, buf, got, 0, (struct sockaddr *)&from, fromlen);
+        }
+    }
+    return NULL;
+}
+
+/*
+* Sockets
+*
+*/
+int host_real_socket(int type) {
+    if (type == SOCK_RAW) {
+        return socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+    }
+    return socket(AF_INET, type, 0);
+}
+
+int host_real_close(int fd) {
+    return close(fd);
+}
+
+int host_real_set_timeout(int fd, uint32_t timeout_us) {
+    struct timeval tv;
+
+    tv.tv_sec = timeout_us / 1000000;
+    tv.tv_usec = timeout_us % 1000000;
+    return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+int host_real_set_ttl(int fd, int ttl) {
+    return setsockopt(fd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl));
+}
+
+int host_real_set_nonblock(int fd, bool nonblock) {
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    return fcntl(fd, F_SETFL, nonblock ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+}
+
+int host_real_connect(int fd, uint32_t addr, uint16_t port) {
+    struct sockaddr_in to;
+
+    host_fill_addr(&to, addr, port);
+    return connect(fd, (struct sockaddr *)&to, sizeof(to));
+}
+
+int host_real_error(int fd) {
+    socklen_t len = sizeof(int);
+    int err = 0;
+
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    return err;
+}
+
+int host_real_sendto(int fd, const void *data, int len, int dontwait, uint32_t addr, uint16_t port) {
+    struct sockaddr_in to;
+
+    host_fill_addr(&to, addr, port);
+    return (int)sendto(fd, data, len, dontwait ? MSG_DONTWAIT : 0, (struct sockaddr *)&to, sizeof(to));
+}
+
+int host_real_recvfrom(int fd, void *buf, int len, int dontwait, uint32_t *from, uint16_t *port) {
+    struct sockaddr_in sin;
+    socklen_t sinlen = sizeof(sin);
+    int got = (int)recvfrom(fd, buf, len, dontwait ? MSG_DONTWAIT : 0, (struct sockaddr *)&sin, &sinlen);
+
+    if (got >= 0) {
+        *from = sin.sin_addr.s_addr;
+        *port = ntohs(sin.sin_port);
+    }
+    return got;
+}
+
+int host_real_wait(int fd, uint32_t timeout_us, bool writable) {
+    struct pollfd p;
+
+    p.fd = fd;
+    p.events = writable ? POLLOUT : POLLIN;
+    p.revents = 0;
+    return poll(&p, 1, (int)((timeout_us + 999) / 1000));
+}
+
+uint64_t host_real_now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void host_real_sleep_us(uint64_t us) {
+    struct timespec ts;
+
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
+    while ((nanosleep(&ts, &ts) != 0) && (errno == EINTR)) {
+    }
+}
+
+/*
+* Local listeners
+*
+*/
+bool ping_host_tcp_listen(uint16_t *port) {
+    int fd;
+
+    if (listener_count >= HOST_LISTENERS) {
+        return false;
+    }
+    if ((fd = host_bind_local(SOCK_STREAM, port)) < 0) {
+        return false;
+    }
+    // The kernel completes handshakes from the backlog, nobody needs to accept()
+    if (listen(fd, 64) < 0) {
+        close(fd);
+        return false;
+    }
+    listeners[listener_count++] = fd;
+    return true;
+}
+
+bool ping_host_udp_echo(uint16_t *port) {
+    if (echo_fd >= 0) {
+        return false;
+    }
+    if ((echo_fd = host_bind_local(SOCK_DGRAM, port)) < 0) {
+        return false;
+    }
+    echo_stop = false;
+    if (pthread_create(&echo_thread, NULL, host_echo_loop, NULL) != 0) {
+        close(echo_fd);
+        echo_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void ping_host_stop_listeners(void) {
+    while (listener_count > 0) {
+        close(listeners[--listener_count]);
+    }
+    if (echo_fd >= 0) {
+        echo_stop = true;
+        pthread_join(echo_thread, NULL);
+        close(echo_fd);
+        echo_fd = -1;
+    }
+}
@@ -0,0 +1,293 @@
+// https://docs.platformio.org/en/latest/plus/unit-testing.html
+// Test for the known Access Point selector. Runs on the board and on the
+// host with: pio test -e native
+#include <unity.h>
+#include <time.h>
+#include <aaApSelector.h>
+#include <knownNetworks.h>
+
+#define SCAN_SIZE 64
+
+static const char *known_ssids[] = {"MN_LIVINGROOM", "MN_WORKSHOP_2.4GHz", "MN_DS_OFFICE_2.4GHz", "MN_OUTSIDE", "borfpiggle"};
+static const uint8_t num_known = sizeof(known_ssids) / sizeof(known_ssids[0]);
+static const uint8_t bssid[6] = {0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01};
+
+static aaApSelector *selector;
+
+struct scanned_ap
+{
+    char ssid[33];
+    uint8_t len;
+    int8_t rssi;
+};
+
+static struct scanned_ap scan[SCAN_SIZE];
+
+static void offer(const char *ssid, int8_t rssi)
+{
+    selector->offer(ssid, strlen(ssid), rssi, 6, bssid);
+}
+
+void setUp(void)
+{
+    selector = new aaApSelector();
+    for (uint8_t i = 0; i < num_known; i++)
+    {
+        selector->addKnown(known_ssids[i]);
+    }
+}
+
+void tearDown(void)
+{
+    delete selector;
+}
+
+void test_index_finds_every_known_ssid(void)
+{
+    TEST_ASSERT_EQUAL_UINT8(num_known, selector->knownCount());
+    for (uint8_t i = 0; i < num_known; i++)
+    {
+        TEST_ASSERT_EQUAL_INT8(i, selector->findKnown(known_ssids[i], strlen(known_ssids[i])));
+    }
+    TEST_ASSERT_EQUAL_INT8(-1, selector->findKnown("MN_", 3));
+    TEST_ASSERT_EQUAL_INT8(-1, selector->findKnown("MN_OUTSIDE_5GHz", 15));
+    TEST_ASSERT_EQUAL_INT8(-1, selector->findKnown("", 0));
+    // Scan records are not null terminated at the SSID length
+    TEST_ASSERT_EQUAL_INT8(3, selector->findKnown("MN_OUTSIDEXX", 10));
+    TEST_ASSERT_FALSE(selector->addKnown("MN_OUTSIDE"));
+    TEST_ASSERT_FALSE(selector->addKnown("0123456789012345678901234567890123"));
+}
+
+void test_index_fills_to_capacity(void)
+{
+    static char names[AP_SELECTOR_MAX_KNOWN][8];
+    aaApSelector full;
+
+    for (uint8_t i = 0; i < AP_SELECTOR_MAX_KNOWN; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "ap%u", i);
+        TEST_ASSERT_TRUE(full.addKnown(names[i]));
+    }
+    TEST_ASSERT_FALSE(full.addKnown("one_too_many"));
+    for (uint8_t i = 0; i < AP_SELECTOR_MAX_KNOWN; i++)
+    {
+        TEST_ASSERT_EQUAL_INT8(i, full.findKnown(names[i], strlen(names[i])));
+    }
+}
+
+void test_ranks_by_rssi_not_scan_order(void)
+{
+    offer("MN_WORKSHOP_2.4GHz", -80);
+    offer("neighbour", -40);
+    offer("MN_LIVINGROOM", -55);
+    offer("MN_OUTSIDE", -70);
+
+    TEST_ASSERT_EQUAL_UINT8(3, selector->candidateCount());
+    TEST_ASSERT_EQUAL_INT8(0, selector->candidate(0)->known);
+    TEST_ASSERT_EQUAL_INT8(3, selector->candidate(1)->known);
+    TEST_ASSERT_EQUAL_INT8(1, selector->candidate(2)->known);
+    TEST_ASSERT_EQUAL_INT8(-55, selector->candidate(0)->rssi);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(bssid, selector->candidate(0)->bssid, 6);
+    TEST_ASSERT_NULL(selector->candidate(3));
+
+    selector->clearCandidates();
+    TEST_ASSERT_EQUAL_UINT8(0, selector->candidateCount());
+    TEST_ASSERT_NULL(selector->candidate(0));
+}
+
+void test_priority_outweighs_small_rssi_gap(void)
+{
+    aaApSelector ranked;
+
+    ranked.addKnown("home", 0);
+    ranked.addKnown("robot_lab", 1);
+    ranked.offer("home", 4, -60, 1, bssid);
+    ranked.offer("robot_lab", 9, -60 - AP_SELECTOR_PRIORITY_DB + 1, 11, bssid);
+    TEST_ASSERT_EQUAL_INT8(1, ranked.candidate(0)->known);
+
+    ranked.clearCandidates();
+    ranked.offer("home", 4, -60, 1, bssid);
+    ranked.offer("robot_lab", 9, -60 - AP_SELECTOR_PRIORITY_DB - 1, 11, bssid);
+    TEST_ASSERT_EQUAL_INT8(0, ranked.candidate(0)->known);
+}
+
+void test_history_demotes_failing_and_slow_networks(void)
+{
+    int16_t fresh = selector->score(0, -60);
+
+    // Untried networks are neither promoted nor demoted
+    TEST_ASSERT_EQUAL_INT16(-60 * 4, fresh);
+
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        selector->recordAttempt(0, false, 0);
+    }
+    TEST_ASSERT_EQUAL_UINT16(4, selector->getHistory(0).attempts);
+    TEST_ASSERT_TRUE(selector->score(0, -60) < fresh);
+    TEST_ASSERT_TRUE(selector->score(0, -60) >= fresh - AP_SELECTOR_HISTORY_DB * 2);
+
+    offer("MN_LIVINGROOM", -60);
+    offer("MN_OUTSIDE", -62);
+    TEST_ASSERT_EQUAL_INT8(3, selector->candidate(0)->known);
+
+    // Reliable but slow loses to equally reliable and fast
+    selector->recordAttempt(1, true, 4000);
+    selector->recordAttempt(2, true, 200);
+    TEST_ASSERT_EQUAL_UINT32(4000, selector->getHistory(1).connectMs);
+    TEST_ASSERT_TRUE(selector->score(1, -60) < selector->score(2, -60));
+    TEST_ASSERT_EQUAL_INT16(fresh + AP_SELECTOR_HISTORY_DB * 2 / 3 - AP_SELECTOR_MAX_SLOW_DB * 4, selector->score(1, -60));
+
+    selector->recordAttempt(1, true, 0);
+    TEST_ASSERT_EQUAL_UINT32(3000, selector->getHistory(1).connectMs);
+}
+
+void test_keeps_only_the_best_candidates(void)
+{
+    for (int8_t rssi = -90; rssi <= -41; rssi++)
+    {
+        offer(known_ssids[(rssi + 90) % num_known], rssi);
+    }
+    TEST_ASSERT_EQUAL_UINT8(AP_SELECTOR_MAX_CANDIDATES, selector->candidateCount());
+    for (uint8_t rank = 0; rank < AP_SELECTOR_MAX_CANDIDATES; rank++)
+    {
+        TEST_ASSERT_EQUAL_INT8(-41 - rank, selector->candidate(rank)->rssi);
+    }
+}
+
+void test_compile_time_table_matches_runtime_hash(void)
+{
+    static constexpr knownNetwork table[] = {
+        KNOWN_NETWORK("MN_OUTSIDE", "5194741299", 2),
+        KNOWN_NETWORK("", "", 0),
+        KNOWN_NETWORK("0123456789abcdef0123456789abcdef", "pw", 1),
+    };
+    static_assert(table[0].ssidHash == apSsidHash("MN_OUTSIDE", 10), "hash is a constant expression");
+    aaApSelector flash;
+
+    TEST_ASSERT_EQUAL_UINT8(10, table[0].ssidLen);
+    TEST_ASSERT_EQUAL_UINT8(0, table[1].ssidLen);
+    TEST_ASSERT_EQUAL_UINT8(32, table[2].ssidLen);
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        TEST_ASSERT_EQUAL_HEX32(aaApSelector::hash(table[i].ssid, table[i].ssidLen), table[i].ssidHash);
+    }
+    TEST_ASSERT_TRUE(flash.addKnown(table[0].ssid, table[0].ssidLen, table[0].ssidHash, table[0].priority));
+    TEST_ASSERT_TRUE(flash.addKnown(table[2].ssid, table[2].ssidLen, table[2].ssidHash, table[2].priority));
+    TEST_ASSERT_FALSE(flash.addKnown(table[0].ssid, table[0].ssidLen, table[0].ssidHash, 0));
+    TEST_ASSERT_EQUAL_INT16(1, flash.findKnown("0123456789abcdef0123456789abcdef", 32));
+    TEST_ASSERT_EQUAL_INT16(0, flash.findKnown("MN_OUTSIDE", 10));
+}
+
+/*
+* The nested loop the selector replaces: every scanned SSID copied to the heap
+* (as WiFi.SSID(i) does) and compared against every known one, strongest
+* match wins. Uses the RSSI the old code meant to, so both pick the same AP.
+*/
+static int8_t select_nested(void)
+{
+    int8_t best = -1;
+    int8_t strongest = -128;
+    char *copy;
+
+    for (uint8_t i = 0; i < SCAN_SIZE; i++)
+    {
+        for (uint8_t j = 0; j < num_known; j++)
+        {
+            copy = (char *)malloc(scan[i].len + 1);
+            memcpy(copy, scan[i].ssid, scan[i].len + 1);
+            if ((strlen(known_ssids[j]) == strlen(copy)) && (strcmp(known_ssids[j], copy) == 0) &&
+                (scan[i].rssi > strongest))
+            {
+                strongest = scan[i].rssi;
+                best = j;
+            }
+            free(copy);
+        }
+    }
+    return best;
+}
+
+static int8_t select_indexed(void)
+{
+    selector->clearCandidates();
+    for (uint8_t i = 0; i < SCAN_SIZE; i++)
+    {
+        selector->offer(scan[i].ssid, scan[i].len, scan[i].rssi, 1, bssid);
+    }
+    return selector->candidateCount() ? selector->candidate(0)->known : -1;
+}
+
+void test_selection_benchmark(void)
+{
+    const uint32_t rounds = 20000;
+    volatile int8_t sink = 0;
+    char message[96];
+    clock_t started;
+    double nested, indexed;
+
+    // A busy block of flats: mostly strangers, some sharing our prefix
+    for (uint8_t i = 0; i < SCAN_SIZE; i++)
+    {
+        if (i % 13 == 5)
+        {
+            strcpy(scan[i].ssid, known_ssids[(i / 13) % num_known]);
+        }
+        else
+        {
+            snprintf(scan[i].ssid, sizeof(scan[i].ssid), i % 3 ? "MN_NEIGHBOUR_%u" : "Flat%u-2.4GHz", i);
+        }
+        scan[i].len = strlen(scan[i].ssid);
+        scan[i].rssi = -30 - (i * 37) % 60;
+    }
+    TEST_ASSERT_EQUAL_INT8(select_nested(), select_indexed());
+
+    started = clock();
+    for (uint32_t r = 0; r < rounds; r++)
+    {
+        sink = sink + select_nested();
+    }
+    nested = (double)(clock() - started) / CLOCKS_PER_SEC;
+
+    started = clock();
+    for (uint32_t r = 0; r < rounds; r++)
+    {
+        sink = sink + select_indexed();
+    }
+    indexed = (double)(clock() - started) / CLOCKS_PER_SEC;
+
+    snprintf(message, sizeof(message), "%u APs: nested loop %.2f us, indexed %.2f us per scan",
+             SCAN_SIZE, nested * 1e6 / rounds, indexed * 1e6 / rounds);
+    TEST_MESSAGE(message);
+}
+
+int runUnityTests(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_index_finds_every_known_ssid);
+    RUN_TEST(test_index_fills_to_capacity);
+    RUN_TEST(test_ranks_by_rssi_not_scan_order);
+    RUN_TEST(test_priority_outweighs_small_rssi_gap);
+    RUN_TEST(test_history_demotes_failing_and_slow_networks);
+    RUN_TEST(test_keeps_only_the_best_candidates);
+    RUN_TEST(test_compile_time_table_matches_runtime_hash);
+    RUN_TEST(test_selection_benchmark);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+#include <Arduino.h>
+void setup()
+{
+    delay(2000); // service delay
+    runUnityTests();
+}
+
+void loop()
+{
+}
+#else
+int main(void)
+{
+    return runUnityTests();
+}
+#endif
@@ -0,0 +1,598 @@
+// https://docs.platformio.org/en/latest/plus/unit-testing.html
+// Host test for the ping engine (ping.cpp, ESP32Ping.cpp) against the
+// simulated network in test/host. Run with: pio test -e native
+#include <unity.h>
+#include <time.h>
+#include <ESP32Ping.h>
+#include <ping_arp.h>
+#include <ping_host.h>
+
+static const IPAddress gateway(192, 168, 1, 1);
+static const IPAddress nowhere(192, 168, 1, 250);
+static struct ping_resp last_resp;
+
+static void on_ping_done(void *opt, void *pdata)
+{
+    last_resp = *reinterpret_cast<struct ping_resp *>(pdata);
+}
+
+static void set_link(IPAddress addr, uint8_t model, uint32_t rtt_us, uint32_t spread_us, float loss_pct)
+{
+    struct ping_host_link link;
+
+    memset(&link, 0, sizeof(link));
+    link.rtt_model = model;
+    link.rtt_us = rtt_us;
+    link.spread_us = spread_us;
+    link.loss_pct = loss_pct;
+    ping_host_set_link(addr, &link);
+}
+
+void setUp(void)
+{
+    // Drop the cached socket before the simulator forgets it
+    ping_socket_close();
+    ping_set_backend(PING_BACKEND_SOCKET);
+    ping_host_reset(12345);
+    ping_dns_flush();
+    memset(&last_resp, 0, sizeof(last_resp));
+}
+
+void tearDown(void)
+{
+    ping_host_stop_listeners();
+}
+
+void test_constant_rtt_is_reported_exactly(void)
+{
+    set_link(gateway, PING_HOST_RTT_CONSTANT, 20000, 0, 0);
+
+    TEST_ASSERT_TRUE(Ping.ping(gateway, 5));
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 20.0, Ping.averageTime());
+    TEST_ASSERT_EQUAL_UINT32(20000, Ping.percentile(50));
+    TEST_ASSERT_EQUAL_UINT32(20000, Ping.percentile(99));
+    TEST_ASSERT_EQUAL_UINT32(0, Ping.jitter());
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 0.0, Ping.packetLoss());
+}
+
+void test_unreachable_host_times_out(void)
+{
+    struct ping_option option;
+    uint64_t started = ping_host_now_us();
+
+    memset(&option, 0, sizeof(option));
+    option.recv_function = &on_ping_done;
+
+    // Three 1 s timeouts plus two 1 s intervals
+    TEST_ASSERT_FALSE(ping_start(nowhere, 3, 1, 32, 1, &option));
+    TEST_ASSERT_EQUAL_UINT32(5000000, ping_host_now_us() - started);
+    TEST_ASSERT_EQUAL_UINT32(3, last_resp.timeout_count);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 100.0, ping_hist_loss(last_resp.histogram));
+    TEST_ASSERT_EQUAL_UINT32(3, ping_host_get_counters()->dropped);
+}
+
+void test_loss_rate_matches_link(void)
+{
+    set_link(gateway, PING_HOST_RTT_CONSTANT, 5000, 0, 30);
+
+    Ping.pingWindow(gateway, 1000, 8, 10, 200);
+    TEST_ASSERT_EQUAL_FLOAT(ping_host_get_counters()->dropped / 10.0, Ping.packetLoss());
+    TEST_ASSERT_FLOAT_WITHIN(5.0, 30.0, Ping.packetLoss());
+}
+
+void test_percentiles_follow_rtt_distribution(void)
+{
+    // Normal, mean 50 ms and standard deviation 5 ms: p90 is 56.4 ms
+    set_link(gateway, PING_HOST_RTT_NORMAL, 50000, 5000, 0);
+
+    TEST_ASSERT_TRUE(Ping.pingWindow(gateway, 2000, 8, 10, 1000));
+    TEST_ASSERT_UINT32_WITHIN(2000, 50000, Ping.percentile(50));
+    TEST_ASSERT_UINT32_WITHIN(2500, 56400, Ping.percentile(90));
+    TEST_ASSERT_FLOAT_WITHIN(1.0, 50.0, Ping.averageTime());
+    TEST_ASSERT_TRUE(Ping.jitter() > 2000);
+}
+
+void test_window_counts_late_and_duplicate_replies(void)
+{
+    struct ping_host_link link;
+    const struct ping_host_counters *counters = ping_host_get_counters();
+
+    // Held back replies arrive after the 100 ms timeout but before their
+    // slot is reused 16 probes (160 ms) later
+    memset(&link, 0, sizeof(link));
+    link.rtt_us = 20000;
+    link.reorder_pct = 10;
+    link.reorder_delay_us = 120000;
+    link.duplicate_pct = 10;
+    link.duplicate_delay_us = 5000;
+    ping_host_set_link(gateway, &link);
+
+    Ping.pingWindow(gateway, 500, 8, 10, 100);
+    TEST_ASSERT_TRUE(counters->reordered > 0);
+    TEST_ASSERT_TRUE(counters->duplicated > 0);
+    TEST_ASSERT_EQUAL_UINT32(500 - counters->reordered, 500 - Ping.packetLoss() * 5);
+
+    // Replies still on the way when the session ends are not seen
+    TEST_ASSERT_TRUE(Ping.lateReplies() <= counters->reordered);
+    TEST_ASSERT_UINT32_WITHIN(4, counters->reordered, Ping.lateReplies());
+    TEST_ASSERT_TRUE(Ping.duplicateReplies() <= counters->duplicated);
+    TEST_ASSERT_UINT32_WITHIN(4, counters->duplicated, Ping.duplicateReplies());
+}
+
+void test_classic_late_reply_is_not_a_match(void)
+{
+    struct ping_option option;
+    const struct ping_socket_stats *stats = ping_socket_get_stats();
+    uint32_t drained = stats->drained;
+
+    memset(&option, 0, sizeof(option));
+    option.recv_function = &on_ping_done;
+
+    // Every reply arrives half a second after its 1 s timeout
+    set_link(gateway, PING_HOST_RTT_CONSTANT, 1500000, 0, 0);
+    TEST_ASSERT_FALSE(ping_start(gateway, 3, 1, 32, 1, &option));
+    TEST_ASSERT_EQUAL_UINT32(2, last_resp.late_count);
+
+    // The last one is still queued and is thrown away by the next session
+    delay(1000);
+    set_link(gateway, PING_HOST_RTT_CONSTANT, 1000, 0, 0);
+    TEST_ASSERT_TRUE(ping_start(gateway, 1, 1, 32, 1, &option));
+    TEST_ASSERT_EQUAL_UINT32(drained + 1, stats->drained);
+    TEST_ASSERT_EQUAL_UINT32(0, last_resp.late_count);
+}
+
+void test_socket_reused_until_disconnect(void)
+{
+    const struct ping_socket_stats *stats = ping_socket_get_stats();
+    uint32_t opens = stats->opens;
+    uint32_t reuses = stats->reuses;
+
+    set_link(gateway, PING_HOST_RTT_CONSTANT, 2000, 0, 0);
+    TEST_ASSERT_TRUE(Ping.ping(gateway, 1));
+    TEST_ASSERT_TRUE(Ping.ping(gateway, 1));
+    TEST_ASSERT_TRUE(Ping.ping(gateway, 1));
+    TEST_ASSERT_EQUAL_UINT32(opens + 1, stats->opens);
+    TEST_ASSERT_EQUAL_UINT32(reuses + 2, stats->reuses);
+    TEST_ASSERT_EQUAL_UINT32(1, ping_host_get_counters()->sockets_opened);
+
+    ping_host_wifi_disconnect();
+    TEST_ASSERT_TRUE(Ping.ping(gateway, 1));
+    TEST_ASSERT_EQUAL_UINT32(opens + 2, stats->opens);
+    TEST_ASSERT_EQUAL_UINT32(1, ping_host_get_counters()->sockets_closed);
+
+    // Idle sockets are closed after PING_SOCKET_IDLE_MS
+    TEST_ASSERT_FALSE(ping_socket_expire(1000));
+    delay(1000);
+    TEST_ASSERT_TRUE(ping_socket_expire(1000));
+    TEST_ASSERT_EQUAL_UINT32(2, ping_host_get_counters()->sockets_closed);
+}
+
+void test_hostname_lookups_are_cached(void)
+{
+    const struct ping_dns_stats *stats = ping_dns_get_stats();
+    uint32_t negative_hits;
+    uint32_t hits;
+
+    set_link(gateway, PING_HOST_RTT_CONSTANT, 2000, 0, 0);
+    ping_host_add_name("gateway.local", gateway, 30000);
+
+    TEST_ASSERT_TRUE(Ping.ping("gateway.local", 1));
+    hits = stats->hits;
+    TEST_ASSERT_TRUE(Ping.ping("gateway.local", 1));
+    TEST_ASSERT_EQUAL_UINT32(1, ping_host_get_counters()->dns_queries);
+    TEST_ASSERT_EQUAL_UINT32(hits + 1, stats->hits);
+
+    TEST_ASSERT_FALSE(Ping.ping("nowhere.local", 1));
+    negative_hits = stats->negative_hits;
+    TEST_ASSERT_FALSE(Ping.ping("nowhere.local", 1));
+    TEST_ASSERT_EQUAL_UINT32(2, ping_host_get_counters()->dns_queries);
+    TEST_ASSERT_EQUAL_UINT32(negative_hits + 1, stats->negative_hits);
+
+    // Literal addresses never reach the resolver
+    TEST_ASSERT_TRUE(Ping.ping("192.168.1.1", 1));
+    TEST_ASSERT_EQUAL_UINT32(2, ping_host_get_counters()->dns_queries);
+
+    // A failed refresh keeps serving the last address
+    ping_host_remove_name("gateway.local");
+    delay(PING_DNS_TTL_MS);
+    TEST_ASSERT_TRUE(Ping.ping("gateway.local", 1));
+    TEST_ASSERT_EQUAL_UINT32(3, ping_host_get_counters()->dns_queries);
+    delay(PING_DNS_QUERY_TIMEOUT_MS);
+    TEST_ASSERT_TRUE(Ping.ping("gateway.local", 1));
+    TEST_ASSERT_EQUAL_UINT32(3, ping_host_get_counters()->dns_queries);
+}
+
+void test_path_mtu_binary_search(void)
+{
+    struct ping_host_link link;
+    struct ping_pmtu_result result;
+
+    memset(&link, 0, sizeof(link));
+    link.rtt_us = 3000;
+    link.mtu = 1400;
+    ping_host_set_link(gateway, &link);
+
+    TEST_ASSERT_TRUE(ping_pmtu(gateway, 0, 500, 1, &result));
+    TEST_ASSERT_EQUAL_UINT16(1400, result.mtu);
+    TEST_ASSERT_EQUAL_UINT16(1372, result.payload);
+    TEST_ASSERT_EQUAL_UINT8(1, result.exact);
+    // Largest size, smallest size, then ceil(log2(1500 - 68)) steps
+    TEST_ASSERT_TRUE(result.probes <= 2 + 11);
+
+    // A clean path costs one probe
+    link.mtu = 0;
+    ping_host_set_link(gateway, &link);
+    TEST_ASSERT_EQUAL_UINT16(PING_PMTU_MAX, Ping.pathMTU(gateway));
+    TEST_ASSERT_TRUE(ping_pmtu(gateway, 0, 500, 1, &result));
+    TEST_ASSERT_EQUAL_UINT16(1, result.probes);
+}
+
+void test_path_mtu_survives_loss(void)
+{
+    struct ping_host_link link;
+    struct ping_pmtu_result result;
+
+    memset(&link, 0, sizeof(link));
+    link.rtt_us = 3000;
+    link.loss_pct = 10;
+    link.mtu = 576;
+    ping_host_set_link(gateway, &link);
+
+    TEST_ASSERT_TRUE(ping_pmtu(gateway, 1500, 200, 4, &result));
+    TEST_ASSERT_EQUAL_UINT16(576, result.mtu);
+
+    TEST_ASSERT_FALSE(ping_pmtu(nowhere, 1500, 200, 2, &result));
+    TEST_ASSERT_EQUAL_UINT16(0, result.mtu);
+    TEST_ASSERT_EQUAL_UINT16(4, result.probes);
+}
+
+void test_sweep_estimates_bandwidth_and_base_latency(void)
+{
+    struct ping_host_link link;
+    struct ping_sweep_result result;
+
+    // 2 Mbit/s bottleneck behind 5 ms of latency with queueing noise
+    memset(&link, 0, sizeof(link));
+    link.rtt_model = PING_HOST_RTT_EXPONENTIAL;
+    link.rtt_us = 5000;
+    link.spread_us = 3000;
+    link.bandwidth_kbps = 2000;
+    ping_host_set_link(gateway, &link);
+
+    TEST_ASSERT_TRUE(ping_sweep(gateway, 0, 0, 8, 10, 500, &result));
+    TEST_ASSERT_EQUAL_UINT8(8, result.steps);
+    TEST_ASSERT_EQUAL_UINT16(PING_PMTU_MIN, result.size[0]);
+    TEST_ASSERT_EQUAL_UINT16(PING_PMTU_MAX, result.size[7]);
+    TEST_ASSERT_UINT32_WITHIN(200, 2000, result.kbps);
+    TEST_ASSERT_FLOAT_WITHIN(1000, 5000, result.base_us);
+
+    // Every size must come back whole to count
+    link.mtu = 1000;
+    ping_host_set_link(gateway, &link);
+    TEST_ASSERT_UINT32_WITHIN(200, 2000, Ping.bandwidth(gateway, &result));
+    TEST_ASSERT_EQUAL_UINT32(0, result.min_us[7]);
+    TEST_ASSERT_TRUE(result.min_us[0] > 0);
+
+    TEST_ASSERT_EQUAL_UINT32(0, Ping.bandwidth(nowhere, NULL, 100));
+}
+
+void test_traceroute_reports_each_hop(void)
+{
+    static const uint32_t routers[] = {IPAddress(192, 168, 1, 1), 0, IPAddress(10, 0, 0, 1)};
+    const IPAddress broker(10, 0, 0, 42);
+    struct ping_trace_result result;
+
+    set_link(broker, PING_HOST_RTT_CONSTANT, 40000, 0, 0);
+    ping_host_set_route(broker, routers, 3);
+
+    TEST_ASSERT_TRUE(Ping.traceroute(broker, result));
+    TEST_ASSERT_EQUAL_UINT8(4, result.hops);
+    TEST_ASSERT_EQUAL_UINT8(1, result.reached);
+
+    TEST_ASSERT_EQUAL_UINT32(routers[0], result.hop[0].addr);
+    TEST_ASSERT_EQUAL_UINT8(3, result.hop[0].received);
+    TEST_ASSERT_EQUAL_UINT32(10000, result.hop[0].mean_us);
+
+    // A silent router costs one timeout
+    TEST_ASSERT_EQUAL_UINT32(0, result.hop[1].addr);
+    TEST_ASSERT_EQUAL_UINT8(3, result.hop[1].sent);
+    TEST_ASSERT_EQUAL_UINT8(0, result.hop[1].received);
+
+    TEST_ASSERT_EQUAL_UINT32(routers[2], result.hop[2].addr);
+    TEST_ASSERT_EQUAL_UINT32(30000, result.hop[2].min_us);
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)broker, result.hop[3].addr);
+    TEST_ASSERT_EQUAL_UINT32(40000, result.hop[3].max_us);
+    TEST_ASSERT_EQUAL_UINT32(1000 + 10 + 30 + 40, result.elapsed_ms);
+}
+
+void test_traceroute_is_bounded_and_restores_ttl(void)
+{
+    static const uint32_t routers[] = {IPAddress(192, 168, 1, 1), IPAddress(10, 0, 0, 1)};
+    const IPAddress broker(10, 0, 0, 42);
+    struct ping_trace_result result;
+
+    TEST_ASSERT_FALSE(ping_traceroute(nowhere, 5, 4, 200, &result));
+    TEST_ASSERT_EQUAL_UINT8(5, result.hops);
+    TEST_ASSERT_EQUAL_UINT8(0, result.reached);
+    TEST_ASSERT_EQUAL_UINT32(5 * 200, result.elapsed_ms);
+
+    // Stopping short of the target must not leave a short TTL behind
+    set_link(broker, PING_HOST_RTT_CONSTANT, 40000, 0, 0);
+    ping_host_set_route(broker, routers, 2);
+    TEST_ASSERT_FALSE(ping_traceroute(broker, 1, 2, 200, &result));
+    TEST_ASSERT_EQUAL_UINT32(routers[0], result.hop[0].addr);
+    TEST_ASSERT_TRUE(Ping.ping(broker, 1));
+    TEST_ASSERT_EQUAL_UINT32(2, ping_host_get_counters()->ttl_exceeded);
+}
+
+void test_tcp_probe_times_local_listener(void)
+{
+    const IPAddress localhost(127, 0, 0, 1);
+    struct ping_option option;
+    uint16_t port;
+
+    memset(&option, 0, sizeof(option));
+    option.recv_function = &on_ping_done;
+    TEST_ASSERT_TRUE(ping_host_tcp_listen(&port));
+
+    TEST_ASSERT_TRUE(ping_start_probe(PING_PROBE_TCP, localhost, port, 5, 10, 0, 500, &option));
+    TEST_ASSERT_EQUAL_UINT32(0, last_resp.timeout_count);
+    TEST_ASSERT_TRUE(last_resp.resp_time < 50.0);
+    TEST_ASSERT_EQUAL_UINT32(5, last_resp.total_count);
+
+    Ping.setProbeType(PING_PROBE_TCP, port);
+    TEST_ASSERT_TRUE(Ping.ping(localhost, 1));
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 0.0, Ping.packetLoss());
+    Ping.setProbeType(PING_PROBE_ICMP);
+
+    // A refused connection reached the host but not the service
+    ping_host_stop_listeners();
+    TEST_ASSERT_FALSE(ping_start_probe(PING_PROBE_TCP, localhost, port, 2, 10, 0, 500, &option));
+    TEST_ASSERT_EQUAL_UINT32(2, last_resp.timeout_count);
+    TEST_ASSERT_EQUAL_UINT32(2, last_resp.refused_count);
+}
+
+void test_udp_probe_round_trips_through_echo(void)
+{
+    const IPAddress localhost(127, 0, 0, 1);
+    struct ping_option option;
+    uint16_t port;
+
+    memset(&option, 0, sizeof(option));
+    option.recv_function = &on_ping_done;
+    TEST_ASSERT_TRUE(ping_host_udp_echo(&port));
+
+    TEST_ASSERT_TRUE(ping_start_probe(PING_PROBE_UDP, localhost, port, 5, 10, 200, 500, &option));
+    TEST_ASSERT_EQUAL_UINT32(0, last_resp.timeout_count);
+    TEST_ASSERT_EQUAL_UINT32(200, last_resp.bytes);
+    TEST_ASSERT_TRUE(last_resp.resp_time < 50.0);
+
+    // Nobody answers once the echo service is gone
+    ping_host_stop_listeners();
+    TEST_ASSERT_FALSE(ping_start_probe(PING_PROBE_UDP, localhost, port, 2, 10, 0, 100, &option));
+    TEST_ASSERT_EQUAL_UINT32(2, last_resp.timeout_count);
+}
+
+void test_raw_pcb_backend_matches_on_arrival(void)
+{
+    struct ping_host_link link;
+    const struct ping_host_counters *counters = ping_host_get_counters();
+    uint32_t queued = ping_raw_get_stats()->queued;
+
+    set_link(gateway, PING_HOST_RTT_CONSTANT, 3000, 0, 0);
+    Ping.setBackend(PING_BACKEND_RAW_PCB);
+
+    // Timestamped by the callback on arrival, not when the session wakes up
+    TEST_ASSERT_TRUE(Ping.pingWindow(gateway, 40, 4, 1, 100));
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 3.0, Ping.averageTime());
+    TEST_ASSERT_EQUAL_UINT32(0, Ping.jitter());
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 0.0, Ping.packetLoss());
+    TEST_ASSERT_EQUAL_UINT32(40, counters->pcb_taken);
+    TEST_ASSERT_EQUAL_UINT32(40, ping_raw_get_stats()->queued - queued);
+    TEST_ASSERT_EQUAL_UINT32(0, counters->sockets_opened);
+
+    // Late and duplicate replies are told apart the same way as on a socket
+    memset(&link, 0, sizeof(link));
+    link.rtt_us = 20000;
+    link.reorder_pct = 10;
+    link.reorder_delay_us = 120000;
+    link.duplicate_pct = 10;
+    link.duplicate_delay_us = 5000;
+    ping_host_set_link(gateway, &link);
+    Ping.pingWindow(gateway, 300, 8, 10, 100);
+    TEST_ASSERT_TRUE(Ping.lateReplies() > 0);
+    TEST_ASSERT_TRUE(Ping.duplicateReplies() > 0);
+    TEST_ASSERT_UINT32_WITHIN(4, counters->reordered, Ping.lateReplies());
+
+    // Replies still on the way after the session are left to lwIP
+    delay(200);
+    TEST_ASSERT_TRUE(counters->pcb_passed > 0);
+    TEST_ASSERT_EQUAL_UINT32(0, ping_raw_get_stats()->overflows);
+
+    // A disconnect replaces the PCB along with the socket
+    TEST_ASSERT_EQUAL_UINT32(1, counters->pcbs_opened);
+    ping_host_wifi_disconnect();
+    TEST_ASSERT_TRUE(Ping.pingWindow(gateway, 4, 4, 1, 100));
+    TEST_ASSERT_EQUAL_UINT32(2, counters->pcbs_opened);
+
+    Ping.setBackend(PING_BACKEND_SOCKET);
+    TEST_ASSERT_TRUE(Ping.pingWindow(gateway, 4, 4, 1, 100));
+    TEST_ASSERT_EQUAL_UINT32(1, counters->sockets_opened);
+}
+
+void test_timestamp_offset_and_one_way_delay(void)
+{
+    struct ping_host_link link;
+    ping_ts_result result;
+
+    memset(&link, 0, sizeof(link));
+    link.rtt_model = PING_HOST_RTT_CONSTANT;
+    link.rtt_us = 10000;
+    link.clock_offset_us = -3600000000LL + 250000;
+    ping_host_set_link(gateway, &link);
+
+    TEST_ASSERT_TRUE(Ping.timestamp(gateway, result, 4, 100, 500));
+    TEST_ASSERT_EQUAL_UINT8(4, result.received);
+    TEST_ASSERT_EQUAL_UINT32(4, ping_host_get_counters()->timestamp_requests);
+    TEST_ASSERT_INT64_WITHIN(500, -3600000000LL + 250000, result.offset_us);
+    TEST_ASSERT_UINT32_WITHIN(1000, 10000, result.delay_us);
+
+    // With a synchronised clock the raw one-way times are the delays
+    link.clock_offset_us = 0;
+    link.forward_pct = 70;
+    ping_host_set_link(gateway, &link);
+    TEST_ASSERT_TRUE(Ping.timestamp(gateway, result, 4, 100, 500));
+    TEST_ASSERT_INT_WITHIN(500, 7000, result.forward_us);
+    TEST_ASSERT_INT_WITHIN(500, 3000, result.back_us);
+}
+
+void test_timestamp_min_filter_and_rejects(void)
+{
+    struct ping_host_link link;
+    ping_ts_result result;
+
+    // Queueing adds up to 40 ms, the least delayed exchange still pins the offset
+    memset(&link, 0, sizeof(link));
+    link.rtt_model = PING_HOST_RTT_EXPONENTIAL;
+    link.rtt_us = 4000;
+    link.spread_us = 10000;
+    link.forward_pct = 50;
+    link.clock_offset_us = 1500000;
+    ping_host_set_link(gateway, &link);
+
+    TEST_ASSERT_TRUE(Ping.timestamp(gateway, result, 16, 10, 500));
+    TEST_ASSERT_INT_WITHIN(1000, 1500000, result.offset_us);
+    TEST_ASSERT_TRUE(result.delay_us < 6000);
+
+    // Replies in a private timebase are not mixed in
+    link.nonstandard_time = true;
+    ping_host_set_link(gateway, &link);
+    TEST_ASSERT_FALSE(Ping.timestamp(gateway, result, 3, 10, 500));
+    TEST_ASSERT_EQUAL_UINT8(3, result.nonstandard);
+
+    // Nobody answers
+    TEST_ASSERT_FALSE(Ping.timestamp(nowhere, result, 2, 10, 100));
+    TEST_ASSERT_EQUAL_UINT8(2, result.sent);
+    TEST_ASSERT_EQUAL_UINT8(0, result.received);
+}
+
+void test_arp_probe_times_neighbour(void)
+{
+    const uint8_t mac[6] = {0x24, 0x0a, 0xc4, 0x01, 0x02, 0x03};
+    struct ping_arp_result result;
+
+    ping_host_set_netif(IPAddress(192, 168, 1, 10), IPAddress(255, 255, 255, 0));
+    ping_host_add_neighbour(gateway, mac, 1500);
+
+    TEST_ASSERT_TRUE(ping_arp(gateway, 100, &result));
+    TEST_ASSERT_FALSE(result.cached);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(mac, result.mac, 6);
+    TEST_ASSERT_UINT32_WITHIN(PING_ARP_POLL_US, 1500, result.latency_us);
+    TEST_ASSERT_EQUAL_UINT16(1500 / PING_ARP_POLL_US, result.polls);
+
+    // The answer stays in the table, the next probe is answered from it
+    TEST_ASSERT_TRUE(ping_arp(gateway, 100, &result));
+    TEST_ASSERT_TRUE(result.cached);
+    TEST_ASSERT_EQUAL_UINT32(0, result.latency_us);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(mac, result.mac, 6);
+    TEST_ASSERT_EQUAL_UINT32(2, ping_host_get_counters()->arp_requests);
+}
+
+void test_arp_probe_absent_or_off_subnet(void)
+{
+    struct ping_arp_result result;
+    uint64_t started;
+
+    // No interface up yet
+    TEST_ASSERT_FALSE(ping_arp(gateway, 100, &result));
+    TEST_ASSERT_EQUAL_UINT32(0, ping_host_get_counters()->arp_requests);
+
+    ping_host_set_netif(IPAddress(192, 168, 1, 10), IPAddress(255, 255, 255, 0));
+
+    // Off the subnet ARP cannot reach it, nothing is sent
+    TEST_ASSERT_FALSE(ping_arp(IPAddress(10, 0, 0, 1), 100, &result));
+    TEST_ASSERT_EQUAL_UINT32(0, ping_host_get_counters()->arp_requests);
+
+    // Nobody answers: gives up at the timeout, polling once per tick after the spin
+    started = ping_host_now_us();
+    TEST_ASSERT_FALSE(ping_arp(nowhere, 50, &result));
+    TEST_ASSERT_FALSE(result.present);
+    TEST_ASSERT_UINT32_WITHIN(1000, 50000, (uint32_t)(ping_host_now_us() - started));
+    TEST_ASSERT_TRUE(result.polls < PING_ARP_SPIN_US / PING_ARP_POLL_US + 50);
+    TEST_ASSERT_EQUAL_UINT32(1, ping_host_get_counters()->arp_requests);
+}
+
+void test_throughput_benchmark(void)
+{
+    const uint32_t probes = 20000;
+    char message[96];
+    clock_t started;
+    double seconds;
+
+    set_link(gateway, PING_HOST_RTT_EXPONENTIAL, 2000, 1000, 0);
+
+    started = clock();
+    TEST_ASSERT_TRUE(Ping.pingWindow(gateway, probes, PING_MAX_WINDOW, 1, 1000));
+    seconds = (double)(clock() - started) / CLOCKS_PER_SEC;
+
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 0.0, Ping.packetLoss());
+    snprintf(message, sizeof(message), "%u probes in %.3f s CPU, %.0f probes/s",
+             (unsigned)probes, seconds, probes / (seconds > 0 ? seconds : 1e-9));
+    TEST_MESSAGE(message);
+
+    Ping.setBackend(PING_BACKEND_RAW_PCB);
+    started = clock();
+    TEST_ASSERT_TRUE(Ping.pingWindow(gateway, probes, PING_MAX_WINDOW, 1, 1000));
+    seconds = (double)(clock() - started) / CLOCKS_PER_SEC;
+    Ping.setBackend(PING_BACKEND_SOCKET);
+
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 0.0, Ping.packetLoss());
+    snprintf(message, sizeof(message), "raw PCB: %u probes in %.3f s CPU, %.0f probes/s",
+             (unsigned)probes, seconds, probes / (seconds > 0 ? seconds : 1e-9));
+    TEST_MESSAGE(message);
+}
+
+void test_loopback_real_socket(void)
+{
+    if (!ping_host_use_loopback())
+    {
+        TEST_IGNORE_MESSAGE("raw ICMP sockets not permitted, needs CAP_NET_RAW");
+    }
+
+    TEST_ASSERT_TRUE(Ping.pingWindow(IPAddress(127, 0, 0, 1), 5, 2, 10, 1000));
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 0.0, Ping.packetLoss());
+    TEST_ASSERT_TRUE(Ping.averageTime() < 100.0);
+}
+
+int runUnityTests(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_constant_rtt_is_reported_exactly);
+    RUN_TEST(test_unreachable_host_times_out);
+    RUN_TEST(test_loss_rate_matches_link);
+    RUN_TEST(test_percentiles_follow_rtt_distribution);
+    RUN_TEST(test_window_counts_late_and_duplicate_replies);
+    RUN_TEST(test_classic_late_reply_is_not_a_match);
+    RUN_TEST(test_socket_reused_until_disconnect);
+    RUN_TEST(test_hostname_lookups_are_cached);
+    RUN_TEST(test_path_mtu_binary_search);
+    RUN_TEST(test_path_mtu_survives_loss);
+    RUN_TEST(test_sweep_estimates_bandwidth_and_base_latency);
+    RUN_TEST(test_traceroute_reports_each_hop);
+    RUN_TEST(test_traceroute_is_bounded_and_restores_ttl);
+    RUN_TEST(test_tcp_probe_times_local_listener);
+    RUN_TEST(test_udp_probe_round_trips_through_echo);
+    RUN_TEST(test_raw_pcb_backend_matches_on_arrival);
+    RUN_TEST(test_timestamp_offset_and_one_way_delay);
+    RUN_TEST(test_timestamp_min_filter_and_rejects);
+    RUN_TEST(test_arp_probe_times_neighbour);
+    RUN_TEST(test_arp_probe_absent_or_off_subnet);
+    RUN_TEST(test_throughput_benchmark);
+    RUN_TEST(test_loopback_real_socket);
+    return UNITY_END();
+}
+
+int main(void)
+{
+    return runUnityTests();
+}
@@ -0,0 +1,174 @@
+// https://docs.platformio.org/en/latest/plus/unit-testing.html
+// Host test for the ping latency histogram. Run with: pio test -e native
+#include <unity.h>
+#include <ping_histogram.h>
+
+static struct ping_histogram hist;
+
+void setUp(void)
+{
+    ping_hist_reset(&hist);
+}
+
+void tearDown(void)
+{
+}
+
+void test_small_values_are_exact(void)
+{
+    for (uint32_t v = 0; v < PING_HIST_SUB_COUNT; v++)
+    {
+        TEST_ASSERT_EQUAL_UINT32(v, ping_hist_bucket_low(ping_hist_bucket_index(v)));
+        TEST_ASSERT_EQUAL_UINT32(v, ping_hist_bucket_high(ping_hist_bucket_index(v)));
+    }
+}
+
+void test_bucket_bounds_contain_value(void)
+{
+    for (uint32_t v = 1; v < (1UL << PING_HIST_MAX_BITS); v += 1 + v / 97)
+    {
+        uint16_t i = ping_hist_bucket_index(v);
+        TEST_ASSERT_TRUE(i < PING_HIST_BUCKETS);
+        TEST_ASSERT_TRUE(ping_hist_bucket_low(i) <= v);
+        TEST_ASSERT_TRUE(ping_hist_bucket_high(i) >= v);
+    }
+}
+
+void test_buckets_are_contiguous(void)
+{
+    for (uint16_t i = 1; i < PING_HIST_BUCKETS; i++)
+    {
+        TEST_ASSERT_EQUAL_UINT32(ping_hist_bucket_high(i - 1) + 1, ping_hist_bucket_low(i));
+    }
+}
+
+void test_bucket_relative_error(void)
+{
+    // Midpoint of any bucket must be within 1/2^(SUB_BITS+1) of every value in it.
+    for (uint32_t v = PING_HIST_SUB_COUNT; v < (1UL << PING_HIST_MAX_BITS); v += 1 + v / 211)
+    {
+        uint16_t i = ping_hist_bucket_index(v);
+        uint32_t mid = ping_hist_bucket_low(i) + (ping_hist_bucket_high(i) - ping_hist_bucket_low(i)) / 2;
+        uint32_t err = (mid > v) ? mid - v : v - mid;
+        TEST_ASSERT_TRUE(err * (2UL * PING_HIST_SUB_COUNT) <= v);
+    }
+}
+
+void test_overflow_pins_to_last_bucket(void)
+{
+    TEST_ASSERT_EQUAL_UINT16(PING_HIST_BUCKETS - 1, ping_hist_bucket_index(UINT32_MAX));
+    ping_hist_record(&hist, UINT32_MAX);
+    TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, ping_hist_percentile(&hist, 100));
+}
+
+void test_percentiles_uniform(void)
+{
+    for (uint32_t v = 1; v <= 1000; v++)
+    {
+        ping_hist_record_sent(&hist);
+        ping_hist_record(&hist, v * 100); // 100 us .. 100 ms
+    }
+    TEST_ASSERT_UINT32_WITHIN(50000 / 32, 50000, ping_hist_percentile(&hist, 50));
+    TEST_ASSERT_UINT32_WITHIN(90000 / 32, 90000, ping_hist_percentile(&hist, 90));
+    TEST_ASSERT_UINT32_WITHIN(99000 / 32, 99000, ping_hist_percentile(&hist, 99));
+    TEST_ASSERT_EQUAL_UINT32(100000, ping_hist_percentile(&hist, 100));
+    TEST_ASSERT_EQUAL_UINT32(100, hist.min_us);
+    TEST_ASSERT_EQUAL_UINT32(50050, ping_hist_mean(&hist));
+    TEST_ASSERT_EQUAL_FLOAT(0.0, ping_hist_loss(&hist));
+}
+
+void test_jitter_constant_and_alternating(void)
+{
+    for (int i = 0; i < 100; i++)
+    {
+        ping_hist_record(&hist, 20000);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, ping_hist_jitter(&hist));
+
+    // |D| is always 1000 us, the filter converges on it.
+    for (int i = 0; i < 500; i++)
+    {
+        ping_hist_record(&hist, (i & 1) ? 20000 : 21000);
+    }
+    TEST_ASSERT_UINT32_WITHIN(16, 1000, ping_hist_jitter(&hist));
+}
+
+void test_loss(void)
+{
+    for (int i = 0; i < 10; i++)
+    {
+        ping_hist_record_sent(&hist);
+    }
+    for (int i = 0; i < 7; i++)
+    {
+        ping_hist_record(&hist, 1000);
+    }
+    TEST_ASSERT_EQUAL_FLOAT(30.0, ping_hist_loss(&hist));
+}
+
+void test_merge_matches_single_session(void)
+{
+    static struct ping_histogram a, b, all;
+    ping_hist_reset(&a);
+    ping_hist_reset(&b);
+    ping_hist_reset(&all);
+    for (uint32_t v = 1; v <= 400; v++)
+    {
+        struct ping_histogram *side = (v % 3) ? &a : &b;
+        ping_hist_record_sent(side);
+        ping_hist_record(side, v * 37);
+        ping_hist_record_sent(&all);
+        ping_hist_record(&all, v * 37);
+    }
+    ping_hist_merge(&hist, &a);
+    ping_hist_merge(&hist, &b);
+    TEST_ASSERT_EQUAL_UINT32(all.count, hist.count);
+    TEST_ASSERT_EQUAL_UINT32(all.sent, hist.sent);
+    TEST_ASSERT_EQUAL_UINT32(all.min_us, hist.min_us);
+    TEST_ASSERT_EQUAL_UINT32(all.max_us, hist.max_us);
+    TEST_ASSERT_EQUAL_UINT32(ping_hist_percentile(&all, 50), ping_hist_percentile(&hist, 50));
+    TEST_ASSERT_EQUAL_UINT32(ping_hist_percentile(&all, 99), ping_hist_percentile(&hist, 99));
+    TEST_ASSERT_EQUAL_MEMORY(all.buckets, hist.buckets, sizeof(all.buckets));
+}
+
+void test_empty(void)
+{
+    TEST_ASSERT_EQUAL_UINT32(0, ping_hist_percentile(&hist, 50));
+    TEST_ASSERT_EQUAL_UINT32(0, ping_hist_mean(&hist));
+    TEST_ASSERT_EQUAL_UINT32(0, ping_hist_jitter(&hist));
+    TEST_ASSERT_EQUAL_FLOAT(0.0, ping_hist_loss(&hist));
+}
+
+int runUnityTests(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_small_values_are_exact);
+    RUN_TEST(test_bucket_bounds_contain_value);
+    RUN_TEST(test_buckets_are_contiguous);
+    RUN_TEST(test_bucket_relative_error);
+    RUN_TEST(test_overflow_pins_to_last_bucket);
+    RUN_TEST(test_percentiles_uniform);
+    RUN_TEST(test_jitter_constant_and_alternating);
+    RUN_TEST(test_loss);
+    RUN_TEST(test_merge_matches_single_session);
+    RUN_TEST(test_empty);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+#include <Arduino.h>
+void setup()
+{
+    delay(2000); // service delay
+    runUnityTests();
+}
+
+void loop()
+{
+}
+#else
+int main(void)
+{
+    return runUnityTests();
+}
+#endif
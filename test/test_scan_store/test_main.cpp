@@ -0,0 +1,161 @@
+// https://docs.platformio.org/en/latest/plus/unit-testing.html
+// Test for the scan result snapshot store. Runs on the board and on the
+// host with: pio test -e native
+#include <unity.h>
+#include <aaScanStore.h>
+
+static aaScanStore *store;
+
+static void heard(uint8_t last, const char *ssid, uint8_t channel, int8_t rssi, uint32_t now_ms = 100)
+{
+    uint8_t bssid[6] = {0x24, 0x0a, 0xc4, 0x00, 0x00, last};
+
+    store->keep(ssid, strlen(ssid), bssid, channel, rssi, 3, now_ms);
+}
+
+void setUp(void)
+{
+    store = new aaScanStore();
+    store->clear(100);
+}
+
+void tearDown(void)
+{
+    delete store;
+}
+
+void test_copies_each_access_point_once(void)
+{
+    const scanEntry *entry;
+
+    heard(1, "MN_OUTSIDE", 6, -70);
+    heard(2, "neighbour", 11, -50);
+    TEST_ASSERT_EQUAL_UINT8(2, store->count());
+
+    entry = store->get(0);
+    TEST_ASSERT_EQUAL_STRING("MN_OUTSIDE", entry->ssid);
+    TEST_ASSERT_EQUAL_UINT8(10, entry->ssidLen);
+    TEST_ASSERT_EQUAL_HEX32(aaApSelector::hash("MN_OUTSIDE", 10), entry->ssidHash);
+    TEST_ASSERT_EQUAL_UINT8(6, entry->channel);
+    TEST_ASSERT_EQUAL_INT8(-70, entry->rssi);
+    TEST_ASSERT_EQUAL_UINT8(3, entry->auth);
+    TEST_ASSERT_EQUAL_UINT8(1, entry->bssid[5]);
+    TEST_ASSERT_NULL(store->get(2));
+
+    // Heard again on an overlapping channel: only a stronger reading counts
+    heard(1, "MN_OUTSIDE", 7, -80);
+    TEST_ASSERT_EQUAL_INT8(-70, store->get(0)->rssi);
+    heard(1, "MN_OUTSIDE", 5, -60, 250);
+    TEST_ASSERT_EQUAL_UINT8(2, store->count());
+    TEST_ASSERT_EQUAL_INT8(-60, store->get(0)->rssi);
+    TEST_ASSERT_EQUAL_UINT8(5, store->get(0)->channel);
+    TEST_ASSERT_EQUAL_UINT32(250, store->get(0)->seenMs);
+}
+
+void test_full_store_keeps_the_strongest(void)
+{
+    const uint8_t weaker[6] = {0x24, 0x0a, 0xc4, 0x00, 0x00, 200};
+    char ssid[8];
+
+    for (uint8_t i = 0; i < SCAN_STORE_MAX_ENTRIES; i++)
+    {
+        snprintf(ssid, sizeof(ssid), "ap%u", i);
+        heard(i, ssid, 1, -90 + i);
+    }
+    TEST_ASSERT_EQUAL_UINT8(SCAN_STORE_MAX_ENTRIES, store->count());
+    heard(200, "weaker", 1, -95);
+    TEST_ASSERT_EQUAL_INT16(-1, store->find(weaker));
+    heard(201, "stronger", 1, -20);
+    TEST_ASSERT_EQUAL_UINT8(SCAN_STORE_MAX_ENTRIES, store->count());
+    TEST_ASSERT_EQUAL_INT16(-1, store->findSsid("ap0", 3));
+    TEST_ASSERT_TRUE(store->findSsid("stronger", 8) >= 0);
+}
+
+void test_sorts_in_place(void)
+{
+    heard(1, "b", 11, -60);
+    heard(2, "a", 1, -70);
+    heard(3, "b", 6, -40);
+    heard(4, "ab", 1, -50);
+
+    store->sort(scanByRssi);
+    TEST_ASSERT_EQUAL_INT8(-40, store->get(0)->rssi);
+    TEST_ASSERT_EQUAL_INT8(-50, store->get(1)->rssi);
+    TEST_ASSERT_EQUAL_INT8(-60, store->get(2)->rssi);
+    TEST_ASSERT_EQUAL_INT8(-70, store->get(3)->rssi);
+
+    store->sort(scanByChannel);
+    TEST_ASSERT_EQUAL_UINT8(4, store->get(0)->bssid[5]);
+    TEST_ASSERT_EQUAL_UINT8(2, store->get(1)->bssid[5]);
+    TEST_ASSERT_EQUAL_UINT8(6, store->get(2)->channel);
+    TEST_ASSERT_EQUAL_UINT8(11, store->get(3)->channel);
+
+    store->sort(scanBySsid);
+    TEST_ASSERT_EQUAL_STRING("a", store->get(0)->ssid);
+    TEST_ASSERT_EQUAL_STRING("ab", store->get(1)->ssid);
+    TEST_ASSERT_EQUAL_INT8(-40, store->get(2)->rssi);
+    TEST_ASSERT_EQUAL_INT8(-60, store->get(3)->rssi);
+}
+
+void test_finds_by_bssid_and_ssid(void)
+{
+    const uint8_t missing[6] = {0x24, 0x0a, 0xc4, 0x00, 0x00, 9};
+    int16_t first;
+
+    heard(1, "MN_WORKSHOP_2.4GHz", 1, -60);
+    heard(2, "neighbour", 6, -50);
+    heard(3, "MN_WORKSHOP_2.4GHz", 11, -70);
+    store->sort();
+
+    TEST_ASSERT_EQUAL_INT16(2, store->find(store->get(2)->bssid));
+    TEST_ASSERT_EQUAL_INT16(-1, store->find(missing));
+    TEST_ASSERT_EQUAL_INT16(-1, store->find(NULL));
+
+    first = store->findSsid("MN_WORKSHOP_2.4GHz", 18);
+    TEST_ASSERT_EQUAL_INT16(1, first);
+    TEST_ASSERT_EQUAL_INT16(2, store->findSsid("MN_WORKSHOP_2.4GHz", 18, first + 1));
+    TEST_ASSERT_EQUAL_INT16(-1, store->findSsid("MN_WORKSHOP_2.4GHz", 18, 3));
+    TEST_ASSERT_EQUAL_INT16(-1, store->findSsid("MN_WORKSHOP", 11));
+}
+
+void test_reports_staleness(void)
+{
+    TEST_ASSERT_TRUE(store->isStale(100, 1000));
+    heard(1, "MN_OUTSIDE", 6, -70);
+    TEST_ASSERT_EQUAL_UINT32(400, store->ageMs(500));
+    TEST_ASSERT_FALSE(store->isStale(1100, 1000));
+    TEST_ASSERT_TRUE(store->isStale(1101, 1000));
+
+    store->clear(5000);
+    TEST_ASSERT_EQUAL_UINT8(0, store->count());
+    TEST_ASSERT_EQUAL_UINT32(0, store->ageMs(5000));
+}
+
+int runUnityTests(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_copies_each_access_point_once);
+    RUN_TEST(test_full_store_keeps_the_strongest);
+    RUN_TEST(test_sorts_in_place);
+    RUN_TEST(test_finds_by_bssid_and_ssid);
+    RUN_TEST(test_reports_staleness);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+#include <Arduino.h>
+void setup()
+{
+    delay(2000); // service delay
+    runUnityTests();
+}
+
+void loop()
+{
+}
+#else
+int main(void)
+{
+    return runUnityTests();
+}
+#endif